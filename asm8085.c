@@ -0,0 +1,1135 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <ctype.h>
+
+#include "asm8085.h"
+
+// Operand shapes of the 8085 instructions, plus the directives
+enum op_kind
+{
+    OP_NONE,    // no operand                    opcode
+    OP_DST,     // r (INR, DCR)                  opcode | r << 3
+    OP_SRC,     // r (ADD ... CMP)               opcode | r
+    OP_MOV,     // r, r                          opcode | d << 3 | s
+    OP_MVI,     // r, d8                         opcode | r << 3, d8
+    OP_IMM8,    // d8                            opcode, d8
+    OP_IMM16,   // a16                           opcode, lo, hi
+    OP_LXI,     // rp, d16 (B, D, H, SP)         opcode | rp << 4, lo, hi
+    OP_RP,      // rp (B, D, H, SP)              opcode | rp << 4
+    OP_PUSHPOP, // rp (B, D, H, PSW)             opcode | rp << 4
+    OP_BD,      // B or D (LDAX, STAX)           opcode | rp << 4
+    OP_RST,     // n (0-7)                       opcode | n << 3
+    DIR_ORG,
+    DIR_EQU,
+    DIR_DB,
+    DIR_DW,
+    DIR_DS,
+    DIR_END
+};
+
+struct asm_op
+{
+    const char *name;
+    unsigned char kind;
+    unsigned char opcode;
+};
+
+// The full 8085 instruction set, including the ten undocumented opcodes,
+// followed by the directives
+static const struct asm_op asm_ops[] = {
+    {"MOV", OP_MOV, 0x40}, {"MVI", OP_MVI, 0x06}, {"LXI", OP_LXI, 0x01},
+    {"LDA", OP_IMM16, 0x3A}, {"STA", OP_IMM16, 0x32}, {"LHLD", OP_IMM16, 0x2A},
+    {"SHLD", OP_IMM16, 0x22}, {"LDAX", OP_BD, 0x0A}, {"STAX", OP_BD, 0x02},
+    {"XCHG", OP_NONE, 0xEB},
+
+    {"ADD", OP_SRC, 0x80}, {"ADC", OP_SRC, 0x88}, {"SUB", OP_SRC, 0x90},
+    {"SBB", OP_SRC, 0x98}, {"ANA", OP_SRC, 0xA0}, {"XRA", OP_SRC, 0xA8},
+    {"ORA", OP_SRC, 0xB0}, {"CMP", OP_SRC, 0xB8},
+    {"ADI", OP_IMM8, 0xC6}, {"ACI", OP_IMM8, 0xCE}, {"SUI", OP_IMM8, 0xD6},
+    {"SBI", OP_IMM8, 0xDE}, {"ANI", OP_IMM8, 0xE6}, {"XRI", OP_IMM8, 0xEE},
+    {"ORI", OP_IMM8, 0xF6}, {"CPI", OP_IMM8, 0xFE},
+
+    {"INR", OP_DST, 0x04}, {"DCR", OP_DST, 0x05}, {"INX", OP_RP, 0x03},
+    {"DCX", OP_RP, 0x0B}, {"DAD", OP_RP, 0x09}, {"DAA", OP_NONE, 0x27},
+
+    {"RLC", OP_NONE, 0x07}, {"RRC", OP_NONE, 0x0F}, {"RAL", OP_NONE, 0x17},
+    {"RAR", OP_NONE, 0x1F}, {"CMA", OP_NONE, 0x2F}, {"CMC", OP_NONE, 0x3F},
+    {"STC", OP_NONE, 0x37},
+
+    {"JMP", OP_IMM16, 0xC3}, {"JNZ", OP_IMM16, 0xC2}, {"JZ", OP_IMM16, 0xCA},
+    {"JNC", OP_IMM16, 0xD2}, {"JC", OP_IMM16, 0xDA}, {"JPO", OP_IMM16, 0xE2},
+    {"JPE", OP_IMM16, 0xEA}, {"JP", OP_IMM16, 0xF2}, {"JM", OP_IMM16, 0xFA},
+    {"CALL", OP_IMM16, 0xCD}, {"CNZ", OP_IMM16, 0xC4}, {"CZ", OP_IMM16, 0xCC},
+    {"CNC", OP_IMM16, 0xD4}, {"CC", OP_IMM16, 0xDC}, {"CPO", OP_IMM16, 0xE4},
+    {"CPE", OP_IMM16, 0xEC}, {"CP", OP_IMM16, 0xF4}, {"CM", OP_IMM16, 0xFC},
+    {"RET", OP_NONE, 0xC9}, {"RNZ", OP_NONE, 0xC0}, {"RZ", OP_NONE, 0xC8},
+    {"RNC", OP_NONE, 0xD0}, {"RC", OP_NONE, 0xD8}, {"RPO", OP_NONE, 0xE0},
+    {"RPE", OP_NONE, 0xE8}, {"RP", OP_NONE, 0xF0}, {"RM", OP_NONE, 0xF8},
+    {"RST", OP_RST, 0xC7}, {"PCHL", OP_NONE, 0xE9},
+
+    {"PUSH", OP_PUSHPOP, 0xC5}, {"POP", OP_PUSHPOP, 0xC1},
+    {"XTHL", OP_NONE, 0xE3}, {"SPHL", OP_NONE, 0xF9},
+
+    {"IN", OP_IMM8, 0xDB}, {"OUT", OP_IMM8, 0xD3}, {"EI", OP_NONE, 0xFB},
+    {"DI", OP_NONE, 0xF3}, {"HLT", OP_NONE, 0x76}, {"NOP", OP_NONE, 0x00},
+    {"RIM", OP_NONE, 0x20}, {"SIM", OP_NONE, 0x30},
+
+    {"DSUB", OP_NONE, 0x08}, {"ARHL", OP_NONE, 0x10}, {"RDEL", OP_NONE, 0x18},
+    {"LDHI", OP_IMM8, 0x28}, {"LDSI", OP_IMM8, 0x38}, {"RSTV", OP_NONE, 0xCB},
+    {"SHLX", OP_NONE, 0xD9}, {"JNK", OP_IMM16, 0xDD}, {"LHLX", OP_NONE, 0xED},
+    {"JK", OP_IMM16, 0xFD},
+
+    {"ORG", DIR_ORG, 0}, {"EQU", DIR_EQU, 0}, {"DB", DIR_DB, 0},
+    {"DW", DIR_DW, 0}, {"DS", DIR_DS, 0}, {"END", DIR_END, 0},
+};
+
+#define NUM_OPS (int)(sizeof(asm_ops) / sizeof(asm_ops[0]))
+
+// Perfect hash over the mnemonics. Every name is at most four characters,
+// so its upper-cased bytes packed into 32 bits identify it exactly;
+// multiplying by OP_HASH_MUL and keeping the top 9 bits maps the set above
+// onto 512 slots without collisions.
+#define OP_HASH_MUL 0xC8C1878Du
+#define OP_HASH_BITS 9
+#define OP_HASH_SIZE (1 << OP_HASH_BITS)
+#define OP_HASH(key) ((unsigned int)((key) * OP_HASH_MUL) >> (32 - OP_HASH_BITS))
+
+struct asm_symbol
+{
+    const char *name; // points into the source text
+    int length;
+    int value;
+    int line;         // line of the definition, 0 for an empty slot
+};
+
+struct assembler
+{
+    const char *name;
+    int line;
+    int radix;
+    int pass;
+    int errors;
+    int undefined;        // set while evaluating an expression with an unknown symbol
+    unsigned int address; // location counter
+    unsigned int statement_address;
+    unsigned char *mem;
+    FILE *listing;
+    struct asm_result *result;
+
+    unsigned char op_slots[OP_HASH_SIZE];    // mnemonic index + 1, 0 if empty
+    unsigned int op_keys[NUM_OPS];
+
+    struct asm_symbol *symbols;
+    int symbol_capacity;  // power of two
+    int symbol_count;
+
+    unsigned char line_bytes[256]; // bytes emitted by the current line, for the listing
+    int line_byte_count;
+};
+
+static void asm_error(struct assembler *as, const char *fmt, ...)
+{
+    va_list args;
+
+    // Operand errors are reported once, in the second pass
+    if (as->pass == 1)
+    {
+        return;
+    }
+    fprintf(stderr, "%s:%d: error: ", as->name, as->line);
+    va_start(args, fmt);
+    vfprintf(stderr, fmt, args);
+    va_end(args);
+    fputc('\n', stderr);
+    as->errors++;
+}
+
+// Errors that can only be detected in the first pass (symbol definitions)
+static void asm_error_pass1(struct assembler *as, const char *fmt, ...)
+{
+    va_list args;
+
+    fprintf(stderr, "%s:%d: error: ", as->name, as->line);
+    va_start(args, fmt);
+    vfprintf(stderr, fmt, args);
+    va_end(args);
+    fputc('\n', stderr);
+    as->errors++;
+}
+
+static int is_ident_start(int c)
+{
+    return isalpha(c) || c == '_' || c == '.' || c == '?' || c == '@';
+}
+
+static int is_ident_char(int c)
+{
+    return isalnum(c) || c == '_' || c == '.' || c == '?' || c == '@';
+}
+
+static const char *skip_space(const char *p)
+{
+    while (*p == ' ' || *p == '\t' || *p == '\r')
+    {
+        p++;
+    }
+    return p;
+}
+
+static int at_end_of_statement(const char *p)
+{
+    p = skip_space(p);
+    return *p == '\n' || *p == ';' || *p == '\0';
+}
+
+// Pack up to four upper-cased characters into the mnemonic hash key
+static unsigned int pack_key(const char *s, int length)
+{
+    unsigned int key = 0;
+    for (int i = 0; i < length; i++)
+    {
+        key |= (unsigned int)toupper((unsigned char)s[i]) << (8 * i);
+    }
+    return key;
+}
+
+static int build_op_table(struct assembler *as)
+{
+    memset(as->op_slots, 0, sizeof(as->op_slots));
+    for (int i = 0; i < NUM_OPS; i++)
+    {
+        unsigned int key = pack_key(asm_ops[i].name, strlen(asm_ops[i].name));
+        unsigned int slot = OP_HASH(key);
+        if (as->op_slots[slot])
+        {
+            fprintf(stderr, "assembler: mnemonic hash collision (%s, %s)\n",
+                    asm_ops[as->op_slots[slot] - 1].name, asm_ops[i].name);
+            return -1;
+        }
+        as->op_slots[slot] = i + 1;
+        as->op_keys[i] = key;
+    }
+    return 0;
+}
+
+// Look up a mnemonic or directive; returns NULL if the word is not one
+static const struct asm_op *find_op(struct assembler *as, const char *word, int length)
+{
+    if (length > 4)
+    {
+        return NULL;
+    }
+    unsigned int key = pack_key(word, length);
+    int index = as->op_slots[OP_HASH(key)];
+    if (index == 0 || as->op_keys[index - 1] != key)
+    {
+        return NULL;
+    }
+    return &asm_ops[index - 1];
+}
+
+static unsigned int hash_name(const char *name, int length)
+{
+    unsigned int h = 2166136261u; // FNV-1a
+    for (int i = 0; i < length; i++)
+    {
+        h = (h ^ (unsigned char)name[i]) * 16777619u;
+    }
+    return h;
+}
+
+static struct asm_symbol *find_symbol_slot(struct assembler *as, const char *name, int length)
+{
+    unsigned int mask = as->symbol_capacity - 1;
+    unsigned int i = hash_name(name, length) & mask;
+
+    while (as->symbols[i].line != 0)
+    {
+        struct asm_symbol *sym = &as->symbols[i];
+        if (sym->length == length && memcmp(sym->name, name, length) == 0)
+        {
+            return sym;
+        }
+        i = (i + 1) & mask;
+    }
+    return &as->symbols[i];
+}
+
+static struct asm_symbol *lookup_symbol(struct assembler *as, const char *name, int length)
+{
+    struct asm_symbol *sym = find_symbol_slot(as, name, length);
+    return sym->line ? sym : NULL;
+}
+
+static int grow_symbols(struct assembler *as)
+{
+    struct asm_symbol *old = as->symbols;
+    int old_capacity = as->symbol_capacity;
+
+    as->symbol_capacity = old_capacity ? old_capacity * 2 : 256;
+    as->symbols = calloc(as->symbol_capacity, sizeof(struct asm_symbol));
+    if (as->symbols == NULL)
+    {
+        fprintf(stderr, "assembler: out of memory\n");
+        as->symbols = old;
+        as->symbol_capacity = old_capacity;
+        return -1;
+    }
+    for (int i = 0; i < old_capacity; i++)
+    {
+        if (old[i].line)
+        {
+            *find_symbol_slot(as, old[i].name, old[i].length) = old[i];
+        }
+    }
+    free(old);
+    return 0;
+}
+
+static void define_symbol(struct assembler *as, const char *name, int length, int value)
+{
+    if (as->pass != 1)
+    {
+        return;
+    }
+    if ((as->symbol_count + 1) * 2 > as->symbol_capacity && grow_symbols(as) < 0)
+    {
+        as->errors++;
+        return;
+    }
+
+    struct asm_symbol *sym = find_symbol_slot(as, name, length);
+    if (sym->line)
+    {
+        asm_error_pass1(as, "'%.*s' already defined on line %d", length, name, sym->line);
+        return;
+    }
+    sym->name = name;
+    sym->length = length;
+    sym->value = value;
+    sym->line = as->line;
+    as->symbol_count++;
+}
+
+// Is the word made only of hex digits? (numbers in radix 16 mode)
+static int all_hex_digits(const char *p, int length)
+{
+    for (int i = 0; i < length; i++)
+    {
+        if (!isxdigit((unsigned char)p[i]))
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Convert digits in the given base; returns -1 on a bad digit
+static long convert_digits(const char *p, int length, int base)
+{
+    long value = 0;
+
+    if (length == 0)
+    {
+        return -1;
+    }
+    for (int i = 0; i < length; i++)
+    {
+        int c = toupper((unsigned char)p[i]);
+        int digit = isdigit(c) ? c - '0' : (c >= 'A' && c <= 'F') ? c - 'A' + 10 : 99;
+        if (digit >= base)
+        {
+            return -1;
+        }
+        value = (value * base + digit) & 0xFFFFFF;
+    }
+    return value;
+}
+
+// Parse the number occupying the length characters at p
+static int parse_number(struct assembler *as, const char *p, int length, int *value)
+{
+    long v;
+
+    if (length > 2 && p[0] == '0' && (p[1] == 'x' || p[1] == 'X'))
+    {
+        v = convert_digits(p + 2, length - 2, 16);
+    }
+    else
+    {
+        int suffix = toupper((unsigned char)p[length - 1]);
+        if (suffix == 'H')
+            v = convert_digits(p, length - 1, 16);
+        else if (as->radix == 16)
+            v = convert_digits(p, length, 16);
+        else if (suffix == 'B')
+            v = convert_digits(p, length - 1, 2);
+        else if (suffix == 'Q' || suffix == 'O')
+            v = convert_digits(p, length - 1, 8);
+        else if (suffix == 'D')
+            v = convert_digits(p, length - 1, 10);
+        else
+            v = convert_digits(p, length, 10);
+    }
+
+    if (v < 0)
+    {
+        asm_error(as, "bad number '%.*s'", length, p);
+        *value = 0;
+        return -1;
+    }
+    *value = (int)v;
+    return 0;
+}
+
+static int parse_expr(struct assembler *as, const char **pp, int *value);
+
+static int parse_term(struct assembler *as, const char **pp, int *value)
+{
+    const char *p = skip_space(*pp);
+
+    if (*p == '(')
+    {
+        p++;
+        if (parse_expr(as, &p, value) < 0)
+        {
+            return -1;
+        }
+        p = skip_space(p);
+        if (*p != ')')
+        {
+            asm_error(as, "missing ')'");
+            return -1;
+        }
+        *pp = p + 1;
+        return 0;
+    }
+    if (*p == '-' || *p == '+')
+    {
+        int negate = *p == '-';
+        p++;
+        if (parse_term(as, &p, value) < 0)
+        {
+            return -1;
+        }
+        if (negate)
+        {
+            *value = -*value;
+        }
+        *pp = p;
+        return 0;
+    }
+    if (*p == '\'' && p[1] != '\0' && p[1] != '\n' && p[2] == '\'')
+    {
+        *value = (unsigned char)p[1];
+        *pp = p + 3;
+        return 0;
+    }
+    if (*p == '$')
+    {
+        const char *q = p + 1;
+        while (isxdigit((unsigned char)*q))
+        {
+            q++;
+        }
+        if (q == p + 1)
+        {
+            *value = as->statement_address; // current location
+        }
+        else
+        {
+            long v = convert_digits(p + 1, q - p - 1, 16);
+            *value = (int)v;
+        }
+        *pp = q;
+        return 0;
+    }
+    if (isdigit((unsigned char)*p) || is_ident_start((unsigned char)*p))
+    {
+        const char *q = p;
+        while (is_ident_char((unsigned char)*q))
+        {
+            q++;
+        }
+        int length = q - p;
+        *pp = q;
+
+        if (isdigit((unsigned char)*p) || (as->radix == 16 && all_hex_digits(p, length)))
+        {
+            return parse_number(as, p, length, value);
+        }
+
+        struct asm_symbol *sym = lookup_symbol(as, p, length);
+        if (sym == NULL)
+        {
+            if (as->pass == 2)
+            {
+                asm_error(as, "undefined symbol '%.*s'", length, p);
+            }
+            as->undefined = 1;
+            *value = 0;
+            return 0;
+        }
+        *value = sym->value;
+        return 0;
+    }
+
+    asm_error(as, "expected an operand");
+    return -1;
+}
+
+static int parse_product(struct assembler *as, const char **pp, int *value)
+{
+    if (parse_term(as, pp, value) < 0)
+    {
+        return -1;
+    }
+    for (;;)
+    {
+        const char *p = skip_space(*pp);
+        if (*p != '*' && *p != '/')
+        {
+            return 0;
+        }
+        char op = *p++;
+        int rhs;
+        if (parse_term(as, &p, &rhs) < 0)
+        {
+            return -1;
+        }
+        if (op == '*')
+        {
+            *value *= rhs;
+        }
+        else if (rhs == 0)
+        {
+            if (!as->undefined)
+            {
+                asm_error(as, "division by zero");
+            }
+            *value = 0;
+        }
+        else
+        {
+            *value /= rhs;
+        }
+        *pp = p;
+    }
+}
+
+static int parse_expr(struct assembler *as, const char **pp, int *value)
+{
+    if (parse_product(as, pp, value) < 0)
+    {
+        return -1;
+    }
+    for (;;)
+    {
+        const char *p = skip_space(*pp);
+        if (*p != '+' && *p != '-')
+        {
+            return 0;
+        }
+        char op = *p++;
+        int rhs;
+        if (parse_product(as, &p, &rhs) < 0)
+        {
+            return -1;
+        }
+        *value = op == '+' ? *value + rhs : *value - rhs;
+        *pp = p;
+    }
+}
+
+// Evaluate an expression that must be known in the first pass (ORG, EQU, DS)
+static int parse_defined_expr(struct assembler *as, const char **pp, int *value)
+{
+    as->undefined = 0;
+    if (parse_expr(as, pp, value) < 0)
+    {
+        return -1;
+    }
+    if (as->undefined)
+    {
+        asm_error_pass1(as, "symbol used before it is defined");
+        as->undefined = 0;
+        return -1;
+    }
+    return 0;
+}
+
+// Parse a register name: B C D E H L M A -> 0..7, or -1
+static int parse_register(struct assembler *as, const char **pp)
+{
+    static const char names[] = "BCDEHLMA";
+    const char *p = skip_space(*pp);
+    const char *q = p;
+
+    while (is_ident_char((unsigned char)*q))
+    {
+        q++;
+    }
+    if (q - p == 1)
+    {
+        const char *r = strchr(names, toupper((unsigned char)*p));
+        if (r != NULL)
+        {
+            *pp = q;
+            return r - names;
+        }
+    }
+    asm_error(as, "expected a register (A, B, C, D, E, H, L or M)");
+    return -1;
+}
+
+// Parse a register pair: B/BC, D/DE, H/HL -> 0..2; SP or PSW (last) -> 3
+static int parse_pair(struct assembler *as, const char **pp, const char *last)
+{
+    static const char *const pairs[3][2] = { {"B", "BC"}, {"D", "DE"}, {"H", "HL"} };
+    const char *p = skip_space(*pp);
+    const char *q = p;
+    char word[4];
+
+    while (is_ident_char((unsigned char)*q))
+    {
+        q++;
+    }
+    if (q - p >= 1 && q - p <= 3)
+    {
+        for (int i = 0; i < q - p; i++)
+        {
+            word[i] = toupper((unsigned char)p[i]);
+        }
+        word[q - p] = '\0';
+
+        for (int i = 0; i < 3; i++)
+        {
+            if (strcmp(word, pairs[i][0]) == 0 || strcmp(word, pairs[i][1]) == 0)
+            {
+                *pp = q;
+                return i;
+            }
+        }
+        if (last != NULL && strcmp(word, last) == 0)
+        {
+            *pp = q;
+            return 3;
+        }
+    }
+    asm_error(as, "expected a register pair (B, D, H%s%s)", last ? " or " : "", last ? last : "");
+    return -1;
+}
+
+static int expect_comma(struct assembler *as, const char **pp)
+{
+    const char *p = skip_space(*pp);
+    if (*p != ',')
+    {
+        asm_error(as, "expected ','");
+        return -1;
+    }
+    *pp = p + 1;
+    return 0;
+}
+
+static void emit(struct assembler *as, unsigned char byte)
+{
+    if (as->address > 0xFFFF)
+    {
+        asm_error(as, "code runs past address FFFF");
+        as->address++;
+        return;
+    }
+    if (as->pass == 2)
+    {
+        as->mem[as->address] = byte;
+        if (as->line_byte_count < (int)sizeof(as->line_bytes))
+        {
+            as->line_bytes[as->line_byte_count++] = byte;
+        }
+        as->result->bytes++;
+        if (as->result->entry < 0)
+        {
+            as->result->entry = as->address;
+        }
+    }
+    as->address++;
+}
+
+static void emit_value8(struct assembler *as, int value)
+{
+    if (value < -128 || value > 255)
+    {
+        asm_error(as, "value %d does not fit in a byte", value);
+    }
+    emit(as, value & 0xFF);
+}
+
+static void emit_value16(struct assembler *as, int value)
+{
+    if (value < -32768 || value > 65535)
+    {
+        asm_error(as, "value %d does not fit in a word", value);
+    }
+    emit(as, value & 0xFF);
+    emit(as, (value >> 8) & 0xFF);
+}
+
+// Operand expression for an instruction; unknown symbols are fine in pass 1
+static int operand(struct assembler *as, const char **pp)
+{
+    int value = 0;
+    as->undefined = 0;
+    parse_expr(as, pp, &value);
+    return value;
+}
+
+// Assemble one instruction whose mnemonic has already been consumed
+static void assemble_instruction(struct assembler *as, const struct asm_op *op, const char **pp)
+{
+    int r, s;
+
+    switch (op->kind)
+    {
+    case OP_NONE:
+        emit(as, op->opcode);
+        break;
+    case OP_DST:
+        r = parse_register(as, pp);
+        emit(as, op->opcode | (r < 0 ? 0 : r << 3));
+        break;
+    case OP_SRC:
+        r = parse_register(as, pp);
+        emit(as, op->opcode | (r < 0 ? 0 : r));
+        break;
+    case OP_MOV:
+        r = parse_register(as, pp);
+        s = (r < 0 || expect_comma(as, pp) < 0) ? -1 : parse_register(as, pp);
+        if (r == 6 && s == 6)
+        {
+            asm_error(as, "MOV M, M is not an instruction");
+        }
+        emit(as, op->opcode | (r < 0 ? 0 : r << 3) | (s < 0 ? 0 : s));
+        break;
+    case OP_MVI:
+        r = parse_register(as, pp);
+        emit(as, op->opcode | (r < 0 ? 0 : r << 3));
+        emit_value8(as, (r < 0 || expect_comma(as, pp) < 0) ? 0 : operand(as, pp));
+        break;
+    case OP_IMM8:
+        emit(as, op->opcode);
+        emit_value8(as, operand(as, pp));
+        break;
+    case OP_IMM16:
+        emit(as, op->opcode);
+        emit_value16(as, operand(as, pp));
+        break;
+    case OP_LXI:
+        r = parse_pair(as, pp, "SP");
+        emit(as, op->opcode | (r < 0 ? 0 : r << 4));
+        emit_value16(as, (r < 0 || expect_comma(as, pp) < 0) ? 0 : operand(as, pp));
+        break;
+    case OP_RP:
+        r = parse_pair(as, pp, "SP");
+        emit(as, op->opcode | (r < 0 ? 0 : r << 4));
+        break;
+    case OP_PUSHPOP:
+        r = parse_pair(as, pp, "PSW");
+        emit(as, op->opcode | (r < 0 ? 0 : r << 4));
+        break;
+    case OP_BD:
+        r = parse_pair(as, pp, NULL);
+        if (r == 2)
+        {
+            asm_error(as, "%s only takes B or D", op->name);
+        }
+        emit(as, op->opcode | (r < 0 ? 0 : r << 4));
+        break;
+    case OP_RST:
+        r = operand(as, pp);
+        if (r < 0 || r > 7)
+        {
+            asm_error(as, "RST number must be 0-7");
+            r = 0;
+        }
+        emit(as, op->opcode | r << 3);
+        break;
+    }
+}
+
+// DB: a list of byte expressions and quoted strings
+static void assemble_db(struct assembler *as, const char **pp)
+{
+    for (;;)
+    {
+        const char *p = skip_space(*pp);
+        if ((*p == '\'' || *p == '"') && !(p[1] != '\0' && p[2] == *p && *p == '\''))
+        {
+            char quote = *p++;
+            while (*p != quote && *p != '\n' && *p != '\0')
+            {
+                emit(as, (unsigned char)*p++);
+            }
+            if (*p != quote)
+            {
+                asm_error(as, "unterminated string");
+                *pp = p;
+                return;
+            }
+            *pp = p + 1;
+        }
+        else
+        {
+            *pp = p;
+            emit_value8(as, operand(as, pp));
+        }
+
+        p = skip_space(*pp);
+        if (*p != ',')
+        {
+            return;
+        }
+        *pp = p + 1;
+    }
+}
+
+static void assemble_dw(struct assembler *as, const char **pp)
+{
+    for (;;)
+    {
+        emit_value16(as, operand(as, pp));
+        const char *p = skip_space(*pp);
+        if (*p != ',')
+        {
+            return;
+        }
+        *pp = p + 1;
+    }
+}
+
+// Write the listing line(s) for the statement just assembled
+static void list_line(struct assembler *as, const char *line, const char *line_end, int show_address)
+{
+    int length = line_end - line;
+    int count = as->line_byte_count;
+
+    if (length > 0 && line[length - 1] == '\r')
+    {
+        length--;
+    }
+
+    if (show_address)
+    {
+        fprintf(as->listing, "%04X  ", as->statement_address & 0xFFFF);
+    }
+    else
+    {
+        fprintf(as->listing, "      ");
+    }
+    for (int i = 0; i < 4; i++)
+    {
+        if (i < count)
+            fprintf(as->listing, "%02X ", as->line_bytes[i]);
+        else
+            fprintf(as->listing, "   ");
+    }
+    fprintf(as->listing, "%5d  %.*s\n", as->line, length, line);
+
+    // Long DB/DW lines continue on further rows, four bytes each
+    for (int i = 4; i < count; i += 4)
+    {
+        fprintf(as->listing, "%04X  ", (as->statement_address + i) & 0xFFFF);
+        for (int j = i; j < i + 4 && j < count; j++)
+        {
+            fprintf(as->listing, "%02X ", as->line_bytes[j]);
+        }
+        fprintf(as->listing, "\n");
+    }
+}
+
+static int compare_symbols(const void *a, const void *b)
+{
+    const struct asm_symbol *x = a;
+    const struct asm_symbol *y = b;
+    int n = x->length < y->length ? x->length : y->length;
+    int c = memcmp(x->name, y->name, n);
+    return c ? c : x->length - y->length;
+}
+
+static void list_symbols(struct assembler *as)
+{
+    struct asm_symbol *sorted = malloc(sizeof(struct asm_symbol) * (as->symbol_count + 1));
+    int n = 0;
+
+    if (sorted == NULL)
+    {
+        return;
+    }
+    for (int i = 0; i < as->symbol_capacity; i++)
+    {
+        if (as->symbols[i].line)
+        {
+            sorted[n++] = as->symbols[i];
+        }
+    }
+    qsort(sorted, n, sizeof(struct asm_symbol), compare_symbols);
+
+    fprintf(as->listing, "\nSymbols:\n");
+    for (int i = 0; i < n; i++)
+    {
+        fprintf(as->listing, "%-24.*s %04X\n", sorted[i].length, sorted[i].name, sorted[i].value & 0xFFFF);
+    }
+    free(sorted);
+}
+
+// One pass over the source, up to its end or an END directive
+static void assemble_pass(struct assembler *as, const char *source, const char *end)
+{
+    const char *p = source;
+
+    as->address = 0;
+    as->line = 0;
+
+    while (p < end)
+    {
+        const char *line = p;
+        const char *line_end = memchr(p, '\n', end - p);
+        if (line_end == NULL)
+        {
+            line_end = end;
+        }
+        as->line++;
+        as->line_byte_count = 0;
+        as->statement_address = as->address;
+
+        const char *label = NULL;
+        int label_length = 0;
+        const struct asm_op *op = NULL;
+        int show_address = 0;
+        int stop = 0;
+        int errors_before = as->errors;
+
+        p = skip_space(line);
+        if (is_ident_start((unsigned char)*p))
+        {
+            const char *q = p;
+            while (is_ident_char((unsigned char)*q))
+            {
+                q++;
+            }
+            op = find_op(as, p, q - p);
+
+            const char *after = skip_space(q);
+            if (*after == ':')
+            {
+                // "label:" always defines a label, even if it looks like a mnemonic
+                label = p;
+                label_length = q - p;
+                op = NULL;
+                p = skip_space(after + 1);
+            }
+            else if (op == NULL)
+            {
+                // Label without a colon, e.g. "COUNT EQU 10"
+                label = p;
+                label_length = q - p;
+                p = after;
+            }
+            else
+            {
+                p = q;
+            }
+
+            if (op == NULL && is_ident_start((unsigned char)*p))
+            {
+                q = p;
+                while (is_ident_char((unsigned char)*q))
+                {
+                    q++;
+                }
+                op = find_op(as, p, q - p);
+                if (op == NULL)
+                {
+                    asm_error(as, "unknown instruction '%.*s'", (int)(q - p), p);
+                    p = line_end;
+                }
+                else
+                {
+                    p = q;
+                }
+            }
+        }
+
+        if (op != NULL && op->kind == DIR_EQU)
+        {
+            int value;
+            if (label == NULL)
+            {
+                asm_error_pass1(as, "EQU needs a name");
+            }
+            else if (as->pass == 1 && parse_defined_expr(as, &p, &value) == 0)
+            {
+                define_symbol(as, label, label_length, value);
+            }
+            else if (as->pass == 2)
+            {
+                struct asm_symbol *sym = lookup_symbol(as, label, label_length);
+                as->statement_address = sym ? sym->value : 0;
+                show_address = 1;
+                operand(as, &p);
+            }
+        }
+        else
+        {
+            if (label != NULL)
+            {
+                define_symbol(as, label, label_length, as->address);
+                show_address = 1;
+            }
+
+            if (op != NULL)
+            {
+                int value;
+                show_address = 1;
+
+                switch (op->kind)
+                {
+                case DIR_ORG:
+                    if (parse_defined_expr(as, &p, &value) == 0)
+                    {
+                        as->address = value & 0xFFFF;
+                        as->statement_address = as->address;
+                    }
+                    break;
+                case DIR_DB:
+                    assemble_db(as, &p);
+                    break;
+                case DIR_DW:
+                    assemble_dw(as, &p);
+                    break;
+                case DIR_DS:
+                    if (parse_defined_expr(as, &p, &value) == 0)
+                    {
+                        as->address += value;
+                    }
+                    break;
+                case DIR_END:
+                    if (!at_end_of_statement(p))
+                    {
+                        value = operand(as, &p);
+                        if (as->pass == 2)
+                        {
+                            as->result->entry = value & 0xFFFF;
+                        }
+                    }
+                    stop = 1;
+                    break;
+                default:
+                    assemble_instruction(as, op, &p);
+                    break;
+                }
+            }
+        }
+
+        if (as->errors == errors_before && p < line_end && !at_end_of_statement(p))
+        {
+            asm_error(as, "unexpected '%.*s'", (int)(line_end - skip_space(p)), skip_space(p));
+        }
+
+        if (as->pass == 2 && as->listing != NULL)
+        {
+            list_line(as, line, line_end, show_address);
+        }
+
+        p = line_end + 1;
+        if (stop)
+        {
+            break;
+        }
+    }
+}
+
+int assemble(const char *name, const char *source, size_t length, int radix,
+             unsigned char *mem, FILE *listing, struct asm_result *result)
+{
+    struct assembler *as = calloc(1, sizeof(struct assembler));
+    struct asm_result local;
+
+    if (result == NULL)
+    {
+        result = &local;
+    }
+    memset(result, 0, sizeof(*result));
+    result->entry = -1;
+
+    if (as == NULL || build_op_table(as) < 0 || grow_symbols(as) < 0)
+    {
+        free(as);
+        result->errors = 1;
+        return -1;
+    }
+    as->name = name;
+    as->radix = radix;
+    as->mem = mem;
+    as->listing = listing;
+    as->result = result;
+
+    as->pass = 1;
+    assemble_pass(as, source, source + length);
+
+    // Symbol definition errors make the second pass meaningless
+    if (as->errors == 0)
+    {
+        as->pass = 2;
+        assemble_pass(as, source, source + length);
+        if (listing != NULL)
+        {
+            list_symbols(as);
+        }
+    }
+
+    result->errors = as->errors;
+    result->lines = as->line;
+
+    free(as->symbols);
+    free(as);
+    return result->errors ? -1 : 0;
+}
+
+int assemble_file(const char *path, unsigned char *mem, FILE *listing, struct asm_result *result)
+{
+    // Nothing assembled, should the file not even be read
+    if (result != NULL)
+    {
+        memset(result, 0, sizeof(*result));
+        result->entry = -1;
+    }
+
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        perror(path);
+        return -1;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    char *source = malloc(size + 1);
+    if (source == NULL || fread(source, 1, size, file) != (size_t)size)
+    {
+        fprintf(stderr, "%s: could not read file\n", path);
+        free(source);
+        fclose(file);
+        return -1;
+    }
+    source[size] = '\0';
+    fclose(file);
+
+    int status = assemble(path, source, size, 10, mem, listing, result);
+    free(source);
+    return status;
+}
@@ -0,0 +1,49 @@
+#ifndef ASM8085_H
+#define ASM8085_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+// Two-pass 8085 assembler.
+//
+// Source syntax, one statement per line:
+//   [label[:]] [mnemonic [operand[, operand]]] [; comment]
+//
+// Mnemonics, registers and directives are case-insensitive; labels are not.
+// A label without a colon is only recognised when it is not itself a mnemonic.
+// Numbers are decimal by default, with 0FFH / 0xFF / $FF for hex, 1010B for
+// binary, 17Q or 17O for octal and 'c' for a character. A lone $ is the
+// address of the current statement. Operands are expressions built from
+// numbers and symbols with + - * / and parentheses.
+//
+// Directives:
+//   ORG expr               set the location counter
+//   name EQU expr          define a constant
+//   DB expr|'text', ...    emit bytes
+//   DW expr, ...           emit little-endian words
+//   DS count               reserve count bytes
+//   END [start]            stop assembling, optionally giving the entry point
+//
+// With radix 16 (used for the interactive prompt) bare numbers are hex, as in
+// "MVI A, 3F", and a word made only of hex digits is always a number.
+
+// Summary of an assembly run
+struct asm_result
+{
+    int errors;          // number of errors reported
+    int entry;           // END operand, else the first address emitted; -1 if nothing was
+    unsigned long bytes; // number of bytes emitted
+    int lines;           // number of source lines
+};
+
+// Assemble length bytes of source into mem (64 KiB); source[length] must be
+// '\0'. name is used in error messages, radix is 10 or 16, and a listing is
+// written to listing unless it is NULL. Errors go to stderr.
+// Returns 0 on success, -1 if there were errors.
+int assemble(const char *name, const char *source, size_t length, int radix,
+             unsigned char *mem, FILE *listing, struct asm_result *result);
+
+// Read the file at path and assemble it with radix 10
+int assemble_file(const char *path, unsigned char *mem, FILE *listing, struct asm_result *result);
+
+#endif
@@ -0,0 +1,448 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "batch.h"
+#include "cpu8085.h"
+#include "loader.h"
+#include "asm8085.h"
+
+enum batch_status
+{
+    BATCH_PENDING,
+    BATCH_DONE,  // ran until it stopped for the reason in stop
+    BATCH_ERROR  // program could not be loaded
+};
+
+// Final state of one program
+struct batch_result
+{
+    enum batch_status status;
+    enum cpu8085_stop stop;
+    unsigned char reg[8];
+    unsigned short PC, SP;
+    unsigned long long instructions;
+    unsigned long long tstates;
+    unsigned long long memory_hash; // of the memory the program wrote
+};
+
+// A worker's share of the programs: the index range [head, tail). The owner
+// takes work from the head, thieves split off the upper half at the tail.
+struct work_queue
+{
+    pthread_mutex_t lock;
+    int head;
+    int tail;
+};
+
+struct batch
+{
+    char **paths;
+    int count;
+    struct batch_result *results;
+    const struct batch_options *options;
+    struct work_queue *queues;
+    int jobs;
+};
+
+struct worker
+{
+    struct batch *batch;
+    int id;
+};
+
+// Take the next program from our own queue; -1 if it is empty
+static int pop_own(struct work_queue *q)
+{
+    int index = -1;
+
+    pthread_mutex_lock(&q->lock);
+    if (q->head < q->tail)
+    {
+        index = q->head++;
+    }
+    pthread_mutex_unlock(&q->lock);
+    return index;
+}
+
+// Move the upper half of some other worker's remaining range into our own
+// queue. Returns 0 once every queue is empty, i.e. all work is handed out.
+static int steal(struct batch *batch, int self)
+{
+    struct work_queue *own = &batch->queues[self];
+
+    for (int i = 1; i < batch->jobs; i++)
+    {
+        struct work_queue *victim = &batch->queues[(self + i) % batch->jobs];
+        int head = 0, tail = 0;
+
+        pthread_mutex_lock(&victim->lock);
+        int remaining = victim->tail - victim->head;
+        if (remaining > 0)
+        {
+            tail = victim->tail;
+            head = tail - (remaining + 1) / 2;
+            victim->tail = head;
+        }
+        pthread_mutex_unlock(&victim->lock);
+
+        if (tail > head)
+        {
+            pthread_mutex_lock(&own->lock);
+            own->head = head;
+            own->tail = tail;
+            pthread_mutex_unlock(&own->lock);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int has_suffix(const char *path, const char *suffix)
+{
+    size_t n = strlen(path);
+    size_t m = strlen(suffix);
+    return n >= m && strcasecmp(path + n - m, suffix) == 0;
+}
+
+static void run_program(cpu8085 *cpu, const char *path, const struct batch_options *options,
+                        struct batch_result *result)
+{
+    int status;
+
+    cpu8085_init(cpu);
+    if (has_suffix(path, ".asm") || has_suffix(path, ".s"))
+    {
+        struct asm_result assembled;
+        status = assemble_file(path, cpu->memory, NULL, &assembled);
+        cpu->PC = status == 0 && assembled.entry >= 0 ? assembled.entry : options->origin;
+    }
+    else if (has_suffix(path, ".hex"))
+    {
+        int entry = options->origin;
+        status = load_intel_hex(path, cpu->memory, &entry) < 0 ? -1 : 0;
+        cpu->PC = entry;
+    }
+    else
+    {
+        status = load_binary(path, cpu->memory, options->origin) < 0 ? -1 : 0;
+        cpu->PC = options->origin;
+    }
+
+    if (status < 0)
+    {
+        result->status = BATCH_ERROR;
+        return;
+    }
+
+    struct cpu8085_limits limits = {
+        .instructions = options->max_instructions,
+        .tstates = options->max_tstates,
+        .seconds = options->max_seconds,
+    };
+    result->stop = cpu8085_run_limited(cpu, &limits);
+    result->status = BATCH_DONE;
+    memcpy(result->reg, cpu->reg, sizeof(result->reg));
+    result->PC = cpu->PC;
+    result->SP = cpu->SP;
+    result->instructions = cpu->instructions;
+    result->tstates = cpu->tstates;
+    result->memory_hash = cpu8085_dirty_hash(cpu);
+}
+
+static void *worker_main(void *arg)
+{
+    struct worker *worker = arg;
+    struct batch *batch = worker->batch;
+
+    // One CPU per worker, reused for every program it runs
+    cpu8085 *cpu = cpu8085_create();
+    if (cpu == NULL)
+    {
+        return NULL;
+    }
+    // Runs uncached if out of memory
+    if (!batch->options->jit || cpu8085_enable_jit(cpu) < 0)
+    {
+        cpu8085_enable_blocks(cpu);
+    }
+
+    for (;;)
+    {
+        int index = pop_own(&batch->queues[worker->id]);
+        if (index < 0)
+        {
+            if (!steal(batch, worker->id))
+            {
+                break;
+            }
+            continue;
+        }
+        run_program(cpu, batch->paths[index], batch->options, &batch->results[index]);
+    }
+
+    cpu8085_destroy(cpu);
+    return NULL;
+}
+
+static int add_path(struct batch *batch, int *capacity, const char *dir, const char *name)
+{
+    if (batch->count == *capacity)
+    {
+        *capacity = *capacity ? *capacity * 2 : 64;
+        char **grown = realloc(batch->paths, *capacity * sizeof(char *));
+        if (grown == NULL)
+        {
+            return -1;
+        }
+        batch->paths = grown;
+    }
+
+    size_t length = (dir ? strlen(dir) + 1 : 0) + strlen(name) + 1;
+    char *path = malloc(length);
+    if (path == NULL)
+    {
+        return -1;
+    }
+    if (dir != NULL)
+    {
+        snprintf(path, length, "%s/%s", dir, name);
+    }
+    else
+    {
+        snprintf(path, length, "%s", name);
+    }
+    batch->paths[batch->count++] = path;
+    return 0;
+}
+
+static int compare_paths(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// Collect the regular files in a directory, sorted by name
+static int collect_directory(struct batch *batch, const char *dir_path)
+{
+    DIR *dir = opendir(dir_path);
+    int capacity = 0;
+    struct dirent *entry;
+
+    if (dir == NULL)
+    {
+        perror(dir_path);
+        return -1;
+    }
+    while ((entry = readdir(dir)) != NULL)
+    {
+        struct stat st;
+        char path[4096];
+
+        if (entry->d_name[0] == '.')
+        {
+            continue;
+        }
+        snprintf(path, sizeof(path), "%s/%s", dir_path, entry->d_name);
+        if (stat(path, &st) < 0 || !S_ISREG(st.st_mode))
+        {
+            continue;
+        }
+        if (add_path(batch, &capacity, dir_path, entry->d_name) < 0)
+        {
+            closedir(dir);
+            return -1;
+        }
+    }
+    closedir(dir);
+    qsort(batch->paths, batch->count, sizeof(char *), compare_paths);
+    return 0;
+}
+
+// Collect the paths listed in a manifest file
+static int collect_manifest(struct batch *batch, const char *manifest)
+{
+    FILE *file = fopen(manifest, "r");
+    int capacity = 0;
+    char line[4096];
+
+    if (file == NULL)
+    {
+        perror(manifest);
+        return -1;
+    }
+
+    // Relative entries are relative to the manifest's own directory
+    char dir[4096];
+    snprintf(dir, sizeof(dir), "%s", manifest);
+    char *slash = strrchr(dir, '/');
+    if (slash != NULL)
+    {
+        *slash = '\0';
+    }
+
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        char *p = line + strspn(line, " \t");
+        char *end = p + strcspn(p, "#\r\n");
+        while (end > p && (end[-1] == ' ' || end[-1] == '\t'))
+        {
+            end--;
+        }
+        *end = '\0';
+        if (*p == '\0')
+        {
+            continue;
+        }
+        if (add_path(batch, &capacity, (*p == '/' || slash == NULL) ? NULL : dir, p) < 0)
+        {
+            fclose(file);
+            return -1;
+        }
+    }
+    fclose(file);
+    return 0;
+}
+
+static void print_result(const char *path, const struct batch_result *r)
+{
+    if (r->status != BATCH_DONE)
+    {
+        printf("%s status=error\n", path);
+        return;
+    }
+    printf("%s status=%s A=%02X B=%02X C=%02X D=%02X E=%02X H=%02X L=%02X F=%02X "
+           "PC=%04X SP=%04X instructions=%llu tstates=%llu mem=%016llX\n",
+           path, cpu8085_stop_name(r->stop), r->reg[7], r->reg[0], r->reg[1], r->reg[2],
+           r->reg[3], r->reg[4], r->reg[5], r->reg[6], r->PC, r->SP,
+           r->instructions, r->tstates, r->memory_hash);
+}
+
+int run_batch(const char *source, const struct batch_options *options)
+{
+    struct batch batch = { 0 };
+    struct stat st;
+
+    batch.options = options;
+    if (stat(source, &st) < 0)
+    {
+        perror(source);
+        return 1;
+    }
+    if ((S_ISDIR(st.st_mode) ? collect_directory(&batch, source) : collect_manifest(&batch, source)) < 0)
+    {
+        fprintf(stderr, "batch: could not collect the programs from %s\n", source);
+        return 1;
+    }
+
+    batch.jobs = options->jobs > 0 ? options->jobs : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (batch.jobs < 1)
+    {
+        batch.jobs = 1;
+    }
+    if (batch.jobs > batch.count && batch.count > 0)
+    {
+        batch.jobs = batch.count;
+    }
+
+    batch.results = calloc(batch.count ? batch.count : 1, sizeof(struct batch_result));
+    batch.queues = calloc(batch.jobs, sizeof(struct work_queue));
+    pthread_t *threads = calloc(batch.jobs, sizeof(pthread_t));
+    struct worker *workers = calloc(batch.jobs, sizeof(struct worker));
+    if (batch.results == NULL || batch.queues == NULL || threads == NULL || workers == NULL)
+    {
+        fprintf(stderr, "batch: out of memory\n");
+        return 1;
+    }
+
+    // Start every worker with an equal contiguous slice of the programs
+    for (int i = 0; i < batch.jobs; i++)
+    {
+        pthread_mutex_init(&batch.queues[i].lock, NULL);
+        batch.queues[i].head = (int)((long long)batch.count * i / batch.jobs);
+        batch.queues[i].tail = (int)((long long)batch.count * (i + 1) / batch.jobs);
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    int started = 0;
+    for (int i = 0; i < batch.jobs; i++)
+    {
+        workers[i].batch = &batch;
+        workers[i].id = i;
+    }
+    for (; started < batch.jobs; started++)
+    {
+        int error = pthread_create(&threads[started], NULL, worker_main, &workers[started]);
+        if (error != 0)
+        {
+            fprintf(stderr, "batch: could not start worker %d: %s\n", started, strerror(error));
+            break;
+        }
+    }
+    // Without all its threads the batch still finishes: this thread takes
+    // the first worker that did not start, and steals the rest of the work
+    if (started < batch.jobs)
+    {
+        worker_main(&workers[started]);
+    }
+    for (int i = 0; i < started; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    int halted = 0, limited = 0, faulted = 0, errors = 0;
+    unsigned long long instructions = 0;
+    for (int i = 0; i < batch.count; i++)
+    {
+        const struct batch_result *r = &batch.results[i];
+
+        print_result(batch.paths[i], r);
+        instructions += r->instructions;
+        if (r->status != BATCH_DONE)
+        {
+            errors++;
+        }
+        else if (r->stop == CPU8085_STOP_HALT)
+        {
+            halted++;
+        }
+        else if (r->stop == CPU8085_STOP_LOOP)
+        {
+            faulted++;
+        }
+        else
+        {
+            limited++;
+        }
+    }
+
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    fprintf(stderr, "batch: %d programs (%d halted, %d hit a limit, %d faulted, %d failed to load) "
+            "on %d threads in %.3f s, %llu instructions\n",
+            batch.count, halted, limited, faulted, errors, started < batch.jobs ? started + 1 : started,
+            seconds, instructions);
+
+    for (int i = 0; i < batch.jobs; i++)
+    {
+        pthread_mutex_destroy(&batch.queues[i].lock);
+    }
+    for (int i = 0; i < batch.count; i++)
+    {
+        free(batch.paths[i]);
+    }
+    free(batch.paths);
+    free(batch.results);
+    free(batch.queues);
+    free(threads);
+    free(workers);
+    return errors != 0;
+}
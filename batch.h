@@ -0,0 +1,24 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+// Batch runner: executes many independent programs on a pool of worker
+// threads and prints one result line per program, in input order.
+
+struct batch_options
+{
+    int jobs;                            // worker threads; 0 = one per online CPU
+    unsigned long long max_instructions; // per-program budget; 0 = run to HLT
+    unsigned long long max_tstates;      // per-program T-state budget; 0 = none
+    double max_seconds;                  // per-program wall-clock limit; 0 = none
+    unsigned short origin;               // load address and start PC for .bin files
+    int jit;                             // translate hot code (cpu8085_enable_jit())
+};
+
+// Run every program named in a manifest file (one path per line, '#' starts
+// a comment, relative paths are taken from the manifest's directory) or found
+// in a directory. Files ending in .asm/.s are assembled, .hex is Intel HEX and
+// anything else is a raw binary image.
+// Returns 0 if every program loaded, 1 otherwise.
+int run_batch(const char *source, const struct batch_options *options);
+
+#endif
@@ -0,0 +1,40 @@
+; Multi-byte addition: Fibonacci numbers modulo 2^128, X += Y then Y += X,
+; 65536 times over two 16-byte little-endian numbers
+X       EQU 2000H
+Y       EQU 2010H
+LEN     EQU 16
+
+        ORG 0
+        LXI SP, 8000H
+        MVI A, 1
+        STA X
+        STA Y
+        MVI A, 0
+        STA COUNT       ;256 outer rounds
+        MVI B, 0        ;256 inner rounds
+LOOP:   LXI H, Y
+        LXI D, X
+        CALL ADDN
+        LXI H, X
+        LXI D, Y
+        CALL ADDN
+        DCR B
+        JNZ LOOP
+        LXI H, COUNT
+        DCR M
+        JNZ LOOP
+        HLT
+
+; (DE) += (HL), LEN bytes
+ADDN:   MVI C, LEN
+        ORA A           ;clear carry
+NEXT:   LDAX D
+        ADC M
+        STAX D
+        INX D
+        INX H
+        DCR C
+        JNZ NEXT
+        RET
+
+COUNT:  DS 1
@@ -0,0 +1,41 @@
+; BCD arithmetic: Fibonacci numbers in 16-digit packed BCD (modulo 10^16),
+; X += Y then Y += X with DAA, 65536 times
+X       EQU 2000H
+Y       EQU 2008H
+LEN     EQU 8
+
+        ORG 0
+        LXI SP, 8000H
+        MVI A, 1
+        STA X
+        STA Y
+        MVI A, 0
+        STA COUNT       ;256 outer rounds
+        MVI B, 0        ;256 inner rounds
+LOOP:   LXI H, Y
+        LXI D, X
+        CALL ADDBCD
+        LXI H, X
+        LXI D, Y
+        CALL ADDBCD
+        DCR B
+        JNZ LOOP
+        LXI H, COUNT
+        DCR M
+        JNZ LOOP
+        HLT
+
+; (DE) += (HL), LEN bytes of packed BCD
+ADDBCD: MVI C, LEN
+        ORA A           ;clear carry
+NEXT:   LDAX D
+        ADC M
+        DAA
+        STAX D
+        INX D
+        INX H
+        DCR C
+        JNZ NEXT
+        RET
+
+COUNT:  DS 1
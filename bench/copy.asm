@@ -0,0 +1,34 @@
+; Block copy: 256 copies of an 8 KiB block, a byte at a time
+SRC     EQU 2000H
+DST     EQU 4000H
+LEN     EQU 2000H
+
+        ORG 0
+        LXI SP, 8000H
+        LXI H, SRC      ;fill the source with a ramp
+        LXI B, LEN
+FILL:   MOV M, L
+        INX H
+        DCX B
+        MOV A, B
+        ORA C
+        JNZ FILL
+        MVI A, 0
+        STA COUNT       ;256 rounds
+ROUND:  LXI H, SRC
+        LXI D, DST
+        LXI B, LEN
+COPY:   MOV A, M
+        STAX D
+        INX H
+        INX D
+        DCX B
+        MOV A, B
+        ORA C
+        JNZ COPY
+        LXI H, COUNT
+        DCR M
+        JNZ ROUND
+        HLT
+
+COUNT:  DS 1
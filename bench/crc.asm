@@ -0,0 +1,46 @@
+; CRC-16/CCITT (polynomial 1021H), bit by bit, over a 1 KiB buffer:
+; 256 passes, the CRC carried from one pass to the next and left at RESULT
+DATA    EQU 2000H
+RESULT  EQU 2400H
+
+        ORG 0
+        LXI SP, 8000H
+        LXI H, DATA     ;fill the buffer with x = 5x + 17 (mod 256)
+        MVI A, 7
+FILL:   MOV B, A
+        ADD A
+        ADD A
+        ADD B
+        ADI 17
+        MOV M, A
+        INX H
+        MOV B, A
+        MOV A, H
+        CPI RESULT / 256
+        MOV A, B
+        JNZ FILL
+        LXI H, 0FFFFH   ;initial CRC
+        MVI C, 0        ;256 passes
+PASS:   LXI D, DATA
+BYTE:   LDAX D
+        XRA H
+        MOV H, A
+        MVI B, 8
+BIT:    DAD H           ;shift the CRC left, top bit into carry
+        JNC NOXOR
+        MOV A, H
+        XRI 10H
+        MOV H, A
+        MOV A, L
+        XRI 21H
+        MOV L, A
+NOXOR:  DCR B
+        JNZ BIT
+        INX D
+        MOV A, D
+        CPI RESULT / 256
+        JNZ BYTE
+        DCR C
+        JNZ PASS
+        SHLD RESULT
+        HLT
@@ -0,0 +1,49 @@
+; Bubble sort: 200 rounds of filling 128 bytes from a pseudo-random
+; sequence and sorting them into ascending order
+DATA    EQU 2000H
+LEN     EQU 128
+
+        ORG 0
+        LXI SP, 8000H
+        MVI E, 200      ;rounds
+        MVI A, 7        ;seed
+        STA SEED
+ROUND:  CALL FILL
+        MVI C, LEN-1    ;passes
+PASS:   LXI H, DATA
+        MOV B, C        ;comparisons in this pass
+CMP1:   MOV A, M
+        INX H
+        CMP M
+        JC KEEP         ;already in order
+        JZ KEEP
+        MOV D, M        ;swap the pair
+        MOV M, A
+        DCX H
+        MOV M, D
+        INX H
+KEEP:   DCR B
+        JNZ CMP1
+        DCR C
+        JNZ PASS
+        DCR E
+        JNZ ROUND
+        HLT
+
+; Fill DATA with x = 5x + 17 (mod 256), carrying x over in SEED
+FILL:   LXI H, DATA
+        MVI C, LEN
+        LDA SEED
+FNEXT:  MOV B, A
+        ADD A
+        ADD A
+        ADD B
+        ADI 17
+        MOV M, A
+        INX H
+        DCR C
+        JNZ FNEXT
+        STA SEED
+        RET
+
+SEED:   DS 1
@@ -0,0 +1,339 @@
+// Throughput benchmark: runs 8085 programs headless, as fast as the host
+// allows, and prints one line of key=value results per program.
+//
+//   benchtool [--repeat N] [--plain | --jit] [--profile] [--lanes] FILE...
+//
+// Each program is assembled (.asm/.s) or loaded as Intel HEX (.hex) or a raw
+// binary at 0000, then run to HLT N times (default 5); the fastest run is
+// reported. The last line totals all the programs. With --lanes, each
+// program also runs on every lane of the lockstep engine (lanes8085.h), and
+// the figures are for all the lanes together. Exit status: 0, 1 if a
+// program did not halt cleanly or the lanes disagree with the scalar core,
+// 2 usage or file error.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <getopt.h>
+#include <sys/resource.h>
+
+#include "cpu8085.h"
+#include "loader.h"
+#include "asm8085.h"
+#include "lanes8085.h"
+#include "profile.h"
+
+// Stop a program that never halts; far beyond any benchmark workload
+#define BENCH_MAX_INSTRUCTIONS 2000000000ULL
+
+struct bench_result
+{
+    enum cpu8085_stop stop;
+    unsigned long long instructions;
+    unsigned long long tstates;
+    unsigned long long memory_hash;
+    double seconds;
+};
+
+static int has_suffix(const char *path, const char *suffix)
+{
+    size_t n = strlen(path);
+    size_t m = strlen(suffix);
+    return n >= m && strcasecmp(path + n - m, suffix) == 0;
+}
+
+static int load_program(cpu8085 *cpu, const char *path)
+{
+    cpu8085_init(cpu);
+    if (has_suffix(path, ".asm") || has_suffix(path, ".s"))
+    {
+        struct asm_result assembled;
+        if (assemble_file(path, cpu->memory, NULL, &assembled) < 0)
+        {
+            return -1;
+        }
+        cpu->PC = assembled.entry >= 0 ? assembled.entry : 0;
+    }
+    else if (has_suffix(path, ".hex"))
+    {
+        int entry = 0;
+        if (load_intel_hex(path, cpu->memory, &entry) < 0)
+        {
+            return -1;
+        }
+        cpu->PC = entry;
+    }
+    else if (load_binary(path, cpu->memory, 0) < 0)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Best of repeat runs of the program at path, profiled if profile is set
+static int bench(cpu8085 *cpu, const char *path, int repeat, int profile, struct bench_result *best)
+{
+    struct cpu8085_limits limits = { .instructions = BENCH_MAX_INSTRUCTIONS };
+
+    for (int i = 0; i < repeat; i++)
+    {
+        if (load_program(cpu, path) < 0)
+        {
+            return -1;
+        }
+        if (profile && (cpu->profile = profile_create(cpu)) == NULL)
+        {
+            fprintf(stderr, "benchtool: out of memory\n");
+            return -1;
+        }
+
+        double start = now();
+        enum cpu8085_stop stop = cpu8085_run_limited(cpu, &limits);
+        if (cpu->profile != NULL)
+        {
+            cpu8085_sync_profile(cpu);
+        }
+        double seconds = now() - start;
+
+        profile_destroy(cpu->profile);
+        cpu->profile = NULL;
+
+        if (i == 0 || seconds < best->seconds)
+        {
+            best->stop = stop;
+            best->instructions = cpu->instructions;
+            best->tstates = cpu->tstates;
+            best->memory_hash = cpu8085_dirty_hash(cpu);
+            best->seconds = seconds;
+        }
+    }
+    return 0;
+}
+
+// Best of repeat runs of the program at path on every lane; the result
+// sums the lanes and hashes lane 0's memory. Leaves cpu holding lane 0.
+static int bench_lanes(cpu8085 *cpu, lanes8085 *lanes, const char *path, int repeat,
+                       struct bench_result *best)
+{
+    for (int i = 0; i < repeat; i++)
+    {
+        if (load_program(cpu, path) < 0)
+        {
+            return -1;
+        }
+        lanes8085_load(lanes, cpu);
+
+        double start = now();
+        unsigned long long instructions = lanes8085_run(lanes, BENCH_MAX_INSTRUCTIONS);
+        double seconds = now() - start;
+
+        if (i == 0 || seconds < best->seconds)
+        {
+            best->stop = CPU8085_STOP_HALT;
+            best->tstates = 0;
+            for (int lane = 0; lane < lanes->count; lane++)
+            {
+                enum cpu8085_stop stop = lanes8085_stop_reason(lanes, lane);
+                if (stop != CPU8085_STOP_HALT)
+                {
+                    best->stop = stop;
+                }
+                best->tstates += lanes->tstates[lane];
+            }
+            lanes8085_store(lanes, 0, cpu);
+            best->instructions = instructions;
+            best->memory_hash = cpu8085_dirty_hash(cpu);
+            best->seconds = seconds;
+        }
+    }
+    return 0;
+}
+
+// Peak resident set size of this process so far, in KiB
+static long peak_rss_kb(void)
+{
+    struct rusage usage;
+    return getrusage(RUSAGE_SELF, &usage) == 0 ? usage.ru_maxrss : 0;
+}
+
+static void print_result(const char *name, const char *status, unsigned long long instructions,
+                         unsigned long long tstates, double seconds)
+{
+    double ns = instructions ? seconds * 1e9 / instructions : 0;
+    double mips = seconds > 0 ? instructions / seconds / 1e6 : 0;
+    double mhz = seconds > 0 ? tstates / seconds / 1e6 : 0;
+
+    printf("%s status=%s instructions=%llu tstates=%llu seconds=%.6f ns_per_instruction=%.3f "
+           "mips=%.2f emulated_mhz=%.2f",
+           name, status, instructions, tstates, seconds, ns, mips, mhz);
+}
+
+static void print_help(void)
+{
+    printf("Usage: benchtool [--repeat N] [--plain | --jit] [--profile] [--lanes] FILE...\n\n");
+    printf("  --repeat N  Run each program N times and report the fastest (default 5)\n");
+    printf("  --plain     Execute instruction by instruction, without the block cache\n");
+    printf("  --jit       Also translate hot blocks into host machine code (x86-64)\n");
+    printf("  --profile   Profile every run (see --profile in the emulator), to measure\n");
+    printf("              the profiler's overhead\n");
+    printf("  --lanes     Also run each program on %d lanes of the lockstep engine\n", LANES8085_WIDTH);
+    printf("\nPer program: status, instructions, tstates, seconds, ns_per_instruction,\n");
+    printf("mips, emulated_mhz (T-states per host microsecond), mem (hash of the\n");
+    printf("memory written) and peak_rss_kb; the last line is the total.\n");
+    printf("--lanes adds a second line per program, for all the lanes together, with\n");
+    printf("lanes and speedup (its mips over the scalar core's).\n");
+}
+
+int main(int argc, char *argv[])
+{
+    static struct option long_options[] = {
+        {"help", no_argument, NULL, 'h'},
+        {"repeat", required_argument, NULL, 'r'},
+        {"plain", no_argument, NULL, 'p'},
+        {"jit", no_argument, NULL, 'j'},
+        {"profile", no_argument, NULL, 'P'},
+        {"lanes", no_argument, NULL, 'l'},
+        {NULL, 0, NULL, 0}
+    };
+
+    int repeat = 5;
+    int plain = 0;
+    int jit = 0;
+    int use_lanes = 0;
+    int profile = 0;
+    int opt;
+
+    while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1)
+    {
+        switch (opt)
+        {
+        case 'h':
+            print_help();
+            return 0;
+        case 'r':
+            repeat = atoi(optarg);
+            if (repeat < 1)
+            {
+                fprintf(stderr, "Invalid repeat count: %s\n", optarg);
+                return 2;
+            }
+            break;
+        case 'p':
+            plain = 1;
+            break;
+        case 'j':
+            jit = 1;
+            break;
+        case 'P':
+            profile = 1;
+            break;
+        case 'l':
+            use_lanes = 1;
+            break;
+        default:
+            fprintf(stderr, "Run with '--help' for the valid flags.\n");
+            return 2;
+        }
+    }
+    if (optind == argc)
+    {
+        print_help();
+        return 2;
+    }
+
+    cpu8085 *cpu = cpu8085_create();
+    lanes8085 *lanes = use_lanes ? lanes8085_create(LANES8085_WIDTH) : NULL;
+    if (cpu == NULL || (use_lanes && lanes == NULL))
+    {
+        fprintf(stderr, "benchtool: out of memory\n");
+        return 2;
+    }
+    if (jit && cpu8085_enable_jit(cpu) < 0)
+    {
+        fprintf(stderr, "benchtool: no JIT on this host, running the block cache\n");
+    }
+    else if (!plain && !jit)
+    {
+        cpu8085_enable_blocks(cpu); // runs uncached if out of memory
+    }
+
+    unsigned long long instructions = 0, tstates = 0;
+    unsigned long long lane_instructions = 0, lane_tstates = 0;
+    double seconds = 0, lane_seconds = 0;
+    int status = 0;
+
+    for (int i = optind; i < argc; i++)
+    {
+        struct bench_result r;
+
+        if (bench(cpu, argv[i], repeat, profile, &r) < 0)
+        {
+            printf("%s status=error\n", argv[i]);
+            status = 2;
+            continue;
+        }
+        if (r.stop != CPU8085_STOP_HALT && status == 0)
+        {
+            status = 1;
+        }
+        print_result(argv[i], cpu8085_stop_name(r.stop), r.instructions, r.tstates, r.seconds);
+        printf(" mem=%016llX peak_rss_kb=%ld\n", r.memory_hash, peak_rss_kb());
+        instructions += r.instructions;
+        tstates += r.tstates;
+        seconds += r.seconds;
+
+        if (lanes == NULL)
+        {
+            continue;
+        }
+
+        struct bench_result lr;
+        if (bench_lanes(cpu, lanes, argv[i], repeat, &lr) < 0)
+        {
+            printf("%s status=error\n", argv[i]);
+            status = 2;
+            continue;
+        }
+
+        // Every lane ran the same program, so lane 0 must end as the scalar run did
+        const char *lane_status = cpu8085_stop_name(lr.stop);
+        if (lr.stop != r.stop || lr.memory_hash != r.memory_hash ||
+            lr.instructions != r.instructions * lanes->count)
+        {
+            lane_status = "mismatch";
+        }
+        if (lr.stop != CPU8085_STOP_HALT || lane_status[0] == 'm')
+        {
+            status = status ? status : 1;
+        }
+        print_result(argv[i], lane_status, lr.instructions, lr.tstates, lr.seconds);
+        printf(" lanes=%d speedup=%.2f mem=%016llX peak_rss_kb=%ld\n", lanes->count,
+               lr.seconds > 0 && r.seconds > 0 ? r.seconds * lanes->count / lr.seconds : 0,
+               lr.memory_hash, peak_rss_kb());
+        lane_instructions += lr.instructions;
+        lane_tstates += lr.tstates;
+        lane_seconds += lr.seconds;
+    }
+
+    print_result("total", status == 0 ? "ok" : "failed", instructions, tstates, seconds);
+    printf(" peak_rss_kb=%ld\n", peak_rss_kb());
+    if (lanes != NULL)
+    {
+        print_result("total", status == 0 ? "ok" : "failed", lane_instructions, lane_tstates, lane_seconds);
+        printf(" lanes=%d speedup=%.2f peak_rss_kb=%ld\n", lanes->count,
+               lane_seconds > 0 && seconds > 0 ? seconds * lanes->count / lane_seconds : 0,
+               peak_rss_kb());
+    }
+
+    lanes8085_destroy(lanes);
+    cpu8085_destroy(cpu);
+    return status;
+}
@@ -0,0 +1,123 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bintrace.h"
+
+// How long either side sleeps when it has to wait for the other
+#define WRITER_IDLE_NS 200000
+#define PRODUCER_WAIT_NS 20000
+
+static void sleep_ns(long ns)
+{
+    struct timespec ts = { 0, ns };
+    nanosleep(&ts, NULL);
+}
+
+// Copy published records to the file in contiguous runs, until closing is
+// set and everything has been written
+static void *writer_main(void *arg)
+{
+    struct bintrace *trace = arg;
+    unsigned long consumed = atomic_load_explicit(&trace->consumed, memory_order_relaxed);
+
+    for (;;)
+    {
+        int closing = atomic_load(&trace->closing);
+        unsigned long published = atomic_load_explicit(&trace->published, memory_order_acquire);
+
+        if (published == consumed)
+        {
+            if (closing)
+            {
+                break;
+            }
+            sleep_ns(WRITER_IDLE_NS);
+            continue;
+        }
+
+        // Up to the end of the ring; the rest goes in the next round
+        unsigned long start = consumed & (BINTRACE_RING_RECORDS - 1);
+        unsigned long count = published - consumed;
+        if (count > BINTRACE_RING_RECORDS - start)
+        {
+            count = BINTRACE_RING_RECORDS - start;
+        }
+        if (!trace->error && fwrite(&trace->ring[start], sizeof(struct trace_record), count, trace->file) != count)
+        {
+            trace->error = 1;
+        }
+        consumed += count;
+        atomic_store_explicit(&trace->consumed, consumed, memory_order_release);
+    }
+    return NULL;
+}
+
+struct bintrace *bintrace_open(const char *path)
+{
+    struct bintrace *trace = calloc(1, sizeof(*trace));
+    if (trace == NULL)
+    {
+        fprintf(stderr, "%s: out of memory\n", path);
+        return NULL;
+    }
+    trace->ring = malloc(BINTRACE_RING_RECORDS * sizeof(struct trace_record));
+    trace->file = fopen(path, "wb");
+    if (trace->ring == NULL || trace->file == NULL)
+    {
+        perror(path);
+        if (trace->file != NULL)
+        {
+            fclose(trace->file);
+        }
+        free(trace->ring);
+        free(trace);
+        return NULL;
+    }
+    setvbuf(trace->file, NULL, _IOFBF, 1 << 20);
+
+    struct bintrace_header header = { .record_size = sizeof(struct trace_record) };
+    memcpy(header.magic, BINTRACE_MAGIC, sizeof(header.magic));
+    fwrite(&header, sizeof(header), 1, trace->file);
+
+    trace->free_until = BINTRACE_RING_RECORDS;
+    if (pthread_create(&trace->writer, NULL, writer_main, trace) != 0)
+    {
+        fprintf(stderr, "%s: could not start the trace writer\n", path);
+        fclose(trace->file);
+        free(trace->ring);
+        free(trace);
+        return NULL;
+    }
+    return trace;
+}
+
+void bintrace_wait(struct bintrace *trace)
+{
+    for (;;)
+    {
+        unsigned long consumed = atomic_load_explicit(&trace->consumed, memory_order_acquire);
+        trace->free_until = consumed + BINTRACE_RING_RECORDS;
+        if (trace->head != trace->free_until)
+        {
+            return;
+        }
+        sleep_ns(PRODUCER_WAIT_NS);
+    }
+}
+
+int bintrace_close(struct bintrace *trace)
+{
+    atomic_store(&trace->closing, 1);
+    pthread_join(trace->writer, NULL);
+
+    int error = trace->error;
+    if (fclose(trace->file) != 0)
+    {
+        error = 1;
+    }
+    free(trace->ring);
+    free(trace);
+    return error ? -1 : 0;
+}
@@ -0,0 +1,113 @@
+#ifndef BINTRACE_H
+#define BINTRACE_H
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <pthread.h>
+
+// Binary execution trace: one fixed-size record per instruction, written to
+// a file by a background thread.
+//
+// File layout: a struct bintrace_header followed by the records, in order of
+// execution. Multi-byte fields are in host byte order (little-endian on the
+// machines we run on); tracetool decodes, filters and diffs these files.
+
+#define BINTRACE_MAGIC "8085TRC1"
+
+struct bintrace_header
+{
+    char magic[8];               // BINTRACE_MAGIC, not NUL-terminated
+    unsigned int record_size;    // sizeof(struct trace_record)
+    unsigned int reserved;
+};
+
+struct trace_record
+{
+    unsigned short pc;         // address of the instruction
+    unsigned short sp;         // SP after it
+    unsigned short write_addr; // lowest address it wrote to memory
+    unsigned char bytes[3];    // the opcode and the two bytes after it
+    unsigned char write_count; // bytes written at write_addr (0-2)
+    unsigned char write[2];    // values written at write_addr, write_addr + 1
+    unsigned char reg[8];      // B C D E H L F A after the instruction
+};
+
+// Set in write_count for an interrupt acknowledge rather than an
+// instruction: pc is the address interrupted, bytes[1] and bytes[2] the
+// vector (low byte first) and the write the return address pushed.
+#define TRACE_INTERRUPT 0x80
+#define TRACE_WRITE_COUNT(record) ((record)->write_count & ~TRACE_INTERRUPT)
+
+_Static_assert(sizeof(struct trace_record) == 20, "trace records must stay 20 bytes");
+
+// Records in the ring between the CPU and the writer thread (power of two)
+#define BINTRACE_RING_RECORDS (1 << 16)
+
+// Single-producer, single-consumer ring. The CPU thread fills slots at head
+// and publishes them; the writer thread copies published records to the file
+// and hands the slots back through consumed.
+struct bintrace
+{
+    struct trace_record *ring;
+    unsigned long head;               // next slot to fill (CPU thread only)
+    unsigned long free_until;         // head may reach this without looking at consumed
+    _Atomic unsigned long published;  // records ready for the writer
+    _Atomic unsigned long consumed;   // records the writer has written out
+    _Atomic int closing;
+    FILE *file;
+    pthread_t writer;
+    int error;                        // set by the writer on a failed write
+};
+
+// Create path and start the writer thread; NULL (with a message on stderr)
+// on failure
+struct bintrace *bintrace_open(const char *path);
+
+// Write out every published record, stop the writer and close the file.
+// Returns 0, or -1 if any write failed.
+int bintrace_close(struct bintrace *trace);
+
+// Slow path of bintrace_next(): wait for the writer to free slots
+void bintrace_wait(struct bintrace *trace);
+
+// Slot for the next record; waits while the ring is full
+static inline struct trace_record *bintrace_next(struct bintrace *trace)
+{
+    if (trace->head == trace->free_until)
+    {
+        bintrace_wait(trace);
+    }
+    return &trace->ring[trace->head & (BINTRACE_RING_RECORDS - 1)];
+}
+
+// Hand the record returned by bintrace_next() to the writer
+static inline void bintrace_commit(struct bintrace *trace)
+{
+    atomic_store_explicit(&trace->published, ++trace->head, memory_order_release);
+}
+
+// Note a memory write in a record. Instructions write at most two adjacent
+// bytes, in either order (PUSH and CALL write SP-1 before SP-2).
+static inline void trace_record_write(struct trace_record *record, unsigned short addr, unsigned char value)
+{
+    if (record->write_count == 0)
+    {
+        record->write_addr = addr;
+        record->write[0] = value;
+        record->write_count = 1;
+    }
+    else if (addr == (unsigned short)(record->write_addr + 1))
+    {
+        record->write[1] = value;
+        record->write_count = 2;
+    }
+    else
+    {
+        record->write[1] = record->write[0];
+        record->write[0] = value;
+        record->write_addr = addr;
+        record->write_count = 2;
+    }
+}
+
+#endif
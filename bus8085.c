@@ -0,0 +1,101 @@
+#include <string.h>
+
+#include "bus8085.h"
+#include "cpu8085.h"
+
+void bus8085_init(struct bus8085 *bus)
+{
+    memset(bus, 0, sizeof(*bus));
+}
+
+void bus8085_map_ports(struct bus8085 *bus, unsigned char first, int count,
+                       bus8085_read_fn read, bus8085_write_fn write, void *device)
+{
+    for (int port = first; port < first + count && port < 256; port++)
+    {
+        bus->ports[port] = (struct bus8085_handler){ read, write, device };
+    }
+}
+
+int bus8085_map_memory(struct bus8085 *bus, unsigned short start, unsigned int length,
+                       bus8085_read_fn read, bus8085_write_fn write, void *device)
+{
+    if (length == 0 || start + length > CPU8085_MEMORY_SIZE || bus->region_count == BUS8085_MAX_REGIONS)
+    {
+        return -1;
+    }
+    bus->regions[bus->region_count++] = (struct bus8085_region){
+        start, length, { read, write, device }
+    };
+    return 0;
+}
+
+void cpu8085_attach_bus(struct cpu8085 *cpu, struct bus8085 *bus)
+{
+    cpu->bus = bus;
+    for (int page = 0; page < 256; page++)
+    {
+        cpu->mmio[page] &= ~CPU8085_PAGE_DEVICE;
+    }
+    for (int i = 0; bus != NULL && i < bus->region_count; i++)
+    {
+        const struct bus8085_region *r = &bus->regions[i];
+        for (unsigned int page = r->start >> 8; page <= (r->start + r->length - 1) >> 8; page++)
+        {
+            cpu->mmio[page] |= CPU8085_PAGE_DEVICE;
+        }
+    }
+}
+
+unsigned char bus8085_in(const struct bus8085 *bus, unsigned char port)
+{
+    const struct bus8085_handler *h = &bus->ports[port];
+    return h->read != NULL ? h->read(h->device, port) : 0xFF;
+}
+
+void bus8085_out(const struct bus8085 *bus, unsigned char port, unsigned char value)
+{
+    const struct bus8085_handler *h = &bus->ports[port];
+    if (h->write != NULL)
+    {
+        h->write(h->device, port, value);
+    }
+}
+
+static const struct bus8085_region *find_region(const struct bus8085 *bus, unsigned short addr)
+{
+    for (int i = 0; i < bus->region_count; i++)
+    {
+        const struct bus8085_region *r = &bus->regions[i];
+        if (addr >= r->start && addr - r->start < r->length)
+        {
+            return r;
+        }
+    }
+    return NULL;
+}
+
+int bus8085_read(const struct bus8085 *bus, unsigned short addr, unsigned char *value)
+{
+    const struct bus8085_region *r = find_region(bus, addr);
+    if (r == NULL)
+    {
+        return 0;
+    }
+    *value = r->handler.read != NULL ? r->handler.read(r->handler.device, addr - r->start) : 0xFF;
+    return 1;
+}
+
+int bus8085_write(const struct bus8085 *bus, unsigned short addr, unsigned char value)
+{
+    const struct bus8085_region *r = find_region(bus, addr);
+    if (r == NULL)
+    {
+        return 0;
+    }
+    if (r->handler.write != NULL)
+    {
+        r->handler.write(r->handler.device, addr - r->start, value);
+    }
+    return 1;
+}
@@ -0,0 +1,68 @@
+#ifndef BUS8085_H
+#define BUS8085_H
+
+// Device bus: the 256 I/O ports reached by IN/OUT, plus memory-mapped
+// regions whose reads and writes go to a device instead of RAM.
+//
+// The core only looks at the bus for memory pages that contain a mapped
+// region (a 256-entry page table in the cpu8085), so ordinary RAM keeps its
+// direct array access. Instruction fetches always read RAM: code cannot run
+// from a memory-mapped region.
+
+struct cpu8085;
+
+typedef unsigned char (*bus8085_read_fn)(void *device, unsigned short addr);
+typedef void (*bus8085_write_fn)(void *device, unsigned short addr, unsigned char value);
+
+// A device's side of a port or region. A NULL read returns FF (floating
+// bus); a NULL write ignores the value. addr is the port number, or the
+// offset into a memory region.
+struct bus8085_handler
+{
+    bus8085_read_fn read;
+    bus8085_write_fn write;
+    void *device;
+};
+
+#define BUS8085_MAX_REGIONS 16
+
+struct bus8085_region
+{
+    unsigned short start;
+    unsigned int length;
+    struct bus8085_handler handler;
+};
+
+struct bus8085
+{
+    struct bus8085_handler ports[256];
+    struct bus8085_region regions[BUS8085_MAX_REGIONS];
+    int region_count;
+};
+
+// Empty bus: every port floating, no regions
+void bus8085_init(struct bus8085 *bus);
+
+// Connect count ports starting at first to a device
+void bus8085_map_ports(struct bus8085 *bus, unsigned char first, int count,
+                       bus8085_read_fn read, bus8085_write_fn write, void *device);
+
+// Map length bytes of the address space at start to a device.
+// Returns 0, or -1 if the region is invalid or the table is full.
+int bus8085_map_memory(struct bus8085 *bus, unsigned short start, unsigned int length,
+                       bus8085_read_fn read, bus8085_write_fn write, void *device);
+
+// Plug the bus into a CPU (NULL unplugs it). Map every region before
+// attaching, or attach again afterwards, so the CPU's page table is current.
+void cpu8085_attach_bus(struct cpu8085 *cpu, struct bus8085 *bus);
+
+// Slow paths used by the core for IN/OUT and for pages with mapped regions
+unsigned char bus8085_in(const struct bus8085 *bus, unsigned char port);
+void bus8085_out(const struct bus8085 *bus, unsigned char port, unsigned char value);
+
+// Memory access on a page holding a region: returns 1 if addr is inside a
+// region and was handled, 0 if it is plain RAM after all
+int bus8085_read(const struct bus8085 *bus, unsigned short addr, unsigned char *value);
+int bus8085_write(const struct bus8085 *bus, unsigned short addr, unsigned char value);
+
+#endif
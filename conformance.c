@@ -0,0 +1,1569 @@
+// Conformance test for the 8085 core. Every opcode runs over all its
+// operand and flag combinations (exhaustively for 8-bit operands, sampled
+// for 16-bit ones) against a reference model, on each execution engine:
+// the interpreter, the block cache and the JIT. Random programs then run on
+// all of them, on the lockstep lanes and on forks, and must agree to the
+// last T-state, and conditional breakpoints must stop them alike. Last,
+// the Intel HEX loader must report errors on the right line.
+//
+//   conformance [--quick] [--seed N]
+//
+// --quick samples every opcode instead of sweeping it. Exit status: 0 all
+// passed, 1 mismatches (the first few are printed), 2 usage error.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <unistd.h>
+
+#include "cpu8085.h"
+#include "debug8085.h"
+#include "lanes8085.h"
+#include "loader.h"
+
+// Mismatches printed before the rest are only counted
+#define MAX_REPORTS 20
+
+// The instruction under test sits at CODE_ADDR; every other byte of memory
+// is a HLT, so the instruction is followed by one wherever it goes. Inputs
+// and writes stay out of the code's page, and branch targets out of the
+// page and below it.
+#define CODE_ADDR 0x0100
+#define HLT 0x76
+
+// ---- Reference model ----
+//
+// One instruction at a time, written from the 8085 instruction set
+// description rather than from cpu8085.c or its flag tables. Where the
+// chip's data sheet leaves a choice, it follows the core's documented one:
+// AC after a subtraction is the borrow out of the low digit, ANA sets AC,
+// XRA and ORA clear it, and the undocumented V and K bits (1 and 5) only
+// change through DSUB and POP PSW, bit 3 only through POP PSW.
+
+enum { R_B, R_C, R_D, R_E, R_H, R_L, R_F, R_A };
+
+struct machine
+{
+    unsigned char reg[8];          // B C D E H L F A, as in cpu8085
+    unsigned short pc, sp;
+    unsigned char int_enable, int_mask, sod, sid;
+    unsigned char halted;
+    unsigned int tstates, instructions;
+    unsigned char *memory;
+    int write_count;               // bytes the instruction wrote
+    unsigned short write_addr[2];
+};
+
+static unsigned char ref_szp(unsigned char result)
+{
+    int bits = 0;
+    for (int i = 0; i < 8; i++)
+    {
+        bits += (result >> i) & 1;
+    }
+    return (result & 0x80 ? SIGN_FLAG : 0) | (result == 0 ? ZERO_FLAG : 0) | (bits % 2 == 0 ? PARITY_FLAG : 0);
+}
+
+static unsigned short ref_hl(const struct machine *m)
+{
+    return m->reg[R_H] << 8 | m->reg[R_L];
+}
+
+static void ref_write(struct machine *m, unsigned short addr, unsigned char value)
+{
+    m->memory[addr] = value;
+    m->write_addr[m->write_count++] = addr;
+}
+
+// Register field: 6 is M, the byte at HL
+static unsigned char ref_get(const struct machine *m, int r)
+{
+    return r == 6 ? m->memory[ref_hl(m)] : m->reg[r];
+}
+
+static void ref_set(struct machine *m, int r, unsigned char value)
+{
+    if (r == 6)
+    {
+        ref_write(m, ref_hl(m), value);
+    }
+    else
+    {
+        m->reg[r] = value;
+    }
+}
+
+// Register pair field: BC, DE, HL, SP
+static unsigned short ref_get_rp(const struct machine *m, int rp)
+{
+    return rp == 3 ? m->sp : m->reg[2 * rp] << 8 | m->reg[2 * rp + 1];
+}
+
+static void ref_set_rp(struct machine *m, int rp, unsigned short value)
+{
+    if (rp == 3)
+    {
+        m->sp = value;
+    }
+    else
+    {
+        m->reg[2 * rp] = value >> 8;
+        m->reg[2 * rp + 1] = value & 0xFF;
+    }
+}
+
+static void ref_push(struct machine *m, unsigned short value)
+{
+    m->sp--;
+    ref_write(m, m->sp, value >> 8);
+    m->sp--;
+    ref_write(m, m->sp, value & 0xFF);
+}
+
+static unsigned short ref_pop(struct machine *m)
+{
+    unsigned short value = m->memory[m->sp];
+    m->sp++;
+    value |= m->memory[m->sp] << 8;
+    m->sp++;
+    return value;
+}
+
+// ADD ADC SUB SBB ANA XRA ORA CMP, by bits 5-3 of the opcode
+static void ref_alu(struct machine *m, int op, unsigned char value)
+{
+    unsigned char a = m->reg[R_A];
+    int carry = m->reg[R_F] & CARRY_FLAG;
+    int result;
+    unsigned char f;
+
+    switch (op)
+    {
+    case 0: // ADD
+    case 1: // ADC
+        carry = op == 1 ? carry : 0;
+        result = a + value + carry;
+        f = ref_szp(result & 0xFF) | (result > 0xFF ? CARRY_FLAG : 0) |
+            ((a & 0x0F) + (value & 0x0F) + carry > 0x0F ? AUX_CARRY_FLAG : 0);
+        m->reg[R_A] = result;
+        break;
+    case 4: // ANA
+        m->reg[R_A] = a & value;
+        f = ref_szp(m->reg[R_A]) | AUX_CARRY_FLAG;
+        break;
+    case 5: // XRA
+        m->reg[R_A] = a ^ value;
+        f = ref_szp(m->reg[R_A]);
+        break;
+    case 6: // ORA
+        m->reg[R_A] = a | value;
+        f = ref_szp(m->reg[R_A]);
+        break;
+    default: // SUB, SBB, CMP
+        carry = op == 3 ? carry : 0;
+        result = a - value - carry;
+        f = ref_szp(result & 0xFF) | (result < 0 ? CARRY_FLAG : 0) |
+            ((a & 0x0F) - (value & 0x0F) - carry < 0 ? AUX_CARRY_FLAG : 0);
+        if (op != 7)
+        {
+            m->reg[R_A] = result;
+        }
+        break;
+    }
+    m->reg[R_F] = f;
+}
+
+// NZ Z NC C PO PE P M, by bits 5-3 of the opcode
+static int ref_condition(const struct machine *m, int ccc)
+{
+    unsigned char f = m->reg[R_F];
+    switch (ccc)
+    {
+    case 0: return !(f & ZERO_FLAG);
+    case 1: return (f & ZERO_FLAG) != 0;
+    case 2: return !(f & CARRY_FLAG);
+    case 3: return (f & CARRY_FLAG) != 0;
+    case 4: return !(f & PARITY_FLAG);
+    case 5: return (f & PARITY_FLAG) != 0;
+    case 6: return !(f & SIGN_FLAG);
+    default: return (f & SIGN_FLAG) != 0;
+    }
+}
+
+// Instruction length, from the opcode's encoding
+static int ref_length(unsigned char op)
+{
+    if ((op & 0xCF) == 0x01 || (op & 0xE7) == 0x22 || op == 0xC3 || op == 0xCD ||
+        (op & 0xC7) == 0xC2 || (op & 0xC7) == 0xC4 || op == 0xDD || op == 0xFD)
+    {
+        return 3; // LXI, SHLD LHLD STA LDA, JMP CALL Jcc Ccc, JNK JK
+    }
+    if ((op & 0xC7) == 0x06 || (op & 0xC7) == 0xC6 || op == 0xDB || op == 0xD3 || op == 0x28 || op == 0x38)
+    {
+        return 2; // MVI, ADI..CPI, IN OUT, LDHI LDSI
+    }
+    return 1;
+}
+
+// Execute the instruction at pc, with its documented T-states
+static void ref_step(struct machine *m)
+{
+    unsigned char op = m->memory[m->pc];
+    unsigned char data = m->memory[(unsigned short)(m->pc + 1)];
+    unsigned short addr = data | m->memory[(unsigned short)(m->pc + 2)] << 8;
+    int ddd = (op >> 3) & 7, sss = op & 7, rp = (op >> 4) & 3;
+    unsigned char a = m->reg[R_A];
+    int carry = m->reg[R_F] & CARRY_FLAG;
+
+    m->instructions++;
+    if (op == 0x76) // HLT
+    {
+        m->pc++;
+        m->halted = 1;
+        m->tstates += 5;
+        return;
+    }
+    if ((op & 0xC0) == 0x40) // MOV
+    {
+        ref_set(m, ddd, ref_get(m, sss));
+        m->pc++;
+        m->tstates += ddd == 6 || sss == 6 ? 7 : 4;
+        return;
+    }
+    if ((op & 0xC0) == 0x80) // ALU with a register or M
+    {
+        ref_alu(m, ddd, ref_get(m, sss));
+        m->pc++;
+        m->tstates += sss == 6 ? 7 : 4;
+        return;
+    }
+
+    switch (op)
+    {
+    case 0x00: // NOP
+        m->pc++;
+        m->tstates += 4;
+        break;
+    case 0x01: case 0x11: case 0x21: case 0x31: // LXI
+        ref_set_rp(m, rp, addr);
+        m->pc += 3;
+        m->tstates += 10;
+        break;
+    case 0x02: case 0x12: // STAX
+        ref_write(m, ref_get_rp(m, rp), a);
+        m->pc++;
+        m->tstates += 7;
+        break;
+    case 0x0A: case 0x1A: // LDAX
+        m->reg[R_A] = m->memory[ref_get_rp(m, rp)];
+        m->pc++;
+        m->tstates += 7;
+        break;
+    case 0x03: case 0x13: case 0x23: case 0x33: // INX
+        ref_set_rp(m, rp, ref_get_rp(m, rp) + 1);
+        m->pc++;
+        m->tstates += 6;
+        break;
+    case 0x0B: case 0x1B: case 0x2B: case 0x3B: // DCX
+        ref_set_rp(m, rp, ref_get_rp(m, rp) - 1);
+        m->pc++;
+        m->tstates += 6;
+        break;
+    case 0x04: case 0x0C: case 0x14: case 0x1C: case 0x24: case 0x2C: case 0x34: case 0x3C: // INR
+    {
+        unsigned char value = ref_get(m, ddd);
+        ref_set(m, ddd, value + 1);
+        m->reg[R_F] = carry | ref_szp(value + 1) | ((value & 0x0F) == 0x0F ? AUX_CARRY_FLAG : 0);
+        m->pc++;
+        m->tstates += ddd == 6 ? 10 : 4;
+        break;
+    }
+    case 0x05: case 0x0D: case 0x15: case 0x1D: case 0x25: case 0x2D: case 0x35: case 0x3D: // DCR
+    {
+        unsigned char value = ref_get(m, ddd);
+        ref_set(m, ddd, value - 1);
+        m->reg[R_F] = carry | ref_szp(value - 1) | ((value & 0x0F) == 0 ? AUX_CARRY_FLAG : 0);
+        m->pc++;
+        m->tstates += ddd == 6 ? 10 : 4;
+        break;
+    }
+    case 0x06: case 0x0E: case 0x16: case 0x1E: case 0x26: case 0x2E: case 0x36: case 0x3E: // MVI
+        ref_set(m, ddd, data);
+        m->pc += 2;
+        m->tstates += ddd == 6 ? 10 : 7;
+        break;
+    case 0x07: // RLC
+        m->reg[R_A] = a << 1 | a >> 7;
+        m->reg[R_F] = (m->reg[R_F] & ~CARRY_FLAG) | a >> 7;
+        m->pc++;
+        m->tstates += 4;
+        break;
+    case 0x0F: // RRC
+        m->reg[R_A] = a >> 1 | a << 7;
+        m->reg[R_F] = (m->reg[R_F] & ~CARRY_FLAG) | (a & 1);
+        m->pc++;
+        m->tstates += 4;
+        break;
+    case 0x17: // RAL
+        m->reg[R_A] = a << 1 | carry;
+        m->reg[R_F] = (m->reg[R_F] & ~CARRY_FLAG) | a >> 7;
+        m->pc++;
+        m->tstates += 4;
+        break;
+    case 0x1F: // RAR
+        m->reg[R_A] = a >> 1 | carry << 7;
+        m->reg[R_F] = (m->reg[R_F] & ~CARRY_FLAG) | (a & 1);
+        m->pc++;
+        m->tstates += 4;
+        break;
+    case 0x09: case 0x19: case 0x29: case 0x39: // DAD
+    {
+        unsigned int sum = ref_hl(m) + ref_get_rp(m, rp);
+        ref_set_rp(m, 2, sum);
+        m->reg[R_F] = (m->reg[R_F] & ~CARRY_FLAG) | (sum > 0xFFFF ? CARRY_FLAG : 0);
+        m->pc++;
+        m->tstates += 10;
+        break;
+    }
+    case 0x20: // RIM, no interrupt pending
+        m->reg[R_A] = m->sid << 7 | (m->int_enable ? 0x08 : 0) | m->int_mask;
+        m->pc++;
+        m->tstates += 4;
+        break;
+    case 0x30: // SIM
+        if (a & 0x08)
+        {
+            m->int_mask = a & 0x07;
+        }
+        if (a & 0x40)
+        {
+            m->sod = a >> 7;
+        }
+        m->pc++;
+        m->tstates += 4;
+        break;
+    case 0x22: // SHLD
+        ref_write(m, addr, m->reg[R_L]);
+        ref_write(m, addr + 1, m->reg[R_H]);
+        m->pc += 3;
+        m->tstates += 16;
+        break;
+    case 0x2A: // LHLD
+        m->reg[R_L] = m->memory[addr];
+        m->reg[R_H] = m->memory[(unsigned short)(addr + 1)];
+        m->pc += 3;
+        m->tstates += 16;
+        break;
+    case 0x27: // DAA
+    {
+        unsigned char correction = 0;
+        if ((a & 0x0F) > 9 || (m->reg[R_F] & AUX_CARRY_FLAG))
+        {
+            correction = 0x06;
+        }
+        if (a > 0x99 || carry)
+        {
+            correction |= 0x60;
+            carry = 1;
+        }
+        m->reg[R_A] = a + correction;
+        m->reg[R_F] = ref_szp(m->reg[R_A]) | carry |
+                      ((a & 0x0F) + (correction & 0x0F) > 0x0F ? AUX_CARRY_FLAG : 0);
+        m->pc++;
+        m->tstates += 4;
+        break;
+    }
+    case 0x2F: // CMA
+        m->reg[R_A] = ~a;
+        m->pc++;
+        m->tstates += 4;
+        break;
+    case 0x32: // STA
+        ref_write(m, addr, a);
+        m->pc += 3;
+        m->tstates += 13;
+        break;
+    case 0x3A: // LDA
+        m->reg[R_A] = m->memory[addr];
+        m->pc += 3;
+        m->tstates += 13;
+        break;
+    case 0x37: // STC
+        m->reg[R_F] |= CARRY_FLAG;
+        m->pc++;
+        m->tstates += 4;
+        break;
+    case 0x3F: // CMC
+        m->reg[R_F] ^= CARRY_FLAG;
+        m->pc++;
+        m->tstates += 4;
+        break;
+    case 0xC6: case 0xCE: case 0xD6: case 0xDE: case 0xE6: case 0xEE: case 0xF6: case 0xFE: // ALU immediate
+        ref_alu(m, ddd, data);
+        m->pc += 2;
+        m->tstates += 7;
+        break;
+    case 0xC3: // JMP
+        m->pc = addr;
+        m->tstates += 10;
+        break;
+    case 0xC2: case 0xCA: case 0xD2: case 0xDA: case 0xE2: case 0xEA: case 0xF2: case 0xFA: // Jcc
+        m->pc = ref_condition(m, ddd) ? addr : m->pc + 3;
+        m->tstates += ref_condition(m, ddd) ? 10 : 7;
+        break;
+    case 0xCD: // CALL
+        ref_push(m, m->pc + 3);
+        m->pc = addr;
+        m->tstates += 18;
+        break;
+    case 0xC4: case 0xCC: case 0xD4: case 0xDC: case 0xE4: case 0xEC: case 0xF4: case 0xFC: // Ccc
+        if (ref_condition(m, ddd))
+        {
+            ref_push(m, m->pc + 3);
+            m->pc = addr;
+            m->tstates += 18;
+        }
+        else
+        {
+            m->pc += 3;
+            m->tstates += 9;
+        }
+        break;
+    case 0xC9: // RET
+        m->pc = ref_pop(m);
+        m->tstates += 10;
+        break;
+    case 0xC0: case 0xC8: case 0xD0: case 0xD8: case 0xE0: case 0xE8: case 0xF0: case 0xF8: // Rcc
+        if (ref_condition(m, ddd))
+        {
+            m->pc = ref_pop(m);
+            m->tstates += 12;
+        }
+        else
+        {
+            m->pc++;
+            m->tstates += 6;
+        }
+        break;
+    case 0xC7: case 0xCF: case 0xD7: case 0xDF: case 0xE7: case 0xEF: case 0xF7: case 0xFF: // RST
+        ref_push(m, m->pc + 1);
+        m->pc = ddd * 8;
+        m->tstates += 12;
+        break;
+    case 0xC1: case 0xD1: case 0xE1: case 0xF1: // POP
+    {
+        unsigned short value = ref_pop(m);
+        if (rp == 3)
+        {
+            m->reg[R_A] = value >> 8;
+            m->reg[R_F] = value & 0xFF;
+        }
+        else
+        {
+            ref_set_rp(m, rp, value);
+        }
+        m->pc++;
+        m->tstates += 10;
+        break;
+    }
+    case 0xC5: case 0xD5: case 0xE5: case 0xF5: // PUSH
+        ref_push(m, rp == 3 ? a << 8 | m->reg[R_F] : ref_get_rp(m, rp));
+        m->pc++;
+        m->tstates += 12;
+        break;
+    case 0xD3: // OUT, nothing attached
+        m->pc += 2;
+        m->tstates += 10;
+        break;
+    case 0xDB: // IN, nothing attached
+        m->reg[R_A] = 0xFF;
+        m->pc += 2;
+        m->tstates += 10;
+        break;
+    case 0xE3: // XTHL
+    {
+        unsigned char l = m->memory[m->sp];
+        unsigned char h = m->memory[(unsigned short)(m->sp + 1)];
+        ref_write(m, m->sp, m->reg[R_L]);
+        ref_write(m, m->sp + 1, m->reg[R_H]);
+        m->reg[R_L] = l;
+        m->reg[R_H] = h;
+        m->pc++;
+        m->tstates += 16;
+        break;
+    }
+    case 0xE9: // PCHL
+        m->pc = ref_hl(m);
+        m->tstates += 6;
+        break;
+    case 0xEB: // XCHG
+    {
+        unsigned short de = ref_get_rp(m, 1);
+        ref_set_rp(m, 1, ref_hl(m));
+        ref_set_rp(m, 2, de);
+        m->pc++;
+        m->tstates += 4;
+        break;
+    }
+    case 0xF9: // SPHL
+        m->sp = ref_hl(m);
+        m->pc++;
+        m->tstates += 6;
+        break;
+    case 0xF3: // DI
+        m->int_enable = 0;
+        m->pc++;
+        m->tstates += 4;
+        break;
+    case 0xFB: // EI, in effect once the next instruction has run
+        m->int_enable = 1;
+        m->pc++;
+        m->tstates += 4;
+        break;
+    case 0x08: // DSUB: HL - BC, P from the high byte
+    {
+        int hl = ref_hl(m), bc = ref_get_rp(m, 0);
+        int diff = hl - bc;
+        int signed_diff = (short)hl - (short)bc;
+        unsigned char f = (diff & 0xFFFF) == 0 ? ZERO_FLAG : 0;
+        f |= diff & 0x8000 ? SIGN_FLAG : 0;
+        f |= ref_szp(diff >> 8 & 0xFF) & PARITY_FLAG;
+        f |= (hl & 0xFFF) < (bc & 0xFFF) ? AUX_CARRY_FLAG : 0;
+        f |= diff < 0 ? CARRY_FLAG : 0;
+        f |= signed_diff < -32768 || signed_diff > 32767 ? OVERFLOW_FLAG : 0;
+        f |= !(f & OVERFLOW_FLAG) != !(f & SIGN_FLAG) ? K_FLAG : 0;
+        ref_set_rp(m, 2, diff);
+        m->reg[R_F] = f;
+        m->pc++;
+        m->tstates += 10;
+        break;
+    }
+    case 0x10: // ARHL
+    {
+        unsigned short hl = ref_hl(m);
+        ref_set_rp(m, 2, (hl & 0x8000) | hl >> 1);
+        m->reg[R_F] = (m->reg[R_F] & ~CARRY_FLAG) | (hl & 1);
+        m->pc++;
+        m->tstates += 7;
+        break;
+    }
+    case 0x18: // RDEL
+    {
+        unsigned short de = ref_get_rp(m, 1);
+        ref_set_rp(m, 1, de << 1 | carry);
+        m->reg[R_F] = (m->reg[R_F] & ~CARRY_FLAG) | (de & 0x8000 ? CARRY_FLAG : 0);
+        m->pc++;
+        m->tstates += 10;
+        break;
+    }
+    case 0x28: // LDHI
+    case 0x38: // LDSI
+        ref_set_rp(m, 1, (op == 0x28 ? ref_hl(m) : m->sp) + data);
+        m->pc += 2;
+        m->tstates += 10;
+        break;
+    case 0xCB: // RSTV
+        if (m->reg[R_F] & OVERFLOW_FLAG)
+        {
+            ref_push(m, m->pc + 1);
+            m->pc = 0x40;
+            m->tstates += 12;
+        }
+        else
+        {
+            m->pc++;
+            m->tstates += 6;
+        }
+        break;
+    case 0xD9: // SHLX
+    {
+        unsigned short de = ref_get_rp(m, 1);
+        ref_write(m, de, m->reg[R_L]);
+        ref_write(m, de + 1, m->reg[R_H]);
+        m->pc++;
+        m->tstates += 10;
+        break;
+    }
+    case 0xED: // LHLX
+    {
+        unsigned short de = ref_get_rp(m, 1);
+        m->reg[R_L] = m->memory[de];
+        m->reg[R_H] = m->memory[(unsigned short)(de + 1)];
+        m->pc++;
+        m->tstates += 10;
+        break;
+    }
+    case 0xDD: // JNK
+    case 0xFD: // JK
+    {
+        int taken = ((m->reg[R_F] & K_FLAG) != 0) == (op == 0xFD);
+        m->pc = taken ? addr : m->pc + 3;
+        m->tstates += taken ? 10 : 7;
+        break;
+    }
+    }
+}
+
+// ---- Opcode sweep ----
+
+struct engine
+{
+    const char *name;
+    cpu8085 *cpu;
+};
+
+static struct engine engines[3];
+static int engine_count;
+
+static unsigned char ref_memory[CPU8085_MEMORY_SIZE];
+static unsigned char code[3];
+static int code_length;
+
+static unsigned long long vectors;
+static unsigned long long rejected;
+static int failures;
+static int quick;
+
+static unsigned int rng_state = 1;
+
+static unsigned int rng(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+// A data address outside the code's page
+static unsigned short data_addr(void)
+{
+    unsigned short addr;
+    do
+    {
+        addr = rng();
+    } while (addr >> 8 == CODE_ADDR >> 8);
+    return addr;
+}
+
+// A branch target above the code's page
+static unsigned short target_addr(void)
+{
+    return (CODE_ADDR & 0xFF00) + 0x100 + rng() % (0x10000 - (CODE_ADDR & 0xFF00) - 0x100);
+}
+
+// Registers and flags at random, SP in the upper half (or 0, to wrap)
+static void random_machine(struct machine *m)
+{
+    memset(m, 0, sizeof(*m));
+    for (int r = 0; r < 8; r++)
+    {
+        m->reg[r] = rng();
+    }
+    m->sp = rng() % 64 == 0 ? 0 : 0x8002 + rng() % 0x7FFE;
+    m->pc = CODE_ADDR;
+    m->int_mask = rng() & 0x07;
+    m->sod = rng() & 1;
+    m->sid = rng() & 1;
+    m->int_enable = rng() & 1;
+}
+
+// Point HL at a data address when the opcode reads or writes M
+static void point_hl(struct machine *m)
+{
+    unsigned short addr = data_addr();
+    m->reg[R_H] = addr >> 8;
+    m->reg[R_L] = addr & 0xFF;
+}
+
+static void put_code(const unsigned char *bytes, int length)
+{
+    for (int i = 0; i < code_length; i++)
+    {
+        ref_memory[CODE_ADDR + i] = HLT;
+    }
+    memcpy(ref_memory + CODE_ADDR, bytes, length);
+    memcpy(code, bytes, length);
+    code_length = length;
+    for (int e = 0; e < engine_count; e++)
+    {
+        memcpy(engines[e].cpu->memory, ref_memory, CPU8085_MEMORY_SIZE);
+        cpu8085_flush_blocks(engines[e].cpu);
+    }
+}
+
+static void print_machine(const char *what, const unsigned char *reg, unsigned int pc, unsigned int sp)
+{
+    printf("    %-8s A=%02X B=%02X C=%02X D=%02X E=%02X H=%02X L=%02X F=%02X PC=%04X SP=%04X\n",
+           what, reg[R_A], reg[R_B], reg[R_C], reg[R_D], reg[R_E], reg[R_H], reg[R_L], reg[R_F], pc, sp);
+}
+
+// Compare one engine with the reference result
+static int same(const cpu8085 *cpu, const struct machine *m, unsigned long long tstates, unsigned long long instructions)
+{
+    if (memcmp(cpu->reg, m->reg, sizeof(m->reg)) != 0 || cpu->PC != m->pc || cpu->SP != m->sp ||
+        !cpu->halted || cpu->fault != 0 ||
+        cpu->int_enable != m->int_enable || cpu->int_mask != m->int_mask || cpu->sod != m->sod)
+    {
+        return 0;
+    }
+    if (tstates != m->tstates || instructions != m->instructions)
+    {
+        return 0;
+    }
+
+    // Exactly the bytes the reference wrote, with the same values
+    unsigned long long dirty[CPU8085_DIRTY_WORDS] = { 0 };
+    for (int i = 0; i < m->write_count; i++)
+    {
+        unsigned short addr = m->write_addr[i];
+        if (cpu->memory[addr] != ref_memory[addr])
+        {
+            return 0;
+        }
+        dirty[addr / CPU8085_DIRTY_LINE / 64] |= 1ULL << (addr / CPU8085_DIRTY_LINE % 64);
+    }
+    return memcmp(dirty, cpu->dirty, sizeof(dirty)) == 0;
+}
+
+// Run the instruction from state in, after storing the pokes in memory, on
+// the reference and every engine
+static void check(const struct machine *in, const unsigned short *poke_addr, const unsigned char *poke_value, int pokes)
+{
+    struct machine m = *in;
+    m.memory = ref_memory;
+    for (int i = 0; i < pokes; i++)
+    {
+        ref_memory[poke_addr[i]] = poke_value[i];
+    }
+
+    ref_step(&m);
+    // The instruction is followed by the HLT at wherever it went, unless
+    // it wrote over it
+    int usable = m.halted || ref_memory[m.pc] == HLT;
+    if (usable && !m.halted)
+    {
+        ref_step(&m);
+    }
+
+    for (int e = 0; usable && e < engine_count; e++)
+    {
+        cpu8085 *cpu = engines[e].cpu;
+        for (int i = 0; i < pokes; i++)
+        {
+            cpu->memory[poke_addr[i]] = poke_value[i];
+        }
+        memcpy(cpu->reg, in->reg, sizeof(cpu->reg));
+        cpu->PC = in->pc;
+        cpu->SP = in->sp;
+        cpu->halted = 0;
+        cpu->fault = 0;
+        cpu->waiting = 0;
+        cpu->int_enable = in->int_enable;
+        cpu->int_enable_delay = 0;
+        cpu->int_mask = in->int_mask;
+        cpu->int_lines = 0;
+        cpu->sod = in->sod;
+        cpu->sid = in->sid;
+        cpu->next_event = ~0ULL; // nothing pending, so blocks start at once
+        cpu8085_clear_dirty(cpu);
+
+        unsigned long long tstates = cpu->tstates;
+        unsigned long long instructions = cpu->instructions;
+        // The instruction, the HLT, and the step that finds nothing to wake it
+        cpu8085_run(cpu, 3);
+
+        if (!same(cpu, &m, cpu->tstates - tstates, cpu->instructions - instructions))
+        {
+            if (++failures <= MAX_REPORTS)
+            {
+                char text[32];
+                disassemble_bytes(code, text, sizeof(text));
+                printf("%s: %s differs from the reference\n", engines[e].name, text);
+                print_machine("before", in->reg, in->pc, in->sp);
+                print_machine("expected", m.reg, m.pc, m.sp);
+                print_machine("got", cpu->reg, cpu->PC, cpu->SP);
+                printf("    T-states %u/%llu, instructions %u/%llu, halted %d/%d, fault %d, IE %d/%d, mask %d/%d, SOD %d/%d\n",
+                       m.tstates, cpu->tstates - tstates, m.instructions, cpu->instructions - instructions,
+                       m.halted, cpu->halted, cpu->fault, m.int_enable, cpu->int_enable,
+                       m.int_mask, cpu->int_mask, m.sod, cpu->sod);
+                for (int i = 0; i < m.write_count; i++)
+                {
+                    printf("    [%04X] expected %02X, got %02X\n", m.write_addr[i], ref_memory[m.write_addr[i]],
+                           cpu->memory[m.write_addr[i]]);
+                }
+            }
+        }
+    }
+    vectors += usable;
+    rejected += !usable;
+
+    // Back to the code and HLT everywhere else
+    for (int i = 0; i < pokes + m.write_count; i++)
+    {
+        unsigned short addr = i < pokes ? poke_addr[i] : m.write_addr[i - pokes];
+        unsigned char base = addr >= CODE_ADDR && addr < CODE_ADDR + code_length ? code[addr - CODE_ADDR] : HLT;
+        ref_memory[addr] = base;
+        for (int e = 0; e < engine_count; e++)
+        {
+            engines[e].cpu->memory[addr] = base;
+        }
+    }
+}
+
+// Stack contents for the instructions that pop: a word at SP
+static void check_with_stack(const struct machine *in, unsigned short word)
+{
+    unsigned short addr[2] = { in->sp, (unsigned short)(in->sp + 1) };
+    unsigned char value[2] = { word & 0xFF, word >> 8 };
+    check(in, addr, value, 2);
+}
+
+static void check_with_m(const struct machine *in, unsigned char value)
+{
+    unsigned short addr = in->reg[R_H] << 8 | in->reg[R_L];
+    check(in, &addr, &value, 1);
+}
+
+// F from 5 bits, one per flag: CY P AC Z S
+static unsigned char flags(int k)
+{
+    return (k & 1 ? CARRY_FLAG : 0) | (k & 2 ? PARITY_FLAG : 0) | (k & 4 ? AUX_CARRY_FLAG : 0) |
+           (k & 8 ? ZERO_FLAG : 0) | (k & 16 ? SIGN_FLAG : 0);
+}
+
+// How many of n vectors to run: all of them, or a sample with --quick
+static int sweep(int n)
+{
+    return quick ? (n > 256 ? 256 : n) : n;
+}
+
+// The next value of a swept operand: in order, or at random with --quick
+static unsigned int pick(int i, unsigned int range)
+{
+    return quick ? rng() % range : (unsigned int)i % range;
+}
+
+static void test_opcode(unsigned char op)
+{
+    unsigned char bytes[3] = { op, 0, 0 };
+    int length = ref_length(op);
+    int ddd = (op >> 3) & 7, sss = op & 7, rp = (op >> 4) & 3;
+    struct machine m;
+
+    if ((op & 0xC0) == 0x80 || (op >= 0xC0 && (op & 7) == 6))
+    {
+        // ALU: every A and operand, with CY and AC clear and set, the other
+        // flags at random; A with itself under all 32 flag combinations
+        int immediate = op >= 0xC0;
+        for (int operand = 0; operand < 256; operand += quick ? 37 : 1)
+        {
+            if (immediate)
+            {
+                bytes[1] = operand;
+                put_code(bytes, length);
+            }
+            else if (operand == 0)
+            {
+                put_code(bytes, length);
+            }
+            int n = !immediate && sss == R_A ? 256 * 32 : 256 * 4;
+            for (int i = 0; i < sweep(n); i++)
+            {
+                random_machine(&m);
+                m.reg[R_A] = pick(i, 256);
+                if (!immediate && sss == R_A)
+                {
+                    m.reg[R_F] = (m.reg[R_F] & 0x2A) | flags(pick(i >> 8, 32));
+                }
+                else
+                {
+                    m.reg[R_F] = (m.reg[R_F] & ~(CARRY_FLAG | AUX_CARRY_FLAG)) | flags(pick(i >> 8, 2) | pick(i >> 9, 2) << 2);
+                }
+                if (immediate)
+                {
+                    check(&m, NULL, NULL, 0);
+                }
+                else if (sss == 6)
+                {
+                    point_hl(&m);
+                    check_with_m(&m, operand);
+                }
+                else
+                {
+                    if (sss != R_A)
+                    {
+                        m.reg[sss] = operand;
+                    }
+                    check(&m, NULL, NULL, 0);
+                }
+            }
+            if (!immediate && sss == R_A)
+            {
+                break;
+            }
+        }
+        return;
+    }
+    if ((op & 0xC0) == 0x40 && op != 0x76)
+    {
+        // MOV: every value, under every F
+        put_code(bytes, length);
+        for (int i = 0; i < sweep(256 * 256); i++)
+        {
+            random_machine(&m);
+            m.reg[R_F] = pick(i >> 8, 256);
+            if (ddd == 6 || sss == 6)
+            {
+                point_hl(&m);
+            }
+            if (sss == 6)
+            {
+                check_with_m(&m, pick(i, 256));
+            }
+            else
+            {
+                m.reg[sss] = pick(i, 256);
+                check(&m, NULL, NULL, 0);
+            }
+        }
+        return;
+    }
+
+    switch (op)
+    {
+    case 0x04: case 0x0C: case 0x14: case 0x1C: case 0x24: case 0x2C: case 0x34: case 0x3C: // INR
+    case 0x05: case 0x0D: case 0x15: case 0x1D: case 0x25: case 0x2D: case 0x35: case 0x3D: // DCR
+    case 0x07: case 0x0F: case 0x17: case 0x1F: // rotates
+    case 0x27: case 0x2F: case 0x37: case 0x3F: // DAA, CMA, STC, CMC
+        // Every value under every F
+        put_code(bytes, length);
+        for (int i = 0; i < sweep(256 * 256); i++)
+        {
+            random_machine(&m);
+            m.reg[R_F] = pick(i >> 8, 256);
+            int r = (op & 0x07) >= 4 && (op & 0x07) <= 5 ? ddd : R_A;
+            if (r == 6)
+            {
+                point_hl(&m);
+                check_with_m(&m, pick(i, 256));
+            }
+            else
+            {
+                m.reg[r] = pick(i, 256);
+                check(&m, NULL, NULL, 0);
+            }
+        }
+        return;
+
+    case 0x06: case 0x0E: case 0x16: case 0x1E: case 0x26: case 0x2E: case 0x36: case 0x3E: // MVI
+    case 0x28: case 0x38: // LDHI, LDSI
+        for (int value = 0; value < 256; value++)
+        {
+            bytes[1] = value;
+            put_code(bytes, length);
+            for (int i = 0; i < sweep(64); i++)
+            {
+                random_machine(&m);
+                if (ddd == 6)
+                {
+                    point_hl(&m);
+                }
+                check(&m, NULL, NULL, 0);
+            }
+        }
+        return;
+
+    case 0x01: case 0x11: case 0x21: case 0x31: // LXI
+    case 0x32: case 0x3A: case 0x22: case 0x2A: // STA, LDA, SHLD, LHLD
+        // Sampled addresses, and the ones that wrap
+        for (int j = 0; j < (quick ? 16 : 512); j++)
+        {
+            unsigned short addr = j == 0 ? 0xFFFF : j == 1 ? 0x0000 : op == 0x01 || (op & 0xCF) == 0x01 ? rng() : data_addr();
+            bytes[1] = addr & 0xFF;
+            bytes[2] = addr >> 8;
+            put_code(bytes, length);
+            for (int i = 0; i < sweep(64); i++)
+            {
+                random_machine(&m);
+                unsigned short poke_addr[2] = { addr, (unsigned short)(addr + 1) };
+                unsigned char poke_value[2] = { rng(), rng() };
+                check(&m, poke_addr, poke_value, op == 0x3A || op == 0x2A ? 2 : 0);
+            }
+        }
+        return;
+
+    case 0x02: case 0x12: case 0x0A: case 0x1A: // STAX, LDAX
+    case 0x03: case 0x13: case 0x23: case 0x33: // INX
+    case 0x0B: case 0x1B: case 0x2B: case 0x3B: // DCX
+    case 0x09: case 0x19: case 0x29: case 0x39: // DAD
+    case 0xEB: case 0xE3: case 0xF9: case 0xE9: // XCHG, XTHL, SPHL, PCHL
+    case 0xC5: case 0xD5: case 0xE5: case 0xF5: // PUSH
+    case 0xC1: case 0xD1: case 0xE1: case 0xF1: // POP
+    case 0x08: case 0x10: case 0x18: // DSUB, ARHL, RDEL
+    case 0xD9: case 0xED: // SHLX, LHLX
+        // Register pairs: every value of the pair (or of the word popped),
+        // the others at random, CY clear and set
+        put_code(bytes, length);
+        for (int i = 0; i < sweep(2 * 65536); i++)
+        {
+            random_machine(&m);
+            unsigned short value = pick(i, 65536);
+            m.reg[R_F] = (m.reg[R_F] & ~CARRY_FLAG) | pick(i >> 16, 2);
+            switch (op)
+            {
+            case 0x02: case 0x12:
+                value = value >> 8 == CODE_ADDR >> 8 ? data_addr() : value;
+                ref_set_rp(&m, rp, value);
+                check(&m, NULL, NULL, 0);
+                break;
+            case 0x0A: case 0x1A:
+            {
+                unsigned char data = rng();
+                value = value >> 8 == CODE_ADDR >> 8 ? data_addr() : value;
+                ref_set_rp(&m, rp, value);
+                check(&m, &value, &data, 1);
+                break;
+            }
+            case 0xD9: case 0xED:
+            {
+                // Neither byte of the word in the code's page
+                while (value >> 8 == CODE_ADDR >> 8 || (unsigned short)(value + 1) >> 8 == CODE_ADDR >> 8)
+                {
+                    value = rng();
+                }
+                unsigned short addr[2] = { value, (unsigned short)(value + 1) };
+                unsigned char data[2] = { rng(), rng() };
+                ref_set_rp(&m, 1, value);
+                check(&m, addr, data, op == 0xED ? 2 : 0);
+                break;
+            }
+            case 0x08: case 0x10:
+                ref_set_rp(&m, 2, value);
+                check(&m, NULL, NULL, 0);
+                break;
+            case 0xE9:
+                ref_set_rp(&m, 2, (value >> 8) == CODE_ADDR >> 8 ? target_addr() : value);
+                check(&m, NULL, NULL, 0);
+                break;
+            case 0xE3:
+                check_with_stack(&m, value);
+                break;
+            case 0xC1: case 0xD1: case 0xE1: case 0xF1:
+                check_with_stack(&m, value);
+                break;
+            case 0xF5:
+                m.reg[R_A] = value >> 8;
+                m.reg[R_F] = value & 0xFF;
+                check(&m, NULL, NULL, 0);
+                break;
+            default:
+                ref_set_rp(&m, op == 0xEB || op == 0xF9 ? 2 : rp, value);
+                check(&m, NULL, NULL, 0);
+                break;
+            }
+        }
+        return;
+
+    case 0xC3: case 0xCD: // JMP, CALL
+    case 0xC2: case 0xCA: case 0xD2: case 0xDA: case 0xE2: case 0xEA: case 0xF2: case 0xFA: // Jcc
+    case 0xC4: case 0xCC: case 0xD4: case 0xDC: case 0xE4: case 0xEC: case 0xF4: case 0xFC: // Ccc
+    case 0xDD: case 0xFD: // JNK, JK
+        // Sampled targets, under every F
+        for (int j = 0; j < (quick ? 4 : 64); j++)
+        {
+            unsigned short target = target_addr();
+            bytes[1] = target & 0xFF;
+            bytes[2] = target >> 8;
+            put_code(bytes, length);
+            for (int i = 0; i < sweep(256); i++)
+            {
+                random_machine(&m);
+                m.reg[R_F] = pick(i, 256);
+                check(&m, NULL, NULL, 0);
+            }
+        }
+        return;
+
+    case 0xC9: // RET
+    case 0xC0: case 0xC8: case 0xD0: case 0xD8: case 0xE0: case 0xE8: case 0xF0: case 0xF8: // Rcc
+    case 0xC7: case 0xCF: case 0xD7: case 0xDF: case 0xE7: case 0xEF: case 0xF7: case 0xFF: // RST
+    case 0xCB: // RSTV
+        // Sampled return addresses and stacks, under every F
+        put_code(bytes, length);
+        for (int i = 0; i < sweep(256 * 64); i++)
+        {
+            random_machine(&m);
+            m.reg[R_F] = pick(i, 256);
+            check_with_stack(&m, target_addr());
+        }
+        return;
+
+    case 0xD3: case 0xDB: // OUT, IN: every port
+        for (int port = 0; port < 256; port++)
+        {
+            bytes[1] = port;
+            put_code(bytes, length);
+            for (int i = 0; i < sweep(16); i++)
+            {
+                random_machine(&m);
+                check(&m, NULL, NULL, 0);
+            }
+        }
+        return;
+
+    default: // NOP, HLT, EI, DI, RIM, SIM
+        // Every A and interrupt state
+        put_code(bytes, length);
+        for (int i = 0; i < sweep(256 * 32); i++)
+        {
+            random_machine(&m);
+            m.reg[R_A] = pick(i, 256);
+            int k = pick(i >> 8, 32);
+            m.int_mask = k & 0x07;
+            m.int_enable = k >> 3 & 1;
+            m.sod = m.sid = k >> 4 & 1;
+            check(&m, NULL, NULL, 0);
+        }
+        return;
+    }
+}
+
+static int run_opcode_sweep(void)
+{
+    engines[0] = (struct engine){ "interpreter", cpu8085_create() };
+    engines[1] = (struct engine){ "blocks", cpu8085_create() };
+    engines[2] = (struct engine){ "jit", cpu8085_create() };
+    engine_count = 3;
+    for (int e = 0; e < engine_count; e++)
+    {
+        if (engines[e].cpu == NULL)
+        {
+            fprintf(stderr, "conformance: out of memory\n");
+            return -1;
+        }
+    }
+    if (cpu8085_enable_blocks(engines[1].cpu) < 0)
+    {
+        fprintf(stderr, "conformance: out of memory\n");
+        return -1;
+    }
+    if (cpu8085_enable_jit(engines[2].cpu) < 0)
+    {
+        printf("(no JIT on this host)\n");
+        cpu8085_destroy(engines[2].cpu);
+        engine_count = 2;
+    }
+
+    memset(ref_memory, HLT, sizeof(ref_memory));
+    code_length = 0;
+    for (int op = 0; op < 256; op++)
+    {
+        test_opcode(op);
+    }
+    printf("opcodes: 256, vectors: %llu (%llu rejected), engines: %d, mismatches: %d\n",
+           vectors, rejected, engine_count, failures);
+
+    for (int e = 0; e < engine_count; e++)
+    {
+        cpu8085_destroy(engines[e].cpu);
+    }
+    return 0;
+}
+
+// ---- Random programs ----
+//
+// Straight-line code is where the block cache and the JIT differ most from
+// the interpreter, so each program is a few hundred random instructions,
+// with jumps and calls landing inside it, run for thousands of steps. The
+// interpreter is the reference here.
+
+#define PROGRAM_IMAGE 0x400
+
+static int report(const char *what, int program, const cpu8085 *want, const cpu8085 *got)
+{
+    if (memcmp(want->reg, got->reg, sizeof(want->reg)) == 0 && want->PC == got->PC && want->SP == got->SP &&
+        want->tstates == got->tstates && want->instructions == got->instructions &&
+        want->halted == got->halted && want->fault == got->fault &&
+        memcmp(want->memory, got->memory, CPU8085_MEMORY_SIZE) == 0 &&
+        memcmp(want->dirty, got->dirty, sizeof(want->dirty)) == 0)
+    {
+        return 0;
+    }
+    if (failures++ < MAX_REPORTS)
+    {
+        printf("%s: program %d differs from the interpreter\n", what, program);
+        print_machine("expected", want->reg, want->PC, want->SP);
+        print_machine("got", got->reg, got->PC, got->SP);
+        printf("    T-states %llu/%llu, instructions %llu/%llu, halted %d/%d, fault %d/%d, memory %s\n",
+               want->tstates, got->tstates, want->instructions, got->instructions, want->halted, got->halted,
+               want->fault, got->fault,
+               memcmp(want->memory, got->memory, CPU8085_MEMORY_SIZE) == 0 ? "same" : "differs");
+    }
+    return 1;
+}
+
+// Opcodes other than HLT, I/O and the interrupt controls (no
+// devices are attached) and SPHL (SP stays clear of the code)
+static void make_program(unsigned char *image)
+{
+    int length = 0x100 + rng() % 0x100;
+    int addr = 0;
+    while (addr < length)
+    {
+        unsigned char op;
+        do
+        {
+            op = rng();
+        } while (op == HLT || op == 0xDB || op == 0xD3 || op == 0xFB ||
+                 op == 0xF3 || op == 0x20 || op == 0x30 || op == 0xF9);
+        image[addr] = op;
+        if (ref_length(op) == 2)
+        {
+            image[addr + 1] = rng();
+        }
+        else if (ref_length(op) == 3)
+        {
+            // Addresses land in the program or the data after it
+            unsigned short target = rng() % (length + 64);
+            image[addr + 1] = target & 0xFF;
+            image[addr + 2] = target >> 8;
+        }
+        addr += ref_length(op);
+    }
+    image[addr] = HLT;
+    for (addr++; addr < PROGRAM_IMAGE; addr++)
+    {
+        image[addr] = rng();
+    }
+}
+
+static cpu8085 *program_cpu(const unsigned char *image, const unsigned char *reg)
+{
+    cpu8085 *cpu = cpu8085_create();
+    if (cpu != NULL)
+    {
+        memcpy(cpu->memory, image, PROGRAM_IMAGE);
+        memcpy(cpu->reg, reg, sizeof(cpu->reg));
+        cpu->SP = 0x8000;
+    }
+    return cpu;
+}
+
+static int run_program(int program, lanes8085 *lanes)
+{
+    unsigned char image[PROGRAM_IMAGE];
+    unsigned char reg[8];
+    make_program(image);
+    for (int r = 0; r < 8; r++)
+    {
+        reg[r] = rng();
+    }
+    unsigned long long limit = 10000 + rng() % 10000;
+
+    cpu8085 *want = program_cpu(image, reg);
+    cpu8085 *blocks = program_cpu(image, reg);
+    cpu8085 *jit = program_cpu(image, reg);
+    cpu8085 *child = NULL;
+    cpu8085 *got = NULL;
+    int result = -1;
+    if (want == NULL || blocks == NULL || jit == NULL || cpu8085_enable_blocks(blocks) < 0)
+    {
+        goto out;
+    }
+    lanes8085_load(lanes, want);
+    cpu8085_run(want, limit);
+
+    // A fork halfway through, of a CPU running blocks, finishes the run on
+    // its own cache
+    cpu8085_run(blocks, limit / 2);
+    child = cpu8085_fork(blocks);
+    if (child == NULL)
+    {
+        goto out;
+    }
+    cpu8085_run(blocks, limit - limit / 2);
+    cpu8085_run(child, limit - limit / 2);
+    report("blocks", program, want, blocks);
+    report("fork", program, want, child);
+
+    if (cpu8085_enable_jit(jit) == 0)
+    {
+        cpu8085_run(jit, limit);
+        report("jit", program, want, jit);
+    }
+
+    // Every lane runs the program with its own A and B, against the
+    // interpreter given the same
+    unsigned char lane_a[LANES8085_WIDTH];
+    unsigned char lane_b[LANES8085_WIDTH];
+    for (int lane = 0; lane < lanes->count; lane++)
+    {
+        lanes->reg[R_A][lane] = lane_a[lane] = rng();
+        lanes->reg[R_B][lane] = lane_b[lane] = rng();
+    }
+    lanes8085_run(lanes, limit);
+    for (int lane = 0; lane < lanes->count; lane++)
+    {
+        cpu8085_destroy(want);
+        cpu8085_destroy(got);
+        want = program_cpu(image, reg);
+        got = cpu8085_create();
+        if (want == NULL || got == NULL)
+        {
+            goto out;
+        }
+        want->A = lane_a[lane];
+        want->B = lane_b[lane];
+        cpu8085_run(want, limit);
+        lanes8085_store(lanes, lane, got);
+        report("lanes", program, want, got);
+    }
+    result = 0;
+
+out:
+    cpu8085_destroy(got);
+    cpu8085_destroy(child);
+    cpu8085_destroy(jit);
+    cpu8085_destroy(blocks);
+    cpu8085_destroy(want);
+    return result;
+}
+
+static int run_programs(void)
+{
+    int programs = quick ? 50 : 500;
+    lanes8085 *lanes = lanes8085_create(8);
+    if (lanes == NULL)
+    {
+        fprintf(stderr, "conformance: out of memory\n");
+        return -1;
+    }
+    int before = failures;
+    for (int program = 0; program < programs; program++)
+    {
+        if (run_program(program, lanes) < 0)
+        {
+            fprintf(stderr, "conformance: out of memory\n");
+            lanes8085_destroy(lanes);
+            return -1;
+        }
+    }
+    printf("programs: %d, engines: blocks, jit, fork, lanes, mismatches: %d\n", programs, failures - before);
+    lanes8085_destroy(lanes);
+    return 0;
+}
+
+// ---- Breakpoints ----
+//
+// A conditional breakpoint must stop a program as often with the block
+// cache as without it. Conditions on F catch flags the blocks have not
+// built yet.
+
+// Run to the end, resuming at every breakpoint; returns the number of stops
+static unsigned long long run_to_end(cpu8085 *cpu, unsigned long long limit)
+{
+    unsigned long long stops = 0;
+    while (cpu->instructions < limit)
+    {
+        cpu8085_run(cpu, limit - cpu->instructions);
+        if (cpu->fault != CPU8085_STOP_BREAKPOINT)
+        {
+            break;
+        }
+        stops++;
+        debug8085_resume(cpu);
+    }
+    return stops;
+}
+
+static int run_breakpoint(int program)
+{
+    unsigned char image[PROGRAM_IMAGE];
+    unsigned char reg[8];
+    make_program(image);
+    for (int r = 0; r < 8; r++)
+    {
+        reg[r] = rng();
+    }
+    unsigned long long limit = 10000 + rng() % 10000;
+
+    // Where the program gets to partway through, F compared with what it
+    // was there
+    cpu8085 *probe = program_cpu(image, reg);
+    if (probe == NULL)
+    {
+        return -1;
+    }
+    cpu8085_run(probe, 1 + rng() % limit);
+    unsigned short addr = probe->PC;
+    struct debug8085_condition condition = { R_F, rng() % 6, probe->F };
+    cpu8085_destroy(probe);
+
+    cpu8085 *want = program_cpu(image, reg);
+    cpu8085 *blocks = program_cpu(image, reg);
+    int result = -1;
+    if (want == NULL || blocks == NULL || cpu8085_enable_blocks(blocks) < 0 ||
+        debug8085_attach(want) == NULL || debug8085_attach(blocks) == NULL)
+    {
+        goto out;
+    }
+    debug8085_add_breakpoint(want, addr, &condition);
+    debug8085_add_breakpoint(blocks, addr, &condition);
+    unsigned long long want_stops = run_to_end(want, limit);
+    unsigned long long blocks_stops = run_to_end(blocks, limit);
+    if (want_stops != blocks_stops && failures++ < MAX_REPORTS)
+    {
+        char text[32];
+        debug8085_format_condition(&condition, text, sizeof(text));
+        printf("blocks: program %d stops %llu times at %04X if %s, the interpreter %llu\n",
+               program, blocks_stops, addr, text, want_stops);
+    }
+    else
+    {
+        report("blocks", program, want, blocks);
+    }
+    result = 0;
+
+out:
+    if (want != NULL)
+    {
+        debug8085_detach(want);
+    }
+    if (blocks != NULL)
+    {
+        debug8085_detach(blocks);
+    }
+    cpu8085_destroy(blocks);
+    cpu8085_destroy(want);
+    return result;
+}
+
+static int run_breakpoints(void)
+{
+    int programs = quick ? 50 : 500;
+    int before = failures;
+    for (int program = 0; program < programs; program++)
+    {
+        if (run_breakpoint(program) < 0)
+        {
+            fprintf(stderr, "conformance: out of memory\n");
+            return -1;
+        }
+    }
+    printf("breakpoints: %d, engines: blocks, mismatches: %d\n", programs, failures - before);
+    return 0;
+}
+
+// ---- Intel HEX line numbers ----
+//
+// A file whose third line has a bad checksum, with each kind of line
+// break, and with a blank line before the bad record
+
+static const char *const hex_files[] = {
+    ":0100000000FF\n:0100010000FE\n:0100020000FF\n:00000001FF\n",
+    ":0100000000FF\r\n:0100010000FE\r\n:0100020000FF\r\n:00000001FF\r\n",
+    ":0100000000FF\n\n:0100020000FF\n:00000001FF\n",
+};
+
+static int run_hex_file(int file, unsigned char *memory)
+{
+    char path[] = "/tmp/conformanceXXXXXX";
+    int fd = mkstemp(path);
+    FILE *errors = tmpfile();
+    if (fd < 0 || errors == NULL)
+    {
+        return -1;
+    }
+    size_t length = strlen(hex_files[file]);
+    int written = write(fd, hex_files[file], length) == (ssize_t)length;
+    close(fd);
+
+    // The loader reports on stderr
+    int entry = -1;
+    long loaded = -1;
+    int saved = dup(fileno(stderr));
+    if (written && saved >= 0)
+    {
+        fflush(stderr);
+        dup2(fileno(errors), fileno(stderr));
+        loaded = load_intel_hex(path, memory, &entry);
+        fflush(stderr);
+        dup2(saved, fileno(stderr));
+    }
+    if (saved >= 0)
+    {
+        close(saved);
+    }
+    unlink(path);
+
+    char message[256] = "";
+    rewind(errors);
+    size_t n = fread(message, 1, sizeof(message) - 1, errors);
+    message[n] = '\0';
+    fclose(errors);
+    if (!written || saved < 0)
+    {
+        return -1;
+    }
+
+    char want[64];
+    snprintf(want, sizeof(want), "%s:3: checksum mismatch", path);
+    if (loaded != -1 || strstr(message, want) == NULL)
+    {
+        if (failures++ < MAX_REPORTS)
+        {
+            printf("loader: hex file %d: expected \"%s\", got \"%.*s\"\n", file, want,
+                   (int)strcspn(message, "\n"), message);
+        }
+    }
+    return 0;
+}
+
+static int run_hex_files(void)
+{
+    static unsigned char memory[CPU8085_MEMORY_SIZE];
+    int files = sizeof(hex_files) / sizeof(hex_files[0]);
+    int before = failures;
+    for (int file = 0; file < files; file++)
+    {
+        if (run_hex_file(file, memory) < 0)
+        {
+            fprintf(stderr, "conformance: cannot write a temporary file\n");
+            return -1;
+        }
+    }
+    printf("hex files: %d, mismatches: %d\n", files, failures - before);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    static const struct option options[] = {
+        {"quick", no_argument, NULL, 'q'},
+        {"seed", required_argument, NULL, 's'},
+        {NULL, 0, NULL, 0}
+    };
+    int opt;
+
+    while ((opt = getopt_long(argc, argv, "", options, NULL)) != -1)
+    {
+        switch (opt)
+        {
+        case 'q':
+            quick = 1;
+            break;
+        case 's':
+            rng_state = strtoul(optarg, NULL, 0) | 1;
+            break;
+        default:
+            fprintf(stderr, "usage: conformance [--quick] [--seed N]\n");
+            return 2;
+        }
+    }
+
+    if (run_opcode_sweep() < 0 || run_programs() < 0 || run_breakpoints() < 0 || run_hex_files() < 0)
+    {
+        return 2;
+    }
+    return failures ? 1 : 0;
+}
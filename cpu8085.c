@@ -0,0 +1,2317 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "cpu8085.h"
+#include "profile.h"
+#include "debug8085.h"
+#include "jit8085.h"
+#include "history8085.h"
+
+// Flag lookup tables, generated and verified at build time by gen_flags.c:
+// szp_flags[result], add_flags/sub_flags[FLAG_INDEX(carry, a, b)]
+#include "flags_table.h"
+
+// Per-instruction tracing. Building with -DTRACE=0 compiles every trace
+// statement out of emulate_instruction() instead of testing a flag per opcode.
+#ifndef TRACE
+#define TRACE 1
+#endif
+
+#if TRACE
+#define TRACE_PRINTF(cpu, ...) do { if ((cpu)->trace) printf(__VA_ARGS__); } while (0)
+#define TRACE_ENABLED(cpu) ((cpu)->trace)
+#else
+#define TRACE_PRINTF(cpu, ...) do { } while (0)
+#define TRACE_ENABLED(cpu) 0
+#endif
+
+// T-states charged by each opcode (not-taken count for conditional branches)
+const unsigned char cpu8085_opcode_tstates[256] = {
+    /*        0   1   2   3   4   5   6   7   8   9   A   B   C   D   E   F */
+    /* 0 */   4, 10,  7,  6,  4,  4,  7,  4, 10, 10,  7,  6,  4,  4,  7,  4,
+    /* 1 */   7, 10,  7,  6,  4,  4,  7,  4, 10, 10,  7,  6,  4,  4,  7,  4,
+    /* 2 */   4, 10, 16,  6,  4,  4,  7,  4, 10, 10, 16,  6,  4,  4,  7,  4,
+    /* 3 */   4, 10, 13,  6, 10, 10, 10,  4, 10, 10, 13,  6,  4,  4,  7,  4,
+    /* 4 */   4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4,
+    /* 5 */   4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4,
+    /* 6 */   4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4,
+    /* 7 */   7,  7,  7,  7,  7,  7,  5,  7,  4,  4,  4,  4,  4,  4,  7,  4,
+    /* 8 */   4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4,
+    /* 9 */   4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4,
+    /* A */   4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4,
+    /* B */   4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4,
+    /* C */   6, 10,  7, 10,  9, 12,  7, 12,  6, 10,  7,  6,  9, 18,  7, 12,
+    /* D */   6, 10,  7, 10,  9, 12,  7, 12,  6, 10,  7, 10,  9,  7,  7, 12,
+    /* E */   6, 10,  7, 16,  9, 12,  7, 12,  6,  6,  7,  4,  9, 10,  7, 12,
+    /* F */   6, 10,  7,  4,  9, 12,  7, 12,  6,  6,  7,  4,  9,  7,  7, 12,
+};
+
+// Length in bytes of each instruction
+const unsigned char cpu8085_opcode_length[256] = {
+    /*        0  1  2  3  4  5  6  7  8  9  A  B  C  D  E  F */
+    /* 0 */   1, 3, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1,
+    /* 1 */   1, 3, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1,
+    /* 2 */   1, 3, 3, 1, 1, 1, 2, 1, 2, 1, 3, 1, 1, 1, 2, 1,
+    /* 3 */   1, 3, 3, 1, 1, 1, 2, 1, 2, 1, 3, 1, 1, 1, 2, 1,
+    /* 4 */   1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    /* 5 */   1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    /* 6 */   1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    /* 7 */   1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    /* 8 */   1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    /* 9 */   1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    /* A */   1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    /* B */   1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    /* C */   1, 1, 3, 3, 3, 1, 2, 1, 1, 1, 3, 1, 3, 3, 2, 1,
+    /* D */   1, 1, 3, 2, 3, 1, 2, 1, 1, 1, 3, 2, 3, 3, 2, 1,
+    /* E */   1, 1, 3, 1, 3, 1, 2, 1, 1, 1, 3, 1, 3, 1, 2, 1,
+    /* F */   1, 1, 3, 1, 3, 1, 2, 1, 1, 1, 3, 1, 3, 3, 2, 1,
+};
+
+// Map memory for a CPU: zero-filled, or copy-on-write from an image. With
+// at != NULL the mapping replaces the one already there.
+static unsigned char *map_memory(unsigned char *at, int image_fd)
+{
+    int flags = MAP_PRIVATE | (at != NULL ? MAP_FIXED : 0) | (image_fd < 0 ? MAP_ANONYMOUS : 0);
+    void *memory = mmap(at, CPU8085_MEMORY_SIZE, PROT_READ | PROT_WRITE, flags, image_fd, 0);
+    return memory == MAP_FAILED ? NULL : memory;
+}
+
+cpu8085 *cpu8085_create(void)
+{
+    cpu8085 *cpu = malloc(sizeof(cpu8085));
+    if (cpu == NULL)
+    {
+        return NULL;
+    }
+    cpu->memory = map_memory(NULL, -1);
+    if (cpu->memory == NULL)
+    {
+        free(cpu);
+        return NULL;
+    }
+    cpu->image_fd = -1;
+    cpu->bus = NULL;
+    cpu->blocks = NULL;
+    cpu->blocks_deferred = 0;
+    cpu8085_init(cpu);
+    return cpu;
+}
+
+static void free_blocks(cpu8085 *cpu);
+
+void cpu8085_destroy(cpu8085 *cpu)
+{
+    if (cpu == NULL)
+    {
+        return;
+    }
+    if (cpu->image_fd >= 0)
+    {
+        close(cpu->image_fd);
+    }
+    munmap(cpu->memory, CPU8085_MEMORY_SIZE);
+    free_blocks(cpu);
+    free(cpu);
+}
+
+// Copy the memory into a new memfd that children map privately. This is
+// the one full copy per fork point; the memfd lives on as long as any
+// mapping of it does.
+static int freeze_image(cpu8085 *cpu)
+{
+    int fd = memfd_create("cpu8085-image", MFD_CLOEXEC);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    if (pwrite(fd, cpu->memory, CPU8085_MEMORY_SIZE, 0) != CPU8085_MEMORY_SIZE)
+    {
+        close(fd);
+        return -1;
+    }
+    if (cpu->image_fd >= 0)
+    {
+        close(cpu->image_fd);
+    }
+    cpu->image_fd = fd;
+    cpu->image_instructions = cpu->instructions;
+    return 0;
+}
+
+cpu8085 *cpu8085_fork(cpu8085 *parent)
+{
+    if ((parent->image_fd < 0 || parent->image_instructions != parent->instructions) &&
+        freeze_image(parent) < 0)
+    {
+        return NULL;
+    }
+
+    cpu8085 *child = malloc(sizeof(cpu8085));
+    if (child == NULL)
+    {
+        return NULL;
+    }
+    *child = *parent;
+    child->memory = map_memory(NULL, parent->image_fd);
+    if (child->memory == NULL)
+    {
+        free(child);
+        return NULL;
+    }
+    child->image_fd = -1;
+    cpu8085_attach_bus(child, NULL);
+    child->event_count = 0;
+    child->running_event = NULL;
+    child->next_event = 0; // look at interrupts before the next instruction
+    child->bintrace = NULL;
+    child->trace_record = NULL;
+    child->profile = NULL;
+    child->debug = NULL;
+    child->history = NULL;
+    for (int page = 0; page < 256; page++)
+    {
+        child->mmio[page] &= ~CPU8085_PAGE_HISTORY;
+    }
+    child->blocks = NULL;
+    child->blocks_deferred = parent->blocks != NULL || parent->blocks_deferred;
+    return child;
+}
+
+void cpu8085_reset(cpu8085 *cpu)
+{
+    memset(cpu->reg, 0, sizeof(cpu->reg));
+    cpu->PC = 0x0000; // Program counter starts at 0
+    cpu->SP = 0xFFFF; // Stack pointer starts at top of memory
+    cpu->halted = false;
+    cpu->fault = 0;
+    cpu->tstates = 0;
+    cpu->instructions = 0;
+
+    cpu->int_enable = 0;
+    cpu->int_enable_delay = 0;
+    cpu->int_mask = 0x07;
+    cpu->int_lines = 0;
+    cpu->intr_opcode = 0xFF; // RST 7 from a floating bus
+    cpu->sod = 0;
+    cpu->sid = 0;
+    cpu->waiting = 0;
+    cpu->event_count = 0;
+    cpu->next_event = ~0ULL;
+    cpu->lazy_op = 0;
+}
+
+void cpu8085_init(cpu8085 *cpu)
+{
+    unsigned char *memory = cpu->memory;
+    struct bus8085 *bus = cpu->bus;
+    struct block_cache *blocks = cpu->blocks;
+    unsigned char blocks_deferred = cpu->blocks_deferred;
+
+    if (cpu->image_fd >= 0)
+    {
+        close(cpu->image_fd);
+    }
+    memset(cpu, 0, sizeof(*cpu));
+    cpu->memory = memory;
+    cpu->image_fd = -1;
+    cpu->blocks = blocks;
+    cpu->blocks_deferred = blocks_deferred;
+    cpu8085_flush_blocks(cpu);
+    cpu8085_attach_bus(cpu, bus);
+
+    // Fresh zero pages also drop any pages shared with a fork image
+    if (map_memory(memory, -1) == NULL)
+    {
+        memset(memory, 0, CPU8085_MEMORY_SIZE);
+    }
+    cpu8085_reset(cpu);
+}
+
+void cpu8085_clear_dirty(cpu8085 *cpu)
+{
+    memset(cpu->dirty, 0, sizeof(cpu->dirty));
+}
+
+int cpu8085_next_dirty(const cpu8085 *cpu, int addr)
+{
+    int line = addr / CPU8085_DIRTY_LINE;
+
+    if (addr < 0 || line >= CPU8085_DIRTY_WORDS * 64)
+    {
+        return -1;
+    }
+    // Mask off the lines before addr in the first word, then skip empty words
+    int word = line / 64;
+    unsigned long long bits = cpu->dirty[word] & (~0ULL << (line % 64));
+    while (bits == 0)
+    {
+        if (++word == CPU8085_DIRTY_WORDS)
+        {
+            return -1;
+        }
+        bits = cpu->dirty[word];
+    }
+    return (word * 64 + __builtin_ctzll(bits)) * CPU8085_DIRTY_LINE;
+}
+
+unsigned long long cpu8085_dirty_hash(const cpu8085 *cpu)
+{
+    unsigned long long h = 0xCBF29CE484222325ULL;
+
+    for (int addr = cpu8085_next_dirty(cpu, 0); addr >= 0; addr = cpu8085_next_dirty(cpu, addr + CPU8085_DIRTY_LINE))
+    {
+        h = (h ^ addr) * 0x9E3779B97F4A7C15ULL;
+        for (int i = 0; i < CPU8085_DIRTY_LINE; i += 8)
+        {
+            unsigned long long word;
+            memcpy(&word, cpu->memory + addr + i, sizeof(word));
+            h = (h ^ word) * 0x9E3779B97F4A7C15ULL;
+            h ^= h >> 29;
+        }
+    }
+    return h;
+}
+
+int cpu8085_dirty_compare(const cpu8085 *a, const cpu8085 *b)
+{
+    for (int word = 0; word < CPU8085_DIRTY_WORDS; word++)
+    {
+        unsigned long long bits = a->dirty[word] | b->dirty[word];
+        while (bits != 0)
+        {
+            int addr = (word * 64 + __builtin_ctzll(bits)) * CPU8085_DIRTY_LINE;
+            bits &= bits - 1;
+            for (int i = addr; i < addr + CPU8085_DIRTY_LINE; i++)
+            {
+                if (a->memory[i] != b->memory[i])
+                {
+                    return i;
+                }
+            }
+        }
+    }
+    return -1;
+}
+
+unsigned long long cpu8085_memory_hash(const cpu8085 *cpu)
+{
+    return cpu8085_image_hash(cpu->memory);
+}
+
+unsigned long long cpu8085_image_hash(const unsigned char *image)
+{
+    unsigned long long h = 0xCBF29CE484222325ULL;
+
+    // Eight bytes at a time, with a multiply/xor-shift mix per word
+    for (int i = 0; i < CPU8085_MEMORY_SIZE; i += 8)
+    {
+        unsigned long long word;
+        memcpy(&word, image + i, sizeof(word));
+        h = (h ^ word) * 0x9E3779B97F4A7C15ULL;
+        h ^= h >> 29;
+    }
+    return h;
+}
+
+// Most memory lines print_state() shows
+#define PRINT_STATE_LINES 16
+
+// Function to print the state of the registers and memory with spacing and instruction count
+void print_state(const cpu8085 *cpu)
+{
+    printf("\nInstruction %03llu (%llu T-states):\n", cpu->instructions, cpu->tstates);
+    printf("____________________\n");
+    printf("| Register | Value |\n");
+    printf("|----------|-------|\n");
+    printf("| A        | %02X    |\n", cpu->A);
+    printf("| B        | %02X    |\n", cpu->B);
+    printf("| C        | %02X    |\n", cpu->C);
+    printf("| D        | %02X    |\n", cpu->D);
+    printf("| E        | %02X    |\n", cpu->E);
+    printf("| H        | %02X    |\n", cpu->H);
+    printf("| L        | %02X    |\n", cpu->L);
+    printf("| F        | %02X    |\n", cpu->F);
+    printf("| PC       | %04X  |\n", cpu->PC);
+    printf("| SP       | %04X  |\n", cpu->SP);
+    printf("--------------------\n");
+
+    // Only the lines the program has written, up to PRINT_STATE_LINES of them
+    printf("____________________________________________________________\n");
+    printf("| Memory | 00 01 02 03 04 05 06 07 08 09 0A 0B 0C 0D 0E 0F |\n");
+    printf("|--------|-------------------------------------------------|\n");
+    int lines = 0;
+    for (int addr = cpu8085_next_dirty(cpu, 0); addr >= 0; addr = cpu8085_next_dirty(cpu, addr + CPU8085_DIRTY_LINE))
+    {
+        if (++lines > PRINT_STATE_LINES)
+        {
+            continue;
+        }
+        printf("| %04X   |", addr);
+        for (int i = 0; i < CPU8085_DIRTY_LINE; i++)
+        {
+            printf(" %02X", cpu->memory[addr + i]);
+        }
+        printf(" |\n");
+    }
+    if (lines == 0)
+    {
+        printf("| (nothing written yet)                                    |\n");
+    }
+    else if (lines > PRINT_STATE_LINES)
+    {
+        printf("| ... %5d more lines written                             |\n", lines - PRINT_STATE_LINES);
+    }
+    printf("------------------------------------------------------------\n");
+}
+
+// Mnemonics for the trace output, indexed by opcode. "%02X" marks a data byte
+// operand and "%04X" a little-endian address/data16 operand.
+static const char *const mnemonics[256] = {
+    /* 0 */ "NOP", "LXI B, %04X", "STAX B", "INX B", "INR B", "DCR B", "MVI B, %02X", "RLC",
+            "DSUB", "DAD B", "LDAX B", "DCX B", "INR C", "DCR C", "MVI C, %02X", "RRC",
+    /* 1 */ "ARHL", "LXI D, %04X", "STAX D", "INX D", "INR D", "DCR D", "MVI D, %02X", "RAL",
+            "RDEL", "DAD D", "LDAX D", "DCX D", "INR E", "DCR E", "MVI E, %02X", "RAR",
+    /* 2 */ "RIM", "LXI H, %04X", "SHLD %04X", "INX H", "INR H", "DCR H", "MVI H, %02X", "DAA",
+            "LDHI %02X", "DAD H", "LHLD %04X", "DCX H", "INR L", "DCR L", "MVI L, %02X", "CMA",
+    /* 3 */ "SIM", "LXI SP, %04X", "STA %04X", "INX SP", "INR M", "DCR M", "MVI M, %02X", "STC",
+            "LDSI %02X", "DAD SP", "LDA %04X", "DCX SP", "INR A", "DCR A", "MVI A, %02X", "CMC",
+    /* 4 */ "MOV B, B", "MOV B, C", "MOV B, D", "MOV B, E", "MOV B, H", "MOV B, L", "MOV B, M", "MOV B, A",
+            "MOV C, B", "MOV C, C", "MOV C, D", "MOV C, E", "MOV C, H", "MOV C, L", "MOV C, M", "MOV C, A",
+    /* 5 */ "MOV D, B", "MOV D, C", "MOV D, D", "MOV D, E", "MOV D, H", "MOV D, L", "MOV D, M", "MOV D, A",
+            "MOV E, B", "MOV E, C", "MOV E, D", "MOV E, E", "MOV E, H", "MOV E, L", "MOV E, M", "MOV E, A",
+    /* 6 */ "MOV H, B", "MOV H, C", "MOV H, D", "MOV H, E", "MOV H, H", "MOV H, L", "MOV H, M", "MOV H, A",
+            "MOV L, B", "MOV L, C", "MOV L, D", "MOV L, E", "MOV L, H", "MOV L, L", "MOV L, M", "MOV L, A",
+    /* 7 */ "MOV M, B", "MOV M, C", "MOV M, D", "MOV M, E", "MOV M, H", "MOV M, L", "HLT", "MOV M, A",
+            "MOV A, B", "MOV A, C", "MOV A, D", "MOV A, E", "MOV A, H", "MOV A, L", "MOV A, M", "MOV A, A",
+    /* 8 */ "ADD B", "ADD C", "ADD D", "ADD E", "ADD H", "ADD L", "ADD M", "ADD A",
+            "ADC B", "ADC C", "ADC D", "ADC E", "ADC H", "ADC L", "ADC M", "ADC A",
+    /* 9 */ "SUB B", "SUB C", "SUB D", "SUB E", "SUB H", "SUB L", "SUB M", "SUB A",
+            "SBB B", "SBB C", "SBB D", "SBB E", "SBB H", "SBB L", "SBB M", "SBB A",
+    /* A */ "ANA B", "ANA C", "ANA D", "ANA E", "ANA H", "ANA L", "ANA M", "ANA A",
+            "XRA B", "XRA C", "XRA D", "XRA E", "XRA H", "XRA L", "XRA M", "XRA A",
+    /* B */ "ORA B", "ORA C", "ORA D", "ORA E", "ORA H", "ORA L", "ORA M", "ORA A",
+            "CMP B", "CMP C", "CMP D", "CMP E", "CMP H", "CMP L", "CMP M", "CMP A",
+    /* C */ "RNZ", "POP B", "JNZ %04X", "JMP %04X", "CNZ %04X", "PUSH B", "ADI %02X", "RST 0",
+            "RZ", "RET", "JZ %04X", "RSTV", "CZ %04X", "CALL %04X", "ACI %02X", "RST 1",
+    /* D */ "RNC", "POP D", "JNC %04X", "OUT %02X", "CNC %04X", "PUSH D", "SUI %02X", "RST 2",
+            "RC", "SHLX", "JC %04X", "IN %02X", "CC %04X", "JNK %04X", "SBI %02X", "RST 3",
+    /* E */ "RPO", "POP H", "JPO %04X", "XTHL", "CPO %04X", "PUSH H", "ANI %02X", "RST 4",
+            "RPE", "PCHL", "JPE %04X", "XCHG", "CPE %04X", "LHLX", "XRI %02X", "RST 5",
+    /* F */ "RP", "POP PSW", "JP %04X", "DI", "CP %04X", "PUSH PSW", "ORI %02X", "RST 6",
+            "RM", "SPHL", "JM %04X", "EI", "CM %04X", "JK %04X", "CPI %02X", "RST 7",
+};
+
+int disassemble(const cpu8085 *cpu, unsigned short addr, char *buf, size_t size)
+{
+    unsigned char bytes[3] = {
+        cpu->memory[addr],
+        cpu->memory[(unsigned short)(addr + 1)],
+        cpu->memory[(unsigned short)(addr + 2)],
+    };
+    return disassemble_bytes(bytes, buf, size);
+}
+
+int disassemble_bytes(const unsigned char bytes[3], char *buf, size_t size)
+{
+    const char *fmt = mnemonics[bytes[0]];
+    unsigned char lo = bytes[1];
+    unsigned char hi = bytes[2];
+
+    switch (cpu8085_opcode_length[bytes[0]])
+    {
+    case 3:
+        snprintf(buf, size, fmt, (hi << 8) | lo);
+        return 3;
+    case 2:
+        snprintf(buf, size, fmt, lo);
+        return 2;
+    default:
+        snprintf(buf, size, "%s", fmt);
+        return 1;
+    }
+}
+
+// Register field decoding. Code 6 (M) is the memory byte addressed by HL.
+#define REG_M 6
+#define DDD(opcode) (((opcode) >> 3) & 0x07)
+#define SSS(opcode) ((opcode) & 0x07)
+#define RP(opcode) (((opcode) >> 4) & 0x03)
+#define HL(cpu) (((cpu)->H << 8) | (cpu)->L)
+
+// Data memory accesses of the instructions go through these two helpers.
+// Pages with a memory-mapped device take an out-of-line detour via the bus,
+// and so do writes to pages holding cached code, accesses to watched pages
+// and all writes while an undo log records.
+// An undo log steps back into a block run by running its first instructions
+// again, so while it records, a device access ends the run: the next
+// instruction goes through service() first.
+static inline void end_block_run(cpu8085 *cpu)
+{
+    if (cpu->history != NULL)
+    {
+        cpu->next_event = 0;
+    }
+}
+
+static __attribute__((noinline)) unsigned char mmio_read(cpu8085 *cpu, unsigned short addr)
+{
+    unsigned char value;
+    if (!(cpu->mmio[addr >> 8] & CPU8085_PAGE_DEVICE) || !bus8085_read(cpu->bus, addr, &value))
+    {
+        value = cpu->memory[addr];
+    }
+    else
+    {
+        end_block_run(cpu);
+    }
+    if (cpu->mmio[addr >> 8] & CPU8085_PAGE_WATCH)
+    {
+        debug8085_check_watchpoint(cpu, addr, value, DEBUG8085_READ);
+    }
+    return value;
+}
+
+static inline unsigned char mem_read(cpu8085 *cpu, unsigned short addr)
+{
+    if (__builtin_expect(cpu->mmio[addr >> 8] & (CPU8085_PAGE_DEVICE | CPU8085_PAGE_WATCH), 0))
+    {
+        return mmio_read(cpu, addr);
+    }
+    return cpu->memory[addr];
+}
+
+static inline void ram_write(cpu8085 *cpu, unsigned short addr, unsigned char value)
+{
+    cpu->memory[addr] = value;
+    unsigned int line = addr / CPU8085_DIRTY_LINE;
+    cpu->dirty[line / 64] |= 1ULL << (line % 64);
+}
+
+static void invalidate_code(cpu8085 *cpu, unsigned short addr);
+
+static __attribute__((noinline)) void mmio_write(cpu8085 *cpu, unsigned short addr, unsigned char value)
+{
+    if (cpu->mmio[addr >> 8] & CPU8085_PAGE_HISTORY)
+    {
+        history8085_record_write(cpu->history, addr, cpu->memory[addr]);
+    }
+    if (cpu->mmio[addr >> 8] & CPU8085_PAGE_CODE)
+    {
+        invalidate_code(cpu, addr);
+    }
+    if (!(cpu->mmio[addr >> 8] & CPU8085_PAGE_DEVICE) || !bus8085_write(cpu->bus, addr, value))
+    {
+        ram_write(cpu, addr, value);
+    }
+    else
+    {
+        end_block_run(cpu);
+    }
+    // Last, as a device write may reschedule events and so next_event
+    if (cpu->mmio[addr >> 8] & CPU8085_PAGE_WATCH)
+    {
+        debug8085_check_watchpoint(cpu, addr, value, DEBUG8085_WRITE);
+    }
+}
+
+static inline void mem_write(cpu8085 *cpu, unsigned short addr, unsigned char value)
+{
+    if (__builtin_expect(cpu->mmio[addr >> 8], 0))
+    {
+        mmio_write(cpu, addr, value);
+    }
+    else
+    {
+        ram_write(cpu, addr, value);
+    }
+    if (cpu->trace_record != NULL)
+    {
+        trace_record_write(cpu->trace_record, addr, value);
+    }
+}
+
+static inline unsigned char read_reg(cpu8085 *cpu, int r)
+{
+    return r == REG_M ? mem_read(cpu, HL(cpu)) : cpu->reg[r];
+}
+
+static inline void write_reg(cpu8085 *cpu, int r, unsigned char value)
+{
+    if (r == REG_M)
+    {
+        mem_write(cpu, HL(cpu), value);
+    }
+    else
+    {
+        cpu->reg[r] = value;
+    }
+}
+
+// Fetch the next instruction byte(s) at PC
+static inline unsigned char fetch8(cpu8085 *cpu)
+{
+    return cpu->memory[cpu->PC++];
+}
+
+static inline unsigned short fetch16(cpu8085 *cpu)
+{
+    unsigned short value = cpu->memory[cpu->PC++];  // lower byte
+    value |= cpu->memory[cpu->PC++] << 8;           // upper byte
+    return value;
+}
+
+// Shared ALU for the ADD..CMP group; op is bits 5-3 of the opcode. Forced
+// inline so that each per-operation handler below folds the switch away.
+static inline __attribute__((always_inline)) void alu_op(cpu8085 *cpu, int op, unsigned char value)
+{
+    int carry = cpu->F & CARRY_FLAG;
+
+    switch (op)
+    {
+    case 0: // ADD
+        cpu->F = add_flags[FLAG_INDEX(0, cpu->A, value)];
+        cpu->A += value;
+        break;
+    case 1: // ADC
+        cpu->F = add_flags[FLAG_INDEX(carry, cpu->A, value)];
+        cpu->A += value + carry;
+        break;
+    case 2: // SUB
+        cpu->F = sub_flags[FLAG_INDEX(0, cpu->A, value)];
+        cpu->A -= value;
+        break;
+    case 3: // SBB
+        cpu->F = sub_flags[FLAG_INDEX(carry, cpu->A, value)];
+        cpu->A -= value + carry;
+        break;
+    case 4: // ANA: CY cleared, AC set on the 8085
+        cpu->A &= value;
+        cpu->F = szp_flags[cpu->A] | AUX_CARRY_FLAG;
+        break;
+    case 5: // XRA: CY and AC cleared
+        cpu->A ^= value;
+        cpu->F = szp_flags[cpu->A];
+        break;
+    case 6: // ORA: CY and AC cleared
+        cpu->A |= value;
+        cpu->F = szp_flags[cpu->A];
+        break;
+    case 7: // CMP
+        cpu->F = sub_flags[FLAG_INDEX(0, cpu->A, value)];
+        break;
+    }
+}
+
+static void op_nop(cpu8085 *cpu, unsigned char opcode)
+{
+    (void)cpu;
+    (void)opcode;
+}
+
+// Stop the CPU on a condition it can never leave by itself
+static void fault(cpu8085 *cpu, int reason)
+{
+    cpu->fault = reason;
+    cpu->halted = true;
+}
+
+// HLT only waits here; service() decides whether anything can still wake
+// the CPU, and stops it for good if not
+static void op_hlt(cpu8085 *cpu, unsigned char opcode)
+{
+    (void)opcode;
+    TRACE_PRINTF(cpu, "HLT encountered.\n");
+    cpu->waiting = 1;
+    cpu->next_event = 0;
+}
+
+// MOV r1, r2 (01DDDSSS)
+static void op_mov(cpu8085 *cpu, unsigned char opcode)
+{
+    write_reg(cpu, DDD(opcode), read_reg(cpu, SSS(opcode)));
+}
+
+// MVI r, data (00DDD110)
+static void op_mvi(cpu8085 *cpu, unsigned char opcode)
+{
+    write_reg(cpu, DDD(opcode), fetch8(cpu));
+}
+
+// INR/DCR of a value; the carry flag is unaffected
+static inline unsigned char inr8(cpu8085 *cpu, unsigned char value)
+{
+    cpu->F = (cpu->F & CARRY_FLAG) | (add_flags[FLAG_INDEX(0, value, 1)] & ~CARRY_FLAG);
+    return value + 1;
+}
+
+static inline unsigned char dcr8(cpu8085 *cpu, unsigned char value)
+{
+    cpu->F = (cpu->F & CARRY_FLAG) | (sub_flags[FLAG_INDEX(0, value, 1)] & ~CARRY_FLAG);
+    return value - 1;
+}
+
+// INR r (00DDD100)
+static void op_inr(cpu8085 *cpu, unsigned char opcode)
+{
+    write_reg(cpu, DDD(opcode), inr8(cpu, read_reg(cpu, DDD(opcode))));
+}
+
+// DCR r (00DDD101)
+static void op_dcr(cpu8085 *cpu, unsigned char opcode)
+{
+    write_reg(cpu, DDD(opcode), dcr8(cpu, read_reg(cpu, DDD(opcode))));
+}
+
+// Register pair in the RP field: BC, DE, HL or SP. B/C, D/E and H/L sit
+// next to each other in reg[], high byte first.
+static inline unsigned short read_rp(const cpu8085 *cpu, int rp)
+{
+    return rp == 3 ? cpu->SP : (cpu->reg[2 * rp] << 8) | cpu->reg[2 * rp + 1];
+}
+
+static inline void write_rp(cpu8085 *cpu, int rp, unsigned short value)
+{
+    if (rp == 3)
+    {
+        cpu->SP = value;
+    }
+    else
+    {
+        cpu->reg[2 * rp] = value >> 8;
+        cpu->reg[2 * rp + 1] = value & 0xFF;
+    }
+}
+
+// LXI rp, data16 (00RP0001)
+static void op_lxi(cpu8085 *cpu, unsigned char opcode)
+{
+    write_rp(cpu, RP(opcode), fetch16(cpu));
+}
+
+// INX rp (00RP0011) and DCX rp (00RP1011); no flags
+static void op_inx(cpu8085 *cpu, unsigned char opcode)
+{
+    write_rp(cpu, RP(opcode), read_rp(cpu, RP(opcode)) + 1);
+}
+
+static void op_dcx(cpu8085 *cpu, unsigned char opcode)
+{
+    write_rp(cpu, RP(opcode), read_rp(cpu, RP(opcode)) - 1);
+}
+
+// DAD rp (00RP1001): HL += rp, only CY affected
+static void op_dad(cpu8085 *cpu, unsigned char opcode)
+{
+    unsigned int sum = HL(cpu) + read_rp(cpu, RP(opcode));
+    write_rp(cpu, 2, sum);
+    cpu->F = (cpu->F & ~CARRY_FLAG) | (sum >> 16);
+}
+
+// STA addr
+static void op_sta(cpu8085 *cpu, unsigned char opcode)
+{
+    (void)opcode;
+    mem_write(cpu, fetch16(cpu), cpu->A);
+}
+
+// LDA addr
+static void op_lda(cpu8085 *cpu, unsigned char opcode)
+{
+    (void)opcode;
+    cpu->A = mem_read(cpu, fetch16(cpu));
+}
+
+// STAX B/D (000R0010) and LDAX B/D (000R1010)
+static void op_stax(cpu8085 *cpu, unsigned char opcode)
+{
+    mem_write(cpu, read_rp(cpu, RP(opcode)), cpu->A);
+}
+
+static void op_ldax(cpu8085 *cpu, unsigned char opcode)
+{
+    cpu->A = mem_read(cpu, read_rp(cpu, RP(opcode)));
+}
+
+// SHLD addr: L to addr, H to addr + 1
+static void op_shld(cpu8085 *cpu, unsigned char opcode)
+{
+    (void)opcode;
+    unsigned short addr = fetch16(cpu);
+    mem_write(cpu, addr, cpu->L);
+    mem_write(cpu, addr + 1, cpu->H);
+}
+
+// LHLD addr
+static void op_lhld(cpu8085 *cpu, unsigned char opcode)
+{
+    (void)opcode;
+    unsigned short addr = fetch16(cpu);
+    cpu->L = mem_read(cpu, addr);
+    cpu->H = mem_read(cpu, addr + 1);
+}
+
+// XCHG: swap HL and DE
+static void op_xchg(cpu8085 *cpu, unsigned char opcode)
+{
+    (void)opcode;
+    unsigned short de = read_rp(cpu, 1);
+    write_rp(cpu, 1, HL(cpu));
+    write_rp(cpu, 2, de);
+}
+
+// SPHL
+static void op_sphl(cpu8085 *cpu, unsigned char opcode)
+{
+    (void)opcode;
+    cpu->SP = HL(cpu);
+}
+
+// Rotates of A; only CY affected.
+// RLC (07) and RRC (0F) rotate 8 bits, RAL (17) and RAR (1F) through CY.
+static void op_rotate(cpu8085 *cpu, unsigned char opcode)
+{
+    unsigned char a = cpu->A;
+    int carry = cpu->F & CARRY_FLAG;
+
+    switch (opcode)
+    {
+    case 0x07:
+        carry = a >> 7;
+        cpu->A = (a << 1) | carry;
+        break;
+    case 0x0F:
+        carry = a & 1;
+        cpu->A = (a >> 1) | (carry << 7);
+        break;
+    case 0x17:
+        cpu->A = (a << 1) | carry;
+        carry = a >> 7;
+        break;
+    default:
+        cpu->A = (a >> 1) | (carry << 7);
+        carry = a & 1;
+        break;
+    }
+    cpu->F = (cpu->F & ~CARRY_FLAG) | carry;
+}
+
+// CMA; no flags
+static void op_cma(cpu8085 *cpu, unsigned char opcode)
+{
+    (void)opcode;
+    cpu->A = ~cpu->A;
+}
+
+// STC and CMC
+static void op_stc(cpu8085 *cpu, unsigned char opcode)
+{
+    (void)opcode;
+    cpu->F |= CARRY_FLAG;
+}
+
+static void op_cmc(cpu8085 *cpu, unsigned char opcode)
+{
+    (void)opcode;
+    cpu->F ^= CARRY_FLAG;
+}
+
+// DAA: add 06 if the low digit is over 9 or AC is set, then 60 if the high
+// digit is over 9 or CY is set. CY stays set once set; S, Z, P and AC are
+// those of the addition.
+static void op_daa(cpu8085 *cpu, unsigned char opcode)
+{
+    (void)opcode;
+    unsigned char a = cpu->A;
+    unsigned char correction = 0;
+    int carry = cpu->F & CARRY_FLAG;
+
+    if ((a & 0x0F) > 9 || (cpu->F & AUX_CARRY_FLAG))
+    {
+        correction |= 0x06;
+    }
+    if (a > 0x99 || carry)
+    {
+        correction |= 0x60;
+        carry = 1;
+    }
+    cpu->A = a + correction;
+    cpu->F = (add_flags[FLAG_INDEX(0, a, correction)] & ~CARRY_FLAG) | carry;
+}
+
+// IN port
+static void op_in(cpu8085 *cpu, unsigned char opcode)
+{
+    (void)opcode;
+    unsigned char port = fetch8(cpu);
+    if (cpu->bus != NULL)
+    {
+        cpu->A = bus8085_in(cpu->bus, port);
+        end_block_run(cpu);
+    }
+    else
+    {
+        cpu->A = 0xFF;
+    }
+}
+
+// OUT port
+static void op_out(cpu8085 *cpu, unsigned char opcode)
+{
+    (void)opcode;
+    unsigned char port = fetch8(cpu);
+    if (cpu->bus != NULL)
+    {
+        bus8085_out(cpu->bus, port, cpu->A);
+        end_block_run(cpu);
+    }
+}
+
+// Stack: the high byte goes to SP-1 and the low byte to SP-2
+static inline void push16(cpu8085 *cpu, unsigned short value)
+{
+    mem_write(cpu, --cpu->SP, value >> 8);
+    mem_write(cpu, --cpu->SP, value & 0xFF);
+}
+
+static inline unsigned short pop16(cpu8085 *cpu)
+{
+    unsigned short value = mem_read(cpu, cpu->SP++);
+    value |= mem_read(cpu, cpu->SP++) << 8;
+    return value;
+}
+
+// PUSH rp (11RP0101) and POP rp (11RP0001); rp 3 is PSW, A high and F low
+static void op_push(cpu8085 *cpu, unsigned char opcode)
+{
+    push16(cpu, RP(opcode) == 3 ? (cpu->A << 8) | cpu->F : read_rp(cpu, RP(opcode)));
+}
+
+static void op_pop(cpu8085 *cpu, unsigned char opcode)
+{
+    unsigned short value = pop16(cpu);
+
+    if (RP(opcode) == 3)
+    {
+        cpu->A = value >> 8;
+        cpu->F = value & 0xFF;
+    }
+    else
+    {
+        write_rp(cpu, RP(opcode), value);
+    }
+}
+
+// XTHL: swap HL with the word on top of the stack
+static void op_xthl(cpu8085 *cpu, unsigned char opcode)
+{
+    (void)opcode;
+    unsigned char l = mem_read(cpu, cpu->SP);
+    unsigned char h = mem_read(cpu, cpu->SP + 1);
+    mem_write(cpu, cpu->SP, cpu->L);
+    mem_write(cpu, cpu->SP + 1, cpu->H);
+    cpu->L = l;
+    cpu->H = h;
+}
+
+// ---- Undocumented instructions ----
+
+// DSUB: HL -= BC. S, Z, AC and CY as for SUB but over 16 bits (AC and CY
+// are the borrows out of bits 11 and 15), P from H; V is the signed
+// overflow and K is V xor S.
+static void op_dsub(cpu8085 *cpu, unsigned char opcode)
+{
+    (void)opcode;
+    unsigned short hl = HL(cpu);
+    unsigned short bc = read_rp(cpu, 0);
+    unsigned int result = hl - bc;
+    unsigned char f = (result >> 8) & SIGN_FLAG;
+
+    write_rp(cpu, 2, result);
+    f |= (result & 0xFFFF) == 0 ? ZERO_FLAG : 0;
+    f |= szp_flags[cpu->H] & PARITY_FLAG;
+    f |= ((hl ^ bc ^ result) >> 8) & AUX_CARRY_FLAG;
+    f |= (result >> 16) & CARRY_FLAG;
+    f |= (((hl ^ bc) & (hl ^ result)) >> 14) & OVERFLOW_FLAG;
+    cpu->F = f | (((f >> 2) ^ (f << 4)) & K_FLAG);
+}
+
+// ARHL: HL shifted right, bit 15 kept; only CY (from bit 0) affected
+static void op_arhl(cpu8085 *cpu, unsigned char opcode)
+{
+    (void)opcode;
+    unsigned short hl = HL(cpu);
+    cpu->F = (cpu->F & ~CARRY_FLAG) | (hl & 1);
+    write_rp(cpu, 2, (hl >> 1) | (hl & 0x8000));
+}
+
+// RDEL: DE rotated left through CY; only CY affected
+static void op_rdel(cpu8085 *cpu, unsigned char opcode)
+{
+    (void)opcode;
+    unsigned short de = read_rp(cpu, 1);
+    write_rp(cpu, 1, (de << 1) | (cpu->F & CARRY_FLAG));
+    cpu->F = (cpu->F & ~CARRY_FLAG) | (de >> 15);
+}
+
+// LDHI data (28) and LDSI data (38): DE = HL or SP plus an unsigned byte
+static void op_ldhi(cpu8085 *cpu, unsigned char opcode)
+{
+    unsigned short base = opcode == 0x28 ? HL(cpu) : cpu->SP;
+    write_rp(cpu, 1, base + fetch8(cpu));
+}
+
+// SHLX: L to [DE], H to [DE + 1]
+static void op_shlx(cpu8085 *cpu, unsigned char opcode)
+{
+    (void)opcode;
+    unsigned short addr = read_rp(cpu, 1);
+    mem_write(cpu, addr, cpu->L);
+    mem_write(cpu, addr + 1, cpu->H);
+}
+
+// LHLX: L from [DE], H from [DE + 1]
+static void op_lhlx(cpu8085 *cpu, unsigned char opcode)
+{
+    (void)opcode;
+    unsigned short addr = read_rp(cpu, 1);
+    cpu->L = mem_read(cpu, addr);
+    cpu->H = mem_read(cpu, addr + 1);
+}
+
+// ---- Interrupts and scheduled events ----
+
+// The interrupt that would be taken now as its CPU8085_INT_* bit, 0 if none.
+// Priority: TRAP, RST 7.5, RST 6.5, RST 5.5, INTR.
+static int acceptable_interrupt(const cpu8085 *cpu)
+{
+    if (cpu->int_lines & CPU8085_INT_TRAP)
+    {
+        return CPU8085_INT_TRAP;
+    }
+    if (!cpu->int_enable)
+    {
+        return 0;
+    }
+    // The SIM mask bits line up with the RST 5.5/6.5/7.5 inputs
+    int lines = cpu->int_lines & ~cpu->int_mask;
+    for (int line = CPU8085_INT_RST75; line != 0; line >>= 1)
+    {
+        if (lines & line)
+        {
+            return line;
+        }
+    }
+    return lines & CPU8085_INT_INTR;
+}
+
+static void update_next_event(cpu8085 *cpu)
+{
+    if (cpu->waiting || cpu->int_enable_delay || acceptable_interrupt(cpu))
+    {
+        cpu->next_event = 0;
+    }
+    else
+    {
+        cpu->next_event = cpu->event_count > 0 ? cpu->events[0].when : ~0ULL;
+    }
+}
+
+void cpu8085_raise(cpu8085 *cpu, int line)
+{
+    cpu->int_lines |= line;
+    update_next_event(cpu);
+}
+
+// The latched edge inputs stay set until taken
+void cpu8085_lower(cpu8085 *cpu, int line)
+{
+    cpu->int_lines &= ~(line & (CPU8085_INT_RST55 | CPU8085_INT_RST65 | CPU8085_INT_INTR));
+    update_next_event(cpu);
+}
+
+// Event min-heap on `when`
+static void sift_down(cpu8085 *cpu, int i)
+{
+    struct cpu8085_event event = cpu->events[i];
+
+    for (;;)
+    {
+        int child = 2 * i + 1;
+        if (child >= cpu->event_count)
+        {
+            break;
+        }
+        if (child + 1 < cpu->event_count && cpu->events[child + 1].when < cpu->events[child].when)
+        {
+            child++;
+        }
+        if (cpu->events[child].when >= event.when)
+        {
+            break;
+        }
+        cpu->events[i] = cpu->events[child];
+        i = child;
+    }
+    cpu->events[i] = event;
+}
+
+int cpu8085_schedule(cpu8085 *cpu, unsigned long long when, cpu8085_event_fn fn, void *context)
+{
+    if (cpu->event_count == CPU8085_MAX_EVENTS)
+    {
+        return -1;
+    }
+    // A periodic source must move on, or run_due_events() never returns
+    const struct cpu8085_event *running = cpu->running_event;
+    if (running != NULL && running->fn == fn && running->context == context && when <= cpu->tstates)
+    {
+        return -1;
+    }
+    int i = cpu->event_count++;
+    while (i > 0 && cpu->events[(i - 1) / 2].when > when)
+    {
+        cpu->events[i] = cpu->events[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    cpu->events[i] = (struct cpu8085_event){ when, fn, context };
+    update_next_event(cpu);
+    return 0;
+}
+
+void cpu8085_cancel(cpu8085 *cpu, cpu8085_event_fn fn, void *context)
+{
+    int count = 0;
+
+    for (int i = 0; i < cpu->event_count; i++)
+    {
+        if (cpu->events[i].fn != fn || cpu->events[i].context != context)
+        {
+            cpu->events[count++] = cpu->events[i];
+        }
+    }
+    cpu->event_count = count;
+    for (int i = count / 2 - 1; i >= 0; i--)
+    {
+        sift_down(cpu, i);
+    }
+    update_next_event(cpu);
+}
+
+// Run every event that is due. A callback may schedule further events.
+static void run_due_events(cpu8085 *cpu)
+{
+    while (cpu->event_count > 0 && cpu->events[0].when <= cpu->tstates)
+    {
+        struct cpu8085_event event = cpu->events[0];
+        cpu->events[0] = cpu->events[--cpu->event_count];
+        sift_down(cpu, 0);
+        cpu->running_event = &event;
+        event.fn(cpu, event.context);
+        cpu->running_event = NULL;
+    }
+}
+
+// Binary trace of an interrupt acknowledge: a record of its own, holding
+// the return address push
+static __attribute__((noinline)) void push_traced(cpu8085 *cpu, unsigned short vector)
+{
+    struct trace_record *record = bintrace_next(cpu->bintrace);
+    record->pc = cpu->PC;
+    record->bytes[0] = 0;
+    record->bytes[1] = vector & 0xFF;
+    record->bytes[2] = vector >> 8;
+    record->write_count = 0;
+    record->write_addr = 0;
+    record->write[0] = record->write[1] = 0;
+    cpu->trace_record = record;
+
+    push16(cpu, cpu->PC);
+
+    record->write_count |= TRACE_INTERRUPT;
+    memcpy(record->reg, cpu->reg, sizeof(record->reg));
+    record->sp = cpu->SP;
+    cpu->trace_record = NULL;
+    bintrace_commit(cpu->bintrace);
+}
+
+// Acknowledge an interrupt: like an RST to its vector, taking 12 T-states
+static void take_interrupt(cpu8085 *cpu, int line)
+{
+    unsigned short vector;
+
+    switch (line)
+    {
+    case CPU8085_INT_TRAP:  vector = 0x24; break;
+    case CPU8085_INT_RST75: vector = 0x3C; break;
+    case CPU8085_INT_RST65: vector = 0x34; break;
+    case CPU8085_INT_RST55: vector = 0x2C; break;
+    default:
+        // Only RST instructions are supported on the INTR bus cycle
+        vector = (cpu->intr_opcode & 0xC7) == 0xC7 ? cpu->intr_opcode & 0x38 : 0x38;
+        break;
+    }
+    TRACE_PRINTF(cpu, "Interrupt taken, vector %04X\n", vector);
+
+    cpu->int_lines &= ~(line & (CPU8085_INT_TRAP | CPU8085_INT_RST75 | CPU8085_INT_INTR));
+    cpu->int_enable = 0;
+    cpu->waiting = 0;
+    if (cpu->bintrace != NULL)
+    {
+        push_traced(cpu, vector);
+    }
+    else
+    {
+        push16(cpu, cpu->PC);
+    }
+    cpu->PC = vector;
+    cpu->tstates += 12;
+    if (cpu->profile != NULL)
+    {
+        profile_call(cpu->profile, vector, cpu->SP + 2, 1);
+        profile_attribute(cpu->profile, 0, 12);
+    }
+}
+
+// Pending work before an instruction, reached once tstates passes
+// next_event. Returns 1 if an instruction should execute now, 0 if the CPU
+// is idle in HLT (or has just stopped there).
+static __attribute__((noinline)) int service(cpu8085 *cpu)
+{
+    // EI enables interrupts only after the instruction following it
+    if (cpu->int_enable_delay && --cpu->int_enable_delay == 0)
+    {
+        cpu->int_enable = 1;
+    }
+    run_due_events(cpu);
+
+    if (cpu->waiting && !acceptable_interrupt(cpu))
+    {
+        if (cpu->event_count == 0)
+        {
+            TRACE_PRINTF(cpu, "Nothing left to wake the CPU. Exiting.\n");
+            cpu->waiting = 0;
+            cpu->halted = true;
+            cpu->next_event = ~0ULL;
+            return 0;
+        }
+        // Idle in HLT: skip straight to the next event
+        if (cpu->tstates < cpu->events[0].when)
+        {
+            cpu->tstates = cpu->events[0].when;
+        }
+        run_due_events(cpu);
+    }
+
+    int line = acceptable_interrupt(cpu);
+    if (line)
+    {
+        take_interrupt(cpu, line);
+    }
+    update_next_event(cpu);
+    return !cpu->waiting;
+}
+
+// EI; a pending interrupt is not taken before the next instruction has run
+static void op_ei(cpu8085 *cpu, unsigned char opcode)
+{
+    (void)opcode;
+    if (!cpu->int_enable)
+    {
+        cpu->int_enable_delay = 2;
+        cpu->next_event = 0;
+    }
+}
+
+// DI
+static void op_di(cpu8085 *cpu, unsigned char opcode)
+{
+    (void)opcode;
+    cpu->int_enable = 0;
+    cpu->int_enable_delay = 0;
+    update_next_event(cpu);
+}
+
+// SIM: A bit 3 (MSE) loads the masks from bits 2-0, bit 4 clears the RST 7.5
+// latch, bit 6 (SDE) latches bit 7 onto SOD
+static void op_sim(cpu8085 *cpu, unsigned char opcode)
+{
+    (void)opcode;
+    if (cpu->A & 0x08)
+    {
+        cpu->int_mask = cpu->A & 0x07;
+    }
+    if (cpu->A & 0x10)
+    {
+        cpu->int_lines &= ~CPU8085_INT_RST75;
+    }
+    if (cpu->A & 0x40)
+    {
+        cpu->sod = cpu->A >> 7;
+    }
+    update_next_event(cpu);
+}
+
+// RIM: A = SID, pending 7.5/6.5/5.5, IE, masks 7.5/6.5/5.5 (bit 7 to bit 0)
+static void op_rim(cpu8085 *cpu, unsigned char opcode)
+{
+    (void)opcode;
+    cpu->A = (cpu->sid << 7) |
+             ((cpu->int_lines & (CPU8085_INT_RST55 | CPU8085_INT_RST65 | CPU8085_INT_RST75)) << 4) |
+             (cpu->int_enable ? 0x08 : 0x00) | cpu->int_mask;
+}
+
+// Branch condition in bits 5-3 of Jcc/Ccc/Rcc: NZ Z NC C PO PE P M.
+// The upper two bits pick the flag, the lowest says whether it must be set.
+static inline int condition(const cpu8085 *cpu, unsigned char opcode)
+{
+    static const unsigned char flag[4] = { ZERO_FLAG, CARRY_FLAG, PARITY_FLAG, SIGN_FLAG };
+    int ccc = DDD(opcode);
+    return ((cpu->F & flag[ccc >> 1]) != 0) == (ccc & 1);
+}
+
+// A jump back onto its own first byte changes nothing, so it repeats forever,
+// unless a scheduled event can still interrupt it
+static inline void jump(cpu8085 *cpu, unsigned short target, int length)
+{
+    if (target == (unsigned short)(cpu->PC - length) && cpu->event_count == 0)
+    {
+        TRACE_PRINTF(cpu, "Jump to self at %04X. Exiting.\n", target);
+        fault(cpu, CPU8085_STOP_LOOP);
+    }
+    cpu->PC = target;
+}
+
+// JMP addr
+static void op_jmp(cpu8085 *cpu, unsigned char opcode)
+{
+    (void)opcode;
+    jump(cpu, fetch16(cpu), 3);
+}
+
+// Jcc addr (11CCC010)
+static void op_jcc(cpu8085 *cpu, unsigned char opcode)
+{
+    unsigned short target = fetch16(cpu);
+    if (condition(cpu, opcode))
+    {
+        jump(cpu, target, 3);
+        cpu->tstates += CPU8085_JCC_TAKEN_TSTATES;
+    }
+}
+
+// CALL addr
+static void op_call(cpu8085 *cpu, unsigned char opcode)
+{
+    (void)opcode;
+    unsigned short target = fetch16(cpu);
+    push16(cpu, cpu->PC);
+    cpu->PC = target;
+}
+
+// Ccc addr (11CCC100)
+static void op_ccc(cpu8085 *cpu, unsigned char opcode)
+{
+    unsigned short target = fetch16(cpu);
+    if (condition(cpu, opcode))
+    {
+        push16(cpu, cpu->PC);
+        cpu->PC = target;
+        cpu->tstates += CPU8085_CCC_TAKEN_TSTATES;
+    }
+}
+
+// RET
+static void op_ret(cpu8085 *cpu, unsigned char opcode)
+{
+    (void)opcode;
+    cpu->PC = pop16(cpu);
+}
+
+// Rcc (11CCC000)
+static void op_rcc(cpu8085 *cpu, unsigned char opcode)
+{
+    if (condition(cpu, opcode))
+    {
+        cpu->PC = pop16(cpu);
+        cpu->tstates += CPU8085_RCC_TAKEN_TSTATES;
+    }
+}
+
+// RST n (11NNN111): call to n * 8
+static void op_rst(cpu8085 *cpu, unsigned char opcode)
+{
+    push16(cpu, cpu->PC);
+    cpu->PC = opcode & 0x38;
+}
+
+// RSTV: RST 8 (a call to 0040) if V is set
+static void op_rstv(cpu8085 *cpu, unsigned char opcode)
+{
+    (void)opcode;
+    if (cpu->F & OVERFLOW_FLAG)
+    {
+        push16(cpu, cpu->PC);
+        cpu->PC = 0x0040;
+        cpu->tstates += CPU8085_RSTV_TAKEN_TSTATES;
+    }
+}
+
+// JNK addr (DD) and JK addr (FD): jump if K is clear or set
+static void op_jk(cpu8085 *cpu, unsigned char opcode)
+{
+    unsigned short target = fetch16(cpu);
+    if (((cpu->F & K_FLAG) != 0) == (opcode == 0xFD))
+    {
+        jump(cpu, target, 3);
+        cpu->tstates += CPU8085_JCC_TAKEN_TSTATES;
+    }
+}
+
+// PCHL
+static void op_pchl(cpu8085 *cpu, unsigned char opcode)
+{
+    (void)opcode;
+    jump(cpu, HL(cpu), 1);
+}
+
+// ALU group: one handler per operation, for both the register/M form
+// (10OOOSSS) and the immediate form (11OOO110)
+#define ALU_HANDLERS(name, op) \
+    static void op_##name(cpu8085 *cpu, unsigned char opcode) { alu_op(cpu, op, read_reg(cpu, SSS(opcode))); } \
+    static void op_##name##_imm(cpu8085 *cpu, unsigned char opcode) { (void)opcode; alu_op(cpu, op, fetch8(cpu)); }
+
+ALU_HANDLERS(add, 0)
+ALU_HANDLERS(adc, 1)
+ALU_HANDLERS(sub, 2)
+ALU_HANDLERS(sbb, 3)
+ALU_HANDLERS(ana, 4)
+ALU_HANDLERS(xra, 5)
+ALU_HANDLERS(ora, 6)
+ALU_HANDLERS(cmp, 7)
+
+// Opcode dispatch table. The DDD/SSS/RP fields are decoded by the handlers,
+// so one handler serves every register variant of an instruction.
+static void (*const opcode_table[256])(cpu8085 *cpu, unsigned char opcode) = {
+    [0x00] = op_nop,
+
+    [0x01] = op_lxi, [0x11] = op_lxi, [0x21] = op_lxi, [0x31] = op_lxi,
+    [0x03] = op_inx, [0x13] = op_inx, [0x23] = op_inx, [0x33] = op_inx,
+    [0x0B] = op_dcx, [0x1B] = op_dcx, [0x2B] = op_dcx, [0x3B] = op_dcx,
+    [0x09] = op_dad, [0x19] = op_dad, [0x29] = op_dad, [0x39] = op_dad,
+    [0x32] = op_sta, [0x3A] = op_lda, [0x22] = op_shld, [0x2A] = op_lhld,
+    [0x02] = op_stax, [0x12] = op_stax, [0x0A] = op_ldax, [0x1A] = op_ldax,
+    [0xEB] = op_xchg, [0xE3] = op_xthl, [0xF9] = op_sphl,
+    [0xC5] = op_push, [0xD5] = op_push, [0xE5] = op_push, [0xF5] = op_push,
+    [0xC1] = op_pop, [0xD1] = op_pop, [0xE1] = op_pop, [0xF1] = op_pop,
+
+    [0x07] = op_rotate, [0x0F] = op_rotate, [0x17] = op_rotate, [0x1F] = op_rotate,
+    [0x27] = op_daa, [0x2F] = op_cma, [0x37] = op_stc, [0x3F] = op_cmc,
+
+    [0x04] = op_inr, [0x0C] = op_inr, [0x14] = op_inr, [0x1C] = op_inr,
+    [0x24] = op_inr, [0x2C] = op_inr, [0x34] = op_inr, [0x3C] = op_inr,
+    [0x05] = op_dcr, [0x0D] = op_dcr, [0x15] = op_dcr, [0x1D] = op_dcr,
+    [0x25] = op_dcr, [0x2D] = op_dcr, [0x35] = op_dcr, [0x3D] = op_dcr,
+    [0x06] = op_mvi, [0x0E] = op_mvi, [0x16] = op_mvi, [0x1E] = op_mvi,
+    [0x26] = op_mvi, [0x2E] = op_mvi, [0x36] = op_mvi, [0x3E] = op_mvi,
+
+    [0x40 ... 0x7F] = op_mov,
+    [0x76] = op_hlt,
+
+    [0x80 ... 0x87] = op_add, [0x88 ... 0x8F] = op_adc,
+    [0x90 ... 0x97] = op_sub, [0x98 ... 0x9F] = op_sbb,
+    [0xA0 ... 0xA7] = op_ana, [0xA8 ... 0xAF] = op_xra,
+    [0xB0 ... 0xB7] = op_ora, [0xB8 ... 0xBF] = op_cmp,
+
+    [0xC6] = op_add_imm, [0xCE] = op_adc_imm, [0xD6] = op_sub_imm, [0xDE] = op_sbb_imm,
+    [0xE6] = op_ana_imm, [0xEE] = op_xra_imm, [0xF6] = op_ora_imm, [0xFE] = op_cmp_imm,
+
+    [0xDB] = op_in, [0xD3] = op_out,
+    [0xFB] = op_ei, [0xF3] = op_di, [0x30] = op_sim, [0x20] = op_rim,
+
+    [0xC3] = op_jmp, [0xCD] = op_call, [0xC9] = op_ret, [0xE9] = op_pchl,
+    [0xC2] = op_jcc, [0xCA] = op_jcc, [0xD2] = op_jcc, [0xDA] = op_jcc,
+    [0xE2] = op_jcc, [0xEA] = op_jcc, [0xF2] = op_jcc, [0xFA] = op_jcc,
+    [0xC4] = op_ccc, [0xCC] = op_ccc, [0xD4] = op_ccc, [0xDC] = op_ccc,
+    [0xE4] = op_ccc, [0xEC] = op_ccc, [0xF4] = op_ccc, [0xFC] = op_ccc,
+    [0xC0] = op_rcc, [0xC8] = op_rcc, [0xD0] = op_rcc, [0xD8] = op_rcc,
+    [0xE0] = op_rcc, [0xE8] = op_rcc, [0xF0] = op_rcc, [0xF8] = op_rcc,
+    [0xC7] = op_rst, [0xCF] = op_rst, [0xD7] = op_rst, [0xDF] = op_rst,
+    [0xE7] = op_rst, [0xEF] = op_rst, [0xF7] = op_rst, [0xFF] = op_rst,
+
+    [0x08] = op_dsub, [0x10] = op_arhl, [0x18] = op_rdel, [0x28] = op_ldhi, [0x38] = op_ldhi,
+    [0xD9] = op_shlx, [0xED] = op_lhlx, [0xCB] = op_rstv, [0xDD] = op_jk, [0xFD] = op_jk,
+};
+
+// Fetch, charge and dispatch one instruction
+static inline __attribute__((always_inline)) void execute(cpu8085 *cpu)
+{
+    unsigned char opcode = fetch8(cpu);
+    cpu->tstates += cpu8085_opcode_tstates[opcode];
+    opcode_table[opcode](cpu, opcode);
+
+    cpu->instructions++;
+}
+
+// Binary trace: the instruction bytes are taken before it runs, in case it
+// overwrites itself, and the registers after it. Kept out of line so the
+// untraced path stays small.
+static __attribute__((noinline)) void execute_traced(cpu8085 *cpu)
+{
+    struct trace_record *record = bintrace_next(cpu->bintrace);
+    record->pc = cpu->PC;
+    record->bytes[0] = cpu->memory[cpu->PC];
+    record->bytes[1] = cpu->memory[(unsigned short)(cpu->PC + 1)];
+    record->bytes[2] = cpu->memory[(unsigned short)(cpu->PC + 2)];
+    record->write_count = 0;
+    record->write_addr = 0;
+    record->write[0] = record->write[1] = 0;
+    cpu->trace_record = record;
+
+    execute(cpu);
+
+    memcpy(record->reg, cpu->reg, sizeof(record->reg));
+    record->sp = cpu->SP;
+    cpu->trace_record = NULL;
+    bintrace_commit(cpu->bintrace);
+}
+
+// Profile: the instruction's address, opcode and T-states are taken around
+// it, with any call, return or loop back edge it made
+static __attribute__((noinline)) void execute_profiled(cpu8085 *cpu)
+{
+    unsigned short pc = cpu->PC;
+    unsigned char opcode = cpu->memory[pc];
+    unsigned long long tstates = cpu->tstates;
+
+    if (cpu->bintrace != NULL)
+    {
+        execute_traced(cpu);
+    }
+    else
+    {
+        execute(cpu);
+    }
+
+    tstates = cpu->tstates - tstates;
+    profile_count(cpu->profile, pc, opcode, 1, tstates);
+    profile_attribute(cpu->profile, 1, tstates);
+    profile_branch(cpu->profile, opcode, pc, pc + cpu8085_opcode_length[opcode], cpu->PC, cpu->SP);
+}
+
+// One instruction, after any pending work
+static inline void step(cpu8085 *cpu)
+{
+    if (cpu->tstates >= cpu->next_event && !service(cpu))
+    {
+        return;
+    }
+    if (cpu->debug != NULL && debug8085_break(cpu))
+    {
+        return;
+    }
+
+#if TRACE
+    if (cpu->trace)
+    {
+        char text[32];
+        disassemble(cpu, cpu->PC, text, sizeof(text));
+        printf("Executing opcode: %02X\n%s\n", cpu->memory[cpu->PC], text);
+    }
+#endif
+
+    if (cpu->profile != NULL)
+    {
+        execute_profiled(cpu);
+        return;
+    }
+    if (cpu->bintrace != NULL)
+    {
+        execute_traced(cpu);
+        return;
+    }
+    execute(cpu);
+}
+
+// Undo log: the state is recorded before service(), as an interrupt taken
+// there writes to the stack. A call that ran no instruction keeps its
+// entry only if it wrote something.
+static __attribute__((noinline)) void step_recorded(cpu8085 *cpu)
+{
+    struct history8085 *history = cpu->history;
+    unsigned long long instructions = cpu->instructions;
+
+    if (instructions >= history->next_keyframe)
+    {
+        history8085_keyframe(cpu);
+    }
+    history8085_reserve(history, 1);
+    history8085_record(history, cpu, 1);
+    step(cpu);
+    if (cpu->instructions == instructions)
+    {
+        struct history8085_entry *entry = &history->entries[(history->head - 1) & (history->capacity - 1)];
+        entry->executed = 0;
+        if (entry->write_count == 0)
+        {
+            history->head--;
+        }
+    }
+}
+
+// Function to emulate an instruction
+void emulate_instruction(cpu8085 *cpu)
+{
+    if (cpu->history != NULL)
+    {
+        step_recorded(cpu);
+        return;
+    }
+    step(cpu);
+}
+
+// ---- Block cache ----
+
+// A block is a straight-line run of instructions decoded once into micro-ops:
+// operands are read and register fields resolved at decode time, and the
+// common register-only instructions get a handler of their own. A block
+// ends after anything that can change PC other than by falling through
+// (jumps, calls, returns, RST, RSTV, PCHL, HLT) or after
+// BLOCK_MAX_OPS instructions. Blocks sit in a direct-mapped table indexed by
+// their start address.
+#define BLOCK_CACHE_SLOTS 2048
+#define BLOCK_MAX_OPS 16
+#define BLOCK_EMPTY 0x10000 // start of an unused slot
+
+// Decoding a block costs about as much as running a hundred instructions,
+// so code too big for the table must not thrash it: decodes are rationed
+// to one per BLOCK_DECODE_COST instructions run, with a reserve of
+// BLOCK_DECODE_BURST decodes for a program moving on to new code. Code
+// outside the ration runs one instruction at a time.
+#define BLOCK_DECODE_COST 256
+#define BLOCK_DECODE_BURST 64
+
+// Each micro-op leaves PC after its instruction, as executing it would
+struct block_op
+{
+    void (*fn)(cpu8085 *cpu, const struct block_op *op);
+    unsigned short pc;
+    unsigned short next_pc;
+    unsigned short operand; // immediate byte or 16-bit address
+    unsigned char opcode;
+    unsigned char tstates;
+};
+
+struct block
+{
+    unsigned int start;
+    unsigned int end; // first address past the block
+    int count;
+    // While profiling: complete runs of the block and their T-states, not
+    // yet handed over to cpu->profile
+    unsigned long long profile_runs;
+    unsigned long long profile_tstates;
+    struct block_op ops[BLOCK_MAX_OPS];
+};
+
+struct block_cache
+{
+    unsigned long long decode_at; // instruction count from which a decode is allowed
+    // One bit per CPU8085_DIRTY_LINE bytes that some block was decoded from,
+    // so writes near but not into code don't search the table
+    unsigned long long code[CPU8085_DIRTY_WORDS];
+    struct jit8085 *jit; // NULL unless cpu8085_enable_jit()
+    struct block blocks[BLOCK_CACHE_SLOTS];
+};
+
+// Lazy flags: what the last ALU micro-op did (cpu8085.lazy_op). CY is kept
+// as it goes: while blocks run, lazy_carry is always the current carry. S,
+// Z and P all follow from lazy_result, so a conditional jump never needs F
+// itself; AC comes from bit 4 of
+// lazy_aux ^ lazy_result, lazy_aux being a ^ b of an addition/subtraction.
+// F is built, exactly as the flag tables give it, only when read.
+
+static __attribute__((noinline)) void build_flags(cpu8085 *cpu)
+{
+    unsigned char aux = cpu->lazy_op == CPU8085_LAZY_ARITH ? (cpu->lazy_aux ^ cpu->lazy_result) & AUX_CARRY_FLAG :
+                        cpu->lazy_op == CPU8085_LAZY_ANA ? AUX_CARRY_FLAG : 0;
+
+    cpu->F = szp_flags[cpu->lazy_result] | cpu->lazy_carry | aux;
+    cpu->lazy_op = CPU8085_LAZY_NONE;
+}
+
+// Make F current before anything reads it
+static inline void flags_now(cpu8085 *cpu)
+{
+    if (cpu->lazy_op != CPU8085_LAZY_NONE)
+    {
+        build_flags(cpu);
+    }
+}
+
+static inline void lazy_flags(cpu8085 *cpu, int op, unsigned char result, unsigned char aux, int carry)
+{
+    cpu->lazy_op = op;
+    cpu->lazy_result = result;
+    cpu->lazy_aux = aux;
+    cpu->lazy_carry = carry;
+}
+
+// alu_op() with the flags left for later
+static inline __attribute__((always_inline)) void lazy_alu_op(cpu8085 *cpu, int op, unsigned char value)
+{
+    unsigned char a = cpu->A;
+    int carry = (op == 1 || op == 3) ? cpu->lazy_carry : 0;
+    int result;
+
+    switch (op)
+    {
+    case 0: // ADD
+    case 1: // ADC
+        result = a + value + carry;
+        cpu->A = result;
+        lazy_flags(cpu, CPU8085_LAZY_ARITH, result, a ^ value, (result >> 8) & CARRY_FLAG);
+        break;
+    case 2: // SUB
+    case 3: // SBB
+        result = a - value - carry;
+        cpu->A = result;
+        lazy_flags(cpu, CPU8085_LAZY_ARITH, result, a ^ value, (result >> 8) & CARRY_FLAG);
+        break;
+    case 4: // ANA
+        cpu->A &= value;
+        lazy_flags(cpu, CPU8085_LAZY_ANA, cpu->A, 0, 0);
+        break;
+    case 5: // XRA
+        cpu->A ^= value;
+        lazy_flags(cpu, CPU8085_LAZY_LOGIC, cpu->A, 0, 0);
+        break;
+    case 6: // ORA
+        cpu->A |= value;
+        lazy_flags(cpu, CPU8085_LAZY_LOGIC, cpu->A, 0, 0);
+        break;
+    case 7: // CMP
+        result = a - value;
+        lazy_flags(cpu, CPU8085_LAZY_ARITH, result, a ^ value, (result >> 8) & CARRY_FLAG);
+        break;
+    }
+}
+
+// Any instruction, through its handler in opcode_table
+static void uop_generic(cpu8085 *cpu, const struct block_op *op)
+{
+    flags_now(cpu);
+    cpu->PC = op->pc + 1;
+    opcode_table[op->opcode](cpu, op->opcode);
+    cpu->lazy_carry = cpu->F & CARRY_FLAG;
+}
+
+// The same for handlers that neither read nor write F
+static void uop_generic_noflags(cpu8085 *cpu, const struct block_op *op)
+{
+    cpu->PC = op->pc + 1;
+    opcode_table[op->opcode](cpu, op->opcode);
+}
+
+// MOV r1, r2 with neither of them M
+static void uop_mov(cpu8085 *cpu, const struct block_op *op)
+{
+    cpu->reg[DDD(op->opcode)] = cpu->reg[SSS(op->opcode)];
+    cpu->PC = op->next_pc;
+}
+
+static void uop_mvi(cpu8085 *cpu, const struct block_op *op)
+{
+    cpu->reg[DDD(op->opcode)] = op->operand;
+    cpu->PC = op->next_pc;
+}
+
+static void uop_inr(cpu8085 *cpu, const struct block_op *op)
+{
+    unsigned char value = cpu->reg[DDD(op->opcode)];
+    cpu->reg[DDD(op->opcode)] = value + 1;
+    lazy_flags(cpu, CPU8085_LAZY_ARITH, value + 1, value ^ 1, cpu->lazy_carry);
+    cpu->PC = op->next_pc;
+}
+
+static void uop_dcr(cpu8085 *cpu, const struct block_op *op)
+{
+    unsigned char value = cpu->reg[DDD(op->opcode)];
+    cpu->reg[DDD(op->opcode)] = value - 1;
+    lazy_flags(cpu, CPU8085_LAZY_ARITH, value - 1, value ^ 1, cpu->lazy_carry);
+    cpu->PC = op->next_pc;
+}
+
+static void uop_jmp(cpu8085 *cpu, const struct block_op *op)
+{
+    cpu->PC = op->next_pc;
+    jump(cpu, op->operand, 3);
+}
+
+// Jcc, one micro-op per condition, testing the lazy state directly
+#define JCC_UOP(name, lazy_test) \
+    static void uop_##name(cpu8085 *cpu, const struct block_op *op) \
+    { \
+        cpu->PC = op->next_pc; \
+        if (cpu->lazy_op != CPU8085_LAZY_NONE ? (lazy_test) : condition(cpu, op->opcode)) \
+        { \
+            jump(cpu, op->operand, 3); \
+            cpu->tstates += CPU8085_JCC_TAKEN_TSTATES; \
+        } \
+    }
+
+JCC_UOP(jnz, cpu->lazy_result != 0)
+JCC_UOP(jz, cpu->lazy_result == 0)
+JCC_UOP(jnc, !cpu->lazy_carry)
+JCC_UOP(jc, cpu->lazy_carry)
+JCC_UOP(jpo, !(szp_flags[cpu->lazy_result] & PARITY_FLAG))
+JCC_UOP(jpe, szp_flags[cpu->lazy_result] & PARITY_FLAG)
+JCC_UOP(jp, !(cpu->lazy_result & 0x80))
+JCC_UOP(jm, cpu->lazy_result & 0x80)
+
+// ALU group on a register (not M) and immediate
+#define ALU_UOPS(name, op) \
+    static void uop_##name(cpu8085 *cpu, const struct block_op *o) { lazy_alu_op(cpu, op, cpu->reg[SSS(o->opcode)]); cpu->PC = o->next_pc; } \
+    static void uop_##name##_imm(cpu8085 *cpu, const struct block_op *o) { lazy_alu_op(cpu, op, o->operand); cpu->PC = o->next_pc; }
+
+ALU_UOPS(add, 0)
+ALU_UOPS(adc, 1)
+ALU_UOPS(sub, 2)
+ALU_UOPS(sbb, 3)
+ALU_UOPS(ana, 4)
+ALU_UOPS(xra, 5)
+ALU_UOPS(ora, 6)
+ALU_UOPS(cmp, 7)
+
+static void (*uop_for(unsigned char opcode))(cpu8085 *, const struct block_op *)
+{
+    static void (*const alu[8])(cpu8085 *, const struct block_op *) = {
+        uop_add, uop_adc, uop_sub, uop_sbb, uop_ana, uop_xra, uop_ora, uop_cmp,
+    };
+    static void (*const jcc[8])(cpu8085 *, const struct block_op *) = {
+        uop_jnz, uop_jz, uop_jnc, uop_jc, uop_jpo, uop_jpe, uop_jp, uop_jm,
+    };
+    static void (*const alu_imm[8])(cpu8085 *, const struct block_op *) = {
+        uop_add_imm, uop_adc_imm, uop_sub_imm, uop_sbb_imm,
+        uop_ana_imm, uop_xra_imm, uop_ora_imm, uop_cmp_imm,
+    };
+    void (*handler)(cpu8085 *, unsigned char) = opcode_table[opcode];
+
+    if (handler == op_mov && DDD(opcode) != REG_M && SSS(opcode) != REG_M)
+    {
+        return uop_mov;
+    }
+    if (DDD(opcode) != REG_M)
+    {
+        if (handler == op_mvi)
+        {
+            return uop_mvi;
+        }
+        if (handler == op_inr)
+        {
+            return uop_inr;
+        }
+        if (handler == op_dcr)
+        {
+            return uop_dcr;
+        }
+    }
+    if (opcode >= 0x80 && opcode <= 0xBF && SSS(opcode) != REG_M)
+    {
+        return alu[DDD(opcode)];
+    }
+    if ((opcode & 0xC7) == 0xC6)
+    {
+        return alu_imm[DDD(opcode)];
+    }
+    if (handler == op_jmp)
+    {
+        return uop_jmp;
+    }
+    if (handler == op_jcc)
+    {
+        return jcc[DDD(opcode)];
+    }
+    if (handler == op_mov || handler == op_mvi || handler == op_lxi || handler == op_inx ||
+        handler == op_dcx || handler == op_sta || handler == op_lda || handler == op_stax ||
+        handler == op_ldax || handler == op_shld || handler == op_lhld || handler == op_xchg ||
+        handler == op_xthl || handler == op_sphl || handler == op_cma || handler == op_in ||
+        handler == op_out || handler == op_call || handler == op_ret || handler == op_rst ||
+        handler == op_pchl || handler == op_nop || handler == op_ldhi || handler == op_shlx ||
+        handler == op_lhlx || ((handler == op_push || handler == op_pop) && RP(opcode) != 3))
+    {
+        return uop_generic_noflags;
+    }
+    return uop_generic;
+}
+
+static int ends_block(unsigned char opcode)
+{
+    void (*handler)(cpu8085 *, unsigned char) = opcode_table[opcode];
+
+    return handler == op_jmp || handler == op_jcc || handler == op_call || handler == op_ccc ||
+           handler == op_ret || handler == op_rcc || handler == op_rst || handler == op_pchl ||
+           handler == op_hlt || handler == op_rstv || handler == op_jk;
+}
+
+// Hand runs runs of the first n ops of a block, tstates in all, to the
+// profile. Only a block's last op can take more than its base T-states (a
+// taken branch), so it gets what the others did not take. Returns the
+// last op's T-states.
+static unsigned long long profile_ops(struct profile *profile, const struct block_op *ops, int n,
+                                      unsigned long long runs, unsigned long long tstates)
+{
+    for (int i = 0; i < n - 1; i++)
+    {
+        profile_count(profile, ops[i].pc, ops[i].opcode, runs, runs * ops[i].tstates);
+        tstates -= runs * ops[i].tstates;
+    }
+    profile_count(profile, ops[n - 1].pc, ops[n - 1].opcode, runs, tstates);
+    return tstates;
+}
+
+// Before a block is dropped or replaced, or the profile is read. The back
+// edges of complete runs are counted here: a JMP always jumps, and a taken
+// Jcc shows in the T-states.
+static void fold_block_profile(cpu8085 *cpu, struct block *block)
+{
+    if (cpu->profile != NULL && block->start != BLOCK_EMPTY && block->profile_runs)
+    {
+        unsigned long long runs = block->profile_runs;
+        const struct block_op *last = &block->ops[block->count - 1];
+        unsigned long long tstates = profile_ops(cpu->profile, block->ops, block->count, runs,
+                                                 block->profile_tstates);
+        if (profile_branch_kind[last->opcode] == PROFILE_JUMP && last->operand <= last->pc)
+        {
+            cpu->profile->back_edges[last->pc] +=
+                last->opcode == 0xC3 ? runs : (tstates - runs * last->tstates) / CPU8085_JCC_TAKEN_TSTATES;
+        }
+    }
+    block->profile_runs = 0;
+    block->profile_tstates = 0;
+}
+
+// After n ops of block ran for tstates T-states. Complete runs are only
+// counted in the block itself, and only calls and returns need following
+// straight away.
+static inline void profile_block(cpu8085 *cpu, struct block *block, unsigned int start, int n,
+                                 unsigned long long tstates)
+{
+    struct profile *profile = cpu->profile;
+    const struct block_op *last = &block->ops[n - 1];
+
+    profile_attribute(profile, n, tstates);
+    if (n == block->count && block->start == start)
+    {
+        block->profile_runs++;
+        block->profile_tstates += tstates;
+        if (profile_branch_kind[last->opcode] <= PROFILE_JUMP)
+        {
+            return;
+        }
+    }
+    else
+    {
+        profile_ops(profile, block->ops, n, 1, tstates);
+    }
+    profile_branch(profile, last->opcode, last->pc, last->next_pc, cpu->PC, cpu->SP);
+}
+
+void cpu8085_sync_flags(cpu8085 *cpu)
+{
+    flags_now(cpu);
+}
+
+void cpu8085_sync_profile(cpu8085 *cpu)
+{
+    for (int i = 0; cpu->blocks != NULL && i < BLOCK_CACHE_SLOTS; i++)
+    {
+        fold_block_profile(cpu, &cpu->blocks->blocks[i]);
+    }
+}
+
+int cpu8085_enable_blocks(cpu8085 *cpu)
+{
+    if (cpu->blocks == NULL)
+    {
+        cpu->blocks = calloc(1, sizeof(*cpu->blocks));
+        if (cpu->blocks == NULL)
+        {
+            return -1;
+        }
+    }
+    cpu8085_flush_blocks(cpu);
+    return 0;
+}
+
+int cpu8085_enable_jit(cpu8085 *cpu)
+{
+    if (cpu8085_enable_blocks(cpu) < 0)
+    {
+        return -1;
+    }
+    if (cpu->blocks->jit == NULL)
+    {
+        cpu->blocks->jit = jit8085_create(cpu->blocks->code);
+        if (cpu->blocks->jit == NULL)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void free_blocks(cpu8085 *cpu)
+{
+    if (cpu->blocks != NULL)
+    {
+        jit8085_destroy(cpu->blocks->jit);
+    }
+    free(cpu->blocks);
+}
+
+void cpu8085_flush_blocks(cpu8085 *cpu)
+{
+    for (int page = 0; page < 256; page++)
+    {
+        cpu->mmio[page] &= ~CPU8085_PAGE_CODE;
+    }
+    if (cpu->blocks == NULL)
+    {
+        return;
+    }
+    memset(cpu->blocks->code, 0, sizeof(cpu->blocks->code));
+    cpu->blocks->decode_at = 0;
+    if (cpu->blocks->jit != NULL)
+    {
+        jit8085_flush(cpu->blocks->jit);
+    }
+    for (int i = 0; i < BLOCK_CACHE_SLOTS; i++)
+    {
+        fold_block_profile(cpu, &cpu->blocks->blocks[i]);
+        cpu->blocks->blocks[i].start = BLOCK_EMPTY;
+    }
+}
+
+// A write to a page with cached code: drop every block holding addr
+static void invalidate_code(cpu8085 *cpu, unsigned short addr)
+{
+    struct block_cache *cache = cpu->blocks;
+    unsigned int line = addr / CPU8085_DIRTY_LINE;
+
+    if (cache == NULL || !(cache->code[line / 64] & (1ULL << (line % 64))))
+    {
+        return;
+    }
+    if (cache->jit != NULL)
+    {
+        jit8085_invalidate(cache->jit, addr);
+    }
+    for (int i = 0; i < BLOCK_CACHE_SLOTS; i++)
+    {
+        struct block *block = &cache->blocks[i];
+        if (addr >= block->start && addr < block->end)
+        {
+            fold_block_profile(cpu, block);
+            block->start = BLOCK_EMPTY;
+        }
+    }
+}
+
+// An instruction running past FFFF is left out, so such a block can be empty
+static void decode_block(cpu8085 *cpu, struct block *block, unsigned short pc)
+{
+    unsigned int addr = pc;
+
+    fold_block_profile(cpu, block);
+    block->count = 0;
+    while (block->count < BLOCK_MAX_OPS && addr < CPU8085_MEMORY_SIZE)
+    {
+        unsigned char opcode = cpu->memory[addr];
+        unsigned int next = addr + cpu8085_opcode_length[opcode];
+        if (next > CPU8085_MEMORY_SIZE)
+        {
+            break;
+        }
+        // A breakpoint is only looked for at the start of a block
+        if (block->count > 0 && cpu->debug != NULL && debug8085_armed(cpu->debug, addr))
+        {
+            break;
+        }
+        struct block_op *op = &block->ops[block->count++];
+        op->fn = uop_for(opcode);
+        op->pc = addr;
+        op->next_pc = next;
+        op->opcode = opcode;
+        op->tstates = cpu8085_opcode_tstates[opcode];
+        op->operand = cpu8085_opcode_length[opcode] == 3 ? cpu->memory[addr + 1] | cpu->memory[addr + 2] << 8 :
+                      cpu8085_opcode_length[opcode] == 2 ? cpu->memory[addr + 1] : 0;
+        addr = next;
+        if (ends_block(opcode))
+        {
+            break;
+        }
+    }
+    // An empty block is not kept, or the next visit to pc would run it
+    block->start = block->count > 0 ? pc : BLOCK_EMPTY;
+    block->end = addr;
+
+    for (unsigned int a = pc; a < addr; a += CPU8085_DIRTY_LINE - a % CPU8085_DIRTY_LINE)
+    {
+        unsigned int line = a / CPU8085_DIRTY_LINE;
+        cpu->blocks->code[line / 64] |= 1ULL << (line % 64);
+        cpu->mmio[a >> 8] |= CPU8085_PAGE_CODE;
+    }
+}
+
+// Run blocks from PC for up to max instructions. Stops after the
+// instruction that reaches tstate_limit or next_event, or that overwrote
+// its own block, just where the one-at-a-time loops would have stopped.
+// Returns the number of instructions run; 0 leaves the instruction at PC
+// to emulate_instruction().
+static unsigned long long run_blocks(cpu8085 *cpu, unsigned long long max, unsigned long long tstate_limit)
+{
+    struct block_cache *cache = cpu->blocks;
+    struct history8085 *history = cpu->history;
+    unsigned long long first = cpu->instructions;
+    unsigned long long end_count = max < ~0ULL - first ? first + max : ~0ULL;
+    // Translated code neither profiles, nor checks breakpoints, nor logs writes
+    struct jit8085 *jit = cpu->profile == NULL && cpu->debug == NULL && history == NULL ? cache->jit : NULL;
+
+    cpu->lazy_carry = cpu->F & CARRY_FLAG;
+    while (cpu->instructions < end_count && !cpu->halted &&
+           cpu->tstates < tstate_limit && cpu->tstates < cpu->next_event)
+    {
+        if (cpu->debug != NULL && debug8085_break(cpu))
+        {
+            break;
+        }
+        if (history != NULL)
+        {
+            if (cpu->instructions >= history->next_keyframe)
+            {
+                history8085_keyframe(cpu);
+            }
+            history8085_reserve(history, BLOCK_MAX_OPS);
+        }
+        if (jit != NULL && jit8085_run(jit, cpu, end_count, tstate_limit) > 0)
+        {
+            continue;
+        }
+        struct block *block = &cache->blocks[cpu->PC % BLOCK_CACHE_SLOTS];
+        unsigned int start = cpu->PC;
+        if (block->start != start)
+        {
+            if (cpu->instructions < cache->decode_at)
+            {
+                // Over the ration: a block's worth of instructions uncached
+                flags_now(cpu);
+                for (int i = 0; i < BLOCK_MAX_OPS && cpu->instructions < end_count && !cpu->halted &&
+                     cpu->tstates < tstate_limit && cpu->tstates < cpu->next_event; i++)
+                {
+                    if (i > 0 && cpu->debug != NULL && debug8085_break(cpu))
+                    {
+                        break;
+                    }
+                    if (history != NULL)
+                    {
+                        history8085_record(history, cpu, 1);
+                    }
+                    if (cpu->profile != NULL)
+                    {
+                        execute_profiled(cpu);
+                    }
+                    else
+                    {
+                        execute(cpu);
+                    }
+                }
+                cpu->lazy_carry = cpu->F & CARRY_FLAG;
+                continue;
+            }
+            unsigned long long reserve = cpu->instructions > BLOCK_DECODE_BURST * BLOCK_DECODE_COST ?
+                                         cpu->instructions - BLOCK_DECODE_BURST * BLOCK_DECODE_COST : 0;
+            cache->decode_at = (cache->decode_at > reserve ? cache->decode_at : reserve) + BLOCK_DECODE_COST;
+
+            decode_block(cpu, block, cpu->PC);
+            if (block->count == 0)
+            {
+                break;
+            }
+        }
+
+        const struct block_op *op = block->ops;
+        const struct block_op *end = op + (end_count - cpu->instructions < (unsigned long long)block->count ?
+                                           end_count - cpu->instructions : (unsigned long long)block->count);
+        unsigned long long tstates = cpu->tstates;
+        if (history == NULL)
+        {
+            do
+            {
+                cpu->tstates += op->tstates;
+                op->fn(cpu, op);
+                op++;
+            } while (op < end && cpu->tstates < cpu->next_event && cpu->tstates < tstate_limit &&
+                     block->start == start);
+        }
+        else
+        {
+            // The same, keeping the undo log's writes apart by instruction
+            struct history8085_entry *entry = history8085_record(history, cpu, 0);
+            do
+            {
+                history->offset = op - block->ops;
+                cpu->tstates += op->tstates;
+                op->fn(cpu, op);
+                op++;
+            } while (op < end && cpu->tstates < cpu->next_event && cpu->tstates < tstate_limit &&
+                     block->start == start);
+            entry->executed = op - block->ops;
+        }
+        cpu->instructions += op - block->ops;
+        if (cpu->profile != NULL)
+        {
+            profile_block(cpu, block, start, op - block->ops, cpu->tstates - tstates);
+        }
+    }
+    flags_now(cpu);
+    return cpu->instructions - first;
+}
+
+// Run the next instruction(s): a block when the cache is on and the run is
+// not traced, otherwise a single instruction
+static inline void run_some(cpu8085 *cpu, unsigned long long max, unsigned long long tstate_limit)
+{
+    if (cpu->blocks != NULL && cpu->bintrace == NULL && !TRACE_ENABLED(cpu) &&
+        run_blocks(cpu, max, tstate_limit) > 0)
+    {
+        return;
+    }
+    emulate_instruction(cpu);
+}
+
+// A fork's block cache is only made once it runs; without one if that fails
+static inline void make_deferred_blocks(cpu8085 *cpu)
+{
+    if (cpu->blocks_deferred)
+    {
+        cpu->blocks_deferred = 0;
+        cpu8085_enable_blocks(cpu);
+    }
+}
+
+unsigned long long cpu8085_run(cpu8085 *cpu, unsigned long long max_instructions)
+{
+    unsigned long long start = cpu->instructions;
+
+    make_deferred_blocks(cpu);
+    while (!cpu->halted && (max_instructions == 0 || cpu->instructions - start < max_instructions))
+    {
+        run_some(cpu, max_instructions ? max_instructions - (cpu->instructions - start) : ~0ULL, ~0ULL);
+    }
+    return cpu->instructions - start;
+}
+
+static double monotonic_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Instructions between two looks at the wall clock
+#define WATCHDOG_INTERVAL 4096
+
+enum cpu8085_stop cpu8085_run_limited(cpu8085 *cpu, const struct cpu8085_limits *limits)
+{
+    unsigned long long start = cpu->instructions;
+    unsigned long long idle = 0; // steps spent idle in HLT
+    unsigned long long tstates = limits->tstates ? cpu->tstates + limits->tstates : ~0ULL;
+    double deadline = limits->seconds > 0 ? monotonic_seconds() + limits->seconds : 0;
+
+    make_deferred_blocks(cpu);
+    while (!cpu->halted)
+    {
+        // Idle steps count as instructions, or a CPU waiting in HLT for
+        // an interrupt that never comes would outlast the limit
+        unsigned long long done = cpu->instructions - start + idle;
+        if (limits->instructions && done >= limits->instructions)
+        {
+            return CPU8085_STOP_INSTRUCTIONS;
+        }
+        if (cpu->tstates >= tstates)
+        {
+            return CPU8085_STOP_TSTATES;
+        }
+        if (deadline && monotonic_seconds() >= deadline)
+        {
+            return CPU8085_STOP_TIMEOUT;
+        }
+
+        // Run to the next wall-clock check, or to the instruction limit if
+        // nearer, coming back here after an idle step
+        unsigned long long chunk = limits->instructions ? limits->instructions - done : ~0ULL - cpu->instructions;
+        if (deadline && chunk > WATCHDOG_INTERVAL)
+        {
+            chunk = WATCHDOG_INTERVAL;
+        }
+        unsigned long long end = cpu->instructions + chunk;
+        while (!cpu->halted && cpu->instructions < end && cpu->tstates < tstates)
+        {
+            unsigned long long before = cpu->instructions;
+            run_some(cpu, end - cpu->instructions, tstates);
+            if (cpu->instructions == before && !cpu->halted)
+            {
+                idle++;
+                break;
+            }
+        }
+    }
+    return cpu8085_stop_reason(cpu);
+}
+
+enum cpu8085_stop cpu8085_stop_reason(const cpu8085 *cpu)
+{
+    return cpu->fault ? (enum cpu8085_stop)cpu->fault : CPU8085_STOP_HALT;
+}
+
+const char *cpu8085_stop_name(enum cpu8085_stop reason)
+{
+    switch (reason)
+    {
+    case CPU8085_STOP_HALT:
+        return "halt";
+    case CPU8085_STOP_INSTRUCTIONS:
+        return "instructions";
+    case CPU8085_STOP_TSTATES:
+        return "tstates";
+    case CPU8085_STOP_TIMEOUT:
+        return "timeout";
+    case CPU8085_STOP_LOOP:
+        return "loop";
+    case CPU8085_STOP_BREAKPOINT:
+        return "breakpoint";
+    case CPU8085_STOP_WATCHPOINT:
+        return "watchpoint";
+    }
+    return "unknown";
+}
+
+unsigned long long cpu8085_run_tstates(cpu8085 *cpu, unsigned long long max_tstates)
+{
+    unsigned long long start = cpu->tstates;
+
+    unsigned long long end = max_tstates ? start + max_tstates : ~0ULL;
+
+    make_deferred_blocks(cpu);
+    while (!cpu->halted && cpu->tstates < end)
+    {
+        run_some(cpu, ~0ULL, end);
+    }
+    return cpu->tstates - start;
+}
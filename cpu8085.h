@@ -0,0 +1,296 @@
+#ifndef CPU8085_H
+#define CPU8085_H
+
+#include <stddef.h>
+
+#include "bintrace.h"
+#include "bus8085.h"
+
+// Reentrant Intel 8085 core. All machine state lives in a cpu8085 context,
+// so any number of independent CPUs can run in one process (one thread per
+// context at a time).
+
+#define CPU8085_MEMORY_SIZE 65536
+
+// Memory writes are tracked per line of this many bytes
+#define CPU8085_DIRTY_LINE 16
+#define CPU8085_DIRTY_WORDS (CPU8085_MEMORY_SIZE / CPU8085_DIRTY_LINE / 64)
+
+// Flag bit positions in the F register
+#define CARRY_FLAG 0x01
+#define AUX_CARRY_FLAG 0x10
+#define PARITY_FLAG 0x04
+#define ZERO_FLAG 0x40
+#define SIGN_FLAG 0x80
+// Undocumented: signed overflow (V) and V xor S (K) of DSUB, tested by
+// RSTV, JNK and JK. No other instruction but POP PSW sets them.
+#define OVERFLOW_FLAG 0x02
+#define K_FLAG 0x20
+
+// Instruction timing and length, by opcode. The T-states are the not-taken
+// count for conditional branches, which cost this much more when taken:
+// Jcc, JNK and JK 7 -> 10, Ccc 9 -> 18, Rcc and RSTV 6 -> 12.
+extern const unsigned char cpu8085_opcode_tstates[256];
+extern const unsigned char cpu8085_opcode_length[256];
+
+#define CPU8085_JCC_TAKEN_TSTATES 3
+#define CPU8085_CCC_TAKEN_TSTATES 9
+#define CPU8085_RCC_TAKEN_TSTATES 6
+#define CPU8085_RSTV_TAKEN_TSTATES 6
+
+// Interrupt inputs for cpu8085_raise() / cpu8085_lower(), also the bits of
+// cpu8085.int_lines. RST 7.5 and TRAP are edge-triggered: a raise is latched
+// until the interrupt is taken. RST 6.5, RST 5.5 and INTR are levels that
+// stay asserted until lowered, except that taking INTR acknowledges it.
+#define CPU8085_INT_RST55 0x01
+#define CPU8085_INT_RST65 0x02
+#define CPU8085_INT_RST75 0x04
+#define CPU8085_INT_TRAP 0x08
+#define CPU8085_INT_INTR 0x10
+
+// Bits of cpu8085.mmio[]
+#define CPU8085_PAGE_DEVICE 0x01
+#define CPU8085_PAGE_CODE 0x02
+#define CPU8085_PAGE_WATCH 0x04
+#define CPU8085_PAGE_HISTORY 0x08
+
+// What the last ALU operation in the block cache did (cpu8085.lazy_op)
+#define CPU8085_LAZY_NONE 0  // F is current
+#define CPU8085_LAZY_ARITH 1 // ADD/ADC/SUB/SBB/CMP/INR/DCR
+#define CPU8085_LAZY_ANA 2   // AC set
+#define CPU8085_LAZY_LOGIC 3 // XRA/ORA: AC clear
+
+// Scheduled device events: a callback run once the T-state counter reaches
+// `when`. Kept in a min-heap of at most CPU8085_MAX_EVENTS.
+#define CPU8085_MAX_EVENTS 32
+
+struct cpu8085;
+struct profile;
+struct debug8085;
+typedef void (*cpu8085_event_fn)(struct cpu8085 *cpu, void *context);
+
+struct cpu8085_event
+{
+    unsigned long long when;
+    cpu8085_event_fn fn;
+    void *context;
+};
+
+// Why a run stopped. The values double as the emulator's exit status
+// (1 is left for usage and load errors).
+enum cpu8085_stop
+{
+    CPU8085_STOP_HALT = 0,          // HLT executed
+    CPU8085_STOP_INSTRUCTIONS = 2,  // instruction budget used up
+    CPU8085_STOP_TSTATES = 3,       // T-state budget used up
+    CPU8085_STOP_TIMEOUT = 4,       // wall-clock limit reached
+    CPU8085_STOP_LOOP = 5,          // jump to itself: the program can never progress
+    // 6 is unused: there are no unimplemented opcodes left
+    CPU8085_STOP_BREAKPOINT = 7,    // debugger breakpoint (see debug8085.h)
+    CPU8085_STOP_WATCHPOINT = 8,    // debugger watchpoint
+};
+
+// Watchdog limits for cpu8085_run_limited(), counted from the start of the
+// call; 0 disables a limit. Each step idle in HLT (a skip to the next
+// event) counts as an instruction.
+struct cpu8085_limits
+{
+    unsigned long long instructions;
+    unsigned long long tstates;
+    double seconds; // host wall-clock time
+};
+
+typedef struct cpu8085
+{
+    // 8-bit registers, laid out in the order of the 3-bit register field of
+    // an opcode (B C D E H L M A) so they can be indexed by it. Code 6 is M,
+    // the memory byte addressed by HL, so that slot holds F instead.
+    union
+    {
+        unsigned char reg[8];
+        struct
+        {
+            unsigned char B, C, D, E, H, L, F, A;
+        };
+    };
+    unsigned short PC, SP;
+
+    int halted;                    // set by HLT, and on a fault
+    int fault;                     // 0 or CPU8085_STOP_LOOP,
+                                   // or a debugger stop
+    int trace;                     // print every instruction (TRACE builds only)
+    unsigned long long tstates;    // T-states (clock cycles) executed so far, with the
+                                   // taken/not-taken cost of conditional branches
+    unsigned long long instructions;
+
+    // Interrupt controller
+    unsigned char int_enable;       // IE flip-flop, set by EI and cleared by DI and by taking an interrupt
+    unsigned char int_enable_delay; // EI only takes effect after the following instruction
+    unsigned char int_mask;         // SIM mask bits: 0 RST 5.5, 1 RST 6.5, 2 RST 7.5 (1 = masked)
+    unsigned char int_lines;        // asserted/latched inputs, CPU8085_INT_*
+    unsigned char intr_opcode;      // RST instruction an INTR device puts on the bus
+    unsigned char sod;              // serial output data latched by SIM
+    unsigned char sid;              // serial input data returned by RIM
+    int waiting;                    // HLT with events pending: idle until an interrupt
+
+    // Pending work (events, interrupts, EI delay, HLT idling) is looked at
+    // before an instruction only once tstates reaches next_event
+    unsigned long long next_event;
+    struct cpu8085_event events[CPU8085_MAX_EVENTS];
+    int event_count;
+    const struct cpu8085_event *running_event; // the event whose callback runs, or NULL
+
+    // One bit per CPU8085_DIRTY_LINE bytes of memory, set when an instruction
+    // writes there. Cleared by cpu8085_init() and cpu8085_clear_dirty().
+    unsigned long long dirty[CPU8085_DIRTY_WORDS];
+
+    // I/O devices (see bus8085.h), NULL for none: IN then reads FF and OUT
+    // does nothing. mmio[page] flags the 256-byte pages whose data accesses
+    // need a detour: CPU8085_PAGE_DEVICE pages hold a memory-mapped region
+    // and go through the bus, writes to CPU8085_PAGE_CODE pages check the
+    // block cache for code they overwrite, CPU8085_PAGE_WATCH pages hold a
+    // debugger watchpoint, and while an undo log records, every page is a
+    // CPU8085_PAGE_HISTORY page whose writes it logs.
+    struct bus8085 *bus;
+    unsigned char mmio[256];
+
+    struct block_cache *blocks;          // decoded instruction blocks, NULL when off
+    unsigned char blocks_deferred;       // a fork's cache, made by its first cpu8085_run*() call
+    struct profile *profile;             // execution profile (see profile.h), NULL when off
+    struct debug8085 *debug;             // breakpoints and watchpoints (see debug8085.h), NULL when off
+    struct history8085 *history;         // undo log for reverse execution (see history8085.h), NULL when off
+
+    // Inside the block cache, F is only built when something reads it: an
+    // ALU micro-op records what it did here instead. F is always up to date
+    // once a cpu8085_run*() call returns.
+    unsigned char lazy_op;               // CPU8085_LAZY_*
+    unsigned char lazy_result, lazy_aux, lazy_carry;
+
+    struct bintrace *bintrace;           // binary trace output, NULL when off
+    struct trace_record *trace_record;   // record of the instruction in progress
+
+    // CPU8085_MEMORY_SIZE bytes in a mapping of their own. Forked CPUs map a
+    // frozen image of their parent's memory copy-on-write.
+    unsigned char *memory;
+    int image_fd;                        // memfd holding the image children are forked from, or -1
+    unsigned long long image_instructions; // instruction count when that image was taken
+} cpu8085;
+
+// Allocate a CPU in its power-on state; NULL if out of memory
+cpu8085 *cpu8085_create(void);
+void cpu8085_destroy(cpu8085 *cpu);
+
+// New CPU with the parent's registers, counters and memory. The memory is
+// shared copy-on-write with a frozen image of the parent's (host pages of
+// 4 KiB), so a fork costs a mapping plus a page copy per page it writes.
+// Forks taken while the parent has not executed in between share one image,
+// so don't write to parent->memory by hand between two forks.
+// If the parent has a block cache, the child gets one of its own (never
+// translating to host code) on its first cpu8085_run*() call. The child has
+// no bus and no scheduled events, since those belong to the parent's
+// devices: attach devices of its own if it needs any. Tracing, profiling,
+// the debugger and the undo log are not inherited either.
+// NULL if the fork failed.
+cpu8085 *cpu8085_fork(cpu8085 *parent);
+
+// Clear registers, counters and memory; SP starts at the top of memory.
+// A forked CPU gets fresh private memory. An attached bus stays attached.
+void cpu8085_init(cpu8085 *cpu);
+
+// Clear registers, counters, interrupt state and scheduled events, keeping
+// memory (PC = 0, SP = FFFF, interrupts disabled, RST 7.5/6.5/5.5 masked)
+void cpu8085_reset(cpu8085 *cpu);
+
+// Assert / release an interrupt input (CPU8085_INT_*)
+void cpu8085_raise(cpu8085 *cpu, int line);
+void cpu8085_lower(cpu8085 *cpu, int line);
+
+// Run fn(cpu, context) once tstates reaches when. Returns 0, or -1 if the
+// event queue is full or if a callback reschedules itself (same fn and
+// context) for a time that has already come, which would run it forever.
+int cpu8085_schedule(cpu8085 *cpu, unsigned long long when, cpu8085_event_fn fn, void *context);
+
+// Drop every scheduled event with this callback and context
+void cpu8085_cancel(cpu8085 *cpu, cpu8085_event_fn fn, void *context);
+
+// Execute one instruction at PC, first taking any due events and pending
+// interrupt. After a HLT with events scheduled, each call instead skips
+// ahead to the next event until an interrupt wakes the CPU; with nothing
+// scheduled HLT stops it for good.
+void emulate_instruction(cpu8085 *cpu);
+
+// Block cache for cpu8085_run*(): straight-line runs of code are decoded
+// once and replayed as a block, instead of fetching and dispatching each
+// instruction through emulate_instruction(). Writes by the program into
+// cached code drop the blocks concerned, but memory changed by hand (other
+// than through cpu8085_init() or snapshot_load()) needs
+// cpu8085_flush_blocks(). Runs that are traced step one instruction at a
+// time regardless. Returns 0, or -1 if out of memory.
+int cpu8085_enable_blocks(cpu8085 *cpu);
+void cpu8085_flush_blocks(cpu8085 *cpu);
+
+// The block cache, plus translation of hot blocks into host machine code
+// (x86-64 only, see jit8085.h). Translated code is bypassed while a run is
+// profiled, debugged or recorded for going back. Returns 0, or -1 if the
+// host can't run translated code or is out of memory; the block cache is
+// enabled either way.
+int cpu8085_enable_jit(cpu8085 *cpu);
+
+// Bring F up to date after changing the lazy flag state (lazy_op and the
+// rest) by hand, as a debugger going back in time does
+void cpu8085_sync_flags(cpu8085 *cpu);
+
+// Hand what the block cache has counted for cpu->profile over to it; call
+// before reading the profile
+void cpu8085_sync_profile(cpu8085 *cpu);
+
+// Run until HLT or until max_instructions have executed (0 = no limit);
+// returns the number of instructions executed by this call
+unsigned long long cpu8085_run(cpu8085 *cpu, unsigned long long max_instructions);
+
+// Run until HLT or until at least max_tstates clock cycles have passed
+// (0 = no limit); returns the number of T-states executed by this call.
+// The last instruction may overshoot the budget by up to 17 T-states.
+unsigned long long cpu8085_run_tstates(cpu8085 *cpu, unsigned long long max_tstates);
+
+// Run until HLT, a fault, or until one of the limits is reached; returns
+// the reason for stopping
+enum cpu8085_stop cpu8085_run_limited(cpu8085 *cpu, const struct cpu8085_limits *limits);
+
+// Reason the CPU stopped by itself (HLT or a fault); only meaningful once
+// halted is set
+enum cpu8085_stop cpu8085_stop_reason(const cpu8085 *cpu);
+
+// Short name of a stop reason, e.g. "halt" or "loop"
+const char *cpu8085_stop_name(enum cpu8085_stop reason);
+
+// Disassemble the instruction at addr into buf; returns its length in bytes
+int disassemble(const cpu8085 *cpu, unsigned short addr, char *buf, size_t size);
+
+// Disassemble an instruction from its opcode and the two bytes after it
+int disassemble_bytes(const unsigned char bytes[3], char *buf, size_t size);
+
+// Forget which memory has been written, e.g. after loading a program
+void cpu8085_clear_dirty(cpu8085 *cpu);
+
+// Start address of the first written line at or after addr; -1 if none
+int cpu8085_next_dirty(const cpu8085 *cpu, int addr);
+
+// Hash of the addresses and contents of the written lines only. Two runs
+// from the same starting image that wrote the same memory hash the same.
+unsigned long long cpu8085_dirty_hash(const cpu8085 *cpu);
+
+// Compare the lines written by either CPU (they are assumed to have started
+// from the same image); returns the first address that differs, or -1
+int cpu8085_dirty_compare(const cpu8085 *a, const cpu8085 *b);
+
+// 64-bit hash of the full 64 KiB memory, for comparing final states
+unsigned long long cpu8085_memory_hash(const cpu8085 *cpu);
+
+// The same hash of any 64 KiB memory image
+unsigned long long cpu8085_image_hash(const unsigned char *image);
+
+// Print the registers and the memory written so far as tables on stdout
+void print_state(const cpu8085 *cpu);
+
+#endif
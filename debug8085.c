@@ -0,0 +1,351 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+
+#include "debug8085.h"
+
+struct debug8085 *debug8085_attach(cpu8085 *cpu)
+{
+    struct debug8085 *debug = calloc(1, sizeof(struct debug8085));
+    if (debug == NULL)
+    {
+        return NULL;
+    }
+    debug->hit_breakpoint = -1;
+    debug->hit_watchpoint = -1;
+    debug->resume_pc = cpu->PC;
+    debug->resume_instructions = cpu->instructions;
+    cpu->debug = debug;
+    return debug;
+}
+
+// Flag the pages holding a watched byte, so that their data accesses
+// detour through debug8085_check_watchpoint()
+static void update_watched_pages(cpu8085 *cpu)
+{
+    const struct debug8085 *debug = cpu->debug;
+
+    for (int page = 0; page < 256; page++)
+    {
+        cpu->mmio[page] &= ~CPU8085_PAGE_WATCH;
+    }
+    for (int i = 0; debug != NULL && i < debug->watchpoint_count; i++)
+    {
+        for (int page = debug->watchpoints[i].start >> 8; page <= debug->watchpoints[i].end >> 8; page++)
+        {
+            cpu->mmio[page] |= CPU8085_PAGE_WATCH;
+        }
+    }
+}
+
+void debug8085_detach(cpu8085 *cpu)
+{
+    if (cpu->debug == NULL)
+    {
+        return;
+    }
+    debug8085_resume(cpu);
+    free(cpu->debug);
+    cpu->debug = NULL;
+    update_watched_pages(cpu);
+}
+
+// Rebuild the bitmap from the table
+static void update_armed(struct debug8085 *debug)
+{
+    memset(debug->armed, 0, sizeof(debug->armed));
+    for (int i = 0; i < debug->breakpoint_count; i++)
+    {
+        unsigned short addr = debug->breakpoints[i].addr;
+        debug->armed[addr / 64] |= 1ULL << (addr % 64);
+    }
+}
+
+int debug8085_add_breakpoint(cpu8085 *cpu, unsigned short addr, const struct debug8085_condition *condition)
+{
+    struct debug8085 *debug = cpu->debug;
+    if (debug->breakpoint_count == DEBUG8085_MAX_BREAKPOINTS)
+    {
+        return -1;
+    }
+
+    struct debug8085_breakpoint *b = &debug->breakpoints[debug->breakpoint_count];
+    memset(b, 0, sizeof(*b));
+    b->addr = addr;
+    if (condition != NULL)
+    {
+        b->conditional = 1;
+        b->condition = *condition;
+    }
+    debug->breakpoint_count++;
+    update_armed(debug);
+
+    // Cached blocks may run straight through addr
+    if (cpu->blocks != NULL)
+    {
+        cpu8085_flush_blocks(cpu);
+    }
+    return debug->breakpoint_count - 1;
+}
+
+int debug8085_add_watchpoint(cpu8085 *cpu, unsigned short start, unsigned short end, int access)
+{
+    struct debug8085 *debug = cpu->debug;
+    if (debug->watchpoint_count == DEBUG8085_MAX_WATCHPOINTS)
+    {
+        return -1;
+    }
+
+    struct debug8085_watchpoint *w = &debug->watchpoints[debug->watchpoint_count++];
+    w->start = start < end ? start : end;
+    w->end = start < end ? end : start;
+    w->access = access;
+    w->hits = 0;
+    update_watched_pages(cpu);
+    return debug->watchpoint_count - 1;
+}
+
+int debug8085_remove_breakpoint(cpu8085 *cpu, int index)
+{
+    struct debug8085 *debug = cpu->debug;
+    if (index < 0 || index >= debug->breakpoint_count)
+    {
+        return -1;
+    }
+    memmove(&debug->breakpoints[index], &debug->breakpoints[index + 1],
+            (debug->breakpoint_count - index - 1) * sizeof(struct debug8085_breakpoint));
+    debug->breakpoint_count--;
+    debug->hit_breakpoint = -1;
+    update_armed(debug);
+    return 0;
+}
+
+int debug8085_remove_watchpoint(cpu8085 *cpu, int index)
+{
+    struct debug8085 *debug = cpu->debug;
+    if (index < 0 || index >= debug->watchpoint_count)
+    {
+        return -1;
+    }
+    memmove(&debug->watchpoints[index], &debug->watchpoints[index + 1],
+            (debug->watchpoint_count - index - 1) * sizeof(struct debug8085_watchpoint));
+    debug->watchpoint_count--;
+    debug->hit_watchpoint = -1;
+    update_watched_pages(cpu);
+    return 0;
+}
+
+void debug8085_resume(cpu8085 *cpu)
+{
+    struct debug8085 *debug = cpu->debug;
+
+    if (cpu->fault == CPU8085_STOP_BREAKPOINT || cpu->fault == CPU8085_STOP_WATCHPOINT)
+    {
+        cpu->fault = 0;
+        cpu->halted = 0;
+    }
+    debug->hit_breakpoint = -1;
+    debug->hit_watchpoint = -1;
+    debug->resume_pc = cpu->PC;
+    debug->resume_instructions = cpu->instructions;
+}
+
+// ---- Conditions ----
+
+static const char *const reg_names[] = { "B", "C", "D", "E", "H", "L", "F", "A", "BC", "DE", "HL", "SP" };
+static const char *const compare_names[] = { "==", "!=", "<", "<=", ">", ">=" };
+
+static unsigned short reg_value(const cpu8085 *cpu, int reg)
+{
+    switch (reg)
+    {
+    case DEBUG8085_REG_BC:
+        return cpu->B << 8 | cpu->C;
+    case DEBUG8085_REG_DE:
+        return cpu->D << 8 | cpu->E;
+    case DEBUG8085_REG_HL:
+        return cpu->H << 8 | cpu->L;
+    case DEBUG8085_REG_SP:
+        return cpu->SP;
+    }
+    return cpu->reg[reg];
+}
+
+static int holds(const cpu8085 *cpu, const struct debug8085_condition *condition)
+{
+    unsigned short value = reg_value(cpu, condition->reg);
+
+    switch (condition->compare)
+    {
+    case DEBUG8085_EQ:
+        return value == condition->value;
+    case DEBUG8085_NE:
+        return value != condition->value;
+    case DEBUG8085_LT:
+        return value < condition->value;
+    case DEBUG8085_LE:
+        return value <= condition->value;
+    case DEBUG8085_GT:
+        return value > condition->value;
+    case DEBUG8085_GE:
+        return value >= condition->value;
+    }
+    return 0;
+}
+
+int debug8085_parse_condition(const char *text, struct debug8085_condition *condition)
+{
+    while (isspace((unsigned char)*text))
+    {
+        text++;
+    }
+
+    // Register name: the longest that matches, so "B" does not take "BC"
+    int reg = -1;
+    size_t length = 0;
+    for (int i = 0; i < (int)(sizeof(reg_names) / sizeof(reg_names[0])); i++)
+    {
+        size_t n = strlen(reg_names[i]);
+        if (n > length && strncasecmp(text, reg_names[i], n) == 0 && !isalnum((unsigned char)text[n]))
+        {
+            reg = i;
+            length = n;
+        }
+    }
+    if (reg < 0)
+    {
+        return -1;
+    }
+    text += length;
+    while (isspace((unsigned char)*text))
+    {
+        text++;
+    }
+
+    // The longest operator that matches, so "<" does not take "<="
+    int compare = -1;
+    for (int i = 0; i < (int)(sizeof(compare_names) / sizeof(compare_names[0])); i++)
+    {
+        size_t n = strlen(compare_names[i]);
+        if (strncmp(text, compare_names[i], n) == 0 && (compare < 0 || n > strlen(compare_names[compare])))
+        {
+            compare = i;
+        }
+    }
+    if (compare < 0)
+    {
+        return -1;
+    }
+    text += strlen(compare_names[compare]);
+
+    char *end;
+    unsigned long value = strtoul(text, &end, 16);
+    while (isspace((unsigned char)*end))
+    {
+        end++;
+    }
+    if (end == text || *end != '\0' || value > (reg < 8 ? 0xFFUL : 0xFFFFUL))
+    {
+        return -1;
+    }
+
+    condition->reg = reg;
+    condition->compare = compare;
+    condition->value = value;
+    return 0;
+}
+
+void debug8085_format_condition(const struct debug8085_condition *condition, char *buf, size_t size)
+{
+    snprintf(buf, size, condition->reg < 8 ? "%s %s %02X" : "%s %s %04X", reg_names[condition->reg],
+             compare_names[condition->compare], condition->value);
+}
+
+// ---- Lookups ----
+
+int debug8085_find_breakpoint(const cpu8085 *cpu)
+{
+    const struct debug8085 *debug = cpu->debug;
+
+    for (int i = 0; i < debug->breakpoint_count; i++)
+    {
+        const struct debug8085_breakpoint *b = &debug->breakpoints[i];
+        if (b->addr == cpu->PC && (!b->conditional || holds(cpu, &b->condition)))
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int debug8085_find_watchpoint(const struct debug8085 *debug, unsigned short addr, int access)
+{
+    for (int i = 0; i < debug->watchpoint_count; i++)
+    {
+        const struct debug8085_watchpoint *w = &debug->watchpoints[i];
+        if ((w->access & access) && addr >= w->start && addr <= w->end)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// ---- Hooks ----
+
+// Halt the CPU for the debugger; it leaves a cached block at once
+static void stop(cpu8085 *cpu, int reason)
+{
+    cpu->fault = reason;
+    cpu->halted = 1;
+    cpu->next_event = 0;
+}
+
+int debug8085_check_breakpoint(cpu8085 *cpu)
+{
+    struct debug8085 *debug = cpu->debug;
+
+    // Already stopped here, and asked again by a fallback to emulate_instruction()
+    if (cpu->fault == CPU8085_STOP_BREAKPOINT)
+    {
+        return 1;
+    }
+    if (cpu->PC == debug->resume_pc && cpu->instructions == debug->resume_instructions)
+    {
+        return 0;
+    }
+    // Conditions may test F, which a cached block can still owe
+    cpu8085_sync_flags(cpu);
+    int i = debug8085_find_breakpoint(cpu);
+    if (i < 0)
+    {
+        return 0;
+    }
+    debug->breakpoints[i].hits++;
+    debug->hit_breakpoint = i;
+    stop(cpu, CPU8085_STOP_BREAKPOINT);
+    return 1;
+}
+
+void debug8085_check_watchpoint(cpu8085 *cpu, unsigned short addr, unsigned char value, int access)
+{
+    struct debug8085 *debug = cpu->debug;
+
+    // The first access an instruction makes to a watchpoint is the one reported
+    if (debug == NULL || debug->hit_watchpoint >= 0)
+    {
+        return;
+    }
+    int i = debug8085_find_watchpoint(debug, addr, access);
+    if (i >= 0)
+    {
+        debug->watchpoints[i].hits++;
+        debug->hit_watchpoint = i;
+        debug->hit_addr = addr;
+        debug->hit_value = value;
+        debug->hit_access = access;
+        stop(cpu, CPU8085_STOP_WATCHPOINT);
+    }
+}
@@ -0,0 +1,147 @@
+#ifndef DEBUG8085_H
+#define DEBUG8085_H
+
+#include "cpu8085.h"
+
+// Breakpoints and watchpoints for a cpu8085, for a debugger to drive.
+//
+// Attach a debug8085 to a CPU with debug8085_attach(). Breakpoints are
+// looked up in a bitmap with one bit per address, at the start of each
+// instruction or cached block, so a run with none armed keeps the block
+// cache's speed; a block never runs past an address with a breakpoint.
+// Watchpoints flag their memory pages in cpu->mmio[] like a device region,
+// so accesses to other pages are not slowed down at all. Instruction
+// fetches are not watched, only data reads and writes.
+//
+// A breakpoint stops the CPU before the instruction at its address, a
+// watchpoint after the instruction that made the access. The CPU is then
+// halted with fault CPU8085_STOP_BREAKPOINT or CPU8085_STOP_WATCHPOINT, so
+// any cpu8085_run*() call returns, and debug8085_resume() lets it carry on.
+
+#define DEBUG8085_MAX_BREAKPOINTS 64
+#define DEBUG8085_MAX_WATCHPOINTS 16
+
+// Watchpoint access bits
+#define DEBUG8085_READ 0x01
+#define DEBUG8085_WRITE 0x02
+
+// Registers a condition can test: reg[] indexes (B C D E H L F A), then the
+// register pairs
+#define DEBUG8085_REG_BC 8
+#define DEBUG8085_REG_DE 9
+#define DEBUG8085_REG_HL 10
+#define DEBUG8085_REG_SP 11
+
+enum debug8085_compare
+{
+    DEBUG8085_EQ,
+    DEBUG8085_NE,
+    DEBUG8085_LT,
+    DEBUG8085_LE,
+    DEBUG8085_GT,
+    DEBUG8085_GE,
+};
+
+// "reg compare value", e.g. A == 3F or HL >= 2000
+struct debug8085_condition
+{
+    int reg;
+    enum debug8085_compare compare;
+    unsigned short value;
+};
+
+struct debug8085_breakpoint
+{
+    unsigned short addr;
+    int conditional;                      // stop only when condition holds
+    struct debug8085_condition condition;
+    unsigned long long hits;
+};
+
+struct debug8085_watchpoint
+{
+    unsigned short start, end;            // inclusive
+    int access;                           // DEBUG8085_READ and/or DEBUG8085_WRITE
+    unsigned long long hits;
+};
+
+struct debug8085
+{
+    unsigned long long armed[CPU8085_MEMORY_SIZE / 64]; // bit per address with a breakpoint
+    struct debug8085_breakpoint breakpoints[DEBUG8085_MAX_BREAKPOINTS];
+    int breakpoint_count;
+    struct debug8085_watchpoint watchpoints[DEBUG8085_MAX_WATCHPOINTS];
+    int watchpoint_count;
+
+    // The last stop: the breakpoint or watchpoint hit (an index, -1 for
+    // none), and for a watchpoint the access that hit it
+    int hit_breakpoint;
+    int hit_watchpoint;
+    unsigned short hit_addr;
+    unsigned char hit_value;
+    int hit_access;
+
+    // A breakpoint at the instruction a resumed run starts with does not
+    // stop it again
+    unsigned short resume_pc;
+    unsigned long long resume_instructions;
+};
+
+// Give cpu a debug8085 with nothing armed; returns it, or NULL if out of
+// memory. debug8085_detach() removes and frees it.
+struct debug8085 *debug8085_attach(cpu8085 *cpu);
+void debug8085_detach(cpu8085 *cpu);
+
+// Add a breakpoint at addr, stopping only when condition holds if it is not
+// NULL; returns its index, or -1 if the table is full
+int debug8085_add_breakpoint(cpu8085 *cpu, unsigned short addr, const struct debug8085_condition *condition);
+
+// Add a watchpoint on start..end (inclusive) for the given accesses;
+// returns its index, or -1 if the table is full
+int debug8085_add_watchpoint(cpu8085 *cpu, unsigned short start, unsigned short end, int access);
+
+// Remove by index; later entries move down one. Returns 0, or -1 if there
+// is no such entry.
+int debug8085_remove_breakpoint(cpu8085 *cpu, int index);
+int debug8085_remove_watchpoint(cpu8085 *cpu, int index);
+
+// Is there a breakpoint (conditional or not) at addr?
+static inline int debug8085_armed(const struct debug8085 *debug, unsigned short addr)
+{
+    return (debug->armed[addr / 64] >> (addr % 64)) & 1;
+}
+
+// Clear a breakpoint or watchpoint stop, so that the next run carries on
+// from PC (stepping over a breakpoint there)
+void debug8085_resume(cpu8085 *cpu);
+
+// The first breakpoint at PC whose condition holds, or -1
+int debug8085_find_breakpoint(const cpu8085 *cpu);
+
+// The first watchpoint on addr for any of the given accesses, or -1
+int debug8085_find_watchpoint(const struct debug8085 *debug, unsigned short addr, int access);
+
+// Parse a condition such as "A == 3F", "hl>=2000" or "B != 0" (values in
+// hex); returns 0, or -1 if text is not one
+int debug8085_parse_condition(const char *text, struct debug8085_condition *condition);
+
+// Format a condition as parsed
+void debug8085_format_condition(const struct debug8085_condition *condition, char *buf, size_t size);
+
+// ---- Called by the core ----
+
+int debug8085_check_breakpoint(cpu8085 *cpu);
+void debug8085_check_watchpoint(cpu8085 *cpu, unsigned short addr, unsigned char value, int access);
+
+// Stop before the instruction at PC if a breakpoint there says so; returns 1
+// if the CPU stopped
+static inline int debug8085_break(cpu8085 *cpu)
+{
+    if (__builtin_expect(debug8085_armed(cpu->debug, cpu->PC), 0))
+    {
+        return debug8085_check_breakpoint(cpu);
+    }
+    return 0;
+}
+
+#endif
@@ -0,0 +1,912 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdarg.h>
+#include <ctype.h>
+#include <ncurses.h>
+
+#include "debugger.h"
+#include "debug8085.h"
+#include "history8085.h"
+
+// Host time a run gets between two looks at the keyboard
+#define DEBUGGER_SLICE_SECONDS 0.05
+
+// Instructions a finish steps between two looks at the keyboard
+#define DEBUGGER_FINISH_POLL 4096
+
+// Rows of device output shown
+#define DEBUGGER_OUTPUT_ROWS 4
+
+// Width of the left column (registers, breakpoints and watchpoints)
+#define DEBUGGER_LEFT_WIDTH 38
+
+#define DEBUGGER_LINE_SIZE 128
+
+struct debugger
+{
+    cpu8085 *cpu;
+    struct debug8085 *debug;
+    struct standard_devices *devices;
+
+    // Device output, captured while the console is open
+    FILE *output;
+    char *output_text;
+    size_t output_size;
+
+    unsigned short code_addr;   // first address in the disassembly view
+    int follow_pc;              // keep PC in the disassembly view
+    unsigned short memory_addr; // first address in the memory view
+    int help;                   // show the commands instead of the disassembly
+
+    char message[160];
+    char last_command[DEBUGGER_LINE_SIZE];
+};
+
+static const char *const help_text[] = {
+    "s, step [N]          run N instructions (1), into calls",
+    "n, next              run one instruction, over calls",
+    "f, finish            run until the current routine returns",
+    "c, continue          run until a breakpoint, watchpoint or HLT",
+    "                     (any key interrupts)",
+    "rs, rstep [N]        go back N instructions (1)",
+    "rc, rcontinue        go back to a breakpoint, or to the last",
+    "                     write to a watchpoint",
+    "who ADDR             show the last write to ADDR going back",
+    "b, break ADDR [if COND]",
+    "                     breakpoint, e.g. b 0120 if A == 3F",
+    "                     (COND: B C D E H L F A BC DE HL SP,",
+    "                     == != < <= > >=, a hex value)",
+    "w, watch ADDR[-END] [r|w|rw]",
+    "                     watchpoint on reads and/or writes (w)",
+    "d, delete N          remove breakpoint N",
+    "unwatch N            remove watchpoint N",
+    "x ADDR               show memory from ADDR",
+    "l, list [ADDR]       disassemble from ADDR, or follow PC",
+    "q, quit              leave the debugger",
+    "Enter repeats the last command. Addresses and values are hex.",
+};
+
+// Formatted text at (y, x), cut to width columns
+static void put(int y, int x, int width, const char *format, ...)
+{
+    char text[256];
+    va_list args;
+
+    if (width <= 0 || y < 0 || y >= LINES)
+    {
+        return;
+    }
+    va_start(args, format);
+    vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+    mvaddnstr(y, x, text, width);
+}
+
+static void message(struct debugger *d, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    vsnprintf(d->message, sizeof(d->message), format, args);
+    va_end(args);
+}
+
+// ---- Views ----
+
+static void draw_registers(const struct debugger *d, int y, int width)
+{
+    const cpu8085 *cpu = d->cpu;
+    static const char flag_names[] = "SZ-A-P-C";
+    char flags[9];
+
+    for (int i = 0; i < 8; i++)
+    {
+        flags[i] = (cpu->F & (0x80 >> i)) && flag_names[i] != '-' ? flag_names[i] : '-';
+    }
+    flags[8] = '\0';
+
+    attron(A_BOLD);
+    put(y, 0, width, "Registers");
+    attroff(A_BOLD);
+    put(y + 1, 1, width, "A  %02X   F  %02X   %s", cpu->A, cpu->F, flags);
+    put(y + 2, 1, width, "B  %02X   C  %02X   BC %04X", cpu->B, cpu->C, cpu->B << 8 | cpu->C);
+    put(y + 3, 1, width, "D  %02X   E  %02X   DE %04X", cpu->D, cpu->E, cpu->D << 8 | cpu->E);
+    put(y + 4, 1, width, "H  %02X   L  %02X   HL %04X", cpu->H, cpu->L, cpu->H << 8 | cpu->L);
+    put(y + 5, 1, width, "PC %04X SP %04X", cpu->PC, cpu->SP);
+    put(y + 6, 1, width, "IE %d  mask %X  lines %02X%s", cpu->int_enable, cpu->int_mask, cpu->int_lines,
+        cpu->waiting ? "  (HLT)" : "");
+    put(y + 7, 1, width, "instructions %llu", cpu->instructions);
+    put(y + 8, 1, width, "T-states     %llu", cpu->tstates);
+}
+
+// Breakpoints, then watchpoints, in rows from y to y + rows - 1
+static void draw_points(const struct debugger *d, int y, int rows, int width)
+{
+    const struct debug8085 *debug = d->debug;
+    int end = y + rows;
+
+    attron(A_BOLD);
+    put(y++, 0, width, "Breakpoints");
+    attroff(A_BOLD);
+    for (int i = 0; i < debug->breakpoint_count && y < end; i++, y++)
+    {
+        const struct debug8085_breakpoint *b = &debug->breakpoints[i];
+        char condition[32] = "";
+        if (b->conditional)
+        {
+            strcpy(condition, "if ");
+            debug8085_format_condition(&b->condition, condition + 3, sizeof(condition) - 3);
+        }
+        put(y, 1, width - 1, "%-2d %04X %6llu hits %s", i, b->addr, b->hits, condition);
+    }
+
+    y++;
+    attron(A_BOLD);
+    put(y++, 0, width, "Watchpoints");
+    attroff(A_BOLD);
+    for (int i = 0; i < debug->watchpoint_count && y < end; i++, y++)
+    {
+        const struct debug8085_watchpoint *w = &debug->watchpoints[i];
+        put(y, 1, width - 1, "%-2d %04X-%04X %-2s %6llu hits", i, w->start, w->end,
+            w->access == (DEBUG8085_READ | DEBUG8085_WRITE) ? "rw" : w->access == DEBUG8085_READ ? "r" : "w",
+            w->hits);
+    }
+}
+
+// Address just past rows instructions disassembled from addr
+static unsigned int code_end(const cpu8085 *cpu, unsigned short addr, int rows)
+{
+    unsigned int a = addr;
+    for (int i = 0; i < rows && a < CPU8085_MEMORY_SIZE; i++)
+    {
+        a += cpu8085_opcode_length[cpu->memory[a]];
+    }
+    return a;
+}
+
+static void draw_code(struct debugger *d, int y, int x, int rows, int width)
+{
+    const cpu8085 *cpu = d->cpu;
+
+    attron(A_BOLD);
+    put(y++, x, width, d->help ? "Commands" : "Disassembly");
+    attroff(A_BOLD);
+    rows--;
+
+    if (d->help)
+    {
+        for (int i = 0; i < (int)(sizeof(help_text) / sizeof(help_text[0])) && i < rows; i++)
+        {
+            put(y + i, x + 1, width - 1, "%s", help_text[i]);
+        }
+        return;
+    }
+
+    // Start at PC again once it leaves the view
+    if (d->follow_pc && (cpu->PC < d->code_addr || cpu->PC >= code_end(cpu, d->code_addr, rows)))
+    {
+        d->code_addr = cpu->PC;
+    }
+
+    unsigned int addr = d->code_addr;
+    for (int i = 0; i < rows && addr < CPU8085_MEMORY_SIZE; i++)
+    {
+        char text[32], bytes[12] = "";
+        int length = disassemble(cpu, addr, text, sizeof(text));
+        for (int b = 0; b < length; b++)
+        {
+            snprintf(bytes + 3 * b, sizeof(bytes) - 3 * b, "%02X ", cpu->memory[(unsigned short)(addr + b)]);
+        }
+
+        if (addr == cpu->PC)
+        {
+            attron(A_REVERSE);
+        }
+        put(y + i, x, width, "%c%c %04X  %-9s %s", addr == cpu->PC ? '>' : ' ',
+            debug8085_armed(d->debug, addr) ? '*' : ' ', addr, bytes, text);
+        attroff(A_REVERSE);
+        addr += length;
+    }
+}
+
+static int watched(const struct debug8085 *debug, unsigned short addr)
+{
+    for (int i = 0; i < debug->watchpoint_count; i++)
+    {
+        if (addr >= debug->watchpoints[i].start && addr <= debug->watchpoints[i].end)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Hex and text, 16 bytes a row where there is room for them, else 8;
+// watched bytes in bold
+static void draw_memory(const struct debugger *d, int y, int x, int rows, int width)
+{
+    const cpu8085 *cpu = d->cpu;
+    int per_row = width >= 6 + 16 * 4 ? 16 : 8;
+
+    attron(A_BOLD);
+    put(y++, x, width, "Memory");
+    attroff(A_BOLD);
+
+    for (int row = 0; row < rows - 1; row++)
+    {
+        unsigned short base = d->memory_addr + row * per_row;
+        put(y + row, x, width, "%04X", base);
+        for (int i = 0; i < per_row; i++)
+        {
+            unsigned short addr = base + i;
+            unsigned char value = cpu->memory[addr];
+            int bold = watched(d->debug, addr);
+
+            if (bold)
+            {
+                attron(A_BOLD);
+            }
+            put(y + row, x + 6 + 3 * i, width - 6 - 3 * i, "%02X", value);
+            put(y + row, x + 6 + 3 * per_row + i, width - 6 - 3 * per_row - i, "%c", isprint(value) ? value : '.');
+            attroff(A_BOLD);
+        }
+    }
+}
+
+// The last rows lines of device output
+static void draw_output(struct debugger *d, int y, int rows, int width)
+{
+    attron(A_BOLD);
+    put(y++, 0, width, "Output");
+    attroff(A_BOLD);
+    if (d->output == NULL)
+    {
+        return;
+    }
+
+    fflush(d->output);
+    const char *text = d->output_text;
+    size_t end = d->output_size;
+    if (end > 0 && text[end - 1] == '\n')
+    {
+        end--;
+    }
+    size_t start = end;
+    for (int n = 0; n < rows && start > 0; )
+    {
+        if (text[--start] == '\n' && ++n == rows)
+        {
+            start++;
+        }
+    }
+
+    for (int row = 0; row < rows && start < end; row++)
+    {
+        size_t length = 0;
+        while (start + length < end && text[start + length] != '\n')
+        {
+            length++;
+        }
+        char line[256];
+        size_t n = length < sizeof(line) - 1 ? length : sizeof(line) - 1;
+        for (size_t i = 0; i < n; i++)
+        {
+            line[i] = isprint((unsigned char)text[start + i]) ? text[start + i] : '.';
+        }
+        line[n] = '\0';
+        put(y + row, 1, width - 1, "%s", line);
+        start += length + 1;
+    }
+}
+
+static void draw(struct debugger *d, const char *input)
+{
+    int left = DEBUGGER_LEFT_WIDTH < COLS / 2 ? DEBUGGER_LEFT_WIDTH : COLS / 2;
+    int right = COLS - left - 1;
+    int top_rows = LINES - DEBUGGER_OUTPUT_ROWS - 3; // above the output, message and command lines
+    int code_rows = top_rows / 2 > 10 ? top_rows / 2 : 10;
+
+    erase();
+    draw_registers(d, 0, left);
+    draw_points(d, 10, top_rows - 10, left);
+    if (d->help)
+    {
+        draw_code(d, 0, left + 1, top_rows, right);
+    }
+    else
+    {
+        draw_code(d, 0, left + 1, code_rows, right);
+        draw_memory(d, code_rows, left + 1, top_rows - code_rows, right);
+    }
+    draw_output(d, top_rows, DEBUGGER_OUTPUT_ROWS, COLS);
+    put(LINES - 2, 0, COLS, "%s", d->message);
+    put(LINES - 1, 0, COLS, "(8085) %s", input);
+    refresh();
+}
+
+// ---- Running ----
+
+static int key_pressed(void)
+{
+    nodelay(stdscr, TRUE);
+    int ch = getch();
+    nodelay(stdscr, FALSE);
+    return ch != ERR;
+}
+
+// Run until the CPU stops, count more instructions have run (0 = no limit)
+// or a key is pressed; returns 1 on a key
+static int run(struct debugger *d, unsigned long long count)
+{
+    cpu8085 *cpu = d->cpu;
+    unsigned long long end = cpu->instructions + count;
+
+    while (!cpu->halted && (count == 0 || cpu->instructions < end))
+    {
+        struct cpu8085_limits limits = { count ? end - cpu->instructions : 0, 0, DEBUGGER_SLICE_SECONDS };
+        cpu8085_run_limited(cpu, &limits);
+        if (!cpu->halted && (count == 0 || cpu->instructions < end) && key_pressed())
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int is_call(unsigned char opcode)
+{
+    return opcode == 0xCD || opcode == 0xCB || (opcode & 0xC7) == 0xC4 || (opcode & 0xC7) == 0xC7;
+}
+
+static int is_return(unsigned char opcode)
+{
+    return opcode == 0xC9 || (opcode & 0xC7) == 0xC0;
+}
+
+// Step until a return takes the return address at or above SP now, i.e.
+// leaves the routine running now; returns 1 on a key
+static int finish(struct debugger *d)
+{
+    cpu8085 *cpu = d->cpu;
+    unsigned short frame = cpu->SP;
+
+    for (unsigned long long n = 1; !cpu->halted; n++)
+    {
+        unsigned short sp = cpu->SP;
+        unsigned char opcode = cpu->memory[cpu->PC];
+        unsigned short return_addr = cpu->memory[sp] | cpu->memory[(unsigned short)(sp + 1)] << 8;
+
+        if (run(d, 1))
+        {
+            return 1;
+        }
+        // An interrupt taken instead leaves SP lower
+        if (is_return(opcode) && sp >= frame && cpu->SP == (unsigned short)(sp + 2) && cpu->PC == return_addr)
+        {
+            return 0;
+        }
+        if (n % DEBUGGER_FINISH_POLL == 0 && key_pressed())
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// A CPU that stopped for good can't be run any further
+static int can_run(struct debugger *d)
+{
+    const cpu8085 *cpu = d->cpu;
+
+    if (cpu->halted && cpu->fault != CPU8085_STOP_BREAKPOINT && cpu->fault != CPU8085_STOP_WATCHPOINT)
+    {
+        message(d, "The program has stopped (%s)", cpu8085_stop_name(cpu8085_stop_reason(cpu)));
+        return 0;
+    }
+    debug8085_resume(d->cpu);
+    return 1;
+}
+
+// Say why a run ended
+static void report_stop(struct debugger *d, int interrupted)
+{
+    const cpu8085 *cpu = d->cpu;
+    const struct debug8085 *debug = d->debug;
+    char text[32];
+
+    disassemble(cpu, cpu->PC, text, sizeof(text));
+    if (interrupted)
+    {
+        message(d, "Interrupted at %04X  %s", cpu->PC, text);
+    }
+    else if (cpu->fault == CPU8085_STOP_BREAKPOINT)
+    {
+        message(d, "Breakpoint %d at %04X  %s", debug->hit_breakpoint, cpu->PC, text);
+    }
+    else if (cpu->fault == CPU8085_STOP_WATCHPOINT)
+    {
+        message(d, "Watchpoint %d: %s %04X (%02X), now at %04X  %s", debug->hit_watchpoint,
+                debug->hit_access == DEBUG8085_READ ? "read from" : "wrote to", debug->hit_addr,
+                debug->hit_value, cpu->PC, text);
+    }
+    else if (cpu->halted)
+    {
+        message(d, "The program has stopped (%s) at %04X", cpu8085_stop_name(cpu8085_stop_reason(cpu)), cpu->PC);
+    }
+    else
+    {
+        message(d, "At %04X  %s", cpu->PC, text);
+    }
+}
+
+// Going back needs the undo log
+static int can_go_back(struct debugger *d)
+{
+    if (d->cpu->history == NULL)
+    {
+        message(d, "No history; start the debugger with --history N");
+        return 0;
+    }
+    return 1;
+}
+
+// rs [N]
+static void step_back(struct debugger *d, unsigned long long count)
+{
+    const cpu8085 *cpu = d->cpu;
+    char text[32];
+
+    long long back = history8085_step_back(d->cpu, count);
+    disassemble(cpu, cpu->PC, text, sizeof(text));
+    if (back < 0)
+    {
+        message(d, "Replay stopped short of the target, at %04X  %s", cpu->PC, text);
+    }
+    else if ((unsigned long long)back < count)
+    {
+        message(d, "Back %lld, as far as the history goes, at %04X  %s", back, cpu->PC, text);
+    }
+    else
+    {
+        message(d, "At %04X  %s", cpu->PC, text);
+    }
+}
+
+// rc: the state is before the instruction that hit
+static void reverse_continue(struct debugger *d)
+{
+    const cpu8085 *cpu = d->cpu;
+    const struct debug8085 *debug = d->debug;
+    char text[32];
+
+    int hit = history8085_reverse_continue(d->cpu);
+    disassemble(cpu, cpu->PC, text, sizeof(text));
+    if (!hit)
+    {
+        message(d, "Start of the history, at %04X  %s", cpu->PC, text);
+    }
+    else if (debug->hit_breakpoint >= 0)
+    {
+        message(d, "Breakpoint %d at %04X  %s", debug->hit_breakpoint, cpu->PC, text);
+    }
+    else
+    {
+        message(d, "Watchpoint %d: %04X (%02X) is written by %04X  %s", debug->hit_watchpoint, debug->hit_addr,
+                debug->hit_value, cpu->PC, text);
+    }
+}
+
+// who ADDR
+static void show_last_write(struct debugger *d, unsigned short addr)
+{
+    struct history8085_last_write write;
+
+    if (!history8085_find_write(d->cpu, addr, &write))
+    {
+        message(d, "No write to %04X in the history", addr);
+        return;
+    }
+    message(d, "%04X: %02X -> %02X at instruction %llu, by %04X", addr, write.old, write.value,
+            write.instruction, write.pc);
+}
+
+// ---- Commands ----
+
+// Hex address, with or without a trailing H
+static int parse_addr(const char *text, unsigned short *addr)
+{
+    char *end;
+    unsigned long value;
+
+    if (text == NULL || !isxdigit((unsigned char)*text))
+    {
+        return -1;
+    }
+    value = strtoul(text, &end, 16);
+    if (*end == 'h' || *end == 'H')
+    {
+        end++;
+    }
+    if (*end != '\0' || value > 0xFFFF)
+    {
+        return -1;
+    }
+    *addr = value;
+    return 0;
+}
+
+static int parse_index(const char *text, int *index)
+{
+    char *end;
+
+    if (text == NULL || !isdigit((unsigned char)*text))
+    {
+        return -1;
+    }
+    *index = strtol(text, &end, 10);
+    return *end == '\0' ? 0 : -1;
+}
+
+// b ADDR [if COND]
+static void command_break(struct debugger *d, char *args)
+{
+    char *addr_text = args != NULL ? strtok(args, " \t") : NULL;
+    char *rest = addr_text != NULL ? strtok(NULL, "") : NULL;
+    unsigned short addr;
+    struct debug8085_condition condition;
+
+    if (parse_addr(addr_text, &addr) < 0)
+    {
+        message(d, "Usage: break ADDR [if COND]");
+        return;
+    }
+    while (rest != NULL && isspace((unsigned char)*rest))
+    {
+        rest++;
+    }
+    if (rest != NULL && *rest != '\0')
+    {
+        if (strncasecmp(rest, "if", 2) != 0 || debug8085_parse_condition(rest + 2, &condition) < 0)
+        {
+            message(d, "Bad condition; e.g. break %04X if A == 3F", addr);
+            return;
+        }
+    }
+
+    int index = debug8085_add_breakpoint(d->cpu, addr, rest != NULL && *rest != '\0' ? &condition : NULL);
+    if (index < 0)
+    {
+        message(d, "No room for more than %d breakpoints", DEBUG8085_MAX_BREAKPOINTS);
+        return;
+    }
+    message(d, "Breakpoint %d at %04X", index, addr);
+}
+
+// w ADDR[-END] [r|w|rw]
+static void command_watch(struct debugger *d, char *args)
+{
+    char *range = args != NULL ? strtok(args, " \t") : NULL;
+    char *kind = range != NULL ? strtok(NULL, " \t") : NULL;
+    char *dash = range != NULL ? strchr(range, '-') : NULL;
+    unsigned short start, end;
+    int access = DEBUG8085_WRITE;
+
+    if (dash != NULL)
+    {
+        *dash = '\0';
+    }
+    if (parse_addr(range, &start) < 0 || (dash != NULL && parse_addr(dash + 1, &end) < 0))
+    {
+        message(d, "Usage: watch ADDR[-END] [r|w|rw]");
+        return;
+    }
+    if (dash == NULL)
+    {
+        end = start;
+    }
+    if (kind != NULL)
+    {
+        access = strcasecmp(kind, "r") == 0 ? DEBUG8085_READ :
+                 strcasecmp(kind, "w") == 0 ? DEBUG8085_WRITE :
+                 strcasecmp(kind, "rw") == 0 ? DEBUG8085_READ | DEBUG8085_WRITE : 0;
+        if (access == 0)
+        {
+            message(d, "Usage: watch ADDR[-END] [r|w|rw]");
+            return;
+        }
+    }
+
+    int index = debug8085_add_watchpoint(d->cpu, start, end, access);
+    if (index < 0)
+    {
+        message(d, "No room for more than %d watchpoints", DEBUG8085_MAX_WATCHPOINTS);
+        return;
+    }
+    message(d, "Watchpoint %d on %04X-%04X", index, d->debug->watchpoints[index].start,
+            d->debug->watchpoints[index].end);
+}
+
+// Run one command line; returns 0 to quit
+static int execute_command(struct debugger *d, char *line)
+{
+    cpu8085 *cpu = d->cpu;
+    char *name = strtok(line, " \t");
+    char *args = strtok(NULL, "");
+    char *arg = args;
+    unsigned short addr;
+    int index;
+
+    d->help = 0;
+    d->message[0] = '\0';
+    if (name == NULL)
+    {
+        return 1;
+    }
+    while (arg != NULL && isspace((unsigned char)*arg))
+    {
+        arg++;
+    }
+    if (arg != NULL && *arg == '\0')
+    {
+        arg = NULL;
+    }
+
+    if (strcmp(name, "s") == 0 || strcmp(name, "step") == 0)
+    {
+        int count = 1;
+        if (arg != NULL && (parse_index(arg, &count) < 0 || count < 1))
+        {
+            message(d, "Usage: step [N]");
+        }
+        else if (can_run(d))
+        {
+            report_stop(d, run(d, count));
+        }
+    }
+    else if (strcmp(name, "n") == 0 || strcmp(name, "next") == 0)
+    {
+        if (can_run(d))
+        {
+            unsigned char opcode = cpu->memory[cpu->PC];
+            unsigned short next = cpu->PC + cpu8085_opcode_length[opcode];
+            int interrupted = run(d, 1);
+            if (!interrupted && !cpu->halted && is_call(opcode) && cpu->PC != next)
+            {
+                interrupted = finish(d);
+            }
+            report_stop(d, interrupted);
+        }
+    }
+    else if (strcmp(name, "f") == 0 || strcmp(name, "finish") == 0)
+    {
+        if (can_run(d))
+        {
+            report_stop(d, finish(d));
+        }
+    }
+    else if (strcmp(name, "c") == 0 || strcmp(name, "continue") == 0)
+    {
+        if (can_run(d))
+        {
+            message(d, "Running; press any key to interrupt");
+            draw(d, "");
+            report_stop(d, run(d, 0));
+        }
+    }
+    else if (strcmp(name, "rs") == 0 || strcmp(name, "rstep") == 0)
+    {
+        int count = 1;
+        if (arg != NULL && (parse_index(arg, &count) < 0 || count < 1))
+        {
+            message(d, "Usage: rstep [N]");
+        }
+        else if (can_go_back(d))
+        {
+            debug8085_resume(cpu);
+            step_back(d, count);
+        }
+    }
+    else if (strcmp(name, "rc") == 0 || strcmp(name, "rcontinue") == 0)
+    {
+        if (can_go_back(d))
+        {
+            debug8085_resume(cpu);
+            message(d, "Going back; this may take a while");
+            draw(d, "");
+            reverse_continue(d);
+        }
+    }
+    else if (strcmp(name, "who") == 0)
+    {
+        if (parse_addr(arg, &addr) < 0)
+        {
+            message(d, "Usage: who ADDR");
+        }
+        else if (can_go_back(d))
+        {
+            show_last_write(d, addr);
+        }
+    }
+    else if (strcmp(name, "b") == 0 || strcmp(name, "break") == 0)
+    {
+        command_break(d, args);
+    }
+    else if (strcmp(name, "w") == 0 || strcmp(name, "watch") == 0)
+    {
+        command_watch(d, args);
+    }
+    else if (strcmp(name, "d") == 0 || strcmp(name, "delete") == 0)
+    {
+        if (parse_index(arg, &index) < 0 || debug8085_remove_breakpoint(cpu, index) < 0)
+        {
+            message(d, "Usage: delete N, N a breakpoint number");
+        }
+    }
+    else if (strcmp(name, "unwatch") == 0)
+    {
+        if (parse_index(arg, &index) < 0 || debug8085_remove_watchpoint(cpu, index) < 0)
+        {
+            message(d, "Usage: unwatch N, N a watchpoint number");
+        }
+    }
+    else if (strcmp(name, "x") == 0)
+    {
+        if (parse_addr(arg, &addr) < 0)
+        {
+            message(d, "Usage: x ADDR");
+        }
+        else
+        {
+            d->memory_addr = addr;
+        }
+    }
+    else if (strcmp(name, "l") == 0 || strcmp(name, "list") == 0)
+    {
+        if (arg == NULL)
+        {
+            d->follow_pc = 1;
+        }
+        else if (parse_addr(arg, &addr) < 0)
+        {
+            message(d, "Usage: list [ADDR]");
+        }
+        else
+        {
+            d->follow_pc = 0;
+            d->code_addr = addr;
+        }
+    }
+    else if (strcmp(name, "h") == 0 || strcmp(name, "help") == 0)
+    {
+        d->help = 1;
+    }
+    else if (strcmp(name, "q") == 0 || strcmp(name, "quit") == 0)
+    {
+        return 0;
+    }
+    else
+    {
+        message(d, "Unknown command '%s'; type help for the list", name);
+    }
+    return 1;
+}
+
+// Read a command line into line; returns -1 when the terminal is gone
+static int read_command(struct debugger *d, char *line, size_t size)
+{
+    size_t length = 0;
+
+    line[0] = '\0';
+    for (;;)
+    {
+        draw(d, line);
+        int ch = getch();
+        if (ch == ERR)
+        {
+            return -1;
+        }
+        if (ch == '\n' || ch == '\r' || ch == KEY_ENTER)
+        {
+            return 0;
+        }
+        if ((ch == KEY_BACKSPACE || ch == 127 || ch == '\b') && length > 0)
+        {
+            line[--length] = '\0';
+        }
+        else if (ch >= ' ' && ch < 127 && length < size - 1)
+        {
+            line[length++] = ch;
+            line[length] = '\0';
+        }
+    }
+}
+
+int debugger_run(cpu8085 *cpu, struct standard_devices *devices, unsigned long history)
+{
+    struct debugger d = { 0 };
+    char line[DEBUGGER_LINE_SIZE];
+
+    FILE *tty = fopen("/dev/tty", "r+");
+    if (tty == NULL)
+    {
+        perror("/dev/tty");
+        return -1;
+    }
+    d.cpu = cpu;
+    d.devices = devices;
+    d.follow_pc = 1;
+    d.debug = debug8085_attach(cpu);
+    if (d.debug == NULL)
+    {
+        printf("Out of memory\n");
+        fclose(tty);
+        return -1;
+    }
+    if (history > 0 && history8085_attach(cpu, history) == NULL)
+    {
+        printf("Out of memory for a history of %lu instructions\n", history);
+        debug8085_detach(cpu);
+        fclose(tty);
+        return -1;
+    }
+    SCREEN *screen = newterm(NULL, tty, tty);
+    if (screen == NULL)
+    {
+        printf("Cannot start the debugger on this terminal\n");
+        history8085_detach(cpu);
+        debug8085_detach(cpu);
+        fclose(tty);
+        return -1;
+    }
+    cbreak();
+    noecho();
+    keypad(stdscr, TRUE);
+
+    // Device output would scribble over the screen, and keys typed at the
+    // console are commands
+    int in_fd = -1;
+    if (devices != NULL && (d.output = open_memstream(&d.output_text, &d.output_size)) != NULL)
+    {
+        devices->uart.out = devices->led.out = devices->display.out = d.output;
+        in_fd = devices->uart.in_fd;
+        devices->uart.in_fd = -1;
+    }
+    int trace = cpu->trace;
+    cpu->trace = 0;
+
+    message(&d, "Stopped at %04X; type help for the commands", cpu->PC);
+    while (read_command(&d, line, sizeof(line)) == 0)
+    {
+        // Enter alone repeats the last command
+        if (line[0] == '\0')
+        {
+            strcpy(line, d.last_command);
+        }
+        else
+        {
+            strcpy(d.last_command, line);
+        }
+        if (!execute_command(&d, line))
+        {
+            break;
+        }
+    }
+
+    endwin();
+    delscreen(screen);
+    fclose(tty);
+
+    cpu->trace = trace;
+    if (d.output != NULL)
+    {
+        devices->uart.out = devices->led.out = devices->display.out = stdout;
+        devices->uart.in_fd = in_fd;
+        fclose(d.output);
+        fwrite(d.output_text, 1, d.output_size, stdout);
+        free(d.output_text);
+    }
+    history8085_detach(cpu);
+    debug8085_detach(cpu);
+    return 0;
+}
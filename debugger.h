@@ -0,0 +1,24 @@
+#ifndef DEBUGGER_H
+#define DEBUGGER_H
+
+#include "cpu8085.h"
+#include "devices.h"
+
+// Interactive debugger console for the emulator, full screen on the
+// terminal (ncurses): registers, a disassembly and a memory view, the
+// breakpoints and watchpoints (see debug8085.h), and the devices' output,
+// driven by gdb-like commands (step, next, finish, continue, break,
+// watch, ...; "help" lists them). With a history (see history8085.h) it
+// also steps and runs backwards.
+//
+// Runs go through cpu8085_run_limited(), so the block cache is used when
+// enabled. Device output is shown in the console and written to stdout when
+// it closes; the console UART gets no input meanwhile.
+
+// Debug cpu until the user quits. devices are the standard devices
+// attached to cpu, or NULL for none; history is the number of instructions
+// to be able to go back through, 0 for none. Returns 0, or -1 if the
+// console could not be started.
+int debugger_run(cpu8085 *cpu, struct standard_devices *devices, unsigned long history);
+
+#endif
@@ -0,0 +1,277 @@
+#include <stdio.h>
+#include <string.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include "devices.h"
+
+// ---- UART ----
+
+static void uart_poll(struct uart *uart)
+{
+    struct pollfd pfd = { uart->in_fd, POLLIN, 0 };
+
+    if (uart->pending || uart->in_fd < 0 || poll(&pfd, 1, 0) <= 0)
+    {
+        return;
+    }
+    if (read(uart->in_fd, &uart->byte, 1) == 1)
+    {
+        uart->pending = 1;
+    }
+    else
+    {
+        uart->in_fd = -1; // end of input
+    }
+}
+
+static unsigned char uart_read(void *device, unsigned short port)
+{
+    struct uart *uart = device;
+
+    uart_poll(uart);
+    if (port != uart->base)
+    {
+        return 0x02 | (uart->pending ? 0x01 : 0x00);
+    }
+    if (!uart->pending)
+    {
+        return 0x00;
+    }
+    uart->pending = 0;
+    return uart->byte;
+}
+
+static void uart_write(void *device, unsigned short port, unsigned char value)
+{
+    struct uart *uart = device;
+
+    if (port == uart->base)
+    {
+        fputc(value, uart->out);
+        fflush(uart->out);
+    }
+}
+
+void uart_attach(struct uart *uart, struct bus8085 *bus, unsigned char base, int in_fd, FILE *out)
+{
+    memset(uart, 0, sizeof(*uart));
+    uart->base = base;
+    uart->in_fd = in_fd;
+    uart->out = out;
+    bus8085_map_ports(bus, base, 2, uart_read, uart_write, uart);
+}
+
+// ---- Timer ----
+
+static void timer_expire(cpu8085 *cpu, void *context);
+
+// (Re)arm for a full period from now; a zero period never expires
+static void timer_restart(struct timer *timer)
+{
+    unsigned long long length = (unsigned long long)timer->period * TIMER_PRESCALE;
+
+    cpu8085_cancel(timer->cpu, timer_expire, timer);
+    timer->expired = 0;
+    if (timer->running && length != 0)
+    {
+        timer->deadline = timer->cpu->tstates + length;
+        if (cpu8085_schedule(timer->cpu, timer->deadline, timer_expire, timer) < 0)
+        {
+            timer->running = 0; // event queue full
+        }
+    }
+}
+
+static void timer_expire(cpu8085 *cpu, void *context)
+{
+    struct timer *timer = context;
+
+    timer->expired = 1;
+    if (timer->interrupt)
+    {
+        cpu8085_raise(cpu, timer->interrupt);
+    }
+    // A zero period (written while running) stops the timer
+    if (timer->period == 0)
+    {
+        timer->running = 0;
+        return;
+    }
+    // Periods follow each other exactly, however late this event ran.
+    // Periods that went by before it ran are missed, not run back to back.
+    unsigned long long length = (unsigned long long)timer->period * TIMER_PRESCALE;
+    timer->deadline += length;
+    if (timer->deadline <= cpu->tstates)
+    {
+        timer->deadline += ((cpu->tstates - timer->deadline) / length + 1) * length;
+    }
+    // Stopped, as the status port then shows, if the event queue is full
+    if (cpu8085_schedule(cpu, timer->deadline, timer_expire, timer) < 0)
+    {
+        timer->running = 0;
+    }
+}
+
+static unsigned char timer_read(void *device, unsigned short port)
+{
+    struct timer *timer = device;
+
+    switch (port - timer->base)
+    {
+    case 0:
+        return timer->period & 0xFF;
+    case 1:
+        return timer->period >> 8;
+    default:
+    {
+        unsigned char status = (timer->expired ? 0x01 : 0x00) | (timer->running ? 0x02 : 0x00);
+        timer->expired = 0;
+        return status;
+    }
+    }
+}
+
+static void timer_write(void *device, unsigned short port, unsigned char value)
+{
+    struct timer *timer = device;
+
+    switch (port - timer->base)
+    {
+    case 0:
+        timer->period = (timer->period & 0xFF00) | value;
+        timer_restart(timer);
+        break;
+    case 1:
+        timer->period = (timer->period & 0x00FF) | (value << 8);
+        timer_restart(timer);
+        break;
+    default:
+        if ((value & 0x01) != timer->running)
+        {
+            timer->running = value & 0x01;
+            timer_restart(timer);
+        }
+        break;
+    }
+}
+
+void timer_attach(struct timer *timer, struct bus8085 *bus, unsigned char base, cpu8085 *cpu, int interrupt)
+{
+    memset(timer, 0, sizeof(*timer));
+    timer->cpu = cpu;
+    timer->base = base;
+    timer->interrupt = interrupt;
+    bus8085_map_ports(bus, base, 3, timer_read, timer_write, timer);
+}
+
+// ---- LED latch ----
+
+static unsigned char led_read(void *device, unsigned short port)
+{
+    struct led_latch *led = device;
+    (void)port;
+    return led->value;
+}
+
+static void led_write(void *device, unsigned short port, unsigned char value)
+{
+    struct led_latch *led = device;
+    (void)port;
+
+    if (value == led->value)
+    {
+        return;
+    }
+    led->value = value;
+
+    // Bit 7 on the left, '*' for a lit LED
+    char lights[9];
+    for (int i = 0; i < 8; i++)
+    {
+        lights[i] = value & (0x80 >> i) ? '*' : '.';
+    }
+    lights[8] = '\0';
+    fprintf(led->out, "[LED] %s\n", lights);
+}
+
+void led_latch_attach(struct led_latch *led, struct bus8085 *bus, unsigned char port, FILE *out)
+{
+    memset(led, 0, sizeof(*led));
+    led->out = out;
+    bus8085_map_ports(bus, port, 1, led_read, led_write, led);
+}
+
+// ---- 7-segment display ----
+
+// Characters for the common segment patterns (gfedcba)
+static char segment_char(unsigned char segments)
+{
+    static const struct { unsigned char segments; char c; } glyphs[] = {
+        {0x3F, '0'}, {0x06, '1'}, {0x5B, '2'}, {0x4F, '3'}, {0x66, '4'}, {0x6D, '5'},
+        {0x7D, '6'}, {0x07, '7'}, {0x7F, '8'}, {0x6F, '9'}, {0x77, 'A'}, {0x7C, 'b'},
+        {0x39, 'C'}, {0x5E, 'd'}, {0x79, 'E'}, {0x71, 'F'}, {0x76, 'H'}, {0x38, 'L'},
+        {0x73, 'P'}, {0x3E, 'U'}, {0x40, '-'}, {0x08, '_'}, {0x00, ' '},
+    };
+
+    for (size_t i = 0; i < sizeof(glyphs) / sizeof(glyphs[0]); i++)
+    {
+        if (glyphs[i].segments == (segments & 0x7F))
+        {
+            return glyphs[i].c;
+        }
+    }
+    return '?';
+}
+
+static unsigned char seven_segment_read(void *device, unsigned short offset)
+{
+    struct seven_segment *display = device;
+    return display->segments[offset];
+}
+
+static void seven_segment_write(void *device, unsigned short offset, unsigned char value)
+{
+    struct seven_segment *display = device;
+
+    if (display->segments[offset] == value)
+    {
+        return;
+    }
+    display->segments[offset] = value;
+
+    char text[2 * SEVEN_SEGMENT_MAX_DIGITS + 1];
+    int n = 0;
+    for (int i = 0; i < display->digits; i++)
+    {
+        text[n++] = segment_char(display->segments[i]);
+        if (display->segments[i] & 0x80)
+        {
+            text[n++] = '.';
+        }
+    }
+    text[n] = '\0';
+    fprintf(display->out, "[7SEG] %s\n", text);
+}
+
+int seven_segment_attach(struct seven_segment *display, struct bus8085 *bus, unsigned short addr,
+                         int digits, FILE *out)
+{
+    memset(display, 0, sizeof(*display));
+    display->out = out;
+    display->digits = digits < SEVEN_SEGMENT_MAX_DIGITS ? digits : SEVEN_SEGMENT_MAX_DIGITS;
+    return bus8085_map_memory(bus, addr, display->digits, seven_segment_read, seven_segment_write, display);
+}
+
+// ---- Standard machine ----
+
+void standard_devices_attach(struct standard_devices *devices, cpu8085 *cpu)
+{
+    bus8085_init(&devices->bus);
+    uart_attach(&devices->uart, &devices->bus, STANDARD_UART_PORT, STDIN_FILENO, stdout);
+    led_latch_attach(&devices->led, &devices->bus, STANDARD_LED_PORT, stdout);
+    timer_attach(&devices->timer, &devices->bus, STANDARD_TIMER_PORT, cpu, STANDARD_TIMER_INTERRUPT);
+    seven_segment_attach(&devices->display, &devices->bus, STANDARD_DISPLAY_ADDR,
+                         STANDARD_DISPLAY_DIGITS, stdout);
+    cpu8085_attach_bus(cpu, &devices->bus);
+}
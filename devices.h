@@ -0,0 +1,92 @@
+#ifndef DEVICES_H
+#define DEVICES_H
+
+#include <stdio.h>
+
+#include "cpu8085.h"
+
+// Built-in devices for the bus (see bus8085.h).
+
+// Console UART: data at port base, status at base + 1.
+// Status bit 0: a received byte is waiting; bit 1: ready to send (always).
+// Reading data with nothing received returns 00.
+struct uart
+{
+    unsigned char base;
+    int in_fd;           // read without blocking; -1 for no input
+    FILE *out;
+    int pending;         // a received byte is held in byte
+    unsigned char byte;
+};
+
+void uart_attach(struct uart *uart, struct bus8085 *bus, unsigned char base, int in_fd, FILE *out);
+
+// Interval timer counting the CPU's T-states, at ports base to base + 2:
+//   base, base + 1  period low/high byte, in units of TIMER_PRESCALE T-states;
+//                   writing either byte restarts the timer, and a
+//                   period of 0 never expires
+//   base + 2        write: bit 0 starts (1) or stops (0) the timer
+//                   read:  bit 0 the period elapsed since the last read
+//                          (cleared by reading), bit 1 running
+// Each expiry is a scheduled CPU event, which also raises `interrupt`
+// (a CPU8085_INT_* input, or 0 for a polled timer).
+#define TIMER_PRESCALE 64
+
+struct timer
+{
+    cpu8085 *cpu;
+    int interrupt;
+    unsigned char base;
+    unsigned short period;
+    int running;
+    int expired;
+    unsigned long long deadline; // T-state count of the next expiry
+};
+
+void timer_attach(struct timer *timer, struct bus8085 *bus, unsigned char base, cpu8085 *cpu, int interrupt);
+
+// Output latch driving 8 LEDs, at one port; prints the LEDs when they change
+struct led_latch
+{
+    FILE *out;
+    unsigned char value;
+};
+
+void led_latch_attach(struct led_latch *led, struct bus8085 *bus, unsigned char port, FILE *out);
+
+// Memory-mapped 7-segment display of up to 8 digits, one byte per digit
+// (bit 0 = segment a ... bit 6 = segment g, bit 7 = decimal point), the
+// leftmost digit at the lowest address. Prints the display when it changes.
+#define SEVEN_SEGMENT_MAX_DIGITS 8
+
+struct seven_segment
+{
+    FILE *out;
+    int digits;
+    unsigned char segments[SEVEN_SEGMENT_MAX_DIGITS];
+};
+
+int seven_segment_attach(struct seven_segment *display, struct bus8085 *bus, unsigned short addr,
+                         int digits, FILE *out);
+
+// The emulator's standard machine
+#define STANDARD_UART_PORT 0x00
+#define STANDARD_LED_PORT 0x02
+#define STANDARD_TIMER_PORT 0x10
+#define STANDARD_TIMER_INTERRUPT CPU8085_INT_RST75
+#define STANDARD_DISPLAY_ADDR 0xF800
+#define STANDARD_DISPLAY_DIGITS 8
+
+struct standard_devices
+{
+    struct bus8085 bus;
+    struct uart uart;
+    struct led_latch led;
+    struct timer timer;
+    struct seven_segment display;
+};
+
+// Set up the standard devices, console on stdin/stdout, and attach them to cpu
+void standard_devices_attach(struct standard_devices *devices, cpu8085 *cpu);
+
+#endif
@@ -1,953 +1,756 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <ctype.h>
 #include <unistd.h>
-#include <ncurses.h>
+#include <time.h>
+#include <getopt.h>
+#include <stdbool.h>
+
+#include "cpu8085.h"
+#include "loader.h"
+#include "asm8085.h"
+#include "batch.h"
+#include "snapshot.h"
+#include "devices.h"
+#include "profile.h"
+#include "debugger.h"
+
+// Per-instruction tracing; must match the TRACE setting the core was built with
+#ifndef TRACE
+#define TRACE 1
+#endif
+
+// Execution pacing modes for the run loop
+enum run_mode
+{
+    MODE_REALTIME, // pace against the emulated clock frequency
+    MODE_TURBO,    // run as fast as the host allows
+    MODE_STEP,     // wait for Enter before every instruction
+    MODE_DEBUG     // interactive debugger console (see debugger.h)
+};
 
-int haltEncountered = false;
+// Standard 8085 clock: a 6.144 MHz crystal divided by two
+#define DEFAULT_CLOCK_MHZ 3.072
 
-// Define the 8085's registers
-unsigned char A, B, C, D, E, H, L, F;
-unsigned short PC, SP;
+// Instruction budget per program in batch mode unless --max-instructions or
+// --max-tstates is given
+#define DEFAULT_BATCH_BUDGET 100000000ULL
 
-// Define the 8085's memory
-unsigned char memory[65536];
+// Instructions the debugger can step back through unless --history is given
+#define DEFAULT_HISTORY 1048576UL
 
-// Flag bit positions in the F register
-#define CARRY_FLAG 0x01
-#define AUX_CARRY_FLAG 0x10
-#define PARITY_FLAG 0x04
-#define ZERO_FLAG 0x40
-#define SIGN_FLAG 0x80
+// Rows per table of the --profile report
+#define PROFILE_TOP 20
 
-// Macro to set/clear flag bits
-#define SET_FLAG(f) (F |= (f))
-#define CLEAR_FLAG(f) (F &= ~(f))
+// Emulated time between two pacing checks in realtime mode
+#define PACING_SLICE_US 10000
 
-// Macro to check the parity of a byte
-#define CHECK_PARITY(x) (__builtin_parity(x) == 0)
+// Longest turbo burst, in instructions, between two looks at the limits
+#define WATCHDOG_INTERVAL 4096
 
-// Function to update flags based on the result of an operation
-void update_flags(unsigned char result)
+// Monotonic host time in nanoseconds
+static unsigned long long host_time_ns(void)
 {
-    if (result == 0)
-    {
-        SET_FLAG(ZERO_FLAG);
-    }
-    else
-    {
-        CLEAR_FLAG(ZERO_FLAG);
-    }
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
 
-    if (result & 0x80)
-    {
-        SET_FLAG(SIGN_FLAG);
-    }
-    else
+// State for pacing the emulated T-states against the host clock
+struct pacer
+{
+    double clock_hz;
+    unsigned long long slice_tstates; // T-states between two clock checks
+    unsigned long long next_sync;     // T-state count of the next clock check
+    unsigned long long base_tstates;  // T-state count at base_ns
+    unsigned long long base_ns;       // host time the schedule is anchored to
+};
+
+void pacer_init(struct pacer *p, const cpu8085 *cpu, double clock_mhz)
+{
+    p->clock_hz = clock_mhz * 1e6;
+    p->slice_tstates = (unsigned long long)(p->clock_hz * PACING_SLICE_US / 1e6);
+    if (p->slice_tstates == 0)
     {
-        CLEAR_FLAG(SIGN_FLAG);
+        p->slice_tstates = 1;
     }
+    p->base_tstates = cpu->tstates;
+    p->base_ns = host_time_ns();
+    p->next_sync = cpu->tstates + p->slice_tstates;
+}
 
-    if (CHECK_PARITY(result))
+// Sleep until the host clock catches up with the emulated one. Called once per
+// slice rather than per instruction, so the sleep granularity stays coarse
+// while the emulated clock never drifts by more than one slice.
+void pacer_sync(struct pacer *p, const cpu8085 *cpu)
+{
+    unsigned long long now = host_time_ns();
+    unsigned long long target = p->base_ns +
+        (unsigned long long)((cpu->tstates - p->base_tstates) * 1e9 / p->clock_hz);
+
+    if (target > now)
     {
-        SET_FLAG(PARITY_FLAG);
+        unsigned long long wait = target - now;
+        struct timespec ts = { wait / 1000000000ULL, wait % 1000000000ULL };
+        nanosleep(&ts, NULL);
     }
-    else
+    else if (now - target > PACING_SLICE_US * 1000ULL)
     {
-        CLEAR_FLAG(PARITY_FLAG);
+        // The host fell behind (e.g. slow terminal output); re-anchor instead
+        // of running flat out to catch up
+        p->base_ns = now;
+        p->base_tstates = cpu->tstates;
     }
+    p->next_sync = cpu->tstates + p->slice_tstates;
 }
 
-// Function to update flags for subtraction instructions
-void update_flags_subtraction(unsigned char original_A, unsigned char value){
-    unsigned char result = original_A - value;
+// Wait for the user to press Enter before the next step; returns 0 on 'q' or EOF
+int wait_for_step(void)
+{
+    printf("[step] Enter to execute, q to quit: ");
+    fflush(stdout);
 
-    if (result == 0) {
-        SET_FLAG(ZERO_FLAG);
-    } else {
-        CLEAR_FLAG(ZERO_FLAG);
+    int ch = getchar();
+    int quit = (ch == 'q' || ch == 'Q' || ch == EOF);
+    while (ch != '\n' && ch != EOF)
+    {
+        ch = getchar();
     }
+    return !quit;
+}
 
-    if (result & 0x80) {
-        SET_FLAG(SIGN_FLAG);
-    } else {
-        CLEAR_FLAG(SIGN_FLAG);
-    }
+// Memory image of a full snapshot, used as the base of delta snapshots;
+// NULL after printing an error
+unsigned char *load_snapshot_base(const char *path)
+{
+    cpu8085 *base_cpu = cpu8085_create();
+    unsigned char *base = malloc(CPU8085_MEMORY_SIZE);
 
-    if (CHECK_PARITY(result)) {
-        SET_FLAG(PARITY_FLAG);
-    } else {
-        CLEAR_FLAG(PARITY_FLAG);
+    if (base_cpu == NULL || base == NULL || snapshot_load(base_cpu, path, NULL) < 0)
+    {
+        cpu8085_destroy(base_cpu);
+        free(base);
+        return NULL;
     }
+    memcpy(base, base_cpu->memory, CPU8085_MEMORY_SIZE);
+    cpu8085_destroy(base_cpu);
+    return base;
+}
 
-    if (original_A < value) {
-        SET_FLAG(CARRY_FLAG);
-    } else {
-        CLEAR_FLAG(CARRY_FLAG);
-    }
+// Write the periodic or final snapshot, as a delta when there is a base
+void save_snapshot(const cpu8085 *cpu, const char *path, const unsigned char *base, int numbered)
+{
+    char name[4096];
 
-    if ((original_A & 0x0F) < (value & 0x0F)) {
-        SET_FLAG(AUX_CARRY_FLAG);
-    } else {
-        CLEAR_FLAG(AUX_CARRY_FLAG);
+    if (numbered)
+    {
+        snprintf(name, sizeof(name), "%s.%llu", path, cpu->instructions);
+        path = name;
     }
+    snapshot_save(cpu, path, base);
 }
 
-// Function to print the state of the registers and memory with spacing and instruction count
-void print_state(int instruction_count)
+void print_help(void)
 {
-    printf("\nInstruction %03d:\n", instruction_count);
-    printf("____________________\n");
-    printf("| Register | Value |\n");
-    printf("|----------|-------|\n");
-    printf("| A        | %02X    |\n", A);
-    printf("| B        | %02X    |\n", B);
-    printf("| C        | %02X    |\n", C);
-    printf("| D        | %02X    |\n", D);
-    printf("| E        | %02X    |\n", E);
-    printf("| H        | %02X    |\n", H);
-    printf("| L        | %02X    |\n", L);
-    printf("| F        | %02X    |\n", F);
-    printf("| PC       | %04X  |\n", PC);
-    printf("| SP       | %04X  |\n", SP);
-    printf("--------------------\n");
-    printf("____________________\n");
-    printf("| Memory   | Value |\n");
-    printf("|----------|-------|\n");
-    for (int i = 0; i < 16; i++)
-    {
-        printf("| %04X     | %02X    |\n", i, memory[i]);
-    }
-    printf("____________________\n");
+    printf("This is a 8085 uP emulator written in C.\n");
+    printf("All instructions are implemented, the ten undocumented ones included.\n");
+    printf("Just run the program and begin typing in the instructions.\n");
+    printf("Separate each instruction by pressing an Enter key.\n");
+    printf("Once all done, enter the instruction \'HLT\' to terminate the input stream.\n");
+    printf("\n");
+    printf("Options:\n");
+    printf("  --help         Show this help\n");
+    printf("  --turbo        Run unthrottled, as fast as the host allows\n");
+    printf("  --jit          With --turbo or --batch, also translate hot code into\n");
+    printf("                 host machine code (x86-64 hosts). --profile,\n");
+    printf("                 --profile-folded and --trace-file run without it\n");
+    printf("  --step         Single-step: press Enter before each instruction\n");
+    printf("  --debug        Debug the program in a full-screen console: breakpoints,\n");
+    printf("                 watchpoints, step/next/finish, memory and disassembly\n");
+    printf("  --history N    Let the debugger go back through the last N instructions\n");
+    printf("                 or more (default %lu, 0 = off)\n", DEFAULT_HISTORY);
+    printf("  --clock MHZ    Pace execution in real time against an MHZ clock\n");
+    printf("                 (default mode, %.3f MHz)\n", DEFAULT_CLOCK_MHZ);
+    printf("  --quiet        Headless: no per-instruction output, final state only\n");
+    printf("  --summary N    Also print the state every N instructions\n");
+    printf("  --bin FILE     Load a raw binary image instead of reading stdin\n");
+    printf("  --hex FILE     Load an Intel HEX file instead of reading stdin\n");
+    printf("  --asm FILE     Assemble and run an assembly source file\n");
+    printf("  --listing FILE Write an assembler listing (with --asm or stdin input)\n");
+    printf("  --origin ADDR  Load address (hex) for --bin, and the initial PC when\n");
+    printf("                 the program gives no start address of its own\n");
+    printf("  --max-instructions N\n");
+    printf("                 Stop after N instructions even without HLT (waiting\n");
+    printf("                 in HLT, each event waited for counts as one)\n");
+    printf("  --max-tstates N\n");
+    printf("                 Stop once N T-states (clock cycles) have run\n");
+    printf("  --timeout SEC  Stop after SEC seconds of host time\n");
+    printf("  --no-devices   Leave the I/O ports and memory-mapped devices unconnected\n");
+    printf("  --restore FILE Resume from a snapshot instead of loading a program\n");
+    printf("  --save-snapshot FILE\n");
+    printf("                 Save the machine state to FILE when the run ends\n");
+    printf("  --snapshot-every N\n");
+    printf("                 Also save FILE.<instruction count> every N instructions\n");
+    printf("  --snapshot-base FILE\n");
+    printf("                 Full snapshot that delta snapshots are saved against\n");
+    printf("                 and restored on top of\n");
+    printf("  --trace-file FILE\n");
+    printf("                 Write a binary record of every instruction to FILE\n");
+    printf("                 (decode, filter and diff it with tracetool)\n");
+    printf("  --profile FILE Write a profile of the run to FILE: the hottest addresses,\n");
+    printf("                 opcodes, loops and routines by T-states\n");
+    printf("  --profile-folded FILE\n");
+    printf("                 Write the profile's call paths to FILE as folded stacks\n");
+    printf("                 for flamegraph.pl\n");
+    printf("  --batch PATH   Run every program in a directory or manifest file on\n");
+    printf("                 all cores and print one result line per program\n");
+    printf("                 (budget %llu instructions unless --max-instructions\n", DEFAULT_BATCH_BUDGET);
+    printf("                 or --max-tstates is given)\n");
+    printf("  --jobs N       Worker threads for --batch (default: one per core)\n");
+    printf("\nExit status: 0 HLT, 1 usage or load error, 2 instruction limit,\n");
+    printf("3 T-state limit, 4 timeout, 5 jump-to-self loop.\n");
+#if !TRACE
+    printf("\nThis build has tracing compiled out; --quiet is always in effect.\n");
+#endif
 }
 
-// Function to emulate an instruction and print its state
-void emulate_instruction(int *instruction_count)
+// Write the --profile report and the --profile-folded stacks (either path
+// may be NULL)
+static void write_profile(cpu8085 *cpu, const char *report_path, const char *folded_path)
 {
-    unsigned char opcode = memory[PC];
-    PC++;
-
-    unsigned short address;
-    unsigned char data;
-
-    printf("Executing opcode: %02X\n", opcode);
-
-    switch (opcode)
-    {
-    case 0x00: // NOP
-        printf("NOP\n");
-        break;
-    
-    case 0x06: // MVI B, data
-        B = memory[PC++];
-        printf("MVI B, %02X\n", B);
-        break;
-    case 0x0E: // MVI C, data
-        C = memory[PC++];
-        printf("MVI C, %02X\n", C);
-        break;
-    case 0x16: // MVI D, data
-        D = memory[PC++];
-        printf("MVI D, %02X\n", D);
-        break;
-    case 0x1E: // MVI E, data
-        E = memory[PC++];
-        printf("MVI E, %02X\n", E);
-        break;
-    case 0x26: // MVI H, data
-        H = memory[PC++];
-        printf("MVI H, %02X\n", H);
-        break;
-    case 0x2E: // MVI L, data
-        L = memory[PC++];
-        printf("MVI L, %02X\n", L);
-        break;
-    case 0x3E: // MVI A, data
-        A = memory[PC++];
-        printf("MVI A, %02X\n", A);
-        break;
-    
-    case 0x80: // ADD B
-        A += B;
-        update_flags(A);
-        printf("ADD B\n");
-        break;
-    case 0x81: // ADD C
-        A += C;
-        update_flags(A);
-        printf("ADD C\n");
-        break;
-    case 0x86: // ADD M
-        A += memory[(H << 8) | L];
-        update_flags(A);
-        printf("ADD M\n");
-        break;
-    case 0xC6: // ADI data
-        A += memory[PC++];
-        update_flags(A);
-        printf("ADI %02X\n", A);
-        break;
-    case 0x87: // ADD A
-        A += A;
-        update_flags(A);
-        printf("ADD A\n");
-        break;
-    
-    case 0x7F: // MOV A, A
-        A = A;
-        printf("MOV A, A\n");
-        break;
-    case 0x78: // MOV A, B
-        A = B;
-        printf("MOV A, B\n");
-        break;
-    case 0x79: // MOV A, C
-        A = C;
-        printf("MOV A, C\n");
-        break;
-    case 0x7A: // MOV A, D
-        A = D;
-        printf("MOV A, D\n");
-        break;
-    case 0x7B: // MOV A, E
-        A = E;
-        printf("MOV A, E\n");
-        break;
-    case 0x7C: // MOV A, H
-        A = H;
-        printf("MOV A, H\n");
-        break;
-    case 0x7D: // MOV A, L
-        A = L;
-        printf("MOV A, L\n");
-        break;
-    case 0x7E: // MOV A, M
-        A = memory[(H << 8) | L];
-        printf("MOV A, M\n");
-        break;
-
-    case 0x90: // SUB B
-        A -= B;
-        update_flags_subtraction(A, B);
-        printf("SUB B\n");
-        break;
-    case 0x91: // SUB C
-        A -= C;
-        update_flags_subtraction(A, C);
-        printf("SUB C\n");
-        break;
-    case 0x92: // SUB D
-        A -= D;
-        update_flags_subtraction(A, D);
-        printf("SUB D\n");
-        break;
-    case 0x93: // SUB E
-        A -= E;
-        update_flags_subtraction(A, E);
-        printf("SUB E\n");
-        break;
-    case 0x94: // SUB H
-        A -= H;
-        update_flags_subtraction(A, H);
-        printf("SUB H\n");
-        break;
-    case 0x95: // SUB L
-        A -= L;
-        update_flags_subtraction(A, L);
-        printf("SUB L\n");
-        break;
-    case 0x96: // SUB M
-        A -= memory[(H << 8) | L];
-        update_flags_subtraction(A, memory[(H << 8) | L]);
-        printf("SUB M\n");
-        break;
-    case 0x97: // SUB A
-        A -= A;
-        update_flags_subtraction(A, A);
-        printf("SUB A\n");
-        break;
-    case 0xD6: // SUI data
-        A -= memory[PC++];
-        update_flags_subtraction(A, memory[PC]);
-        printf("SUI %02X\n", A);
-        break;
-
-    case 0x01: // LXI B, data16
-        C = memory[PC++];
-        B = memory[PC++];
-        printf("LXI B, %02X%02X\n", B, C);
-        break;
-    case 0x11: // LXI D, data16
-        E = memory[PC++];
-        D = memory[PC++];
-        printf("LXI D, %02X%02X\n", D, E);
-        break;
-    case 0x21: // LXI H, data16
-        L = memory[PC++];
-        H = memory[PC++];
-        printf("LXI H, %02X%02X\n", H, L);
-        break;
-
-    case 0x32: // STA addr
-        address = memory[PC++];  // lower byte
-        address |= memory[PC++] << 8;   // upper byte
-        memory[address] = A;
-        printf("STA %04X\n", address);
-        break;
-
-    case 0xA0: // ANA B
-        printf("ANA B\n");
-        A = A & B;
-        update_flags(A);
-        break;
-    case 0xA1: // ANA C
-        printf("ANA C\n");
-        A = A & C;
-        update_flags(A);
-        break;
-    case 0xA2: // ANA D
-        printf("ANA D\n");
-        A = A & D;
-        update_flags(A);
-        break;
-    case 0xA3: // ANA E
-        printf("ANA E\n");
-        A = A & E;
-        update_flags(A);
-        break;
-    case 0xA4: // ANA H
-        printf("ANA H\n");
-        A = A & H;
-        update_flags(A);
-        break;
-    case 0xA5: // ANA L
-        printf("ANA L\n");
-        A = A & L;
-        update_flags(A);
-        break;
-    case 0xA6: // ANA M
-        printf("ANA M\n");
-        A = A & memory[(H << 8) | L];
-        update_flags(A);
-        break;
-    case 0xA7: // ANA A
-        printf("ANA A\n");
-        A = A & A;
-        update_flags(A);
-        break;
-
-    case 0xA8: // XRA B
-        printf("XRA B\n");
-        A = A ^ B;
-        update_flags(A);
-        break;
-    case 0xA9: // XRA C
-        printf("XRA C\n");
-        A = A ^ C;
-        update_flags(A);
-        break;
-    case 0xAA: // XRA D
-        printf("XRA D\n");
-        A = A ^ D;
-        update_flags(A);
-        break;
-    case 0xAB: // XRA E
-        printf("XRA E\n");
-        A = A ^ E;
-        update_flags(A);
-        break;
-    case 0xAC: // XRA H
-        printf("XRA H\n");
-        A = A ^ H;
-        update_flags(A);
-        break;
-        break;
-    case 0xAD: // XRA L
-        printf("XRA L\n");
-        A = A ^ L;
-        update_flags(A);
-        break;
-    case 0xAE: // XRA M
-        printf("XRA M\n");
-        A = A ^ memory[(H << 8) | L];
-        update_flags(A);
-        break;
-    case 0xAF: // XRA A
-        printf("XRA A\n");
-        A = A ^ A;
-        update_flags(A);
-        break;
-
-    case 0xB0: // ORA B
-        printf("ORA B\n");
-        A = A | B;
-        update_flags(A);
-        break;
-    case 0xB1: // ORA C
-        printf("ORA C\n");
-        A = A | C;
-        update_flags(A);
-        break;
-    case 0xB2: // ORA D
-        printf("ORA D\n");
-        A = A | D;
-        update_flags(A);
-        break;
-    case 0xB3: // ORA E
-        printf("ORA E\n");
-        A = A | E;
-        update_flags(A);
-        break;
-    case 0xB4: // ORA H
-        printf("ORA H\n");
-        A = A | H;
-        update_flags(A);
-        break;
-    case 0xB5: // ORA L
-        printf("ORA L\n");
-        A = A | L;
-        update_flags(A);
-        break;
-    case 0xB6: // ORA M
-        printf("ORA M\n");
-        A = A | memory[(H << 8) | L];
-        update_flags(A);
-        break;
-    case 0xB7: // ORA A
-        printf("ORA A\n");
-        A = A | A;
-        update_flags(A);
-        break;
-
-    case 0xB8: // CMP B
-        update_flags_subtraction(A, B);
-        printf("CMP B\n");
-        break;
-    case 0xB9: // CMP C
-        update_flags_subtraction(A, C);
-        printf("CMP C\n");
-        break;
-    case 0xBA: // CMP D
-        update_flags_subtraction(A, D);
-        printf("CMP D\n");
-        break;
-    case 0xBB: // CMP E
-        update_flags_subtraction(A, E);
-        printf("CMP E\n");
-        break;
-    case 0xBC: // CMP H
-        update_flags_subtraction(A, H);
-        printf("CMP H\n");
-        break;
-    case 0xBD: // CMP L
-        update_flags_subtraction(A, L);
-        printf("CMP L\n");
-        break;
-    case 0xBE: // CMP M
-        update_flags_subtraction(A, memory[(H << 8) | L]);
-        printf("CMP M\n");
-        break;
-    case 0xBF: // CMP A
-        update_flags_subtraction(A, A);
-        printf("CMP A\n");
-        break;
-
-    case 0x04: // INR B
-        B++;
-        update_flags(B);
-        CLEAR_FLAG(CARRY_FLAG); // Carry flag is unaffected
-        printf("INR B\n");
-        break;
-    case 0x0C: // INR C
-        C++;
-        update_flags(C);
-        CLEAR_FLAG(CARRY_FLAG);
-        printf("INR C\n");
-        break;
-    case 0x14: // INR D
-        D++;
-        update_flags(D);
-        CLEAR_FLAG(CARRY_FLAG);
-        printf("INR D\n");
-        break;
-    case 0x1C: // INR E
-        E++;
-        update_flags(E);
-        CLEAR_FLAG(CARRY_FLAG);
-        printf("INR E\n");
-        break;
-    case 0x24: // INR H
-        H++;
-        update_flags(H);
-        CLEAR_FLAG(CARRY_FLAG);
-        printf("INR H\n");
-        break;
-    case 0x2C: // INR L
-        L++;
-        update_flags(L);
-        CLEAR_FLAG(CARRY_FLAG);
-        printf("INR L\n");
-        break;
-    case 0x34: // INR M
-        // Increment memory at address (H << 8 | L)
-        memory[(H << 8) | L]++;
-        update_flags(memory[(H << 8) | L]);
-        CLEAR_FLAG(CARRY_FLAG);
-        printf("INR M\n");
-        break;
-    case 0x3C: // INR A
-        A++;
-        update_flags(A);
-        CLEAR_FLAG(CARRY_FLAG);
-        printf("INR A\n");
-        break;
-
-    case 0x05: // DCR B
-        B--;
-        update_flags(B);
-        if ((B & 0x0F) == 0x0F) { // Borrow from lower nibble
-        SET_FLAG(AUX_CARRY_FLAG);
-        } else {
-            CLEAR_FLAG(AUX_CARRY_FLAG);
-        }
-        printf("DCR B\n");
-        break;
-    case 0x0D: // DCR C
-        C--;
-        update_flags(C);
-        if ((C & 0x0F) == 0x0F) { // Borrow from lower nibble
-        SET_FLAG(AUX_CARRY_FLAG);
-        } else {
-            CLEAR_FLAG(AUX_CARRY_FLAG);
-        }
-        printf("DCR C\n");
-        break;
-    case 0x15: // DCR D
-        D--;
-        update_flags(D);
-        if ((D & 0x0F) == 0x0F) { // Borrow from lower nibble
-        SET_FLAG(AUX_CARRY_FLAG);
-        } else {
-            CLEAR_FLAG(AUX_CARRY_FLAG);
-        }
-        printf("DCR D\n");
-        break;
-    case 0x1D: // DCR E
-        E--;
-        update_flags(E);
-        if ((E & 0x0F) == 0x0F) { // Borrow from lower nibble
-        SET_FLAG(AUX_CARRY_FLAG);
-        } else {
-            CLEAR_FLAG(AUX_CARRY_FLAG);
+    cpu8085_sync_profile(cpu);
+
+    if (report_path != NULL)
+    {
+        FILE *out = fopen(report_path, "w");
+        if (out == NULL)
+        {
+            perror(report_path);
         }
-        printf("DCR E\n");
-        break;
-    case 0x25: // DCR H
-        H--;
-        update_flags(H);
-        if ((H & 0x0F) == 0x0F) { // Borrow from lower nibble
-        SET_FLAG(AUX_CARRY_FLAG);
-        } else {
-            CLEAR_FLAG(AUX_CARRY_FLAG);
+        else
+        {
+            int status = profile_report(cpu->profile, cpu, PROFILE_TOP, out);
+            if (fclose(out) != 0 || status < 0)
+            {
+                printf("Could not write the whole profile to %s\n", report_path);
+            }
         }
-        printf("DCR H\n");
-        break;
-    case 0x2D: // DCR L
-        L--;
-        update_flags(L);
-        if ((L & 0x0F) == 0x0F) { // Borrow from lower nibble
-        SET_FLAG(AUX_CARRY_FLAG);
-        } else {
-            CLEAR_FLAG(AUX_CARRY_FLAG);
+    }
+    if (folded_path != NULL)
+    {
+        FILE *out = fopen(folded_path, "w");
+        if (out == NULL)
+        {
+            perror(folded_path);
         }
-        printf("DCR L\n");
-        break;
-    case 0x3D: // DCR A
-        A--;
-        update_flags(A);
-        if ((A & 0x0F) == 0x0F) { // Borrow from lower nibble
-        SET_FLAG(AUX_CARRY_FLAG);
-        } else {
-            CLEAR_FLAG(AUX_CARRY_FLAG);
+        else
+        {
+            int status = profile_write_folded(cpu->profile, out);
+            if (fclose(out) != 0 || status < 0)
+            {
+                printf("Could not write the whole profile to %s\n", folded_path);
+            }
         }
-        printf("DCR A\n");
-        break;
-
-    case 0x76: // HLT
-        printf("HLT encountered. Exiting.\n");
-        haltEncountered = true;
-        break;
-    default:
-        printf("Unimplemented opcode: %02X\n", opcode);
-        break;
     }
-
-    (*instruction_count)++;
-    print_state(*instruction_count);
 }
 
-int main(int argc, char** argv)
+// Is this the last line of interactive input, i.e. a HLT or END statement?
+static int is_last_line(const char *line)
 {
-    if(argc == 2){
-        if(strcmp(argv[1], "--help") == 0){
-            printf("This is a 8085 uP emulator written in C.\n");
-            printf("The complete instruction set has not been implemented yet.\n");
-            printf("Just run the program and begin typing in the instructions.\n");
-            printf("Separate each instruction by pressing an Enter key.\n");
-            printf("Once all done, enter the instruction \'HLT\' to terminate the input stream.\n") ;
-        }
-        else{
-            printf("Incorrect flag. Valid flag \'--help\'\n");
-        }
-        return 0;
+    const char *p = line + strspn(line, " \t");
+    const char *colon = strchr(p, ':');
+    const char *comment = strchr(p, ';');
+
+    // Skip a "label:" in front of the instruction
+    if (colon != NULL && (comment == NULL || colon < comment))
+    {
+        p = colon + 1 + strspn(colon + 1, " \t");
     }
-    // Initialize the 8085's registers and memory
-    A = B = C = D = E = H = L = F = 0;
-    PC = 0x0000; // Program counter starts at 0
-    SP = 0xFFFF; // Stack pointer starts at top of memory
+    return (strncasecmp(p, "HLT", 3) == 0 || strncasecmp(p, "END", 3) == 0) &&
+           !isalnum((unsigned char)p[3]);
+}
 
-    // User input for the program
-    printf("Enter 8085 assembly instructions (end with 'HLT'):\n");
+// Read assembly source from stdin, up to and including the HLT (or END) line,
+// and assemble it. Numbers are hex at the prompt, as in "MVI A, 3F".
+// Returns 0 on success, -1 if the program does not assemble.
+int read_program(int quiet, unsigned char *mem, FILE *listing, struct asm_result *result)
+{
+    if (!quiet)
+    {
+        printf("Enter 8085 assembly instructions (end with 'HLT'):\n");
+    }
 
     char input[256];
-    int address = 0;
-    while (1)
+    char *source = NULL;
+    size_t length = 0;
+    size_t capacity = 0;
+
+    while (fgets(input, sizeof(input), stdin) != NULL)
     {
-        fgets(input, sizeof(input), stdin);
-        if (strncmp(input, "HLT", 3) == 0)
-        {
-            memory[address++] = 0x76; // HLT opcode
-            break;
-        }
-        else if (strncmp(input, "MVI B,", 6) == 0)
-        {
-            memory[address++] = 0x06; // MVI B opcode
-            memory[address++] = (unsigned char)strtol(input + 6, NULL, 16);
-        }
-        else if (strncmp(input, "MVI C,", 6) == 0)
-        {
-            memory[address++] = 0x0E; // MVI C opcode
-            memory[address++] = (unsigned char)strtol(input + 6, NULL, 16);
-        }
-        else if (strncmp(input, "MVI D,", 6) == 0)
-        {
-            memory[address++] = 0x16; // MVI D opcode
-            memory[address++] = (unsigned char)strtol(input + 6, NULL, 16);
-        }
-        else if (strncmp(input, "MVI E,", 6) == 0)
-        {
-            memory[address++] = 0x1E; // MVI E opcode
-            memory[address++] = (unsigned char)strtol(input + 6, NULL, 16);
-        }
-        else if (strncmp(input, "MVI H,", 6) == 0)
-        {
-            memory[address++] = 0x26; // MVI H opcode
-            memory[address++] = (unsigned char)strtol(input + 6, NULL, 16);
-        }
-        else if (strncmp(input, "MVI L,", 6) == 0)
-        {
-            memory[address++] = 0x2E; // MVI L opcode
-            memory[address++] = (unsigned char)strtol(input + 6, NULL, 16);
-        }
-        else if (strncmp(input, "MVI A,", 6) == 0)
+        size_t n = strlen(input);
+        if (length + n + 1 > capacity)
         {
-            memory[address++] = 0x3E; // MVI A opcode
-            memory[address++] = (unsigned char)strtol(input + 6, NULL, 16);
+            capacity = (length + n + 1) * 2;
+            char *grown = realloc(source, capacity);
+            if (grown == NULL)
+            {
+                printf("Out of memory reading the program\n");
+                free(source);
+                return -1;
+            }
+            source = grown;
         }
-        else if (strncmp(input, "ADD B", 5) == 0)
-        {
-            memory[address++] = 0x80; // ADD B opcode
-        }
-        else if (strncmp(input, "ADD C", 5) == 0)
-        {
-            memory[address++] = 0x81; // ADD C opcode
-        }
-        else if (strncmp(input, "ADD M", 5) == 0)
-        {
-            memory[address++] = 0x86; // ADD M opcode
-        }
-        else if (strncmp(input, "ADD A", 5) == 0)
-        {
-            memory[address++] = 0x87; // ADD M opcode
-        }
-        else if (strncmp(input, "ADI ", 4) == 0)
-        {
-            memory[address++] = 0xC6; // ADI opcode
-            memory[address++] = (unsigned char)strtol(input + 4, NULL, 16);
-        }
-        else if (strncmp(input, "MOV A, A", 8) == 0)
-        {
-            memory[address++] = 0x7F; // MOV A, A opcode
-        }
-        else if (strncmp(input, "MOV A, B", 8) == 0)
-        {
-            memory[address++] = 0x78; // MOV A, B opcode
-        }
-        else if (strncmp(input, "MOV A, C", 8) == 0)
-        {
-            memory[address++] = 0x79; // MOV A, C opcode
-        }
-        else if (strncmp(input, "MOV A, D", 8) == 0)
-        {
-            memory[address++] = 0x7A; // MOV A, D opcode
-        }
-        else if (strncmp(input, "MOV A, E", 8) == 0)
-        {
-            memory[address++] = 0x7B; // MOV A, E opcode
-        }
-        else if (strncmp(input, "MOV A, H", 8) == 0)
-        {
-            memory[address++] = 0x7C; // MOV A, H opcode
-        }
-        else if (strncmp(input, "MOV A, L", 8) == 0)
-        {
-            memory[address++] = 0x7D; // MOV A, L opcode
-        }
-        else if (strncmp(input, "MOV A, M", 8) == 0)
-        {
-            memory[address++] = 0x7E; // MOV A, M opcode
-        }
-        else if (strncmp(input, "SUB B", 5) == 0)
-        {
-            memory[address++] = 0x90; // SUB B opcode
-        }
-        else if (strncmp(input, "SUB C", 5) == 0)
-        {
-            memory[address++] = 0x91; // SUB C opcode
-        }
-        else if (strncmp(input, "SUB D", 5) == 0)
-        {
-            memory[address++] = 0x92; // SUB D opcode
-        }
-        else if (strncmp(input, "SUB E", 5) == 0)
-        {
-            memory[address++] = 0x93; // SUB E opcode
-        }
-        else if (strncmp(input, "SUB H", 5) == 0)
-        {
-            memory[address++] = 0x94; // SUB H opcode
-        }
-        else if (strncmp(input, "SUB L", 5) == 0)
-        {
-            memory[address++] = 0x95; // SUB L opcode
-        }
-        else if (strncmp(input, "SUB A", 5) == 0)
-        {
-            memory[address++] = 0x97; // SUB M opcode
-        }
-        else if (strncmp(input, "SUI ", 4) == 0)
-        {
-            memory[address++] = 0xD6; // SUI opcode
-            memory[address++] = (unsigned char)strtol(input + 4, NULL, 16);
-        }
-        else if (strncmp(input, "ANA B", 5) == 0)
-        {
-            memory[address++] = 0xA0; // AND B opcode
-        }
-        else if (strncmp(input, "ANA C", 5) == 0)
-        {
-            memory[address++] = 0xA1; // AND C opcode
-        }
-        else if (strncmp(input, "ANA D", 5) == 0)
-        {
-            memory[address++] = 0xA2; // AND D opcode
-        }
-        else if (strncmp(input, "ANA E", 5) == 0)
-        {
-            memory[address++] = 0xA3; // AND E opcode
-        }
-        else if (strncmp(input, "ANA H", 5) == 0)
-        {
-            memory[address++] = 0xA4; // AND H opcode
-        }
-        else if (strncmp(input, "ANA L", 5) == 0)
-        {
-            memory[address++] = 0xA5; // AND L opcode
-        }
-        else if (strncmp(input, "ANA A", 5) == 0)
-        {
-            memory[address++] = 0xA7; // AND M opcode
-        }
-        else if (strncmp(input, "XRA B", 5) == 0)
-        {
-            memory[address++] = 0xA8; // XOR B opcode
-        }
-        else if (strncmp(input, "XRA C", 5) == 0)
-        {
-            memory[address++] = 0xA9; // XOR C opcode
-        }
-        else if (strncmp(input, "XRA D", 5) == 0)
-        {
-            memory[address++] = 0xAA; // XOR D opcode
-        }
-        else if (strncmp(input, "XRA E", 5) == 0)
-        {
-            memory[address++] = 0xAB; // XOR E opcode
-        }
-        else if (strncmp(input, "XRA H", 5) == 0)
-        {
-            memory[address++] = 0xAC; // XOR H opcode
-        }
-        else if (strncmp(input, "XRA L", 5) == 0)
-        {
-            memory[address++] = 0xAD; // XOR L opcode
-        }
-        else if (strncmp(input, "XRA A", 5) == 0)
-        {
-            memory[address++] = 0xAF; // XOR M opcode
-        }
-        else if (strncmp(input, "ORA B", 5) == 0)
-        {
-            memory[address++] = 0xB0; // OR B opcode
-        }
-        else if (strncmp(input, "ORA C", 5) == 0)
-        {
-            memory[address++] = 0xB1; // OR C opcode
-        }
-        else if (strncmp(input, "ORA D", 5) == 0)
-        {
-            memory[address++] = 0xB2; // OR D opcode
-        }
-        else if (strncmp(input, "ORA E", 5) == 0)
-        {
-            memory[address++] = 0xB3; // OR E opcode
-        }
-        else if (strncmp(input, "ORA H", 5) == 0)
-        {
-            memory[address++] = 0xB4; // OR H opcode
-        }
-        else if (strncmp(input, "ORA L", 5) == 0)
-        {
-            memory[address++] = 0xB5; // OR L opcode
-        }
-        else if (strncmp(input, "ORA A", 5) == 0)
-        {
-            memory[address++] = 0xB7; // OR B opcode
-        }
-        else if (strncmp(input, "CMP B", 5) == 0)
-        {
-            memory[address++] = 0xB8; // OR B opcode
-        }
-        else if (strncmp(input, "CMP C", 5) == 0)
-        {
-            memory[address++] = 0xB9; // OR C opcode
-        }
-        else if (strncmp(input, "CMP D", 5) == 0)
-        {
-            memory[address++] = 0xBA; // OR D opcode
-        }
-        else if (strncmp(input, "CMP E", 5) == 0)
-        {
-            memory[address++] = 0xBB; // OR E opcode
-        }
-        else if (strncmp(input, "CMP H", 5) == 0)
+        memcpy(source + length, input, n + 1);
+        length += n;
+
+        if (is_last_line(input))
         {
-            memory[address++] = 0xBC; // OR H opcode
+            break;
         }
-        else if (strncmp(input, "CMP L", 5) == 0)
+    }
+
+    int status = assemble("<stdin>", source ? source : "", length, 16, mem, listing, result);
+    free(source);
+    return status;
+}
+
+int main(int argc, char** argv)
+{
+    static const struct option long_options[] = {
+        {"help", no_argument, NULL, 'h'},
+        {"turbo", no_argument, NULL, 't'},
+        {"jit", no_argument, NULL, 'J'},
+        {"step", no_argument, NULL, 's'},
+        {"debug", no_argument, NULL, 'g'},
+        {"history", required_argument, NULL, 'H'},
+        {"clock", required_argument, NULL, 'c'},
+        {"quiet", no_argument, NULL, 'q'},
+        {"summary", required_argument, NULL, 'S'},
+        {"bin", required_argument, NULL, 'b'},
+        {"hex", required_argument, NULL, 'x'},
+        {"origin", required_argument, NULL, 'o'},
+        {"asm", required_argument, NULL, 'a'},
+        {"listing", required_argument, NULL, 'l'},
+        {"max-instructions", required_argument, NULL, 'I'},
+        {"max-tstates", required_argument, NULL, 'T'},
+        {"timeout", required_argument, NULL, 'W'},
+        {"trace-file", required_argument, NULL, 'R'},
+        {"profile", required_argument, NULL, 'P'},
+        {"profile-folded", required_argument, NULL, 'F'},
+        {"no-devices", no_argument, NULL, 'D'},
+        {"restore", required_argument, NULL, 'r'},
+        {"save-snapshot", required_argument, NULL, 'n'},
+        {"snapshot-every", required_argument, NULL, 'e'},
+        {"snapshot-base", required_argument, NULL, 'N'},
+        {"batch", required_argument, NULL, 'B'},
+        {"jobs", required_argument, NULL, 'j'},
+        {NULL, 0, NULL, 0}
+    };
+
+    enum run_mode mode = MODE_REALTIME;
+    double clock_mhz = DEFAULT_CLOCK_MHZ;
+    int quiet = !TRACE;
+    unsigned long long summary_interval = 0;
+    const char *bin_path = NULL;
+    const char *hex_path = NULL;
+    const char *asm_path = NULL;
+    const char *listing_path = NULL;
+    const char *batch_path = NULL;
+    int jobs = 0;
+    int jit = 0;
+    unsigned long history = DEFAULT_HISTORY;
+    unsigned long long max_instructions = 0;
+    unsigned long long max_tstates = 0;
+    double timeout = 0;
+    const char *trace_path = NULL;
+    const char *profile_path = NULL;
+    const char *folded_path = NULL;
+    const char *restore_path = NULL;
+    int devices_enabled = true;
+    const char *snapshot_path = NULL;
+    const char *snapshot_base_path = NULL;
+    unsigned long long snapshot_interval = 0;
+    unsigned short origin = 0;
+    int opt;
+
+    while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1)
+    {
+        switch (opt)
         {
-            memory[address++] = 0xBD; // OR L opcode
+        case 'h':
+            print_help();
+            return 0;
+        case 't':
+            mode = MODE_TURBO;
+            break;
+        case 's':
+            mode = MODE_STEP;
+            break;
+        case 'g':
+            mode = MODE_DEBUG;
+            break;
+        case 'H':
+            history = strtoul(optarg, NULL, 0);
+            break;
+        case 'c':
+            clock_mhz = strtod(optarg, NULL);
+            if (clock_mhz <= 0)
+            {
+                printf("Invalid clock frequency: %s\n", optarg);
+                return 1;
+            }
+            mode = MODE_REALTIME;
+            break;
+        case 'q':
+            quiet = true;
+            break;
+        case 'S':
+            summary_interval = strtoull(optarg, NULL, 0);
+            break;
+        case 'b':
+            bin_path = optarg;
+            break;
+        case 'x':
+            hex_path = optarg;
+            break;
+        case 'o':
+            origin = (unsigned short)strtol(optarg, NULL, 16);
+            break;
+        case 'a':
+            asm_path = optarg;
+            break;
+        case 'l':
+            listing_path = optarg;
+            break;
+        case 'I':
+            max_instructions = strtoull(optarg, NULL, 0);
+            break;
+        case 'T':
+            max_tstates = strtoull(optarg, NULL, 0);
+            break;
+        case 'W':
+            timeout = strtod(optarg, NULL);
+            break;
+        case 'R':
+            trace_path = optarg;
+            break;
+        case 'P':
+            profile_path = optarg;
+            break;
+        case 'F':
+            folded_path = optarg;
+            break;
+        case 'D':
+            devices_enabled = false;
+            break;
+        case 'r':
+            restore_path = optarg;
+            break;
+        case 'n':
+            snapshot_path = optarg;
+            break;
+        case 'e':
+            snapshot_interval = strtoull(optarg, NULL, 0);
+            break;
+        case 'N':
+            snapshot_base_path = optarg;
+            break;
+        case 'B':
+            batch_path = optarg;
+            break;
+        case 'j':
+            jobs = atoi(optarg);
+            break;
+        case 'J':
+            jit = 1;
+            break;
+        default:
+            printf("Incorrect flag. Run with \'--help\' for the valid flags.\n");
+            return 1;
         }
-        else if (strncmp(input, "CMP A", 5) == 0)
+    }
+
+    if (batch_path != NULL)
+    {
+        struct batch_options batch_options = {
+            .jobs = jobs,
+            .max_instructions = max_instructions || max_tstates ? max_instructions : DEFAULT_BATCH_BUDGET,
+            .max_tstates = max_tstates,
+            .max_seconds = timeout,
+            .origin = origin,
+            .jit = jit,
+        };
+        return run_batch(batch_path, &batch_options);
+    }
+
+    // Initialize the 8085's registers and memory
+    cpu8085 *cpu = cpu8085_create();
+    if (cpu == NULL)
+    {
+        printf("Out of memory\n");
+        return 1;
+    }
+    cpu->trace = !quiet;
+
+    // Console UART on ports 00/01, LEDs on 02, timer on 10-12 and a
+    // 7-segment display at F800-F807
+    struct standard_devices devices;
+    if (devices_enabled)
+    {
+        standard_devices_attach(&devices, cpu);
+    }
+
+    unsigned char *snapshot_base = NULL;
+    if (snapshot_base_path != NULL && (snapshot_base = load_snapshot_base(snapshot_base_path)) == NULL)
+    {
+        return 1;
+    }
+    if (snapshot_interval && snapshot_path == NULL)
+    {
+        printf("--snapshot-every needs --save-snapshot FILE\n");
+        return 1;
+    }
+
+    // Resume a snapshot, load the program from a file, or read it interactively
+    if (restore_path != NULL)
+    {
+        if (snapshot_load(cpu, restore_path, snapshot_base) < 0)
         {
-            memory[address++] = 0xBF; // OR M opcode
+            return 1;
         }
-        else if (strncmp(input, "INR B", 5) == 0)
+    }
+    else if (bin_path != NULL)
+    {
+        if (load_binary(bin_path, cpu->memory, origin) < 0)
         {
-            memory[address++] = 0x04; // INR B opcode
+            return 1;
         }
-        else if (strncmp(input, "INR C", 5) == 0)
+        cpu->PC = origin;
+    }
+    else if (hex_path != NULL)
+    {
+        int entry = origin;
+        if (load_intel_hex(hex_path, cpu->memory, &entry) < 0)
         {
-            memory[address++] = 0x0C; // INR C opcode
+            return 1;
         }
-        else if (strncmp(input, "INR D", 5) == 0)
+        cpu->PC = entry;
+    }
+    else
+    {
+        FILE *listing = NULL;
+        struct asm_result result = { 0 };
+        int status;
+
+        if (listing_path != NULL && (listing = fopen(listing_path, "w")) == NULL)
         {
-            memory[address++] = 0x14; // INR D opcode
+            perror(listing_path);
+            return 1;
         }
-        else if (strncmp(input, "INR E", 5) == 0)
+        if (asm_path != NULL)
         {
-            memory[address++] = 0x1C; // INR E opcode
+            status = assemble_file(asm_path, cpu->memory, listing, &result);
         }
-        else if (strncmp(input, "INR H", 5) == 0)
+        else
         {
-            memory[address++] = 0x24; // INR H opcode
+            status = read_program(quiet, cpu->memory, listing, &result);
         }
-        else if (strncmp(input, "INR L", 5) == 0)
+        if (listing != NULL)
         {
-            memory[address++] = 0x2C; // INR L opcode
+            fclose(listing);
         }
-        else if (strncmp(input, "INR A", 5) == 0)
+        if (status < 0)
         {
-            memory[address++] = 0x3C; // INR A opcode
+            if (result.errors)
+            {
+                printf("Program not run: %d assembly error(s)\n", result.errors);
+            }
+            return 1;
         }
-        else if (strncmp(input, "DCR B", 5) == 0)
+        cpu->PC = result.entry >= 0 ? result.entry : origin;
+    }
+
+    if (trace_path != NULL)
+    {
+        cpu->bintrace = bintrace_open(trace_path);
+        if (cpu->bintrace == NULL)
         {
-            memory[address++] = 0x05; // DCR B opcode
+            cpu8085_destroy(cpu);
+            return 1;
         }
-        else if (strncmp(input, "DCR C", 5) == 0)
+    }
+
+    if (profile_path != NULL || folded_path != NULL)
+    {
+        cpu->profile = profile_create(cpu);
+        if (cpu->profile == NULL)
         {
-            memory[address++] = 0x0D; // DCR C opcode
+            printf("Out of memory\n");
+            cpu8085_destroy(cpu);
+            return 1;
         }
-        else if (strncmp(input, "DCR D", 5) == 0)
+    }
+
+    // Translated code is never profiled or traced
+    if (mode == MODE_TURBO && jit && (cpu->profile != NULL || cpu->bintrace != NULL))
+    {
+        printf("--jit has no effect when profiling or tracing, running without it\n");
+        jit = 0;
+    }
+
+    // Unthrottled runs go through the block cache; without memory for it
+    // they simply run uncached
+    if (mode == MODE_TURBO && jit && cpu8085_enable_jit(cpu) < 0)
+    {
+        printf("No JIT on this host, running the block cache\n");
+    }
+    else if (mode == MODE_TURBO || mode == MODE_DEBUG)
+    {
+        cpu8085_enable_blocks(cpu);
+    }
+
+    struct pacer pacer;
+    pacer_init(&pacer, cpu, clock_mhz);
+
+    // Watchdog: limits on instructions, T-states and wall-clock time
+    unsigned long long deadline = timeout > 0 ? host_time_ns() + (unsigned long long)(timeout * 1e9) : 0;
+    enum cpu8085_stop stop = CPU8085_STOP_HALT;
+
+    // Counters carry on from a restored snapshot; limits count from here
+    unsigned long long start_instructions = cpu->instructions;
+    unsigned long long start_tstates = cpu->tstates;
+    unsigned long long idle_steps = 0; // steps idle in HLT, counted as instructions
+    unsigned long long next_summary = start_instructions + summary_interval;
+    bool summary_shown = false; // a summary was printed at summary_instructions
+    unsigned long long summary_instructions = 0;
+    unsigned long long next_snapshot = start_instructions + snapshot_interval;
+
+    // The debugger drives the run itself
+    if (mode == MODE_DEBUG && debugger_run(cpu, devices_enabled ? &devices : NULL, history) < 0)
+    {
+        cpu8085_destroy(cpu);
+        return 1;
+    }
+
+    while (mode != MODE_DEBUG && !cpu->halted)
+    {
+        unsigned long long done = cpu->instructions - start_instructions + idle_steps;
+        if (max_instructions && done >= max_instructions)
         {
-            memory[address++] = 0x15; // DCR D opcode
+            stop = CPU8085_STOP_INSTRUCTIONS;
+            break;
         }
-        else if (strncmp(input, "DCR E", 5) == 0)
+        if (max_tstates && cpu->tstates - start_tstates >= max_tstates)
         {
-            memory[address++] = 0x1D; // DCR E opcode
+            stop = CPU8085_STOP_TSTATES;
+            break;
         }
-        else if (strncmp(input, "DCR H", 5) == 0)
+        unsigned long long now = deadline ? host_time_ns() : 0;
+        if (deadline && now >= deadline)
         {
-            memory[address++] = 0x25; // DCR H opcode
+            stop = CPU8085_STOP_TIMEOUT;
+            break;
         }
-        else if (strncmp(input, "DCR L", 5) == 0)
+
+        if (mode == MODE_STEP && !wait_for_step())
         {
-            memory[address++] = 0x2D; // DCR L opcode
+            break;
         }
-        else if (strncmp(input, "DCR A", 5) == 0)
-        {
-            memory[address++] = 0x3D; // DCR A opcode
+
+        if (mode == MODE_TURBO && !cpu->trace)
+        {
+            // A burst up to the next point where this loop has something to do
+            unsigned long long burst = WATCHDOG_INTERVAL - cpu->instructions % WATCHDOG_INTERVAL;
+            if (max_instructions && max_instructions - done < burst)
+            {
+                burst = max_instructions - done;
+            }
+            if (summary_interval && next_summary - cpu->instructions < burst)
+            {
+                burst = next_summary - cpu->instructions;
+            }
+            if (snapshot_interval && next_snapshot - cpu->instructions < burst)
+            {
+                burst = next_snapshot - cpu->instructions;
+            }
+            struct cpu8085_limits limits = {
+                burst, max_tstates ? start_tstates + max_tstates - cpu->tstates : 0,
+                deadline ? (deadline - now) / 1e9 : 0
+            };
+            unsigned long long before = cpu->instructions;
+            if (cpu8085_run_limited(cpu, &limits) == CPU8085_STOP_INSTRUCTIONS)
+            {
+                idle_steps += burst - (cpu->instructions - before);
+            }
         }
-        else if (strncmp(input, "LXI B,", 6) == 0)
+        else
         {
-            memory[address++] = 0x01; // LXI B opcode
-            unsigned short data16 = (unsigned short)strtol(input + 6, NULL, 16);
-            memory[address++] = data16 & 0xFF;        // Low-order byte
-            memory[address++] = (data16 >> 8) & 0xFF; // High-order byte
+            unsigned long long before = cpu->instructions;
+            emulate_instruction(cpu);
+            if (cpu->instructions == before && !cpu->halted)
+            {
+                idle_steps++;
+            }
         }
-        else if (strncmp(input, "LXI D,", 6) == 0)
+
+#if TRACE
+        if (cpu->trace)
         {
-            memory[address++] = 0x11; // LXI D opcode
-            unsigned short data16 = (unsigned short)strtol(input + 6, NULL, 16);
-            memory[address++] = data16 & 0xFF;        // Low-order byte
-            memory[address++] = (data16 >> 8) & 0xFF; // High-order byte
+            print_state(cpu);
         }
-        else if (strncmp(input, "LXI H,", 6) == 0)
+#endif
+        if (summary_interval && cpu->instructions == next_summary)
         {
-            memory[address++] = 0x21; // LXI H opcode
-            unsigned short data16 = (unsigned short)strtol(input + 6, NULL, 16);
-            memory[address++] = data16 & 0xFF;        // Low-order byte
-            memory[address++] = (data16 >> 8) & 0xFF; // High-order byte
+            print_state(cpu);
+            summary_shown = true;
+            summary_instructions = cpu->instructions;
+            next_summary += summary_interval;
         }
-        else if (strncmp(input, "STA ", 4) == 0)
+        if (cpu->instructions == next_snapshot && snapshot_interval)
         {
-            memory[address++] = 0x32; // STA opcode
-            unsigned short addr = (unsigned short)strtol(input + 4, NULL, 16);
-            memory[address++] = addr & 0xFF;        // Low-order byte
-            memory[address++] = (addr >> 8) & 0xFF; // High-order byte
+            save_snapshot(cpu, snapshot_path, snapshot_base, true);
+            next_snapshot += snapshot_interval;
         }
-        else
+
+        if (mode == MODE_REALTIME && cpu->tstates >= pacer.next_sync)
         {
-            printf("Unknown instruction: %s\n", input);
+            pacer_sync(&pacer, cpu);
         }
     }
 
-    int instruction_count = 0;
-    while (!haltEncountered)
+    if (cpu->halted)
+    {
+        stop = cpu8085_stop_reason(cpu);
+    }
+    if (stop != CPU8085_STOP_HALT)
+    {
+        printf("Stopped (%s) at %04X\n", cpu8085_stop_name(stop), cpu->PC);
+    }
+
+    // Headless and debugger runs only report the final state, unless the
+    // last summary already showed it
+    if ((quiet || mode == MODE_DEBUG) && !(summary_shown && cpu->instructions == summary_instructions))
+    {
+        print_state(cpu);
+    }
+
+    if (cpu->bintrace != NULL && bintrace_close(cpu->bintrace) < 0)
+    {
+        printf("Could not write the whole trace to %s\n", trace_path);
+    }
+    if (snapshot_path != NULL)
+    {
+        save_snapshot(cpu, snapshot_path, snapshot_base, false);
+    }
+    if (cpu->profile != NULL)
     {
-        emulate_instruction(&instruction_count);
-        usleep(500000);
+        write_profile(cpu, profile_path, folded_path);
+        profile_destroy(cpu->profile);
     }
 
-    return 0;
+    free(snapshot_base);
+    cpu8085_destroy(cpu);
+    return stop;
 }
@@ -0,0 +1,185 @@
+// Build-time generator for the 8085 flag lookup tables used by cpu8085.c.
+//
+// Writes flags_table.h to stdout. Every entry is checked against a plain,
+// flag-by-flag reference implementation of the 8085 flag semantics before the
+// header is emitted; any mismatch aborts the build.
+#include <stdio.h>
+#include <stdlib.h>
+
+// Flag bit positions in the F register (same as cpu8085.h)
+#define CARRY_FLAG 0x01
+#define PARITY_FLAG 0x04
+#define AUX_CARRY_FLAG 0x10
+#define ZERO_FLAG 0x40
+#define SIGN_FLAG 0x80
+
+#define FLAG_INDEX(carry, a, b) (((carry) << 16) | ((a) << 8) | (b))
+
+static unsigned char szp_flags[256];
+static unsigned char add_flags[2 * 65536];
+static unsigned char sub_flags[2 * 65536];
+
+// Reference: S, Z and P of a result, one flag at a time
+static unsigned char reference_szp(unsigned char result)
+{
+    unsigned char f = 0;
+    int bits = 0;
+
+    if (result == 0)
+    {
+        f |= ZERO_FLAG;
+    }
+    if (result >= 0x80)
+    {
+        f |= SIGN_FLAG;
+    }
+    for (int i = 0; i < 8; i++)
+    {
+        if (result & (1 << i))
+        {
+            bits++;
+        }
+    }
+    if (bits % 2 == 0)
+    {
+        f |= PARITY_FLAG;
+    }
+    return f;
+}
+
+// Reference: a + b + carry. CY is the carry out of bit 7, AC out of bit 3.
+static unsigned char reference_add(int a, int b, int carry)
+{
+    unsigned char f = reference_szp((a + b + carry) & 0xFF);
+
+    if (a + b + carry > 0xFF)
+    {
+        f |= CARRY_FLAG;
+    }
+    if ((a & 0x0F) + (b & 0x0F) + carry > 0x0F)
+    {
+        f |= AUX_CARRY_FLAG;
+    }
+    return f;
+}
+
+// Reference: a - b - borrow. CY is the borrow into bit 7, AC the borrow from
+// the low nibble (bit 4 into bit 3), as on the 8085.
+static unsigned char reference_sub(int a, int b, int borrow)
+{
+    unsigned char f = reference_szp((a - b - borrow) & 0xFF);
+
+    if (a < b + borrow)
+    {
+        f |= CARRY_FLAG;
+    }
+    if ((a & 0x0F) < (b & 0x0F) + borrow)
+    {
+        f |= AUX_CARRY_FLAG;
+    }
+    return f;
+}
+
+// Build the tables from the carry vector of the operation: bit 8 of the
+// result is CY and bit 4 of (a ^ b ^ result) is the carry/borrow into bit 4.
+static void build_tables(void)
+{
+    for (int v = 0; v < 256; v++)
+    {
+        int p = v ^ (v >> 4);
+        p ^= p >> 2;
+        p ^= p >> 1;
+        szp_flags[v] = (v & SIGN_FLAG) | (v ? 0 : ZERO_FLAG) | ((~p & 1) << 2);
+    }
+
+    for (int carry = 0; carry < 2; carry++)
+    {
+        for (int a = 0; a < 256; a++)
+        {
+            for (int b = 0; b < 256; b++)
+            {
+                int sum = a + b + carry;
+                int diff = a - b - carry;
+
+                add_flags[FLAG_INDEX(carry, a, b)] = szp_flags[sum & 0xFF] |
+                    ((sum >> 8) & CARRY_FLAG) | ((a ^ b ^ sum) & AUX_CARRY_FLAG);
+                sub_flags[FLAG_INDEX(carry, a, b)] = szp_flags[diff & 0xFF] |
+                    ((diff >> 8) & CARRY_FLAG) | ((a ^ b ^ diff) & AUX_CARRY_FLAG);
+            }
+        }
+    }
+}
+
+// Exhaustively compare every entry against the reference implementation
+static int check_tables(void)
+{
+    int errors = 0;
+
+    for (int v = 0; v < 256; v++)
+    {
+        if (szp_flags[v] != reference_szp(v))
+        {
+            fprintf(stderr, "szp_flags[%02X] = %02X, expected %02X\n", v, szp_flags[v], reference_szp(v));
+            errors++;
+        }
+    }
+
+    for (int carry = 0; carry < 2; carry++)
+    {
+        for (int a = 0; a < 256; a++)
+        {
+            for (int b = 0; b < 256; b++)
+            {
+                unsigned char add = add_flags[FLAG_INDEX(carry, a, b)];
+                unsigned char sub = sub_flags[FLAG_INDEX(carry, a, b)];
+
+                if (add != reference_add(a, b, carry))
+                {
+                    fprintf(stderr, "add %02X + %02X + %d: %02X, expected %02X\n", a, b, carry, add, reference_add(a, b, carry));
+                    errors++;
+                }
+                if (sub != reference_sub(a, b, carry))
+                {
+                    fprintf(stderr, "sub %02X - %02X - %d: %02X, expected %02X\n", a, b, carry, sub, reference_sub(a, b, carry));
+                    errors++;
+                }
+            }
+        }
+    }
+    return errors;
+}
+
+static void print_table(const char *name, const unsigned char *table, int size)
+{
+    printf("static const unsigned char %s[%d] = {", name, size);
+    for (int i = 0; i < size; i++)
+    {
+        printf("%s0x%02X,", i % 16 ? "" : "\n    ", table[i]);
+    }
+    printf("\n};\n\n");
+}
+
+int main(void)
+{
+    build_tables();
+
+    int errors = check_tables();
+    if (errors)
+    {
+        fprintf(stderr, "gen_flags: %d table entries disagree with the reference\n", errors);
+        return 1;
+    }
+
+    printf("// Generated by gen_flags.c at build time -- do not edit.\n\n");
+    printf("#ifndef FLAGS_TABLE_H\n#define FLAGS_TABLE_H\n\n");
+    printf("// Index of the add/sub tables: carry-in (0/1), first and second operand\n");
+    printf("#define FLAG_INDEX(carry, a, b) (((carry) << 16) | ((a) << 8) | (b))\n\n");
+    printf("// S, Z and P of a result byte\n");
+    print_table("szp_flags", szp_flags, 256);
+    printf("// Complete F (S, Z, AC, P, CY) of a + b + carry\n");
+    print_table("add_flags", add_flags, 2 * 65536);
+    printf("// Complete F (S, Z, AC, P, CY) of a - b - borrow\n");
+    print_table("sub_flags", sub_flags, 2 * 65536);
+    printf("#endif\n");
+    return 0;
+}
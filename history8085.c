@@ -0,0 +1,411 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "history8085.h"
+#include "debug8085.h"
+
+struct history8085 *history8085_attach(cpu8085 *cpu, unsigned long capacity)
+{
+    struct history8085 *history = calloc(1, sizeof(struct history8085));
+    if (history == NULL)
+    {
+        return NULL;
+    }
+    history->capacity = HISTORY8085_MIN_CAPACITY;
+    while (history->capacity < capacity)
+    {
+        history->capacity *= 2;
+    }
+    history->entries = malloc(history->capacity * sizeof(struct history8085_entry));
+    history->writes = malloc(history->capacity * sizeof(struct history8085_write));
+    if (history->entries == NULL || history->writes == NULL)
+    {
+        free(history->entries);
+        free(history->writes);
+        free(history);
+        return NULL;
+    }
+
+    cpu->history = history;
+    for (int page = 0; page < 256; page++)
+    {
+        cpu->mmio[page] |= CPU8085_PAGE_HISTORY;
+    }
+    // The first keyframe is where recording started
+    history8085_keyframe(cpu);
+    return history;
+}
+
+void history8085_detach(cpu8085 *cpu)
+{
+    struct history8085 *history = cpu->history;
+    if (history == NULL)
+    {
+        return;
+    }
+    for (int page = 0; page < 256; page++)
+    {
+        cpu->mmio[page] &= ~CPU8085_PAGE_HISTORY;
+    }
+    for (int i = 0; i < HISTORY8085_KEYFRAMES; i++)
+    {
+        free(history->keyframes[i].memory);
+    }
+    free(history->entries);
+    free(history->writes);
+    free(history);
+    cpu->history = NULL;
+}
+
+// ---- Recording ----
+
+void history8085_make_room(struct history8085 *history, unsigned long entries, unsigned long writes)
+{
+    while (history->head - history->tail > history->capacity - entries ||
+           history->write_head - history->write_tail > history->capacity - writes)
+    {
+        const struct history8085_entry *oldest = &history->entries[history->tail++ & (history->capacity - 1)];
+        history->write_tail += oldest->write_count;
+    }
+}
+
+void history8085_keyframe(cpu8085 *cpu)
+{
+    struct history8085 *history = cpu->history;
+
+    history->next_keyframe = cpu->instructions + history->capacity;
+
+    // The oldest keyframe makes way, and its memory is reused
+    if (history->keyframe_count == HISTORY8085_KEYFRAMES)
+    {
+        struct history8085_keyframe oldest = history->keyframes[0];
+        memmove(&history->keyframes[0], &history->keyframes[1],
+                (HISTORY8085_KEYFRAMES - 1) * sizeof(struct history8085_keyframe));
+        history->keyframes[HISTORY8085_KEYFRAMES - 1] = oldest;
+        history->keyframe_count--;
+    }
+    struct history8085_keyframe *keyframe = &history->keyframes[history->keyframe_count];
+    if (keyframe->memory == NULL && (keyframe->memory = malloc(CPU8085_MEMORY_SIZE)) == NULL)
+    {
+        return;
+    }
+    keyframe->state = *cpu;
+    memcpy(keyframe->memory, cpu->memory, CPU8085_MEMORY_SIZE);
+    history->keyframe_count++;
+}
+
+// ---- Going back ----
+
+// Keyframes past the instruction cpu is now at belong to a future that
+// will be run again
+static void drop_later_keyframes(cpu8085 *cpu)
+{
+    struct history8085 *history = cpu->history;
+
+    while (history->keyframe_count > 0 &&
+           history->keyframes[history->keyframe_count - 1].state.instructions > cpu->instructions)
+    {
+        history->keyframe_count--;
+    }
+    history->next_keyframe = history->keyframe_count > 0 ?
+                             history->keyframes[history->keyframe_count - 1].state.instructions + history->capacity :
+                             cpu->instructions;
+}
+
+// The CPU is neither halted nor stopped in the recorded past, and service()
+// runs before the next instruction to look at events and interrupts again
+static void resume_here(cpu8085 *cpu)
+{
+    cpu->halted = 0;
+    cpu->fault = 0;
+    cpu->next_event = 0;
+    cpu8085_sync_flags(cpu);
+}
+
+// Undo the newest entry: back to the state before its instructions
+static void undo_entry(cpu8085 *cpu)
+{
+    struct history8085 *history = cpu->history;
+    const struct history8085_entry *entry = &history->entries[--history->head & (history->capacity - 1)];
+    int code = 0;
+
+    for (int i = 0; i < entry->write_count; i++)
+    {
+        const struct history8085_write *write = &history->writes[--history->write_head & (history->capacity - 1)];
+        cpu->memory[write->addr] = write->old;
+        code |= cpu->mmio[write->addr >> 8] & CPU8085_PAGE_CODE;
+    }
+    if (code && cpu->blocks != NULL)
+    {
+        cpu8085_flush_blocks(cpu);
+    }
+
+    memcpy(cpu->reg, entry->reg, sizeof(cpu->reg));
+    cpu->PC = entry->pc;
+    cpu->SP = entry->sp;
+    cpu->tstates = entry->tstates;
+    cpu->lazy_op = entry->lazy_op;
+    cpu->lazy_result = entry->lazy_result;
+    cpu->lazy_aux = entry->lazy_aux;
+    cpu->lazy_carry = entry->lazy_carry;
+    cpu->int_enable = entry->int_enable;
+    cpu->int_enable_delay = entry->int_enable_delay;
+    cpu->int_mask = entry->int_mask;
+    cpu->int_lines = entry->int_lines;
+    cpu->sod = entry->sod;
+    cpu->waiting = entry->waiting;
+    cpu->instructions -= entry->executed;
+    resume_here(cpu);
+}
+
+// Run count instructions forward again, recording as usual but with no
+// stops, profile or trace; returns 0, or -1 if the CPU halted first
+static int rerun(cpu8085 *cpu, unsigned long long count)
+{
+    struct debug8085 *debug = cpu->debug;
+    struct profile *profile = cpu->profile;
+    struct bintrace *bintrace = cpu->bintrace;
+    int trace = cpu->trace;
+    unsigned long long target = cpu->instructions + count;
+
+    cpu->debug = NULL;
+    cpu->profile = NULL;
+    cpu->bintrace = NULL;
+    cpu->trace = 0;
+    if (count > 0)
+    {
+        cpu8085_run(cpu, count);
+    }
+    cpu->debug = debug;
+    cpu->profile = profile;
+    cpu->bintrace = bintrace;
+    cpu->trace = trace;
+    return cpu->instructions == target ? 0 : -1;
+}
+
+// Go back to target through the undo log, into a block run by running its
+// first instructions again; returns -1 if the log does not reach
+static int undo_to(cpu8085 *cpu, unsigned long long target)
+{
+    struct history8085 *history = cpu->history;
+
+    while (cpu->instructions > target && history->head != history->tail)
+    {
+        undo_entry(cpu);
+    }
+    if (cpu->instructions > target)
+    {
+        return -1;
+    }
+    return rerun(cpu, target - cpu->instructions);
+}
+
+// The byte at addr back when the write ring ended at write: the value the
+// oldest newer write to it overwrote, else memory as it is
+static unsigned char byte_then(const cpu8085 *cpu, unsigned long write, unsigned short addr)
+{
+    const struct history8085 *history = cpu->history;
+
+    for (; write != history->write_head; write++)
+    {
+        if (history->writes[write & (history->capacity - 1)].addr == addr)
+        {
+            return history->writes[write & (history->capacity - 1)].old;
+        }
+    }
+    return cpu->memory[addr];
+}
+
+// Address of an entry's instruction offset, the entry's writes starting at
+// write. Only a run's last instruction can jump, so the ones before it
+// follow each other in the code as it was then.
+static unsigned short instruction_pc(const cpu8085 *cpu, const struct history8085_entry *entry,
+                                     unsigned long write, int offset)
+{
+    unsigned short pc = entry->pc;
+
+    for (int i = 0; i < offset; i++)
+    {
+        pc += cpu8085_opcode_length[byte_then(cpu, write, pc)];
+    }
+    return pc;
+}
+
+// Instructions the undo log holds
+static unsigned long long logged_instructions(const struct history8085 *history)
+{
+    unsigned long long count = 0;
+
+    for (unsigned long i = history->tail; i != history->head; i++)
+    {
+        count += history->entries[i & (history->capacity - 1)].executed;
+    }
+    return count;
+}
+
+unsigned long long history8085_oldest(const cpu8085 *cpu)
+{
+    const struct history8085 *history = cpu->history;
+    unsigned long long oldest = cpu->instructions - logged_instructions(history);
+
+    if (history->keyframe_count > 0 && history->keyframes[0].state.instructions < oldest)
+    {
+        oldest = history->keyframes[0].state.instructions;
+    }
+    return oldest;
+}
+
+// Restore a keyframe, with an empty undo log, and run forward to target
+static int replay(cpu8085 *cpu, int index, unsigned long long target)
+{
+    struct history8085 *history = cpu->history;
+    const struct history8085_keyframe *keyframe = &history->keyframes[index];
+    const cpu8085 *state = &keyframe->state;
+
+    memcpy(cpu->memory, keyframe->memory, CPU8085_MEMORY_SIZE);
+    if (cpu->blocks != NULL)
+    {
+        cpu8085_flush_blocks(cpu);
+    }
+    memcpy(cpu->reg, state->reg, sizeof(cpu->reg));
+    cpu->PC = state->PC;
+    cpu->SP = state->SP;
+    cpu->tstates = state->tstates;
+    cpu->instructions = state->instructions;
+    cpu->lazy_op = state->lazy_op;
+    cpu->lazy_result = state->lazy_result;
+    cpu->lazy_aux = state->lazy_aux;
+    cpu->lazy_carry = state->lazy_carry;
+    cpu->int_enable = state->int_enable;
+    cpu->int_enable_delay = state->int_enable_delay;
+    cpu->int_mask = state->int_mask;
+    cpu->int_lines = state->int_lines;
+    cpu->sod = state->sod;
+    cpu->waiting = state->waiting;
+    resume_here(cpu);
+
+    history->head = history->tail;
+    history->write_head = history->write_tail;
+    history->keyframe_count = index + 1;
+    history->next_keyframe = cpu->instructions + history->capacity;
+    return rerun(cpu, target - cpu->instructions);
+}
+
+long long history8085_step_back(cpu8085 *cpu, unsigned long long count)
+{
+    struct history8085 *history = cpu->history;
+    unsigned long long start = cpu->instructions;
+    unsigned long long oldest = history8085_oldest(cpu);
+    unsigned long long target = start - oldest > count ? start - count : oldest;
+
+    if (undo_to(cpu, target) < 0)
+    {
+        // Past the undo log: from the newest keyframe at or before target
+        int index = history->keyframe_count - 1;
+        while (index > 0 && history->keyframes[index].state.instructions > target)
+        {
+            index--;
+        }
+        if (replay(cpu, index, target) < 0)
+        {
+            return -1;
+        }
+    }
+    drop_later_keyframes(cpu);
+    return start - cpu->instructions;
+}
+
+int history8085_reverse_continue(cpu8085 *cpu)
+{
+    struct history8085 *history = cpu->history;
+    struct debug8085 *debug = cpu->debug;
+
+    while (debug != NULL && history->head != history->tail)
+    {
+        struct history8085_entry entry = history->entries[(history->head - 1) & (history->capacity - 1)];
+        unsigned long first_write = history->write_head - entry.write_count;
+
+        // Its newest write to a watchpoint; the value written is in memory
+        // until the entry is undone
+        int watchpoint = -1;
+        int offset = 0;
+        unsigned short addr = 0;
+        unsigned char value = 0;
+        for (unsigned long i = history->write_head; watchpoint < 0 && i != first_write; i--)
+        {
+            const struct history8085_write *write = &history->writes[(i - 1) & (history->capacity - 1)];
+            watchpoint = debug8085_find_watchpoint(debug, write->addr, DEBUG8085_WRITE);
+            offset = write->offset;
+            addr = write->addr;
+            value = cpu->memory[addr];
+        }
+
+        undo_entry(cpu);
+        unsigned long long start = cpu->instructions;
+
+        // Its instructions, the last first: a breakpoint after the write is
+        // met before it going backwards, one before the same instruction after
+        for (int i = entry.executed - 1; i >= 0; i--)
+        {
+            if (watchpoint >= 0 && i == offset)
+            {
+                break;
+            }
+            if (!debug8085_armed(debug, instruction_pc(cpu, &entry, first_write, i)))
+            {
+                continue;
+            }
+            rerun(cpu, i);
+            int breakpoint = debug8085_find_breakpoint(cpu);
+            if (breakpoint >= 0)
+            {
+                debug->breakpoints[breakpoint].hits++;
+                debug->hit_breakpoint = breakpoint;
+                drop_later_keyframes(cpu);
+                return 1;
+            }
+            undo_to(cpu, start);
+        }
+        if (watchpoint >= 0)
+        {
+            rerun(cpu, offset);
+            debug->watchpoints[watchpoint].hits++;
+            debug->hit_watchpoint = watchpoint;
+            debug->hit_addr = addr;
+            debug->hit_value = value;
+            debug->hit_access = DEBUG8085_WRITE;
+            drop_later_keyframes(cpu);
+            return 1;
+        }
+    }
+    drop_later_keyframes(cpu);
+    return 0;
+}
+
+int history8085_find_write(const cpu8085 *cpu, unsigned short addr, struct history8085_last_write *found)
+{
+    const struct history8085 *history = cpu->history;
+    unsigned long long instruction = cpu->instructions;
+    unsigned long write = history->write_head;
+
+    for (unsigned long i = history->head; i != history->tail; i--)
+    {
+        const struct history8085_entry *entry = &history->entries[(i - 1) & (history->capacity - 1)];
+        unsigned long first_write = write - entry->write_count;
+        instruction -= entry->executed;
+        for (; write != first_write; write--)
+        {
+            const struct history8085_write *w = &history->writes[(write - 1) & (history->capacity - 1)];
+            if (w->addr == addr)
+            {
+                found->instruction = instruction + w->offset;
+                found->pc = instruction_pc(cpu, entry, first_write, w->offset);
+                found->old = w->old;
+                found->value = cpu->memory[addr];
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
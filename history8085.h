@@ -0,0 +1,171 @@
+#ifndef HISTORY8085_H
+#define HISTORY8085_H
+
+#include <stddef.h>
+#include <string.h>
+
+#include "cpu8085.h"
+
+// Reverse execution for a cpu8085: an undo log of the recent past, for a
+// debugger to step and run backwards through.
+//
+// Attach a history8085 to a CPU with history8085_attach(). The core records
+// a 32 byte entry with the registers, flags, interrupt state and T-state
+// count before each instruction, or before each run of a cached block, and
+// each memory write adds the address and the byte it overwrote (4 bytes) to
+// a second ring. Both rings are bounded, so the oldest entries fall off as
+// the run goes on. Writes reach the log through the cpu->mmio[] detour
+// (CPU8085_PAGE_HISTORY on every page), and the block cache keeps running:
+// recording costs a few nanoseconds per instruction, and a run of any
+// length needs no more memory.
+//
+// Going back into the middle of a block run restores the state before it
+// and runs its first instructions again. While the log records, a block run
+// ends after any device access (IN, OUT or a memory-mapped device), so
+// those instructions never touch a device and come out the same.
+//
+// Every `capacity` instructions a keyframe (registers and all 64 KiB of
+// memory) is taken as well, HISTORY8085_KEYFRAMES of them kept. Going back
+// further than the undo log reaches restores the nearest keyframe before
+// the target and runs forward from it, recording again.
+//
+// Only the CPU and its memory go back in time. Devices, their scheduled
+// events and the record of written memory (cpu->dirty) don't, so a replay
+// from a keyframe repeats the devices' output and matches the original run
+// only if the program's input and interrupts come out the same. Going back
+// within the undo log is always exact.
+
+#define HISTORY8085_KEYFRAMES 16
+
+// Smallest capacity: a block's entries, and the writes of any instruction
+#define HISTORY8085_MIN_CAPACITY 64
+
+// The state before one or more instructions. reg to sp, the lazy flags and
+// the interrupt state lie as in cpu8085, to be copied in three moves.
+struct history8085_entry
+{
+    unsigned long long tstates;
+    unsigned char reg[8];
+    unsigned short pc, sp;
+    unsigned char lazy_op, lazy_result, lazy_aux, lazy_carry;
+    unsigned char int_enable, int_enable_delay, int_mask, int_lines;
+    unsigned char sod;
+    unsigned char waiting;
+    unsigned char executed;     // instructions run from here: 1, a block run's, or 0 for
+                                // an interrupt taken or HLT idling
+    unsigned char write_count;  // its writes, the newest at the head of the write ring
+};
+
+_Static_assert(sizeof(struct history8085_entry) == 32, "history entries must stay 32 bytes");
+_Static_assert(offsetof(cpu8085, SP) == offsetof(cpu8085, reg) + 10 &&
+               offsetof(cpu8085, lazy_carry) == offsetof(cpu8085, lazy_op) + 3 &&
+               offsetof(cpu8085, int_lines) == offsetof(cpu8085, int_enable) + 3,
+               "history entries copy these fields in runs");
+
+struct history8085_write
+{
+    unsigned short addr;
+    unsigned char old;          // the byte before the write
+    unsigned char offset;       // which of its entry's instructions wrote (0 = the first)
+};
+
+struct history8085_keyframe
+{
+    cpu8085 state;              // registers and counters; its pointers are not used
+    unsigned char *memory;      // CPU8085_MEMORY_SIZE bytes
+};
+
+struct history8085
+{
+    unsigned long capacity;     // entries, also writes (a power of two)
+    struct history8085_entry *entries;
+    unsigned long head, tail;   // entries[tail..head), modulo capacity
+    struct history8085_write *writes;
+    unsigned long write_head, write_tail;
+    unsigned char offset;       // instruction of the newest entry running
+
+    struct history8085_keyframe keyframes[HISTORY8085_KEYFRAMES];
+    int keyframe_count;         // oldest first
+    unsigned long long next_keyframe; // instruction count to take the next one at
+};
+
+// The last write the log holds to an address
+struct history8085_last_write
+{
+    unsigned long long instruction; // instruction count before the write
+    unsigned short pc;              // the instruction that wrote (or an interrupt came before)
+    unsigned char old, value;       // the byte before and after
+};
+
+// Give cpu a history8085 recording the last `capacity` instructions or
+// more (a power of two); returns it, or NULL if out of memory.
+// history8085_detach() removes and frees it.
+struct history8085 *history8085_attach(cpu8085 *cpu, unsigned long capacity);
+void history8085_detach(cpu8085 *cpu);
+
+// The earliest instruction count cpu can go back to
+unsigned long long history8085_oldest(const cpu8085 *cpu);
+
+// Go back count instructions, or as far as the history reaches. Returns the
+// number of instructions gone back, or -1 if a keyframe replay stopped
+// short of the target (cpu is then left there).
+long long history8085_step_back(cpu8085 *cpu, unsigned long long count);
+
+// Go back through the undo log until the state is before an instruction
+// with a breakpoint (whose condition holds), or before an instruction that
+// wrote to a write watchpoint; the hit is noted in cpu->debug like a
+// forward stop. Returns 1 on a hit, 0 at the start of the log. Read
+// watchpoints are not seen, as the log holds no reads.
+int history8085_reverse_continue(cpu8085 *cpu);
+
+// Find the newest write to addr in the undo log; returns 1 and fills
+// *found, or 0 if there is none.
+int history8085_find_write(const cpu8085 *cpu, unsigned short addr, struct history8085_last_write *found);
+
+// ---- Called by the core ----
+
+void history8085_make_room(struct history8085 *history, unsigned long entries, unsigned long writes);
+void history8085_keyframe(cpu8085 *cpu);
+
+// Make room for count entries, dropping the oldest ones if need be
+static inline void history8085_reserve(struct history8085 *history, unsigned long count)
+{
+    if (__builtin_expect(history->head - history->tail > history->capacity - count, 0))
+    {
+        history8085_make_room(history, count, 0);
+    }
+}
+
+// Record the state before executed instructions, into room reserved for
+// it; returns the entry, whose executed count may be set once known
+static inline struct history8085_entry *history8085_record(struct history8085 *history, const cpu8085 *cpu,
+                                                           int executed)
+{
+    struct history8085_entry *entry = &history->entries[history->head++ & (history->capacity - 1)];
+    entry->tstates = cpu->tstates;
+    memcpy(entry->reg, cpu->reg, 12);
+    memcpy(&entry->lazy_op, &cpu->lazy_op, 4);
+    memcpy(&entry->int_enable, &cpu->int_enable, 4);
+    entry->sod = cpu->sod;
+    entry->waiting = cpu->waiting;
+    entry->executed = executed;
+    entry->write_count = 0;
+    history->offset = 0;
+    return entry;
+}
+
+// Record the byte a write to addr is about to overwrite
+static inline void history8085_record_write(struct history8085 *history, unsigned short addr, unsigned char old)
+{
+    if (__builtin_expect(history->write_head - history->write_tail == history->capacity, 0))
+    {
+        history8085_make_room(history, 0, 1);
+    }
+    struct history8085_write *write = &history->writes[history->write_head++ & (history->capacity - 1)];
+    write->addr = addr;
+    write->old = old;
+    write->offset = history->offset;
+    history->entries[(history->head - 1) & (history->capacity - 1)].write_count++;
+}
+
+#endif
@@ -0,0 +1,1799 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "jit8085.h"
+
+#if defined(__x86_64__)
+
+// Room for translated code, and the most one block can take of it
+#define JIT8085_CODE_SIZE (8 << 20)
+#define JIT8085_BLOCK_ROOM (16 << 10)
+#define JIT8085_MAX_BLOCKS 8192
+#define JIT8085_MAX_LINKS 32768
+
+#define BLOCK_DEAD 0x10000 // start of a dropped block
+
+// Why translated code returned to jit8085_run()
+#define EXIT_INTERPRET 0 // the instruction at PC is for the interpreter
+#define EXIT_BUDGET 1    // the block at PC does not fit in what is left of the budget
+#define EXIT_MISS 2      // nothing translated at PC yet
+
+// The static lazy_op of a block before its first flag-setting instruction
+#define LAZY_UNKNOWN -1
+
+// What translated code reads besides the CPU, at fixed offsets from R13
+struct context
+{
+    unsigned long long limit;           // no block starts unless it ends before this T-state
+    unsigned char *site;                // after EXIT_MISS: the jump to patch, or NULL
+    unsigned long long *code_lines;     // the block cache's
+    unsigned char szp[256];             // S, Z and P of a result
+    unsigned short daa[1024];           // DAA, by A | AC << 8 | CY << 9: A, and F << 8
+    const unsigned char *entries[CPU8085_MEMORY_SIZE]; // translated block at each address, or NULL
+};
+
+struct translation
+{
+    unsigned int start;                 // BLOCK_DEAD once dropped
+    unsigned int end;                   // first address past the block
+    const unsigned char *entry;
+    int links;                          // first jump patched to come here, -1 for none
+};
+
+// A jump patched to go straight to a block, and the stub it went to before
+struct link
+{
+    unsigned char *site;
+    int rel32;
+    int next;
+};
+
+struct jit8085
+{
+    unsigned char *code;                // JIT8085_CODE_SIZE bytes, shared code first
+    size_t used, shared;
+    unsigned long flushes;
+    int (*enter)(cpu8085 *cpu, struct context *context, const unsigned char *entry);
+    const unsigned char *exit_interpret, *exit_budget, *exit_miss;
+    const unsigned char *untranslated;  // entries[] of an address left to the interpreter
+    const unsigned char *dispatch_miss;
+    const unsigned char *build_flags;
+    struct context *context;
+    struct translation blocks[JIT8085_MAX_BLOCKS];
+    int block_count;
+    struct link links[JIT8085_MAX_LINKS];
+    int link_count;
+    unsigned char heat[CPU8085_MEMORY_SIZE]; // times jit8085_run() found nothing at an address
+};
+
+// ---- x86-64 encoding ----
+
+enum { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+// Byte registers are AL, CL, DL, BL and R8B..R15B by the numbers above (4 to
+// 7 being SPL..DIL, which need a REX prefix), and these, which can't appear
+// in an instruction with one
+enum { AH = 20, CH, DH, BH };
+
+enum { ADD, OR, ADC, SBB, AND, SUB, XOR, CMP };
+enum { ROL, ROR, RCL, RCR, SHL, SHR };
+enum { CC_C = 2, CC_NC = 3, CC_Z = 4, CC_NZ = 5, CC_S = 8, CC_NS = 9, CC_P = 10, CC_NP = 11 };
+
+// While translated code runs: A in AL, B/C in BH/BL, D/E in CH/CL, H/L in
+// DH/DL and SP in BP, with the upper bits of those registers clear. RSI
+// points at the memory, the lazy flags sit in R8 (the result, only its low
+// byte counts), R9 (a ^ b, only bit 4 counts) and R10 (CY, 0 or 1). RDI
+// and R11 are scratch, R12 holds the cpu8085, R13 the context, R14 and R15
+// the instruction and T-state counters.
+#define MEMBASE RSI
+#define LAZY_RESULT R8
+#define LAZY_AUX R9
+#define LAZY_CARRY R10
+#define CPU R12
+#define CTX R13
+#define INSTRUCTIONS R14
+#define TSTATES R15
+
+#define REG_M 6
+#define DDD(opcode) (((opcode) >> 3) & 0x07)
+#define SSS(opcode) ((opcode) & 0x07)
+#define RP(opcode) (((opcode) >> 4) & 0x03)
+
+// By the register field of an opcode, and by its register pair field
+static const int host_reg[8] = { BH, RBX, CH, RCX, DH, RDX, -1, RAX };
+static const int host_pair[4] = { RBX, RCX, RDX, RBP };
+
+#define CPU_AT(field) AT(CPU, (int)offsetof(cpu8085, field))
+#define CTX_OFFSET(field) ((int)offsetof(struct context, field))
+#define MMIO ((int)offsetof(cpu8085, mmio))
+#define DIRTY ((int)offsetof(cpu8085, dirty))
+
+_Static_assert(CPU8085_DIRTY_LINE == 16, "translated code marks lines of 16 bytes");
+
+struct emitter
+{
+    unsigned char *p;
+};
+
+// A memory operand: base + index * scale + disp, index -1 for none
+struct mem
+{
+    int base, index, scale, disp;
+};
+
+#define AT(base, disp) (&(struct mem){ (base), -1, 1, (disp) })
+#define AT_INDEX(base, index, scale, disp) (&(struct mem){ (base), (index), (scale), (disp) })
+
+#define OP_W 1    // 64-bit operands
+#define OP_16 2   // 16-bit operands
+#define OP_BREG 4 // the reg field is a byte register
+#define OP_BRM 8  // so is the r/m register
+
+static void emit8(struct emitter *e, unsigned int value)
+{
+    *e->p++ = value;
+}
+
+static void emit32(struct emitter *e, unsigned int value)
+{
+    memcpy(e->p, &value, 4);
+    e->p += 4;
+}
+
+static int byte_reg(int reg, int *rex, int *high)
+{
+    if (reg >= AH)
+    {
+        *high = 1;
+        return reg - AH + 4;
+    }
+    if (reg >= 4 && reg < 8)
+    {
+        *rex |= 0x40;
+    }
+    return reg;
+}
+
+// An instruction with a ModRM byte. opcode is one byte, or 0x0F and one
+// byte; reg is a register or the opcode extension; the r/m operand is m,
+// or the register rm if m is NULL.
+static void encode(struct emitter *e, int flags, int opcode, int reg, int rm, const struct mem *m)
+{
+    int rex = flags & OP_W ? 0x48 : 0;
+    int high = 0;
+
+    if (flags & OP_BREG)
+    {
+        reg = byte_reg(reg, &rex, &high);
+    }
+    if (m == NULL && (flags & OP_BRM))
+    {
+        rm = byte_reg(rm, &rex, &high);
+    }
+    rex |= reg & 8 ? 0x44 : 0;
+    if (m != NULL)
+    {
+        rex |= (m->base & 8 ? 0x41 : 0) | (m->index >= 0 && (m->index & 8) ? 0x42 : 0);
+    }
+    else
+    {
+        rex |= rm & 8 ? 0x41 : 0;
+    }
+    if (rex && high)
+    {
+        abort(); // no such instruction: a bug in the translator
+    }
+
+    if (flags & OP_16)
+    {
+        emit8(e, 0x66);
+    }
+    if (rex)
+    {
+        emit8(e, rex);
+    }
+    if (opcode > 0xFF)
+    {
+        emit8(e, opcode >> 8);
+    }
+    emit8(e, opcode & 0xFF);
+    if (m == NULL)
+    {
+        emit8(e, 0xC0 | (reg & 7) << 3 | (rm & 7));
+        return;
+    }
+
+    int mod = m->disp == 0 && (m->base & 7) != RBP ? 0 : m->disp >= -128 && m->disp < 128 ? 1 : 2;
+    if (m->index >= 0 || (m->base & 7) == RSP)
+    {
+        emit8(e, mod << 6 | (reg & 7) << 3 | 4);
+        emit8(e, (m->scale == 8 ? 3 : m->scale == 4 ? 2 : m->scale == 2 ? 1 : 0) << 6 |
+                 (m->index >= 0 ? m->index & 7 : 4) << 3 | (m->base & 7));
+    }
+    else
+    {
+        emit8(e, mod << 6 | (reg & 7) << 3 | (m->base & 7));
+    }
+    if (mod == 1)
+    {
+        emit8(e, m->disp);
+    }
+    else if (mod == 2)
+    {
+        emit32(e, m->disp);
+    }
+}
+
+static void mov(struct emitter *e, int dst, int src)
+{
+    encode(e, 0, 0x89, src, dst, NULL);
+}
+
+static void mov64(struct emitter *e, int dst, int src)
+{
+    encode(e, OP_W, 0x89, src, dst, NULL);
+}
+
+static void mov8(struct emitter *e, int dst, int src)
+{
+    encode(e, OP_BREG | OP_BRM, 0x88, src, dst, NULL);
+}
+
+static void mov_imm(struct emitter *e, int dst, unsigned int imm)
+{
+    if (dst & 8)
+    {
+        emit8(e, 0x41);
+    }
+    emit8(e, 0xB8 + (dst & 7));
+    emit32(e, imm);
+}
+
+static void mov8_imm(struct emitter *e, int dst, unsigned char imm)
+{
+    encode(e, OP_BRM, 0xC6, 0, dst, NULL);
+    emit8(e, imm);
+}
+
+static void load8(struct emitter *e, int dst, const struct mem *m)
+{
+    encode(e, OP_BREG, 0x8A, dst, 0, m);
+}
+
+static void load64(struct emitter *e, int dst, const struct mem *m)
+{
+    encode(e, OP_W, 0x8B, dst, 0, m);
+}
+
+static void store8(struct emitter *e, const struct mem *m, int src)
+{
+    encode(e, OP_BREG, 0x88, src, 0, m);
+}
+
+static void store16(struct emitter *e, const struct mem *m, int src)
+{
+    encode(e, OP_16, 0x89, src, 0, m);
+}
+
+static void store64(struct emitter *e, const struct mem *m, int src)
+{
+    encode(e, OP_W, 0x89, src, 0, m);
+}
+
+static void store8_imm(struct emitter *e, const struct mem *m, unsigned char imm)
+{
+    encode(e, 0, 0xC6, 0, 0, m);
+    emit8(e, imm);
+}
+
+static void store16_imm(struct emitter *e, const struct mem *m, unsigned short imm)
+{
+    encode(e, OP_16, 0xC7, 0, 0, m);
+    emit8(e, imm & 0xFF);
+    emit8(e, imm >> 8);
+}
+
+static void movzx8(struct emitter *e, int dst, int src)
+{
+    encode(e, OP_BRM, 0x0FB6, dst, src, NULL);
+}
+
+static void movzx8_load(struct emitter *e, int dst, const struct mem *m)
+{
+    encode(e, 0, 0x0FB6, dst, 0, m);
+}
+
+static void movzx16(struct emitter *e, int dst, int src)
+{
+    encode(e, 0, 0x0FB7, dst, src, NULL);
+}
+
+static void movzx16_load(struct emitter *e, int dst, const struct mem *m)
+{
+    encode(e, 0, 0x0FB7, dst, 0, m);
+}
+
+static void lea(struct emitter *e, int dst, const struct mem *m)
+{
+    encode(e, 0, 0x8D, dst, 0, m);
+}
+
+static void lea64(struct emitter *e, int dst, const struct mem *m)
+{
+    encode(e, OP_W, 0x8D, dst, 0, m);
+}
+
+static void alu(struct emitter *e, int op, int dst, int src)
+{
+    encode(e, 0, op * 8 + 1, src, dst, NULL);
+}
+
+static void alu8(struct emitter *e, int op, int dst, int src)
+{
+    encode(e, OP_BREG | OP_BRM, op * 8, src, dst, NULL);
+}
+
+static void alu16(struct emitter *e, int op, int dst, int src)
+{
+    encode(e, OP_16, op * 8 + 1, src, dst, NULL);
+}
+
+static void alu_imm_flags(struct emitter *e, int flags, int op, int dst, const struct mem *m, int imm)
+{
+    if (imm >= -128 && imm < 128)
+    {
+        encode(e, flags, 0x83, op, dst, m);
+        emit8(e, imm);
+    }
+    else if (flags & OP_16)
+    {
+        encode(e, flags, 0x81, op, dst, m);
+        emit8(e, imm & 0xFF);
+        emit8(e, (imm >> 8) & 0xFF);
+    }
+    else
+    {
+        encode(e, flags, 0x81, op, dst, m);
+        emit32(e, imm);
+    }
+}
+
+static void alu_imm(struct emitter *e, int op, int dst, int imm)
+{
+    alu_imm_flags(e, 0, op, dst, NULL, imm);
+}
+
+static void alu64_imm(struct emitter *e, int op, int dst, int imm)
+{
+    alu_imm_flags(e, OP_W, op, dst, NULL, imm);
+}
+
+static void alu16_imm(struct emitter *e, int op, int dst, int imm)
+{
+    alu_imm_flags(e, OP_16, op, dst, NULL, (short)imm);
+}
+
+static void alu_mem_imm(struct emitter *e, int op, const struct mem *m, int imm)
+{
+    alu_imm_flags(e, 0, op, 0, m, imm);
+}
+
+static void alu8_mem_imm(struct emitter *e, int op, const struct mem *m, unsigned char imm)
+{
+    encode(e, 0, 0x80, op, 0, m);
+    emit8(e, imm);
+}
+
+static void alu_mem(struct emitter *e, int op, const struct mem *m, int src)
+{
+    encode(e, 0, op * 8 + 1, src, 0, m);
+}
+
+static void alu64_load(struct emitter *e, int op, int dst, const struct mem *m)
+{
+    encode(e, OP_W, op * 8 + 3, dst, 0, m);
+}
+
+static void test8(struct emitter *e, int a, int b)
+{
+    encode(e, OP_BREG | OP_BRM, 0x84, b, a, NULL);
+}
+
+static void test64(struct emitter *e, int a, int b)
+{
+    encode(e, OP_W, 0x85, b, a, NULL);
+}
+
+static void test_imm(struct emitter *e, int reg, unsigned int imm)
+{
+    encode(e, 0, 0xF7, 0, reg, NULL);
+    emit32(e, imm);
+}
+
+static void test8_imm(struct emitter *e, int reg, unsigned char imm)
+{
+    encode(e, OP_BRM, 0xF6, 0, reg, NULL);
+    emit8(e, imm);
+}
+
+static void test8_mem_imm(struct emitter *e, const struct mem *m, unsigned char imm)
+{
+    encode(e, 0, 0xF6, 0, 0, m);
+    emit8(e, imm);
+}
+
+static void shift_imm(struct emitter *e, int kind, int reg, int count)
+{
+    encode(e, 0, 0xC1, kind, reg, NULL);
+    emit8(e, count);
+}
+
+static void shift8_once(struct emitter *e, int kind, int reg)
+{
+    encode(e, OP_BRM, 0xD0, kind, reg, NULL);
+}
+
+static void rol16(struct emitter *e, int reg, int count)
+{
+    encode(e, OP_16, 0xC1, ROL, reg, NULL);
+    emit8(e, count);
+}
+
+static void bt_imm(struct emitter *e, int reg, int bit)
+{
+    encode(e, 0, 0x0FBA, 4, reg, NULL);
+    emit8(e, bit);
+}
+
+static void bt_mem(struct emitter *e, const struct mem *m, int bit)
+{
+    encode(e, 0, 0x0FA3, bit, 0, m);
+}
+
+static void bts(struct emitter *e, int dst, int bit)
+{
+    encode(e, 0, 0x0FAB, bit, dst, NULL);
+}
+
+static void setcc(struct emitter *e, int cc, int reg)
+{
+    encode(e, OP_BRM, 0x0F90 + cc, 0, reg, NULL);
+}
+
+static void inc8(struct emitter *e, int reg, int step)
+{
+    encode(e, OP_BRM, 0xFE, step > 0 ? 0 : 1, reg, NULL);
+}
+
+static void inc16(struct emitter *e, int reg, int step)
+{
+    encode(e, OP_16, 0xFF, step > 0 ? 0 : 1, reg, NULL);
+}
+
+static void not8(struct emitter *e, int reg)
+{
+    encode(e, OP_BRM, 0xF6, 2, reg, NULL);
+}
+
+static void xchg(struct emitter *e, int a, int b)
+{
+    encode(e, 0, 0x87, b, a, NULL);
+}
+
+static void push(struct emitter *e, int reg)
+{
+    if (reg & 8)
+    {
+        emit8(e, 0x41);
+    }
+    emit8(e, 0x50 + (reg & 7));
+}
+
+static void pop(struct emitter *e, int reg)
+{
+    if (reg & 8)
+    {
+        emit8(e, 0x41);
+    }
+    emit8(e, 0x58 + (reg & 7));
+}
+
+static void set_target(unsigned char *site, const unsigned char *target)
+{
+    int rel32 = target - (site + 4);
+    memcpy(site, &rel32, 4);
+}
+
+// Jumps return their rel32 field, to be pointed with set_target() if
+// target is NULL
+static unsigned char *jmp(struct emitter *e, const unsigned char *target)
+{
+    emit8(e, 0xE9);
+    unsigned char *site = e->p;
+    emit32(e, 0);
+    if (target != NULL)
+    {
+        set_target(site, target);
+    }
+    return site;
+}
+
+static unsigned char *jcc(struct emitter *e, int cc, const unsigned char *target)
+{
+    emit8(e, 0x0F);
+    emit8(e, 0x80 + cc);
+    unsigned char *site = e->p;
+    emit32(e, 0);
+    if (target != NULL)
+    {
+        set_target(site, target);
+    }
+    return site;
+}
+
+static void jmp_reg(struct emitter *e, int reg)
+{
+    encode(e, 0, 0xFF, 4, reg, NULL);
+}
+
+static void call(struct emitter *e, const unsigned char *target)
+{
+    emit8(e, 0xE8);
+    emit32(e, 0);
+    set_target(e->p - 4, target);
+}
+
+// ---- Shared code ----
+
+// enter(cpu, context, entry) loads the state into the registers and jumps
+// to entry; the exits store it back and return the reason. A block that
+// does not fit the budget exits with EDI = its address, one that hands an
+// instruction to the interpreter with EDI = the instruction's, and a jump
+// to an address with nothing translated with EDI = the address and R11 =
+// the jump to patch once there is (NULL for a return or PCHL).
+static void emit_shared(struct jit8085 *jit)
+{
+    struct emitter e = { jit->code };
+    static const int saved[] = { RBX, RBP, R12, R13, R14, R15 };
+
+    jit->enter = (int (*)(cpu8085 *, struct context *, const unsigned char *))(void *)e.p;
+    for (int i = 0; i < 6; i++)
+    {
+        push(&e, saved[i]);
+    }
+    mov64(&e, CPU, RDI);
+    mov64(&e, CTX, RSI);
+    mov64(&e, R11, RDX);
+    for (int i = 0; i < 3; i++)
+    {
+        // B/C, D/E and H/L are stored high byte first
+        movzx16_load(&e, host_pair[i], AT(CPU, (int)offsetof(cpu8085, reg) + 2 * i));
+        rol16(&e, host_pair[i], 8);
+    }
+    movzx8_load(&e, RAX, CPU_AT(A));
+    movzx16_load(&e, RBP, CPU_AT(SP));
+    load64(&e, MEMBASE, CPU_AT(memory));
+    movzx8_load(&e, LAZY_RESULT, CPU_AT(lazy_result));
+    movzx8_load(&e, LAZY_AUX, CPU_AT(lazy_aux));
+    movzx8_load(&e, LAZY_CARRY, CPU_AT(lazy_carry));
+    load64(&e, INSTRUCTIONS, CPU_AT(instructions));
+    load64(&e, TSTATES, CPU_AT(tstates));
+    jmp_reg(&e, R11);
+
+    jit->exit_miss = e.p;
+    store64(&e, AT(CTX, CTX_OFFSET(site)), R11);
+    mov_imm(&e, R11, EXIT_MISS);
+    unsigned char *to_exit = jmp(&e, NULL);
+    jit->exit_budget = e.p;
+    mov_imm(&e, R11, EXIT_BUDGET);
+    unsigned char *to_exit2 = jmp(&e, NULL);
+    jit->exit_interpret = e.p;
+    mov_imm(&e, R11, EXIT_INTERPRET);
+    set_target(to_exit, e.p);
+    set_target(to_exit2, e.p);
+    store16(&e, CPU_AT(PC), RDI);
+    for (int i = 0; i < 3; i++)
+    {
+        mov(&e, RDI, host_pair[i]);
+        rol16(&e, RDI, 8);
+        store16(&e, AT(CPU, (int)offsetof(cpu8085, reg) + 2 * i), RDI);
+    }
+    store8(&e, CPU_AT(A), RAX);
+    store16(&e, CPU_AT(SP), RBP);
+    store8(&e, CPU_AT(lazy_result), LAZY_RESULT);
+    store8(&e, CPU_AT(lazy_aux), LAZY_AUX);
+    store8(&e, CPU_AT(lazy_carry), LAZY_CARRY);
+    store64(&e, CPU_AT(instructions), INSTRUCTIONS);
+    store64(&e, CPU_AT(tstates), TSTATES);
+    mov(&e, RAX, R11);
+    for (int i = 5; i >= 0; i--)
+    {
+        pop(&e, saved[i]);
+    }
+    emit8(&e, 0xC3);
+
+    jit->untranslated = e.p;
+    jmp(&e, jit->exit_interpret);
+    jit->dispatch_miss = e.p;
+    alu(&e, XOR, R11, R11);
+    jmp(&e, jit->exit_miss);
+
+    // F into EDI from the lazy state in cpu->lazy_op, for a block that has
+    // not set it itself; clobbers R11
+    jit->build_flags = e.p;
+    movzx8_load(&e, RDI, CPU_AT(lazy_op));
+    test8(&e, RDI, RDI);
+    unsigned char *to_none = jcc(&e, CC_Z, NULL);
+    alu(&e, XOR, R11, R11);
+    alu_imm(&e, CMP, RDI, CPU8085_LAZY_LOGIC);
+    unsigned char *to_szp = jcc(&e, CC_Z, NULL);
+    mov_imm(&e, R11, AUX_CARRY_FLAG);
+    alu_imm(&e, CMP, RDI, CPU8085_LAZY_ANA);
+    unsigned char *to_szp2 = jcc(&e, CC_Z, NULL);
+    mov(&e, R11, LAZY_AUX);
+    alu(&e, XOR, R11, LAZY_RESULT);
+    alu_imm(&e, AND, R11, AUX_CARRY_FLAG);
+    set_target(to_szp, e.p);
+    set_target(to_szp2, e.p);
+    movzx8(&e, RDI, LAZY_RESULT);
+    movzx8_load(&e, RDI, AT_INDEX(CTX, RDI, 1, CTX_OFFSET(szp)));
+    alu(&e, OR, RDI, R11);
+    alu(&e, OR, RDI, LAZY_CARRY);
+    emit8(&e, 0xC3);
+    set_target(to_none, e.p);
+    movzx8_load(&e, RDI, CPU_AT(F));
+    alu_imm(&e, AND, RDI, ~CARRY_FLAG & 0xFF);
+    alu(&e, OR, RDI, LAZY_CARRY);
+    emit8(&e, 0xC3);
+
+    jit->shared = jit->used = e.p - jit->code;
+}
+
+// ---- Translating a block ----
+
+// The state before an instruction, for leaving to the interpreter there
+struct bail
+{
+    unsigned short pc;
+    unsigned int tstates;       // of the block's instructions before it
+    int count;
+    int lazy, lazy_dirty;
+    unsigned char *sites[8];    // jumps here
+    int site_count;
+};
+
+// A write to a page with a flag set. If CPU8085_PAGE_CODE is the only one,
+// the line bitmap tells whether the byte is code, out of line.
+struct code_check
+{
+    unsigned char *site, *resume;
+    int op;                     // the instruction, for its bail
+    int addr_reg;               // register holding the address, or -1 for addr
+    int page_reg;               // register holding the page, or -1 for addr's
+    unsigned short addr;
+};
+
+// A jump to another block
+struct successor
+{
+    unsigned char *site;
+    unsigned short pc;
+};
+
+// A forward conditional jump taken, leaving the block before its end
+struct side_exit
+{
+    unsigned char *site;
+    unsigned short pc;
+    unsigned int tstates;       // of the block up to and including the jump
+    int count;
+    int lazy, lazy_dirty;
+};
+
+struct compiler
+{
+    struct jit8085 *jit;
+    const unsigned char *memory;
+    struct emitter e;
+    int lazy;                   // what cpu->lazy_op holds here, or LAZY_UNKNOWN
+    int lazy_dirty;             // and cpu->lazy_op itself doesn't yet
+    int count;                  // instructions so far
+    unsigned int tstates;       // their T-states, not counting taken branches
+    unsigned int last_tstates;  // the last instruction's
+    struct bail bails[JIT8085_MAX_OPS];
+    struct code_check checks[2 * JIT8085_MAX_OPS];
+    int check_count;
+    struct side_exit exits[JIT8085_MAX_OPS];
+    int exit_count;
+    struct successor successors[JIT8085_MAX_OPS + 2];
+    int successor_count;
+};
+
+// Instructions left to the interpreter; a jump to itself, so that it can stop
+static int translatable(const unsigned char *memory, unsigned int pc)
+{
+    unsigned char opcode = memory[pc];
+    unsigned int length = cpu8085_opcode_length[opcode];
+
+    if (pc + length > CPU8085_MEMORY_SIZE)
+    {
+        return 0;
+    }
+    unsigned short operand = length == 3 ? memory[pc + 1] | memory[pc + 2] << 8 : 0;
+    switch (opcode)
+    {
+    case 0x76: // HLT
+    case 0xDB: // IN
+    case 0xD3: // OUT
+    case 0xFB: // EI
+    case 0xF3: // DI
+    case 0x30: // SIM
+    case 0x20: // RIM
+    case 0x08: case 0x10: case 0x18: case 0x28: case 0x38: // undocumented
+    case 0xCB: case 0xD9: case 0xDD: case 0xED: case 0xFD:
+        return 0;
+    case 0x22: // SHLD and LHLD running past FFFF
+    case 0x2A:
+        return operand != 0xFFFF;
+    }
+    if (opcode == 0xC3 || (opcode & 0xC7) == 0xC2)
+    {
+        return operand != pc;
+    }
+    return 1;
+}
+
+static void begin(struct compiler *c, unsigned short pc, unsigned char opcode)
+{
+    struct bail *b = &c->bails[c->count];
+
+    b->pc = pc;
+    b->tstates = c->tstates;
+    b->count = c->count;
+    b->lazy = c->lazy;
+    b->lazy_dirty = c->lazy_dirty;
+    b->site_count = 0;
+    c->last_tstates = cpu8085_opcode_tstates[opcode];
+    c->tstates += c->last_tstates;
+    c->count++;
+}
+
+// Leave the current instruction to the interpreter if cc holds
+static void bail_if(struct compiler *c, int cc)
+{
+    struct bail *b = &c->bails[c->count - 1];
+    b->sites[b->site_count++] = jcc(&c->e, cc, NULL);
+}
+
+static void set_lazy(struct compiler *c, int op)
+{
+    c->lazy = op;
+    c->lazy_dirty = 1;
+}
+
+// Count the block's instructions and T-states, before leaving it
+static void finish(struct compiler *c, int extra_tstates)
+{
+    if (c->lazy_dirty)
+    {
+        store8_imm(&c->e, CPU_AT(lazy_op), c->lazy);
+    }
+    alu64_imm(&c->e, ADD, TSTATES, c->tstates + extra_tstates);
+    alu64_imm(&c->e, ADD, INSTRUCTIONS, c->count);
+}
+
+static void goto_pc(struct compiler *c, unsigned short pc)
+{
+    struct successor *s = &c->successors[c->successor_count++];
+    s->site = jmp(&c->e, NULL);
+    s->pc = pc;
+}
+
+// To the address in EDI
+static void dispatch(struct compiler *c)
+{
+    load64(&c->e, R11, AT_INDEX(CTX, RDI, 8, CTX_OFFSET(entries)));
+    test64(&c->e, R11, R11);
+    jcc(&c->e, CC_Z, c->jit->dispatch_miss);
+    jmp_reg(&c->e, R11);
+}
+
+static int high_byte(int pair)
+{
+    return pair == RBX ? BH : pair == RCX ? CH : DH;
+}
+
+// Reads from a device or a watched page are for the interpreter. pair is
+// the register pair holding the address, or -1 for addr.
+static void check_read(struct compiler *c, int pair, unsigned short addr)
+{
+    if (pair < 0)
+    {
+        test8_mem_imm(&c->e, AT(CPU, MMIO + (addr >> 8)), CPU8085_PAGE_DEVICE | CPU8085_PAGE_WATCH);
+    }
+    else
+    {
+        movzx8(&c->e, RDI, high_byte(pair));
+        test8_mem_imm(&c->e, AT_INDEX(CPU, RDI, 1, MMIO), CPU8085_PAGE_DEVICE | CPU8085_PAGE_WATCH);
+    }
+    bail_if(c, CC_NZ);
+}
+
+// The flag test is made; goes out of line if the page has a flag set
+static void add_check(struct compiler *c, int addr_reg, int page_reg, unsigned short addr)
+{
+    struct code_check *check = &c->checks[c->check_count++];
+
+    check->site = jcc(&c->e, CC_NZ, NULL);
+    check->resume = c->e.p;
+    check->op = c->count - 1;
+    check->addr_reg = addr_reg;
+    check->page_reg = page_reg;
+    check->addr = addr;
+}
+
+// Writes to anything but plain memory are for the interpreter, which also
+// drops the blocks a write into code changes
+static void check_write(struct compiler *c, int pair, unsigned short addr)
+{
+    if (pair < 0)
+    {
+        alu8_mem_imm(&c->e, CMP, AT(CPU, MMIO + (addr >> 8)), 0);
+        add_check(c, -1, -1, addr);
+    }
+    else
+    {
+        movzx8(&c->e, RDI, high_byte(pair));
+        alu8_mem_imm(&c->e, CMP, AT_INDEX(CPU, RDI, 1, MMIO), 0);
+        add_check(c, pair, RDI, 0);
+    }
+}
+
+// cpu->dirty for a write to the address in reg, or to addr if reg is -1
+static void mark_dirty(struct compiler *c, int reg, unsigned short addr)
+{
+    struct emitter *e = &c->e;
+
+    if (reg < 0)
+    {
+        unsigned int line = addr / CPU8085_DIRTY_LINE;
+        alu_mem_imm(e, OR, AT(CPU, DIRTY + line / 32 * 4), 1u << line % 32);
+        return;
+    }
+    if (reg != RDI)
+    {
+        mov(e, RDI, reg);
+    }
+    shift_imm(e, SHR, RDI, 4);
+    alu(e, XOR, R11, R11);
+    bts(e, R11, RDI);
+    shift_imm(e, SHR, RDI, 5);
+    alu_mem(e, OR, AT_INDEX(CPU, RDI, 4, DIRTY), R11);
+}
+
+// EDI = SP - 2, to write two bytes there. The interpreter takes a push
+// across a 16-byte line, so both bytes are on one line and one page.
+static void push_check(struct compiler *c)
+{
+    struct emitter *e = &c->e;
+
+    lea(e, RDI, AT(RBP, -2));
+    movzx16(e, RDI, RDI);
+    lea(e, R11, AT(RDI, 1));
+    test8_imm(e, R11, 0x0F);
+    bail_if(c, CC_Z);
+    mov(e, R11, RDI);
+    shift_imm(e, SHR, R11, 8);
+    alu8_mem_imm(e, CMP, AT_INDEX(CPU, R11, 1, MMIO), 0);
+    add_check(c, RDI, R11, 0);
+}
+
+static void push_done(struct compiler *c)
+{
+    mov(&c->e, RBP, RDI);
+    mark_dirty(c, RDI, 0);
+}
+
+// Two bytes from SP; the interpreter takes a pop across a page
+static void pop_check(struct compiler *c)
+{
+    struct emitter *e = &c->e;
+
+    lea(e, RDI, AT(RBP, 1));
+    test8_imm(e, RDI, 0xFF);
+    bail_if(c, CC_Z);
+    mov(e, RDI, RBP);
+    shift_imm(e, SHR, RDI, 8);
+    test8_mem_imm(e, AT_INDEX(CPU, RDI, 1, MMIO), CPU8085_PAGE_DEVICE | CPU8085_PAGE_WATCH);
+    bail_if(c, CC_NZ);
+}
+
+static void pop_into(struct compiler *c, int reg)
+{
+    movzx16_load(&c->e, reg, AT_INDEX(MEMBASE, RBP, 1, 0));
+    alu16_imm(&c->e, ADD, RBP, 2);
+}
+
+// F into EDI; clobbers R11
+static void flags_into_edi(struct compiler *c)
+{
+    struct emitter *e = &c->e;
+
+    switch (c->lazy)
+    {
+    case LAZY_UNKNOWN:
+        call(e, c->jit->build_flags);
+        return;
+    case CPU8085_LAZY_NONE:
+        // CY is only kept in R10
+        movzx8_load(e, RDI, CPU_AT(F));
+        alu_imm(e, AND, RDI, ~CARRY_FLAG & 0xFF);
+        alu(e, OR, RDI, LAZY_CARRY);
+        return;
+    }
+    movzx8(e, RDI, LAZY_RESULT);
+    movzx8_load(e, RDI, AT_INDEX(CTX, RDI, 1, CTX_OFFSET(szp)));
+    if (c->lazy == CPU8085_LAZY_ARITH)
+    {
+        mov(e, R11, LAZY_AUX);
+        alu(e, XOR, R11, LAZY_RESULT);
+        alu_imm(e, AND, R11, AUX_CARRY_FLAG);
+        alu(e, OR, RDI, R11);
+    }
+    else if (c->lazy == CPU8085_LAZY_ANA)
+    {
+        alu_imm(e, OR, RDI, AUX_CARRY_FLAG);
+    }
+    alu(e, OR, RDI, LAZY_CARRY);
+}
+
+// Test the condition in bits 5-3 of a Jcc/Ccc/Rcc (NZ Z NC C PO PE P M);
+// returns the host condition code that is true when it holds
+static int condition(struct compiler *c, int ccc)
+{
+    static const unsigned char flag[4] = { ZERO_FLAG, CARRY_FLAG, PARITY_FLAG, SIGN_FLAG };
+    struct emitter *e = &c->e;
+    int set = ccc & 1;
+
+    if (ccc >> 1 == 1)
+    {
+        test8(e, LAZY_CARRY, LAZY_CARRY);
+        return set ? CC_NZ : CC_Z;
+    }
+    if (c->lazy == CPU8085_LAZY_NONE)
+    {
+        test8_mem_imm(e, CPU_AT(F), flag[ccc >> 1]);
+        return set ? CC_NZ : CC_Z;
+    }
+    if (c->lazy == LAZY_UNKNOWN)
+    {
+        call(e, c->jit->build_flags);
+        test_imm(e, RDI, flag[ccc >> 1]);
+        return set ? CC_NZ : CC_Z;
+    }
+    // The host's ZF, PF and SF of the result are the 8085's Z, P and S
+    test8(e, LAZY_RESULT, LAZY_RESULT);
+    switch (ccc >> 1)
+    {
+    case 0:
+        return set ? CC_Z : CC_NZ;
+    case 2:
+        return set ? CC_P : CC_NP;
+    }
+    return set ? CC_S : CC_NS;
+}
+
+// ADD ADC SUB SBB ANA XRA ORA CMP, on a register, M (REG_M) or imm (-1)
+static void alu_op(struct compiler *c, int op, int src, unsigned char imm)
+{
+    static const int host_op[8] = { ADD, ADC, SUB, SBB, AND, XOR, OR, CMP };
+    struct emitter *e = &c->e;
+
+    if (src == REG_M)
+    {
+        check_read(c, RDX, 0);
+        movzx8_load(e, RDI, AT_INDEX(MEMBASE, RDX, 1, 0));
+    }
+    else if (src >= 0)
+    {
+        movzx8(e, RDI, host_reg[src]);
+    }
+    else
+    {
+        mov_imm(e, RDI, imm);
+    }
+
+    if (op >= 4 && op < 7)
+    {
+        alu8(e, host_op[op], RAX, RDI);
+        alu(e, XOR, LAZY_AUX, LAZY_AUX);
+        alu(e, XOR, LAZY_CARRY, LAZY_CARRY);
+        mov(e, LAZY_RESULT, RAX);
+        set_lazy(c, op == 4 ? CPU8085_LAZY_ANA : CPU8085_LAZY_LOGIC);
+        return;
+    }
+    mov(e, LAZY_AUX, RAX);
+    alu(e, XOR, LAZY_AUX, RDI);
+    if (op == 7)
+    {
+        mov(e, LAZY_RESULT, RAX);
+        alu8(e, SUB, LAZY_RESULT, RDI);
+        setcc(e, CC_C, LAZY_CARRY);
+    }
+    else
+    {
+        if (op == 1 || op == 3)
+        {
+            bt_imm(e, LAZY_CARRY, 0);
+        }
+        alu8(e, host_op[op], RAX, RDI);
+        setcc(e, CC_C, LAZY_CARRY);
+        mov(e, LAZY_RESULT, RAX);
+    }
+    set_lazy(c, CPU8085_LAZY_ARITH);
+}
+
+// INR (step 1) or DCR (step -1) of a register or M
+static void inr_dcr(struct compiler *c, int r, int step)
+{
+    struct emitter *e = &c->e;
+    const struct mem *m = AT_INDEX(MEMBASE, RDX, 1, 0);
+
+    if (r == REG_M)
+    {
+        check_write(c, RDX, 0);
+        movzx8_load(e, RDI, m);
+    }
+    else
+    {
+        movzx8(e, RDI, host_reg[r]);
+    }
+    lea(e, LAZY_RESULT, AT(RDI, step));
+    mov(e, LAZY_AUX, RDI);
+    alu_imm(e, XOR, LAZY_AUX, 1);
+    if (r == REG_M)
+    {
+        store8(e, m, LAZY_RESULT);
+        mark_dirty(c, RDX, 0);
+    }
+    else
+    {
+        inc8(e, host_reg[r], step);
+    }
+    set_lazy(c, CPU8085_LAZY_ARITH);
+}
+
+// DAA, by the table
+static void daa(struct compiler *c)
+{
+    struct emitter *e = &c->e;
+
+    switch (c->lazy)
+    {
+    case CPU8085_LAZY_ARITH:
+        mov(e, RDI, LAZY_AUX);
+        alu(e, XOR, RDI, LAZY_RESULT);
+        alu_imm(e, AND, RDI, AUX_CARRY_FLAG);
+        break;
+    case CPU8085_LAZY_ANA:
+        mov_imm(e, RDI, AUX_CARRY_FLAG);
+        break;
+    case CPU8085_LAZY_LOGIC:
+        alu(e, XOR, RDI, RDI);
+        break;
+    default:
+        flags_into_edi(c);
+        alu_imm(e, AND, RDI, AUX_CARRY_FLAG);
+        break;
+    }
+    shift_imm(e, SHL, RDI, 4);
+    mov(e, R11, LAZY_CARRY);
+    shift_imm(e, SHL, R11, 9);
+    alu(e, OR, RDI, R11);
+    alu(e, OR, RDI, RAX);
+    movzx16_load(e, RDI, AT_INDEX(CTX, RDI, 2, CTX_OFFSET(daa)));
+    movzx8(e, RAX, RDI);
+    shift_imm(e, SHR, RDI, 8);
+    store8(e, CPU_AT(F), RDI);
+    mov(e, LAZY_CARRY, RDI);
+    alu_imm(e, AND, LAZY_CARRY, CARRY_FLAG);
+    set_lazy(c, CPU8085_LAZY_NONE);
+}
+
+// Push the return address and go to target, for CALL, a taken Ccc and RST
+static void call_to(struct compiler *c, unsigned short ret, unsigned short target, int extra_tstates)
+{
+    push_check(c);
+    store16_imm(&c->e, AT_INDEX(MEMBASE, RDI, 1, 0), ret);
+    push_done(c);
+    finish(c, extra_tstates);
+    goto_pc(c, target);
+}
+
+static void return_to_caller(struct compiler *c, int extra_tstates)
+{
+    pop_check(c);
+    pop_into(c, RDI);
+    finish(c, extra_tstates);
+    dispatch(c);
+}
+
+// The instruction at pc, known to be translatable; returns 1 if it ends
+// the block
+static int translate(struct compiler *c, unsigned short pc)
+{
+    struct emitter *e = &c->e;
+    const unsigned char *memory = c->memory;
+    unsigned char opcode = memory[pc];
+    unsigned short next = pc + cpu8085_opcode_length[opcode];
+    unsigned char imm8 = memory[(pc + 1) & 0xFFFF];
+    unsigned short imm16 = imm8 | memory[(pc + 2) & 0xFFFF] << 8;
+    const struct mem *m = AT_INDEX(MEMBASE, RDX, 1, 0);
+
+    begin(c, pc, opcode);
+
+    if ((opcode & 0xC0) == 0x40) // MOV
+    {
+        int d = DDD(opcode), s = SSS(opcode);
+        if (d == REG_M)
+        {
+            check_write(c, RDX, 0);
+            store8(e, m, host_reg[s]);
+            mark_dirty(c, RDX, 0);
+        }
+        else if (s == REG_M)
+        {
+            check_read(c, RDX, 0);
+            load8(e, host_reg[d], m);
+        }
+        else if (d != s)
+        {
+            mov8(e, host_reg[d], host_reg[s]);
+        }
+        return 0;
+    }
+    if ((opcode & 0xC0) == 0x80)
+    {
+        alu_op(c, DDD(opcode), SSS(opcode), 0);
+        return 0;
+    }
+    if ((opcode & 0xC7) == 0xC6)
+    {
+        alu_op(c, DDD(opcode), -1, imm8);
+        return 0;
+    }
+
+    int pair = host_pair[RP(opcode)];
+    switch (opcode & 0xCF)
+    {
+    case 0x01: // LXI
+        mov_imm(e, pair, imm16);
+        return 0;
+    case 0x03: // INX
+        inc16(e, pair, 1);
+        return 0;
+    case 0x0B: // DCX
+        inc16(e, pair, -1);
+        return 0;
+    case 0x09: // DAD
+        alu16(e, ADD, RDX, pair);
+        setcc(e, CC_C, LAZY_CARRY);
+        return 0;
+    case 0xC5: // PUSH
+        if (RP(opcode) == 3)
+        {
+            // F is built for the push; writing it back changes nothing
+            flags_into_edi(c);
+            store8(e, CPU_AT(F), RDI);
+        }
+        push_check(c);
+        if (RP(opcode) == 3)
+        {
+            movzx8_load(e, R11, CPU_AT(F));
+            store8(e, AT_INDEX(MEMBASE, RDI, 1, 0), R11);
+            store8(e, AT_INDEX(MEMBASE, RDI, 1, 1), RAX);
+        }
+        else
+        {
+            store16(e, AT_INDEX(MEMBASE, RDI, 1, 0), pair);
+        }
+        push_done(c);
+        return 0;
+    case 0xC1: // POP
+        pop_check(c);
+        if (RP(opcode) == 3)
+        {
+            pop_into(c, RDI);
+            mov(e, RAX, RDI);
+            shift_imm(e, SHR, RAX, 8);
+            store8(e, CPU_AT(F), RDI);
+            mov(e, LAZY_CARRY, RDI);
+            alu_imm(e, AND, LAZY_CARRY, CARRY_FLAG);
+            set_lazy(c, CPU8085_LAZY_NONE);
+        }
+        else
+        {
+            pop_into(c, pair);
+        }
+        return 0;
+    }
+
+    switch (opcode & 0xC7)
+    {
+    case 0x04: // INR
+        inr_dcr(c, DDD(opcode), 1);
+        return 0;
+    case 0x05: // DCR
+        inr_dcr(c, DDD(opcode), -1);
+        return 0;
+    case 0x06: // MVI
+        if (DDD(opcode) == REG_M)
+        {
+            check_write(c, RDX, 0);
+            store8_imm(e, m, imm8);
+            mark_dirty(c, RDX, 0);
+        }
+        else
+        {
+            mov8_imm(e, host_reg[DDD(opcode)], imm8);
+        }
+        return 0;
+    case 0xC2: // Jcc
+    {
+        int cc = condition(c, DDD(opcode));
+        if (imm16 <= pc)
+        {
+            // Backwards, so probably taken: that way falls through
+            unsigned char *not_taken = jcc(e, cc ^ 1, NULL);
+            finish(c, CPU8085_JCC_TAKEN_TSTATES);
+            goto_pc(c, imm16);
+            set_target(not_taken, e->p);
+            finish(c, 0);
+            goto_pc(c, next);
+        }
+        else
+        {
+            // Forwards, so probably not taken: the block goes on, and the
+            // jump leaves it out of line
+            struct side_exit *x = &c->exits[c->exit_count++];
+            x->site = jcc(e, cc, NULL);
+            x->pc = imm16;
+            x->tstates = c->tstates + CPU8085_JCC_TAKEN_TSTATES;
+            x->count = c->count;
+            x->lazy = c->lazy;
+            x->lazy_dirty = c->lazy_dirty;
+            return 0;
+        }
+        return 1;
+    }
+    case 0xC4: // Ccc
+    {
+        unsigned char *not_taken = jcc(e, condition(c, DDD(opcode)) ^ 1, NULL);
+        call_to(c, next, imm16, CPU8085_CCC_TAKEN_TSTATES);
+        set_target(not_taken, e->p);
+        finish(c, 0);
+        goto_pc(c, next);
+        return 1;
+    }
+    case 0xC0: // Rcc
+    {
+        unsigned char *not_taken = jcc(e, condition(c, DDD(opcode)) ^ 1, NULL);
+        return_to_caller(c, CPU8085_RCC_TAKEN_TSTATES);
+        set_target(not_taken, e->p);
+        finish(c, 0);
+        goto_pc(c, next);
+        return 1;
+    }
+    case 0xC7: // RST
+        call_to(c, next, opcode & 0x38, 0);
+        return 1;
+    }
+
+    switch (opcode)
+    {
+    case 0x00: // NOP
+        return 0;
+    case 0x02: // STAX B/D
+    case 0x12:
+        check_write(c, pair, 0);
+        store8(e, AT_INDEX(MEMBASE, pair, 1, 0), RAX);
+        mark_dirty(c, pair, 0);
+        return 0;
+    case 0x0A: // LDAX B/D
+    case 0x1A:
+        check_read(c, pair, 0);
+        load8(e, RAX, AT_INDEX(MEMBASE, pair, 1, 0));
+        return 0;
+    case 0x22: // SHLD
+        check_write(c, -1, imm16);
+        if ((imm16 + 1) / CPU8085_DIRTY_LINE != imm16 / CPU8085_DIRTY_LINE)
+        {
+            check_write(c, -1, imm16 + 1);
+        }
+        store16(e, AT(MEMBASE, imm16), RDX);
+        mark_dirty(c, -1, imm16);
+        mark_dirty(c, -1, imm16 + 1);
+        return 0;
+    case 0x2A: // LHLD
+        check_read(c, -1, imm16);
+        check_read(c, -1, imm16 + 1);
+        movzx16_load(e, RDX, AT(MEMBASE, imm16));
+        return 0;
+    case 0x32: // STA
+        check_write(c, -1, imm16);
+        store8(e, AT(MEMBASE, imm16), RAX);
+        mark_dirty(c, -1, imm16);
+        return 0;
+    case 0x3A: // LDA
+        check_read(c, -1, imm16);
+        load8(e, RAX, AT(MEMBASE, imm16));
+        return 0;
+    case 0x07: // RLC
+    case 0x0F: // RRC
+    case 0x17: // RAL
+    case 0x1F: // RAR
+        if (opcode >= 0x17)
+        {
+            bt_imm(e, LAZY_CARRY, 0);
+        }
+        shift8_once(e, opcode == 0x07 ? ROL : opcode == 0x0F ? ROR : opcode == 0x17 ? RCL : RCR, RAX);
+        setcc(e, CC_C, LAZY_CARRY);
+        return 0;
+    case 0x27: // DAA
+        daa(c);
+        return 0;
+    case 0x2F: // CMA
+        not8(e, RAX);
+        return 0;
+    case 0x37: // STC
+        mov_imm(e, LAZY_CARRY, 1);
+        return 0;
+    case 0x3F: // CMC
+        alu_imm(e, XOR, LAZY_CARRY, 1);
+        return 0;
+    case 0xE3: // XTHL: both bytes on one line
+        lea(e, R11, AT(RBP, 1));
+        test8_imm(e, R11, 0x0F);
+        bail_if(c, CC_Z);
+        mov(e, RDI, RBP);
+        shift_imm(e, SHR, RDI, 8);
+        alu8_mem_imm(e, CMP, AT_INDEX(CPU, RDI, 1, MMIO), 0);
+        add_check(c, RBP, RDI, 0);
+        movzx16_load(e, RDI, AT_INDEX(MEMBASE, RBP, 1, 0));
+        store16(e, AT_INDEX(MEMBASE, RBP, 1, 0), RDX);
+        mov(e, RDX, RDI);
+        mark_dirty(c, RBP, 0);
+        return 0;
+    case 0xEB: // XCHG
+        xchg(e, RCX, RDX);
+        return 0;
+    case 0xF9: // SPHL
+        mov(e, RBP, RDX);
+        return 0;
+    case 0xC3: // JMP
+        finish(c, 0);
+        goto_pc(c, imm16);
+        return 1;
+    case 0xCD: // CALL
+        call_to(c, next, imm16, 0);
+        return 1;
+    case 0xC9: // RET
+        return_to_caller(c, 0);
+        return 1;
+    case 0xE9: // PCHL, unless to itself
+        alu16_imm(e, CMP, RDX, pc);
+        bail_if(c, CC_Z);
+        mov(e, RDI, RDX);
+        finish(c, 0);
+        dispatch(c);
+        return 1;
+    }
+    abort(); // every other opcode was handled above or is not translatable
+}
+
+// The out-of-line code of a block: writes to flagged pages, bails, side
+// exits, jumps to blocks not translated yet and the budget check failing
+static void emit_stubs(struct compiler *c, unsigned short start, unsigned char *budget_site)
+{
+    struct jit8085 *jit = c->jit;
+    struct emitter *e = &c->e;
+
+    for (int i = 0; i < c->check_count; i++)
+    {
+        struct code_check *check = &c->checks[i];
+        struct bail *b = &c->bails[check->op];
+
+        set_target(check->site, e->p);
+        test8_mem_imm(e, check->page_reg < 0 ? AT(CPU, MMIO + (check->addr >> 8)) :
+                      AT_INDEX(CPU, check->page_reg, 1, MMIO), ~CPU8085_PAGE_CODE & 0xFF);
+        b->sites[b->site_count++] = jcc(e, CC_NZ, NULL);
+        push(e, RDI);
+        if (check->addr_reg < 0)
+        {
+            mov_imm(e, RDI, check->addr / CPU8085_DIRTY_LINE);
+        }
+        else
+        {
+            if (check->addr_reg != RDI)
+            {
+                mov(e, RDI, check->addr_reg);
+            }
+            shift_imm(e, SHR, RDI, 4);
+        }
+        load64(e, R11, AT(CTX, CTX_OFFSET(code_lines)));
+        bt_mem(e, AT(R11, 0), RDI);
+        pop(e, RDI);
+        b->sites[b->site_count++] = jcc(e, CC_C, NULL);
+        jmp(e, check->resume);
+    }
+
+    for (int i = 0; i < c->count; i++)
+    {
+        struct bail *b = &c->bails[i];
+        if (b->site_count == 0)
+        {
+            continue;
+        }
+        for (int j = 0; j < b->site_count; j++)
+        {
+            set_target(b->sites[j], e->p);
+        }
+        if (b->lazy_dirty)
+        {
+            store8_imm(e, CPU_AT(lazy_op), b->lazy);
+        }
+        if (b->count > 0)
+        {
+            alu64_imm(e, ADD, TSTATES, b->tstates);
+            alu64_imm(e, ADD, INSTRUCTIONS, b->count);
+        }
+        mov_imm(e, RDI, b->pc);
+        jmp(e, jit->exit_interpret);
+    }
+
+    for (int i = 0; i < c->exit_count; i++)
+    {
+        struct side_exit *x = &c->exits[i];
+        set_target(x->site, e->p);
+        if (x->lazy_dirty)
+        {
+            store8_imm(e, CPU_AT(lazy_op), x->lazy);
+        }
+        alu64_imm(e, ADD, TSTATES, x->tstates);
+        alu64_imm(e, ADD, INSTRUCTIONS, x->count);
+        goto_pc(c, x->pc);
+    }
+
+    for (int i = 0; i < c->successor_count; i++)
+    {
+        struct successor *s = &c->successors[i];
+        set_target(s->site, e->p);
+        mov_imm(e, RDI, s->pc);
+        // LEA R11, [RIP + to the jump's rel32]
+        emit8(e, 0x4C);
+        emit8(e, 0x8D);
+        emit8(e, 0x1D);
+        emit32(e, s->site - (e->p + 4));
+        jmp(e, jit->exit_miss);
+    }
+
+    set_target(budget_site, e->p);
+    mov_imm(e, RDI, start);
+    jmp(e, jit->exit_budget);
+}
+
+// Point a jump at the block translated at pc, remembering where it went
+// before so that dropping the block can undo it
+static void link_to(struct jit8085 *jit, unsigned char *site, unsigned short pc)
+{
+    const unsigned char *entry = jit->context->entries[pc];
+
+    if (entry == NULL || entry == jit->untranslated || jit->link_count == JIT8085_MAX_LINKS)
+    {
+        return;
+    }
+    int index;
+    memcpy(&index, entry - 4, 4);
+    struct link *link = &jit->links[jit->link_count];
+    link->site = site;
+    memcpy(&link->rel32, site, 4);
+    link->next = jit->blocks[index].links;
+    jit->blocks[index].links = jit->link_count++;
+    set_target(site, entry);
+}
+
+// Translate the block at pc (hot, with nothing translated there yet) and
+// enter it into the table; returns its entry, or jit->untranslated if its
+// first instruction is for the interpreter
+static const unsigned char *translate_block(struct jit8085 *jit, cpu8085 *cpu, unsigned short start)
+{
+    struct context *context = jit->context;
+
+    if (!translatable(cpu->memory, start))
+    {
+        context->entries[start] = jit->untranslated;
+        return jit->untranslated;
+    }
+    if (jit->used + JIT8085_BLOCK_ROOM > JIT8085_CODE_SIZE || jit->block_count == JIT8085_MAX_BLOCKS ||
+        jit->link_count > JIT8085_MAX_LINKS - 4)
+    {
+        jit8085_flush(jit);
+    }
+
+    struct compiler c;
+    c.jit = jit;
+    c.memory = cpu->memory;
+    c.e.p = jit->code + jit->used;
+    c.lazy = LAZY_UNKNOWN;
+    c.lazy_dirty = 0;
+    c.count = 0;
+    c.tstates = 0;
+    c.check_count = 0;
+    c.exit_count = 0;
+    c.successor_count = 0;
+
+    // The block's index, then its entry on a 16-byte boundary
+    while ((unsigned long)(c.e.p + 4) % 16 != 0)
+    {
+        emit8(&c.e, 0xCC);
+    }
+    int index = jit->block_count++;
+    emit32(&c.e, index);
+    const unsigned char *entry = c.e.p;
+
+    // Start only if the budget covers everything up to the last instruction
+    lea64(&c.e, RDI, AT(TSTATES, 0x7FFFFFFF));
+    unsigned char *prefix_tstates = c.e.p - 4;
+    alu64_load(&c.e, CMP, RDI, AT(CTX, CTX_OFFSET(limit)));
+    unsigned char *budget_site = jcc(&c.e, CC_NC, NULL);
+
+    unsigned int pc = start;
+    for (;;)
+    {
+        if (c.count == JIT8085_MAX_OPS || pc == CPU8085_MEMORY_SIZE || !translatable(cpu->memory, pc))
+        {
+            finish(&c, 0);
+            goto_pc(&c, pc);
+            break;
+        }
+        unsigned int next = pc + cpu8085_opcode_length[cpu->memory[pc]];
+        int ends = translate(&c, pc);
+        pc = next;
+        if (ends)
+        {
+            break;
+        }
+    }
+    unsigned int prefix = c.tstates - c.last_tstates;
+    memcpy(prefix_tstates, &prefix, 4);
+    emit_stubs(&c, start, budget_site);
+    jit->used = c.e.p - jit->code;
+
+    struct translation *block = &jit->blocks[index];
+    block->start = start;
+    block->end = pc;
+    block->entry = entry;
+    block->links = -1;
+    context->entries[start] = entry;
+    for (unsigned int a = start; a < pc; a += CPU8085_DIRTY_LINE - a % CPU8085_DIRTY_LINE)
+    {
+        unsigned int line = a / CPU8085_DIRTY_LINE;
+        context->code_lines[line / 64] |= 1ULL << (line % 64);
+        cpu->mmio[a >> 8] |= CPU8085_PAGE_CODE;
+    }
+    for (int i = 0; i < c.successor_count; i++)
+    {
+        link_to(jit, c.successors[i].site, c.successors[i].pc);
+    }
+    return entry;
+}
+
+// ---- Interface ----
+
+struct jit8085 *jit8085_create(unsigned long long *code_lines)
+{
+    struct jit8085 *jit = calloc(1, sizeof(struct jit8085));
+    if (jit == NULL)
+    {
+        return NULL;
+    }
+    jit->context = calloc(1, sizeof(struct context));
+    jit->code = mmap(NULL, JIT8085_CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (jit->context == NULL || jit->code == MAP_FAILED)
+    {
+        if (jit->code != MAP_FAILED)
+        {
+            munmap(jit->code, JIT8085_CODE_SIZE);
+        }
+        free(jit->context);
+        free(jit);
+        return NULL;
+    }
+
+    struct context *context = jit->context;
+    context->code_lines = code_lines;
+    for (int v = 0; v < 256; v++)
+    {
+        int p = v ^ (v >> 4);
+        p ^= p >> 2;
+        p ^= p >> 1;
+        context->szp[v] = (v & SIGN_FLAG) | (v ? 0 : ZERO_FLAG) | ((~p & 1) << 2);
+    }
+    // As op_daa() does it
+    for (int i = 0; i < 1024; i++)
+    {
+        int a = i & 0xFF;
+        int carry = i >> 9;
+        int correction = 0;
+        if ((a & 0x0F) > 9 || (i & 0x100))
+        {
+            correction |= 0x06;
+        }
+        if (a > 0x99 || carry)
+        {
+            correction |= 0x60;
+            carry = 1;
+        }
+        int sum = a + correction;
+        int f = context->szp[sum & 0xFF] | ((a ^ correction ^ sum) & AUX_CARRY_FLAG) | carry;
+        context->daa[i] = (sum & 0xFF) | f << 8;
+    }
+
+    emit_shared(jit);
+    jit8085_flush(jit);
+    return jit;
+}
+
+void jit8085_destroy(struct jit8085 *jit)
+{
+    if (jit == NULL)
+    {
+        return;
+    }
+    munmap(jit->code, JIT8085_CODE_SIZE);
+    free(jit->context);
+    free(jit);
+}
+
+void jit8085_flush(struct jit8085 *jit)
+{
+    jit->used = jit->shared;
+    jit->block_count = 0;
+    jit->link_count = 0;
+    jit->flushes++;
+    memset(jit->context->entries, 0, sizeof(jit->context->entries));
+    memset(jit->heat, 0, sizeof(jit->heat));
+}
+
+void jit8085_invalidate(struct jit8085 *jit, unsigned short addr)
+{
+    struct context *context = jit->context;
+
+    for (int i = 0; i < jit->block_count; i++)
+    {
+        struct translation *block = &jit->blocks[i];
+        if (addr < block->start || addr >= block->end)
+        {
+            continue;
+        }
+        for (int l = block->links; l >= 0; l = jit->links[l].next)
+        {
+            memcpy(jit->links[l].site, &jit->links[l].rel32, 4);
+        }
+        context->entries[block->start] = NULL;
+        jit->heat[block->start] = 0;
+        block->start = BLOCK_DEAD;
+        block->end = 0;
+    }
+    // An instruction left to the interpreter may have become translatable
+    for (int pc = addr - 2; pc <= addr; pc++)
+    {
+        if (pc >= 0 && context->entries[pc] == jit->untranslated)
+        {
+            context->entries[pc] = NULL;
+        }
+    }
+}
+
+unsigned long long jit8085_run(struct jit8085 *jit, cpu8085 *cpu, unsigned long long end_count,
+                               unsigned long long tstate_limit)
+{
+    struct context *context = jit->context;
+    unsigned long long first = cpu->instructions;
+    unsigned char *site = NULL;
+
+    for (;;)
+    {
+        unsigned short pc = cpu->PC;
+        const unsigned char *entry = context->entries[pc];
+        if (entry == NULL)
+        {
+            if (++jit->heat[pc] < JIT8085_HOT)
+            {
+                break;
+            }
+            unsigned long flushes = jit->flushes;
+            entry = translate_block(jit, cpu, pc);
+            if (jit->flushes != flushes)
+            {
+                site = NULL;
+            }
+        }
+        if (entry == jit->untranslated)
+        {
+            break;
+        }
+        if (site != NULL)
+        {
+            link_to(jit, site, pc);
+            site = NULL;
+        }
+
+        unsigned long long limit = cpu->next_event < tstate_limit ? cpu->next_event : tstate_limit;
+        if (cpu->instructions >= end_count || cpu->tstates >= limit)
+        {
+            break;
+        }
+        // No instruction takes fewer than 4 T-states, so this keeps to end_count as well
+        if ((limit - cpu->tstates) / 4 > end_count - cpu->instructions)
+        {
+            limit = cpu->tstates + 4 * (end_count - cpu->instructions);
+        }
+        context->limit = limit;
+
+        unsigned long long instructions = cpu->instructions;
+        int reason = jit->enter(cpu, context, entry);
+        // Translated code keeps CY in lazy_carry only
+        if (cpu->lazy_op == CPU8085_LAZY_NONE)
+        {
+            cpu->F = (cpu->F & ~CARRY_FLAG) | cpu->lazy_carry;
+        }
+        if (reason == EXIT_MISS)
+        {
+            site = context->site;
+        }
+        else if (reason == EXIT_INTERPRET || cpu->instructions == instructions)
+        {
+            break;
+        }
+    }
+    return cpu->instructions - first;
+}
+
+#else
+
+struct jit8085 *jit8085_create(unsigned long long *code_lines)
+{
+    (void)code_lines;
+    return NULL;
+}
+
+void jit8085_destroy(struct jit8085 *jit)
+{
+    (void)jit;
+}
+
+void jit8085_flush(struct jit8085 *jit)
+{
+    (void)jit;
+}
+
+void jit8085_invalidate(struct jit8085 *jit, unsigned short addr)
+{
+    (void)jit;
+    (void)addr;
+}
+
+unsigned long long jit8085_run(struct jit8085 *jit, cpu8085 *cpu, unsigned long long end_count,
+                               unsigned long long tstate_limit)
+{
+    (void)jit;
+    (void)cpu;
+    (void)end_count;
+    (void)tstate_limit;
+    return 0;
+}
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef JIT8085_H
+#define JIT8085_H
+
+#include "cpu8085.h"
+
+// Translation of 8085 code into x86-64 machine code, the block cache's
+// fastest tier (see cpu8085_enable_jit()).
+//
+// A block that has started JIT8085_HOT times is translated: a run of up
+// to JIT8085_MAX_OPS instructions, ending at a jump, call or return. A
+// forward conditional jump does not end it; taken, it leaves from there.
+// The 8085 registers live in host registers while translated code runs (A
+// in AL, BC/DE/HL in BX/CX/DX, SP in BP), the flags stay lazy as in the
+// block cache and are only built when something reads them, and a jump
+// to a translated block is patched to go there directly. Returns and PCHL
+// look their target up in a table of translated blocks by address.
+//
+// Translated code gives back to the interpreter, before the instruction
+// concerned, whatever it does not handle itself: IN, OUT, EI, DI, SIM, RIM,
+// HLT, the undocumented opcodes, jumps to self, accesses to device pages,
+// writes into code and stack accesses that cross a 16-byte line. A block
+// only starts if the T-state and instruction budgets cover all of it, so
+// scheduled events and interrupts are seen at the same instruction as by
+// the interpreter, and the state comes out the same.
+//
+// Writes into translated code drop the blocks concerned, and the jumps
+// patched into them. When the code buffer or the tables fill up,
+// everything is dropped and translated again as it gets hot.
+
+#define JIT8085_HOT 16
+#define JIT8085_MAX_OPS 32
+
+struct jit8085;
+
+// A translator for one CPU. code_lines is the block cache's bitmap of the
+// memory lines it holds code from; translated lines are added to it, and
+// their pages flagged CPU8085_PAGE_CODE, so that writes there reach
+// jit8085_invalidate(). NULL if the host is not x86-64 or out of memory.
+struct jit8085 *jit8085_create(unsigned long long *code_lines);
+void jit8085_destroy(struct jit8085 *jit);
+
+// Drop all translations
+void jit8085_flush(struct jit8085 *jit);
+
+// A write to addr, on a line with code: drop the blocks holding it
+void jit8085_invalidate(struct jit8085 *jit, unsigned short addr);
+
+// Run translated code from PC while the budgets last: up to end_count
+// instructions in all, and blocks that end before tstate_limit and
+// cpu->next_event, as run_blocks() would. Translates hot blocks on the
+// way. Stops at the first instruction to be interpreted, or that is not
+// hot yet; returns the number of instructions run. The lazy flag state is
+// left as the block cache keeps it.
+unsigned long long jit8085_run(struct jit8085 *jit, cpu8085 *cpu, unsigned long long end_count,
+                               unsigned long long tstate_limit);
+
+#endif
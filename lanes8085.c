@@ -0,0 +1,1189 @@
+#include <stdlib.h>
+#include <string.h>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "lanes8085.h"
+
+// One register across all lanes, and SP across all lanes, as GCC vectors.
+// may_alias: they are loaded straight from the reg[]/SP[] arrays.
+typedef unsigned char lane_u8 __attribute__((vector_size(LANES8085_WIDTH), may_alias));
+typedef unsigned short lane_u16 __attribute__((vector_size(2 * LANES8085_WIDTH), may_alias));
+
+#define REG_F 6
+#define REG_A 7
+#define REG_M 6
+#define DDD(opcode) (((opcode) >> 3) & 0x07)
+#define SSS(opcode) ((opcode) & 0x07)
+#define RP(opcode) (((opcode) >> 4) & 0x03)
+
+#define REG(lanes, r) (*(lane_u8 *)(lanes)->reg[r])
+#define SPS(lanes) (*(lane_u16 *)(lanes)->SP)
+
+// Visit each lane in a bit mask, lowest first
+#define FOR_LANES(i, bits) \
+    for (unsigned long long m_ = (bits); m_ != 0; m_ &= m_ - 1) \
+        for (int i = __builtin_ctzll(m_), once_ = 1; once_; once_ = 0)
+
+// Lanes at one PC, executing together. Their steps and T-states are added
+// to the per-lane counters only when the group breaks up (flush()).
+struct group
+{
+    lane_u8 vmask;               // FF for the lanes in the group, 00 elsewhere
+    unsigned long long mask;     // the same, one bit per lane
+    int leader;                  // lowest lane; the code is fetched from its memory
+    unsigned short pc;
+    unsigned long long steps;
+    unsigned long long tstates;
+};
+
+// ---- Lane masks ----
+
+// Bit i set for each byte i whose top bit is set
+static inline unsigned long long lane_bits(lane_u8 v)
+{
+    unsigned long long bits = 0;
+#if defined(__AVX2__)
+    for (int k = 0; k < LANES8085_WIDTH; k += 32)
+    {
+        __m256i chunk;
+        memcpy(&chunk, (const unsigned char *)&v + k, sizeof(chunk));
+        bits |= (unsigned long long)(unsigned int)_mm256_movemask_epi8(chunk) << k;
+    }
+#elif defined(__SSE2__)
+    for (int k = 0; k < LANES8085_WIDTH; k += 16)
+    {
+        __m128i chunk;
+        memcpy(&chunk, (const unsigned char *)&v + k, sizeof(chunk));
+        bits |= (unsigned long long)(unsigned int)_mm_movemask_epi8(chunk) << k;
+    }
+#else
+    for (int i = 0; i < LANES8085_WIDTH; i++)
+    {
+        bits |= (unsigned long long)(v[i] >> 7) << i;
+    }
+#endif
+    return bits;
+}
+
+static lane_u8 lane_mask(unsigned long long bits)
+{
+    lane_u8 v;
+    for (int i = 0; i < LANES8085_WIDTH; i++)
+    {
+        v[i] = bits >> i & 1 ? 0xFF : 0x00;
+    }
+    return v;
+}
+
+// Replace the group's lanes of a register
+static inline void put(lane_u8 *r, lane_u8 value, const struct group *g)
+{
+    *r = (*r & ~g->vmask) | (value & g->vmask);
+}
+
+// ---- Memory ----
+
+static inline unsigned char *memory_of(const lanes8085 *lanes, int lane)
+{
+    return lanes->memory + (size_t)lane * CPU8085_MEMORY_SIZE;
+}
+
+static inline unsigned char read8(const lanes8085 *lanes, int lane, unsigned short addr)
+{
+    return memory_of(lanes, lane)[addr];
+}
+
+// Writes are tracked per lane, for lanes8085_store(), and for all lanes
+// together, to notice code being overwritten
+static inline void write8(lanes8085 *lanes, int lane, unsigned short addr, unsigned char value)
+{
+    unsigned int line = addr / CPU8085_DIRTY_LINE;
+    unsigned long long bit = 1ULL << (line % 64);
+
+    memory_of(lanes, lane)[addr] = value;
+    lanes->dirty[lane][line / 64] |= bit;
+    lanes->written[line / 64] |= bit;
+}
+
+static inline unsigned short hl(const lanes8085 *lanes, int lane)
+{
+    return lanes->reg[4][lane] << 8 | lanes->reg[5][lane];
+}
+
+// The M operand (memory at HL) of every lane in the group
+static lane_u8 read_m(const lanes8085 *lanes, const struct group *g)
+{
+    lane_u8 v = { 0 };
+    FOR_LANES(i, g->mask)
+    {
+        v[i] = read8(lanes, i, hl(lanes, i));
+    }
+    return v;
+}
+
+static void write_m(lanes8085 *lanes, const struct group *g, lane_u8 v)
+{
+    FOR_LANES(i, g->mask)
+    {
+        write8(lanes, i, hl(lanes, i), v[i]);
+    }
+}
+
+static inline lane_u8 read_reg(const lanes8085 *lanes, const struct group *g, int r)
+{
+    return r == REG_M ? read_m(lanes, g) : REG(lanes, r);
+}
+
+static inline void write_reg(lanes8085 *lanes, const struct group *g, int r, lane_u8 value)
+{
+    if (r == REG_M)
+    {
+        write_m(lanes, g, value);
+    }
+    else
+    {
+        put(&REG(lanes, r), value, g);
+    }
+}
+
+static inline void push16(lanes8085 *lanes, int lane, unsigned short value)
+{
+    write8(lanes, lane, --lanes->SP[lane], value >> 8);
+    write8(lanes, lane, --lanes->SP[lane], value & 0xFF);
+}
+
+static inline unsigned short pop16(lanes8085 *lanes, int lane)
+{
+    unsigned short value = read8(lanes, lane, lanes->SP[lane]++);
+    value |= read8(lanes, lane, lanes->SP[lane]++) << 8;
+    return value;
+}
+
+// ---- Group bookkeeping ----
+
+// Bring the group's lanes up to date: PC, instructions and T-states
+static void flush(lanes8085 *lanes, struct group *g)
+{
+    FOR_LANES(i, g->mask)
+    {
+        lanes->PC[i] = g->pc;
+        lanes->instructions[i] += g->steps;
+        lanes->tstates[i] += g->tstates;
+    }
+    lanes->steps += g->steps;
+    g->steps = 0;
+    g->tstates = 0;
+}
+
+static void stop_lanes(lanes8085 *lanes, unsigned long long bits, int fault)
+{
+    FOR_LANES(i, bits)
+    {
+        lanes->halted[i] = 1;
+        lanes->fault[i] = fault;
+    }
+}
+
+// Send some of the group's lanes (already flushed, so at the fall-through
+// PC) to target instead, charging extra T-states. from is the address of
+// the branch, for the jump-to-self check of JMP, Jcc and PCHL.
+static void branch_lanes(lanes8085 *lanes, unsigned long long bits, unsigned short target,
+                         int extra, int from)
+{
+    FOR_LANES(i, bits)
+    {
+        lanes->PC[i] = target;
+        lanes->tstates[i] += extra;
+    }
+    if (target == from)
+    {
+        stop_lanes(lanes, bits, CPU8085_STOP_LOOP);
+    }
+}
+
+// ---- Flags, as in the scalar core's flag tables ----
+
+static inline lane_u8 szp(lane_u8 r)
+{
+    lane_u8 p = r ^ (r >> 4);
+    p ^= p >> 2;
+    p ^= p >> 1;
+    return (r & SIGN_FLAG) | ((lane_u8)(r == 0) & ZERO_FLAG) | ((~p & 1) << 2);
+}
+
+// r = a + b + c, or a - b - c: CY out of bit 7, AC out of bit 3
+static inline lane_u8 add_flags(lane_u8 a, lane_u8 b, lane_u8 r)
+{
+    lane_u8 t = a + b;
+    lane_u8 carry = ((lane_u8)(t < a) | (lane_u8)(r < t)) & CARRY_FLAG;
+    return szp(r) | carry | ((a ^ b ^ r) & AUX_CARRY_FLAG);
+}
+
+static inline lane_u8 sub_flags(lane_u8 a, lane_u8 b, lane_u8 c, lane_u8 r)
+{
+    lane_u8 t = a - b;
+    lane_u8 borrow = ((lane_u8)(a < b) | (lane_u8)(t < c)) & CARRY_FLAG;
+    return szp(r) | borrow | ((a ^ b ^ r) & AUX_CARRY_FLAG);
+}
+
+// ---- Vector handlers ----
+
+// Each gets the group with PC already past the instruction and its base
+// T-states charged, and the two bytes after the opcode. Returns 0 to carry
+// on with the group, or 1 once it has flushed the group because its lanes
+// went separate ways or stopped.
+typedef int (*vector_op)(lanes8085 *lanes, struct group *g, unsigned char opcode, unsigned short operand);
+
+static int vop_nop(lanes8085 *lanes, struct group *g, unsigned char opcode, unsigned short operand)
+{
+    (void)lanes;
+    (void)g;
+    (void)opcode;
+    (void)operand;
+    return 0;
+}
+
+static int vop_hlt(lanes8085 *lanes, struct group *g, unsigned char opcode, unsigned short operand)
+{
+    (void)opcode;
+    (void)operand;
+    flush(lanes, g);
+    stop_lanes(lanes, g->mask, 0);
+    return 1;
+}
+
+static int vop_mov(lanes8085 *lanes, struct group *g, unsigned char opcode, unsigned short operand)
+{
+    (void)operand;
+    write_reg(lanes, g, DDD(opcode), read_reg(lanes, g, SSS(opcode)));
+    return 0;
+}
+
+static int vop_mvi(lanes8085 *lanes, struct group *g, unsigned char opcode, unsigned short operand)
+{
+    lane_u8 value = { 0 };
+    write_reg(lanes, g, DDD(opcode), value + (unsigned char)operand);
+    return 0;
+}
+
+static int vop_inr(lanes8085 *lanes, struct group *g, unsigned char opcode, unsigned short operand)
+{
+    (void)operand;
+    lane_u8 v = read_reg(lanes, g, DDD(opcode));
+    lane_u8 r = v + 1;
+    lane_u8 f = REG(lanes, REG_F);
+
+    put(&REG(lanes, REG_F), (f & CARRY_FLAG) | szp(r) | ((v ^ r) & AUX_CARRY_FLAG), g);
+    write_reg(lanes, g, DDD(opcode), r);
+    return 0;
+}
+
+static int vop_dcr(lanes8085 *lanes, struct group *g, unsigned char opcode, unsigned short operand)
+{
+    (void)operand;
+    lane_u8 v = read_reg(lanes, g, DDD(opcode));
+    lane_u8 r = v - 1;
+    lane_u8 f = REG(lanes, REG_F);
+
+    put(&REG(lanes, REG_F), (f & CARRY_FLAG) | szp(r) | ((v ^ r) & AUX_CARRY_FLAG), g);
+    write_reg(lanes, g, DDD(opcode), r);
+    return 0;
+}
+
+// Register pairs: high byte in reg[2 * rp], low byte in reg[2 * rp + 1],
+// and SP for rp 3
+static int vop_lxi(lanes8085 *lanes, struct group *g, unsigned char opcode, unsigned short operand)
+{
+    int rp = RP(opcode);
+    lane_u8 zero = { 0 };
+
+    if (rp == 3)
+    {
+        FOR_LANES(i, g->mask)
+        {
+            lanes->SP[i] = operand;
+        }
+        return 0;
+    }
+    put(&REG(lanes, 2 * rp), zero + (unsigned char)(operand >> 8), g);
+    put(&REG(lanes, 2 * rp + 1), zero + (unsigned char)operand, g);
+    return 0;
+}
+
+static inline void step_pair(lanes8085 *lanes, struct group *g, int rp, int delta)
+{
+    if (rp == 3)
+    {
+        FOR_LANES(i, g->mask)
+        {
+            lanes->SP[i] += delta;
+        }
+        return;
+    }
+    lane_u8 hi = REG(lanes, 2 * rp);
+    lane_u8 lo = REG(lanes, 2 * rp + 1);
+    lane_u8 next = lo + (unsigned char)delta;
+    // Carry into the high byte on FF -> 00, borrow on 00 -> FF
+    lane_u8 wrap = (lane_u8)(delta > 0 ? next == 0 : lo == 0) & 1;
+    put(&REG(lanes, 2 * rp + 1), next, g);
+    put(&REG(lanes, 2 * rp), delta > 0 ? hi + wrap : hi - wrap, g);
+}
+
+static int vop_inx(lanes8085 *lanes, struct group *g, unsigned char opcode, unsigned short operand)
+{
+    (void)operand;
+    step_pair(lanes, g, RP(opcode), 1);
+    return 0;
+}
+
+static int vop_dcx(lanes8085 *lanes, struct group *g, unsigned char opcode, unsigned short operand)
+{
+    (void)operand;
+    step_pair(lanes, g, RP(opcode), -1);
+    return 0;
+}
+
+static int vop_dad(lanes8085 *lanes, struct group *g, unsigned char opcode, unsigned short operand)
+{
+    (void)operand;
+    int rp = RP(opcode);
+    lane_u8 h = REG(lanes, 4), l = REG(lanes, 5);
+    lane_u8 rh, rl;
+
+    if (rp == 3)
+    {
+        lane_u16 sp = SPS(lanes);
+        rh = __builtin_convertvector(sp >> 8, lane_u8);
+        rl = __builtin_convertvector(sp & 0xFF, lane_u8);
+    }
+    else
+    {
+        rh = REG(lanes, 2 * rp);
+        rl = REG(lanes, 2 * rp + 1);
+    }
+
+    lane_u8 low = l + rl;
+    lane_u8 c = (lane_u8)(low < l) & 1;
+    lane_u8 t = h + rh;
+    lane_u8 high = t + c;
+    lane_u8 carry = ((lane_u8)(t < h) | (lane_u8)(high < t)) & CARRY_FLAG;
+
+    put(&REG(lanes, 5), low, g);
+    put(&REG(lanes, 4), high, g);
+    put(&REG(lanes, REG_F), (REG(lanes, REG_F) & ~CARRY_FLAG) | carry, g);
+    return 0;
+}
+
+static int vop_sta(lanes8085 *lanes, struct group *g, unsigned char opcode, unsigned short operand)
+{
+    (void)opcode;
+    FOR_LANES(i, g->mask)
+    {
+        write8(lanes, i, operand, lanes->reg[REG_A][i]);
+    }
+    return 0;
+}
+
+static int vop_lda(lanes8085 *lanes, struct group *g, unsigned char opcode, unsigned short operand)
+{
+    (void)opcode;
+    FOR_LANES(i, g->mask)
+    {
+        lanes->reg[REG_A][i] = read8(lanes, i, operand);
+    }
+    return 0;
+}
+
+static int vop_stax(lanes8085 *lanes, struct group *g, unsigned char opcode, unsigned short operand)
+{
+    (void)operand;
+    int rp = RP(opcode);
+    FOR_LANES(i, g->mask)
+    {
+        write8(lanes, i, lanes->reg[2 * rp][i] << 8 | lanes->reg[2 * rp + 1][i], lanes->reg[REG_A][i]);
+    }
+    return 0;
+}
+
+static int vop_ldax(lanes8085 *lanes, struct group *g, unsigned char opcode, unsigned short operand)
+{
+    (void)operand;
+    int rp = RP(opcode);
+    FOR_LANES(i, g->mask)
+    {
+        lanes->reg[REG_A][i] = read8(lanes, i, lanes->reg[2 * rp][i] << 8 | lanes->reg[2 * rp + 1][i]);
+    }
+    return 0;
+}
+
+static int vop_shld(lanes8085 *lanes, struct group *g, unsigned char opcode, unsigned short operand)
+{
+    (void)opcode;
+    FOR_LANES(i, g->mask)
+    {
+        write8(lanes, i, operand, lanes->reg[5][i]);
+        write8(lanes, i, operand + 1, lanes->reg[4][i]);
+    }
+    return 0;
+}
+
+static int vop_lhld(lanes8085 *lanes, struct group *g, unsigned char opcode, unsigned short operand)
+{
+    (void)opcode;
+    FOR_LANES(i, g->mask)
+    {
+        lanes->reg[5][i] = read8(lanes, i, operand);
+        lanes->reg[4][i] = read8(lanes, i, operand + 1);
+    }
+    return 0;
+}
+
+static int vop_xchg(lanes8085 *lanes, struct group *g, unsigned char opcode, unsigned short operand)
+{
+    (void)opcode;
+    (void)operand;
+    lane_u8 d = REG(lanes, 2), e = REG(lanes, 3);
+    put(&REG(lanes, 2), REG(lanes, 4), g);
+    put(&REG(lanes, 3), REG(lanes, 5), g);
+    put(&REG(lanes, 4), d, g);
+    put(&REG(lanes, 5), e, g);
+    return 0;
+}
+
+static int vop_sphl(lanes8085 *lanes, struct group *g, unsigned char opcode, unsigned short operand)
+{
+    (void)opcode;
+    (void)operand;
+    FOR_LANES(i, g->mask)
+    {
+        lanes->SP[i] = hl(lanes, i);
+    }
+    return 0;
+}
+
+static int vop_xthl(lanes8085 *lanes, struct group *g, unsigned char opcode, unsigned short operand)
+{
+    (void)opcode;
+    (void)operand;
+    FOR_LANES(i, g->mask)
+    {
+        unsigned short sp = lanes->SP[i];
+        unsigned char l = read8(lanes, i, sp);
+        unsigned char h = read8(lanes, i, sp + 1);
+        write8(lanes, i, sp, lanes->reg[5][i]);
+        write8(lanes, i, sp + 1, lanes->reg[4][i]);
+        lanes->reg[5][i] = l;
+        lanes->reg[4][i] = h;
+    }
+    return 0;
+}
+
+static int vop_push(lanes8085 *lanes, struct group *g, unsigned char opcode, unsigned short operand)
+{
+    (void)operand;
+    int rp = RP(opcode);
+    int hi = rp == 3 ? REG_A : 2 * rp;
+    int lo = rp == 3 ? REG_F : 2 * rp + 1;
+    FOR_LANES(i, g->mask)
+    {
+        push16(lanes, i, lanes->reg[hi][i] << 8 | lanes->reg[lo][i]);
+    }
+    return 0;
+}
+
+static int vop_pop(lanes8085 *lanes, struct group *g, unsigned char opcode, unsigned short operand)
+{
+    (void)operand;
+    int rp = RP(opcode);
+    int hi = rp == 3 ? REG_A : 2 * rp;
+    int lo = rp == 3 ? REG_F : 2 * rp + 1;
+    FOR_LANES(i, g->mask)
+    {
+        unsigned short value = pop16(lanes, i);
+        lanes->reg[hi][i] = value >> 8;
+        lanes->reg[lo][i] = value & 0xFF;
+    }
+    return 0;
+}
+
+static int vop_rotate(lanes8085 *lanes, struct group *g, unsigned char opcode, unsigned short operand)
+{
+    (void)operand;
+    lane_u8 a = REG(lanes, REG_A);
+    lane_u8 f = REG(lanes, REG_F);
+    lane_u8 carry = f & CARRY_FLAG;
+    lane_u8 r;
+
+    switch (opcode)
+    {
+    case 0x07: // RLC
+        carry = a >> 7;
+        r = (a << 1) | carry;
+        break;
+    case 0x0F: // RRC
+        carry = a & 1;
+        r = (a >> 1) | (carry << 7);
+        break;
+    case 0x17: // RAL
+        r = (a << 1) | carry;
+        carry = a >> 7;
+        break;
+    default: // RAR
+        r = (a >> 1) | (carry << 7);
+        carry = a & 1;
+        break;
+    }
+    put(&REG(lanes, REG_A), r, g);
+    put(&REG(lanes, REG_F), (f & ~CARRY_FLAG) | carry, g);
+    return 0;
+}
+
+static int vop_cma(lanes8085 *lanes, struct group *g, unsigned char opcode, unsigned short operand)
+{
+    (void)opcode;
+    (void)operand;
+    put(&REG(lanes, REG_A), ~REG(lanes, REG_A), g);
+    return 0;
+}
+
+static int vop_stc(lanes8085 *lanes, struct group *g, unsigned char opcode, unsigned short operand)
+{
+    (void)operand;
+    lane_u8 f = REG(lanes, REG_F);
+    put(&REG(lanes, REG_F), opcode == 0x37 ? f | CARRY_FLAG : f ^ CARRY_FLAG, g);
+    return 0;
+}
+
+static int vop_daa(lanes8085 *lanes, struct group *g, unsigned char opcode, unsigned short operand)
+{
+    (void)opcode;
+    (void)operand;
+    lane_u8 a = REG(lanes, REG_A);
+    lane_u8 f = REG(lanes, REG_F);
+    lane_u8 low = (lane_u8)((a & 0x0F) > 9) | (lane_u8)((f & AUX_CARRY_FLAG) != 0);
+    lane_u8 high = (lane_u8)(a > 0x99) | (lane_u8)((f & CARRY_FLAG) != 0);
+    lane_u8 correction = (low & 0x06) | (high & 0x60);
+    lane_u8 r = a + correction;
+
+    put(&REG(lanes, REG_A), r, g);
+    put(&REG(lanes, REG_F), szp(r) | ((a ^ correction ^ r) & AUX_CARRY_FLAG) | (high & CARRY_FLAG), g);
+    return 0;
+}
+
+// ALU group, one handler per operation as in the scalar core
+static inline __attribute__((always_inline)) void alu_op(lanes8085 *lanes, struct group *g, int op, lane_u8 b)
+{
+    lane_u8 a = REG(lanes, REG_A);
+    lane_u8 f = REG(lanes, REG_F);
+    lane_u8 c = { 0 };
+    lane_u8 r;
+
+    switch (op)
+    {
+    case 1: // ADC
+        c = f & CARRY_FLAG;
+        /* fall through */
+    case 0: // ADD
+        r = a + b + c;
+        f = add_flags(a, b, r);
+        break;
+    case 3: // SBB
+        c = f & CARRY_FLAG;
+        /* fall through */
+    case 2: // SUB
+    case 7: // CMP
+        r = a - b - c;
+        f = sub_flags(a, b, c, r);
+        if (op == 7)
+        {
+            r = a;
+        }
+        break;
+    case 4: // ANA: CY cleared, AC set
+        r = a & b;
+        f = szp(r) | AUX_CARRY_FLAG;
+        break;
+    case 5: // XRA
+        r = a ^ b;
+        f = szp(r);
+        break;
+    default: // ORA
+        r = a | b;
+        f = szp(r);
+        break;
+    }
+    put(&REG(lanes, REG_A), r, g);
+    put(&REG(lanes, REG_F), f, g);
+}
+
+#define ALU_HANDLERS(name, op) \
+    static int vop_##name(lanes8085 *lanes, struct group *g, unsigned char opcode, unsigned short operand) \
+    { \
+        (void)operand; \
+        alu_op(lanes, g, op, read_reg(lanes, g, SSS(opcode))); \
+        return 0; \
+    } \
+    static int vop_##name##_imm(lanes8085 *lanes, struct group *g, unsigned char opcode, unsigned short operand) \
+    { \
+        (void)opcode; \
+        lane_u8 zero = { 0 }; \
+        alu_op(lanes, g, op, zero + (unsigned char)operand); \
+        return 0; \
+    }
+
+ALU_HANDLERS(add, 0)
+ALU_HANDLERS(adc, 1)
+ALU_HANDLERS(sub, 2)
+ALU_HANDLERS(sbb, 3)
+ALU_HANDLERS(ana, 4)
+ALU_HANDLERS(xra, 5)
+ALU_HANDLERS(ora, 6)
+ALU_HANDLERS(cmp, 7)
+
+// ---- Branches ----
+
+// Lanes of the group whose condition (bits 5-3: NZ Z NC C PO PE P M) holds
+static inline unsigned long long condition(const lanes8085 *lanes, const struct group *g, unsigned char opcode)
+{
+    static const unsigned char flag[4] = { ZERO_FLAG, CARRY_FLAG, PARITY_FLAG, SIGN_FLAG };
+    int ccc = DDD(opcode);
+    lane_u8 set = (lane_u8)((REG(lanes, REG_F) & flag[ccc >> 1]) != 0);
+    return lane_bits(ccc & 1 ? set : ~set) & g->mask;
+}
+
+// The whole group jumps; a jump onto its own first byte can never progress
+static inline int jump(lanes8085 *lanes, struct group *g, unsigned short target, int length)
+{
+    int self = target == (unsigned short)(g->pc - length);
+
+    g->pc = target;
+    if (self)
+    {
+        flush(lanes, g);
+        stop_lanes(lanes, g->mask, CPU8085_STOP_LOOP);
+        return 1;
+    }
+    return 0;
+}
+
+static int vop_jmp(lanes8085 *lanes, struct group *g, unsigned char opcode, unsigned short operand)
+{
+    (void)opcode;
+    return jump(lanes, g, operand, 3);
+}
+
+static int vop_jcc(lanes8085 *lanes, struct group *g, unsigned char opcode, unsigned short operand)
+{
+    unsigned long long taken = condition(lanes, g, opcode);
+
+    if (taken == 0)
+    {
+        return 0;
+    }
+    if (taken == g->mask)
+    {
+        g->tstates += CPU8085_JCC_TAKEN_TSTATES;
+        return jump(lanes, g, operand, 3);
+    }
+    flush(lanes, g);
+    branch_lanes(lanes, taken, operand, CPU8085_JCC_TAKEN_TSTATES, (unsigned short)(g->pc - 3));
+    return 1;
+}
+
+static int vop_call(lanes8085 *lanes, struct group *g, unsigned char opcode, unsigned short operand)
+{
+    unsigned short target = (opcode & 0xC7) == 0xC7 ? opcode & 0x38 : operand; // CALL or RST
+    FOR_LANES(i, g->mask)
+    {
+        push16(lanes, i, g->pc);
+    }
+    g->pc = target;
+    return 0;
+}
+
+static int vop_ccc(lanes8085 *lanes, struct group *g, unsigned char opcode, unsigned short operand)
+{
+    unsigned long long taken = condition(lanes, g, opcode);
+
+    if (taken == 0)
+    {
+        return 0;
+    }
+    FOR_LANES(i, taken)
+    {
+        push16(lanes, i, g->pc);
+    }
+    if (taken == g->mask)
+    {
+        g->tstates += CPU8085_CCC_TAKEN_TSTATES;
+        g->pc = operand;
+        return 0;
+    }
+    flush(lanes, g);
+    branch_lanes(lanes, taken, operand, CPU8085_CCC_TAKEN_TSTATES, -1);
+    return 1;
+}
+
+// Return addresses are per lane: the group stays together only if they agree
+static int return_lanes(lanes8085 *lanes, struct group *g, unsigned long long bits, int extra)
+{
+    unsigned short target[LANES8085_WIDTH];
+    int first = __builtin_ctzll(bits);
+    int same = 1;
+
+    FOR_LANES(i, bits)
+    {
+        target[i] = pop16(lanes, i);
+        same &= target[i] == target[first];
+    }
+    if (bits == g->mask && same)
+    {
+        g->tstates += extra;
+        g->pc = target[first];
+        return 0;
+    }
+    flush(lanes, g);
+    FOR_LANES(i, bits)
+    {
+        lanes->PC[i] = target[i];
+        lanes->tstates[i] += extra;
+    }
+    return 1;
+}
+
+static int vop_ret(lanes8085 *lanes, struct group *g, unsigned char opcode, unsigned short operand)
+{
+    (void)opcode;
+    (void)operand;
+    return return_lanes(lanes, g, g->mask, 0);
+}
+
+static int vop_rcc(lanes8085 *lanes, struct group *g, unsigned char opcode, unsigned short operand)
+{
+    (void)operand;
+    unsigned long long taken = condition(lanes, g, opcode);
+    return taken != 0 ? return_lanes(lanes, g, taken, CPU8085_RCC_TAKEN_TSTATES) : 0;
+}
+
+static int vop_pchl(lanes8085 *lanes, struct group *g, unsigned char opcode, unsigned short operand)
+{
+    (void)opcode;
+    (void)operand;
+    unsigned short from = g->pc - 1;
+    unsigned short target = hl(lanes, g->leader);
+    int same = 1;
+
+    FOR_LANES(i, g->mask)
+    {
+        same &= hl(lanes, i) == target;
+    }
+    if (same)
+    {
+        return jump(lanes, g, target, 1);
+    }
+    flush(lanes, g);
+    FOR_LANES(i, g->mask)
+    {
+        branch_lanes(lanes, 1ULL << i, hl(lanes, i), 0, from);
+    }
+    return 1;
+}
+
+// Opcodes left out (NULL) run lane by lane: IN, OUT, EI, DI, SIM, RIM and
+// the undocumented ones
+static const vector_op vector_table[256] = {
+    [0x00] = vop_nop,
+
+    [0x01] = vop_lxi, [0x11] = vop_lxi, [0x21] = vop_lxi, [0x31] = vop_lxi,
+    [0x03] = vop_inx, [0x13] = vop_inx, [0x23] = vop_inx, [0x33] = vop_inx,
+    [0x0B] = vop_dcx, [0x1B] = vop_dcx, [0x2B] = vop_dcx, [0x3B] = vop_dcx,
+    [0x09] = vop_dad, [0x19] = vop_dad, [0x29] = vop_dad, [0x39] = vop_dad,
+    [0x32] = vop_sta, [0x3A] = vop_lda, [0x22] = vop_shld, [0x2A] = vop_lhld,
+    [0x02] = vop_stax, [0x12] = vop_stax, [0x0A] = vop_ldax, [0x1A] = vop_ldax,
+    [0xEB] = vop_xchg, [0xE3] = vop_xthl, [0xF9] = vop_sphl,
+    [0xC5] = vop_push, [0xD5] = vop_push, [0xE5] = vop_push, [0xF5] = vop_push,
+    [0xC1] = vop_pop, [0xD1] = vop_pop, [0xE1] = vop_pop, [0xF1] = vop_pop,
+
+    [0x07] = vop_rotate, [0x0F] = vop_rotate, [0x17] = vop_rotate, [0x1F] = vop_rotate,
+    [0x27] = vop_daa, [0x2F] = vop_cma, [0x37] = vop_stc, [0x3F] = vop_stc,
+
+    [0x04] = vop_inr, [0x0C] = vop_inr, [0x14] = vop_inr, [0x1C] = vop_inr,
+    [0x24] = vop_inr, [0x2C] = vop_inr, [0x34] = vop_inr, [0x3C] = vop_inr,
+    [0x05] = vop_dcr, [0x0D] = vop_dcr, [0x15] = vop_dcr, [0x1D] = vop_dcr,
+    [0x25] = vop_dcr, [0x2D] = vop_dcr, [0x35] = vop_dcr, [0x3D] = vop_dcr,
+    [0x06] = vop_mvi, [0x0E] = vop_mvi, [0x16] = vop_mvi, [0x1E] = vop_mvi,
+    [0x26] = vop_mvi, [0x2E] = vop_mvi, [0x36] = vop_mvi, [0x3E] = vop_mvi,
+
+    [0x40 ... 0x75] = vop_mov, [0x76] = vop_hlt, [0x77 ... 0x7F] = vop_mov,
+
+    [0x80 ... 0x87] = vop_add, [0x88 ... 0x8F] = vop_adc,
+    [0x90 ... 0x97] = vop_sub, [0x98 ... 0x9F] = vop_sbb,
+    [0xA0 ... 0xA7] = vop_ana, [0xA8 ... 0xAF] = vop_xra,
+    [0xB0 ... 0xB7] = vop_ora, [0xB8 ... 0xBF] = vop_cmp,
+
+    [0xC6] = vop_add_imm, [0xCE] = vop_adc_imm, [0xD6] = vop_sub_imm, [0xDE] = vop_sbb_imm,
+    [0xE6] = vop_ana_imm, [0xEE] = vop_xra_imm, [0xF6] = vop_ora_imm, [0xFE] = vop_cmp_imm,
+
+    [0xC3] = vop_jmp, [0xCD] = vop_call, [0xC9] = vop_ret, [0xE9] = vop_pchl,
+    [0xC2] = vop_jcc, [0xCA] = vop_jcc, [0xD2] = vop_jcc, [0xDA] = vop_jcc,
+    [0xE2] = vop_jcc, [0xEA] = vop_jcc, [0xF2] = vop_jcc, [0xFA] = vop_jcc,
+    [0xC4] = vop_ccc, [0xCC] = vop_ccc, [0xD4] = vop_ccc, [0xDC] = vop_ccc,
+    [0xE4] = vop_ccc, [0xEC] = vop_ccc, [0xF4] = vop_ccc, [0xFC] = vop_ccc,
+    [0xC0] = vop_rcc, [0xC8] = vop_rcc, [0xD0] = vop_rcc, [0xD8] = vop_rcc,
+    [0xE0] = vop_rcc, [0xE8] = vop_rcc, [0xF0] = vop_rcc, [0xF8] = vop_rcc,
+    [0xC7] = vop_call, [0xCF] = vop_call, [0xD7] = vop_call, [0xDF] = vop_call,
+    [0xE7] = vop_call, [0xEF] = vop_call, [0xF7] = vop_call, [0xFF] = vop_call,
+};
+
+// ---- Lane by lane ----
+
+// Take over a cpu8085's IE and EI delay. With no interrupts to wait for, a
+// delay of 1 is as good as IE set; a delay of 2 (just after EI) keeps IE
+// clear for one more instruction of the lane.
+static void set_int_enable(lanes8085 *lanes, int lane, int enable, int delay)
+{
+    lanes->int_enable[lane] = enable || delay == 1;
+    lanes->int_enable_delayed &= ~(1ULL << lane);
+    lanes->int_enable_delayed |= (unsigned long long)(delay == 2) << lane;
+}
+
+// One instruction of one lane on the scalar core
+static void scalar_step(lanes8085 *lanes, int lane)
+{
+    cpu8085 *cpu = lanes->scalar;
+    unsigned char *own = cpu->memory;
+
+    for (int r = 0; r < 8; r++)
+    {
+        cpu->reg[r] = lanes->reg[r][lane];
+    }
+    cpu->PC = lanes->PC[lane];
+    cpu->SP = lanes->SP[lane];
+    cpu->tstates = lanes->tstates[lane];
+    cpu->instructions = lanes->instructions[lane];
+    cpu->int_enable = lanes->int_enable[lane];
+    cpu->int_enable_delay = lanes->int_enable_delayed >> lane & 1 ? 2 : 0;
+    cpu->int_mask = lanes->int_mask[lane];
+    cpu->sod = lanes->sod[lane];
+    cpu->halted = 0;
+    cpu->waiting = 0;
+    cpu->fault = 0;
+    cpu->next_event = cpu->int_enable_delay ? 0 : ~0ULL;
+    cpu8085_clear_dirty(cpu);
+    cpu->memory = memory_of(lanes, lane);
+
+    emulate_instruction(cpu);
+
+    cpu->memory = own;
+    for (int r = 0; r < 8; r++)
+    {
+        lanes->reg[r][lane] = cpu->reg[r];
+    }
+    lanes->PC[lane] = cpu->PC;
+    lanes->SP[lane] = cpu->SP;
+    lanes->tstates[lane] = cpu->tstates;
+    lanes->instructions[lane] = cpu->instructions;
+    set_int_enable(lanes, lane, cpu->int_enable, cpu->int_enable_delay);
+    lanes->int_mask[lane] = cpu->int_mask;
+    lanes->sod[lane] = cpu->sod;
+    lanes->halted[lane] = cpu->halted || cpu->waiting; // HLT: nothing can wake a lane
+    lanes->fault[lane] = cpu->fault;
+    for (int w = 0; w < CPU8085_DIRTY_WORDS; w++)
+    {
+        lanes->dirty[lane][w] |= cpu->dirty[w];
+        lanes->written[w] |= cpu->dirty[w];
+    }
+    lanes->scalar_steps++;
+}
+
+// Is the line the same in every lane? Then it no longer counts as written.
+static int line_settled(lanes8085 *lanes, unsigned int line)
+{
+    unsigned int addr = line * CPU8085_DIRTY_LINE;
+
+    for (int i = 1; i < lanes->count; i++)
+    {
+        if (memcmp(memory_of(lanes, i) + addr, memory_of(lanes, 0) + addr, CPU8085_DIRTY_LINE) != 0)
+        {
+            return 0;
+        }
+    }
+    lanes->written[line / 64] &= ~(1ULL << (line % 64));
+    return 1;
+}
+
+// Does the instruction at pc lie where the lanes' memories may differ, and
+// differ between the group's lanes?
+static int code_differs(lanes8085 *lanes, const struct group *g, int length)
+{
+    for (int k = 0; k < length; k++)
+    {
+        unsigned short addr = g->pc + k;
+        unsigned int line = addr / CPU8085_DIRTY_LINE;
+        if (!(lanes->written[line / 64] & 1ULL << (line % 64)) || line_settled(lanes, line))
+        {
+            continue;
+        }
+        unsigned char byte = read8(lanes, g->leader, addr);
+        FOR_LANES(i, g->mask)
+        {
+            if (read8(lanes, i, addr) != byte)
+            {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+// ---- Scheduling ----
+
+// Gather the running lanes at the lowest PC into a group. Returns 0 when
+// no lane is left running. *wait is the lowest PC among the other running
+// lanes (0x10000 if none), *budget the instructions until one of the
+// group's lanes reaches its limit.
+static int form_group(lanes8085 *lanes, const unsigned long long *limit, struct group *g,
+                      unsigned int *wait, unsigned long long *budget)
+{
+    unsigned int pc = 0x10000;
+
+    *wait = 0x10000;
+    g->mask = 0;
+    for (int i = 0; i < lanes->count; i++)
+    {
+        if (lanes->halted[i] || lanes->instructions[i] >= limit[i])
+        {
+            continue;
+        }
+        if (lanes->PC[i] < pc)
+        {
+            if (pc != 0x10000)
+            {
+                *wait = pc;
+            }
+            pc = lanes->PC[i];
+            g->mask = 0;
+        }
+        else if (lanes->PC[i] > pc)
+        {
+            if (lanes->PC[i] < *wait)
+            {
+                *wait = lanes->PC[i];
+            }
+            continue;
+        }
+        g->mask |= 1ULL << i;
+    }
+    if (g->mask == 0)
+    {
+        return 0;
+    }
+
+    *budget = ~0ULL;
+    FOR_LANES(i, g->mask)
+    {
+        if (limit[i] - lanes->instructions[i] < *budget)
+        {
+            *budget = limit[i] - lanes->instructions[i];
+        }
+    }
+    g->vmask = lane_mask(g->mask);
+    g->leader = __builtin_ctzll(g->mask);
+    g->pc = pc;
+    g->steps = 0;
+    g->tstates = 0;
+    lanes->groups++;
+    return 1;
+}
+
+// Run a group until it breaks up, reaches another group's PC or uses up
+// its budget
+static void run_group(lanes8085 *lanes, struct group *g, unsigned int wait, unsigned long long budget)
+{
+    for (;;)
+    {
+        const unsigned char *code = memory_of(lanes, g->leader);
+        unsigned short pc = g->pc;
+        unsigned char opcode = code[pc];
+        vector_op handler = vector_table[opcode];
+
+        if (handler == NULL || code_differs(lanes, g, cpu8085_opcode_length[opcode]))
+        {
+            flush(lanes, g);
+            FOR_LANES(i, g->mask)
+            {
+                scalar_step(lanes, i);
+            }
+            return;
+        }
+
+        if (g->steps == 0 && (lanes->int_enable_delayed & g->mask))
+        {
+            // Lanes just past EI: this instruction can't see IE, so set it now
+            FOR_LANES(i, lanes->int_enable_delayed & g->mask)
+            {
+                lanes->int_enable[i] = 1;
+            }
+            lanes->int_enable_delayed &= ~g->mask;
+        }
+
+        unsigned short operand = code[(unsigned short)(pc + 1)] | code[(unsigned short)(pc + 2)] << 8;
+        g->pc = pc + cpu8085_opcode_length[opcode];
+        g->steps++;
+        g->tstates += cpu8085_opcode_tstates[opcode];
+        if (handler(lanes, g, opcode, operand))
+        {
+            return;
+        }
+        if (g->steps == budget || g->pc >= wait)
+        {
+            flush(lanes, g);
+            return;
+        }
+    }
+}
+
+// Mark the lines whose contents differ between lanes, e.g. inputs stored
+// through lanes8085_memory(), so that code there is run lane by lane
+static void mark_differences(lanes8085 *lanes)
+{
+    const unsigned char *first = memory_of(lanes, 0);
+
+    for (unsigned int line = 0; line < CPU8085_MEMORY_SIZE / CPU8085_DIRTY_LINE; line++)
+    {
+        unsigned long long bit = 1ULL << (line % 64);
+        unsigned int addr = line * CPU8085_DIRTY_LINE;
+
+        for (int i = 1; i < lanes->count && !(lanes->written[line / 64] & bit); i++)
+        {
+            if (memcmp(memory_of(lanes, i) + addr, first + addr, CPU8085_DIRTY_LINE) != 0)
+            {
+                lanes->written[line / 64] |= bit;
+            }
+        }
+    }
+}
+
+unsigned long long lanes8085_run(lanes8085 *lanes, unsigned long long max_instructions)
+{
+    unsigned long long limit[LANES8085_WIDTH];
+    unsigned long long before = 0, after = 0;
+    struct group g;
+    unsigned int wait;
+    unsigned long long budget;
+
+    for (int i = 0; i < lanes->count; i++)
+    {
+        limit[i] = max_instructions ? lanes->instructions[i] + max_instructions : ~0ULL;
+        before += lanes->instructions[i];
+    }
+    mark_differences(lanes);
+    while (form_group(lanes, limit, &g, &wait, &budget))
+    {
+        run_group(lanes, &g, wait, budget);
+    }
+    for (int i = 0; i < lanes->count; i++)
+    {
+        after += lanes->instructions[i];
+    }
+    return after - before;
+}
+
+// ---- Setup ----
+
+lanes8085 *lanes8085_create(int count)
+{
+    if (count < 1 || count > LANES8085_WIDTH)
+    {
+        return NULL;
+    }
+    lanes8085 *lanes = aligned_alloc(_Alignof(lanes8085), sizeof(lanes8085));
+    if (lanes == NULL)
+    {
+        return NULL;
+    }
+    memset(lanes, 0, sizeof(*lanes));
+    lanes->count = count;
+    lanes->memory = calloc(count, CPU8085_MEMORY_SIZE);
+    lanes->scalar = cpu8085_create();
+    if (lanes->memory == NULL || lanes->scalar == NULL)
+    {
+        lanes8085_destroy(lanes);
+        return NULL;
+    }
+    lanes8085_load(lanes, lanes->scalar);
+    return lanes;
+}
+
+void lanes8085_destroy(lanes8085 *lanes)
+{
+    if (lanes == NULL)
+    {
+        return;
+    }
+    cpu8085_destroy(lanes->scalar);
+    free(lanes->memory);
+    free(lanes);
+}
+
+void lanes8085_load(lanes8085 *lanes, const cpu8085 *cpu)
+{
+    for (int i = 0; i < lanes->count; i++)
+    {
+        for (int r = 0; r < 8; r++)
+        {
+            lanes->reg[r][i] = cpu->reg[r];
+        }
+        lanes->PC[i] = cpu->PC;
+        lanes->SP[i] = cpu->SP;
+        lanes->tstates[i] = cpu->tstates;
+        lanes->instructions[i] = cpu->instructions;
+        lanes->halted[i] = cpu->halted;
+        lanes->fault[i] = cpu->fault;
+        set_int_enable(lanes, i, cpu->int_enable, cpu->int_enable_delay);
+        lanes->int_mask[i] = cpu->int_mask;
+        lanes->sod[i] = cpu->sod;
+        memcpy(memory_of(lanes, i), cpu->memory, CPU8085_MEMORY_SIZE);
+        memcpy(lanes->dirty[i], cpu->dirty, sizeof(cpu->dirty));
+    }
+    memset(lanes->written, 0, sizeof(lanes->written));
+}
+
+unsigned char *lanes8085_memory(lanes8085 *lanes, int lane)
+{
+    return memory_of(lanes, lane);
+}
+
+void lanes8085_store(const lanes8085 *lanes, int lane, cpu8085 *cpu)
+{
+    for (int r = 0; r < 8; r++)
+    {
+        cpu->reg[r] = lanes->reg[r][lane];
+    }
+    cpu->PC = lanes->PC[lane];
+    cpu->SP = lanes->SP[lane];
+    cpu->tstates = lanes->tstates[lane];
+    cpu->instructions = lanes->instructions[lane];
+    cpu->halted = lanes->halted[lane];
+    cpu->fault = lanes->fault[lane];
+    cpu->waiting = 0;
+    cpu->int_enable = lanes->int_enable[lane];
+    cpu->int_enable_delay = lanes->int_enable_delayed >> lane & 1 ? 2 : 0;
+    cpu->int_mask = lanes->int_mask[lane];
+    cpu->sod = lanes->sod[lane];
+    cpu->next_event = 0; // re-examine any pending interrupts and events
+    memcpy(cpu->memory, memory_of(lanes, lane), CPU8085_MEMORY_SIZE);
+    memcpy(cpu->dirty, lanes->dirty[lane], sizeof(cpu->dirty));
+    cpu8085_flush_blocks(cpu);
+}
+
+enum cpu8085_stop lanes8085_stop_reason(const lanes8085 *lanes, int lane)
+{
+    if (!lanes->halted[lane])
+    {
+        return CPU8085_STOP_INSTRUCTIONS;
+    }
+    return lanes->fault[lane] ? (enum cpu8085_stop)lanes->fault[lane] : CPU8085_STOP_HALT;
+}
@@ -0,0 +1,91 @@
+#ifndef LANES8085_H
+#define LANES8085_H
+
+#include "cpu8085.h"
+
+// Lockstep engine for many 8085s ("lanes") running the same program on
+// different data, e.g. one program over a set of test inputs.
+//
+// The registers are held as arrays across the lanes (reg[r][lane]), and
+// all lanes at the same PC execute each instruction together, with vector
+// byte operations for the register and flag work (SSE2 on any x86-64, AVX2
+// when built with -mavx2). Lanes whose conditional branches go different
+// ways split into groups. The group at the lowest PC runs first, and groups
+// merge again once they reach the same PC. Every lane has a memory of its
+// own, so memory accesses are made lane by lane.
+//
+// Results are the same as running each lane on its own cpu8085, except
+// that lanes have no devices and no interrupts: IN reads FF and OUT is
+// ignored. EI, DI, SIM, RIM, IN, OUT and the
+// undocumented opcodes run lane by lane through emulate_instruction(), as
+// does code that differs between the lanes of a group.
+
+// Lanes per engine: one byte per lane of the widest vector register, so
+// the layout depends on the build flags; compile all users of this header
+// with the same ones (make SIMD=...). At most 64.
+#if defined(__AVX2__)
+#define LANES8085_WIDTH 32
+#else
+#define LANES8085_WIDTH 16
+#endif
+
+typedef struct lanes8085
+{
+    int count; // lanes in use, 1 to LANES8085_WIDTH
+
+    // Per-lane state, indexed by lane. reg[] is in cpu8085.reg order
+    // (B C D E H L F A).
+    unsigned char reg[8][LANES8085_WIDTH] __attribute__((aligned(64)));
+    unsigned short PC[LANES8085_WIDTH] __attribute__((aligned(64)));
+    unsigned short SP[LANES8085_WIDTH] __attribute__((aligned(64)));
+    unsigned long long tstates[LANES8085_WIDTH];
+    unsigned long long instructions[LANES8085_WIDTH];
+    unsigned char halted[LANES8085_WIDTH];
+    unsigned char fault[LANES8085_WIDTH];       // as cpu8085.fault
+    unsigned char int_enable[LANES8085_WIDTH];
+    unsigned long long int_enable_delayed; // bit per lane just past EI, as cpu8085.int_enable_delay
+    unsigned char int_mask[LANES8085_WIDTH];
+    unsigned char sod[LANES8085_WIDTH];
+
+    // Lane i's memory is the CPU8085_MEMORY_SIZE bytes at
+    // memory + i * CPU8085_MEMORY_SIZE, with its written lines in dirty[i]
+    unsigned char *memory;
+    unsigned long long dirty[LANES8085_WIDTH][CPU8085_DIRTY_WORDS];
+    unsigned long long written[CPU8085_DIRTY_WORDS]; // lines that may differ between lanes
+
+    // Statistics, totals over every run
+    unsigned long long groups;       // times a group of lanes was formed
+    unsigned long long steps;        // instructions executed for a whole group at once
+    unsigned long long scalar_steps; // lane instructions run through emulate_instruction()
+
+    cpu8085 *scalar;                 // runs those, on one lane's state at a time
+} lanes8085;
+
+// Allocate an engine for count lanes, all in the power-on state; NULL if
+// out of memory or count is out of range
+lanes8085 *lanes8085_create(int count);
+void lanes8085_destroy(lanes8085 *lanes);
+
+// Copy cpu's registers, counters and memory into every lane, e.g. after
+// loading the program into cpu. Give the lanes their own inputs afterwards,
+// through reg[][] or lanes8085_memory().
+void lanes8085_load(lanes8085 *lanes, const cpu8085 *cpu);
+
+// A lane's memory
+unsigned char *lanes8085_memory(lanes8085 *lanes, int lane);
+
+// Copy one lane back into cpu: registers, counters, memory and the lines
+// written, halted and fault
+void lanes8085_store(const lanes8085 *lanes, int lane, cpu8085 *cpu);
+
+// Run every lane until it halts or faults, or until it has executed
+// max_instructions more (0 = no limit). Returns the number of instructions
+// executed by this call, summed over the lanes. Each call starts by
+// comparing the lanes' memories, so it is meant for long runs.
+unsigned long long lanes8085_run(lanes8085 *lanes, unsigned long long max_instructions);
+
+// Why a lane stopped: HLT or a fault, or CPU8085_STOP_INSTRUCTIONS if it
+// is still running
+enum cpu8085_stop lanes8085_stop_reason(const lanes8085 *lanes, int lane);
+
+#endif
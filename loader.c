@@ -0,0 +1,208 @@
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "loader.h"
+
+#define MEMORY_SIZE 65536
+
+// Map a whole file read-only; returns NULL (after printing why) on failure
+static const unsigned char *map_file(const char *path, size_t *size)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        perror(path);
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0)
+    {
+        perror(path);
+        close(fd);
+        return NULL;
+    }
+    if (st.st_size == 0)
+    {
+        fprintf(stderr, "%s: file is empty\n", path);
+        close(fd);
+        return NULL;
+    }
+
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        perror(path);
+        return NULL;
+    }
+
+    *size = st.st_size;
+    return data;
+}
+
+long load_binary(const char *path, unsigned char *mem, unsigned short origin)
+{
+    size_t size;
+    const unsigned char *data = map_file(path, &size);
+    if (data == NULL)
+    {
+        return -1;
+    }
+
+    if (size > (size_t)(MEMORY_SIZE - origin))
+    {
+        fprintf(stderr, "%s: %zu byte image does not fit at origin %04X\n", path, size, origin);
+        munmap((void *)data, size);
+        return -1;
+    }
+
+    memcpy(mem + origin, data, size);
+    munmap((void *)data, size);
+    return (long)size;
+}
+
+// Value of one hex digit, or -1
+static int hex_digit(unsigned char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    return -1;
+}
+
+// Parse the two hex digits at p; returns -1 if they are not hex digits
+static int hex_byte(const unsigned char *p)
+{
+    int hi = hex_digit(p[0]);
+    int lo = hex_digit(p[1]);
+    return (hi < 0 || lo < 0) ? -1 : (hi << 4) | lo;
+}
+
+long load_intel_hex(const char *path, unsigned char *mem, int *entry)
+{
+    size_t size;
+    const unsigned char *data = map_file(path, &size);
+    if (data == NULL)
+    {
+        return -1;
+    }
+
+    const unsigned char *p = data;
+    const unsigned char *end = data + size;
+    long loaded = 0;
+    int line = 1;
+    int done = 0;
+
+    while (!done && p < end)
+    {
+        // Skip line breaks and anything else between records
+        if (*p != ':')
+        {
+            if (*p == '\n')
+            {
+                line++;
+            }
+            p++;
+            continue;
+        }
+        p++;
+
+        // Record header: byte count, 16-bit address, record type
+        int header[4];
+        for (int i = 0; i < 4; i++)
+        {
+            header[i] = (end - p >= 2) ? hex_byte(p) : -1;
+            if (header[i] < 0)
+            {
+                goto bad_record;
+            }
+            p += 2;
+        }
+
+        int count = header[0];
+        unsigned int address = (header[1] << 8) | header[2];
+        int type = header[3];
+        unsigned char sum = count + header[1] + header[2] + type;
+
+        if (end - p < 2 * count + 2)
+        {
+            goto bad_record;
+        }
+
+        unsigned char bytes[255];
+        for (int i = 0; i < count; i++, p += 2)
+        {
+            int b = hex_byte(p);
+            if (b < 0)
+            {
+                goto bad_record;
+            }
+            bytes[i] = b;
+            sum += b;
+        }
+
+        int checksum = hex_byte(p);
+        p += 2;
+        if (checksum < 0 || (unsigned char)(sum + checksum) != 0)
+        {
+            fprintf(stderr, "%s:%d: checksum mismatch\n", path, line);
+            munmap((void *)data, size);
+            return -1;
+        }
+
+        switch (type)
+        {
+        case 0x00: // Data
+            if (address + count > MEMORY_SIZE)
+            {
+                fprintf(stderr, "%s:%d: record runs past FFFF\n", path, line);
+                munmap((void *)data, size);
+                return -1;
+            }
+            memcpy(mem + address, bytes, count);
+            loaded += count;
+            break;
+        case 0x01: // End of file
+            done = 1;
+            break;
+        case 0x02: // Extended segment address
+        case 0x04: // Extended linear address
+            // Only a zero base is meaningful for a 16-bit address space
+            if (count != 2 || bytes[0] || bytes[1])
+            {
+                fprintf(stderr, "%s:%d: address beyond the 64 KiB space\n", path, line);
+                munmap((void *)data, size);
+                return -1;
+            }
+            break;
+        case 0x03: // Start segment address (CS:IP)
+        case 0x05: // Start linear address
+            if (count != 4)
+            {
+                goto bad_record;
+            }
+            *entry = (bytes[2] << 8) | bytes[3];
+            break;
+        default:
+            fprintf(stderr, "%s:%d: unknown record type %02X\n", path, line, type);
+            munmap((void *)data, size);
+            return -1;
+        }
+    }
+
+    munmap((void *)data, size);
+    return loaded;
+
+bad_record:
+    fprintf(stderr, "%s:%d: malformed record\n", path, line);
+    munmap((void *)data, size);
+    return -1;
+}
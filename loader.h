@@ -0,0 +1,15 @@
+#ifndef LOADER_H
+#define LOADER_H
+
+// Program image loaders for the 8085's 64 KiB address space.
+// Both return the number of bytes loaded, or -1 after printing an error.
+
+// Load a raw binary image into mem starting at origin. The file is mapped
+// with mmap, so the image is copied exactly once, straight into mem.
+long load_binary(const char *path, unsigned char *mem, unsigned short origin);
+
+// Load an Intel HEX file into mem. If the file has a start address record
+// (type 03 or 05), *entry is set to it; otherwise it is left untouched.
+long load_intel_hex(const char *path, unsigned char *mem, int *entry);
+
+#endif
@@ -0,0 +1,373 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "profile.h"
+
+const unsigned char profile_branch_kind[256] = {
+    [0xC3] = PROFILE_JUMP,
+    [0xC2] = PROFILE_JUMP, [0xCA] = PROFILE_JUMP, [0xD2] = PROFILE_JUMP, [0xDA] = PROFILE_JUMP,
+    [0xE2] = PROFILE_JUMP, [0xEA] = PROFILE_JUMP, [0xF2] = PROFILE_JUMP, [0xFA] = PROFILE_JUMP,
+    [0xDD] = PROFILE_JUMP, [0xFD] = PROFILE_JUMP,
+    [0xCD] = PROFILE_CALL,
+    [0xC7] = PROFILE_CALL, [0xCF] = PROFILE_CALL, [0xD7] = PROFILE_CALL, [0xDF] = PROFILE_CALL,
+    [0xE7] = PROFILE_CALL, [0xEF] = PROFILE_CALL, [0xF7] = PROFILE_CALL, [0xFF] = PROFILE_CALL,
+    [0xC4] = PROFILE_CCALL, [0xCC] = PROFILE_CCALL, [0xD4] = PROFILE_CCALL, [0xDC] = PROFILE_CCALL,
+    [0xE4] = PROFILE_CCALL, [0xEC] = PROFILE_CCALL, [0xF4] = PROFILE_CCALL, [0xFC] = PROFILE_CCALL,
+    [0xCB] = PROFILE_CCALL,
+    [0xC9] = PROFILE_RETURN,
+    [0xC0] = PROFILE_CRETURN, [0xC8] = PROFILE_CRETURN, [0xD0] = PROFILE_CRETURN, [0xD8] = PROFILE_CRETURN,
+    [0xE0] = PROFILE_CRETURN, [0xE8] = PROFILE_CRETURN, [0xF0] = PROFILE_CRETURN, [0xF8] = PROFILE_CRETURN,
+};
+
+// Initial room for call paths
+#define PROFILE_INITIAL_NODES 256
+
+static int add_node(struct profile *profile, unsigned short entry, int interrupt, int parent)
+{
+    if (profile->node_count == profile->node_capacity)
+    {
+        if (profile->node_capacity == PROFILE_MAX_NODES)
+        {
+            return -1;
+        }
+        int capacity = profile->node_capacity ? profile->node_capacity * 2 : PROFILE_INITIAL_NODES;
+        struct profile_node *grown = realloc(profile->nodes, capacity * sizeof(struct profile_node));
+        if (grown == NULL)
+        {
+            return -1;
+        }
+        profile->nodes = grown;
+        profile->node_capacity = capacity;
+    }
+
+    int n = profile->node_count++;
+    struct profile_node *node = &profile->nodes[n];
+    memset(node, 0, sizeof(*node));
+    node->entry = entry;
+    node->interrupt = interrupt;
+    node->parent = parent;
+    node->child = -1;
+    node->sibling = -1;
+    if (parent >= 0)
+    {
+        node->sibling = profile->nodes[parent].child;
+        profile->nodes[parent].child = n;
+    }
+    return n;
+}
+
+struct profile *profile_create(const cpu8085 *cpu)
+{
+    struct profile *profile = calloc(1, sizeof(struct profile));
+    if (profile == NULL)
+    {
+        return NULL;
+    }
+    if (add_node(profile, cpu->PC, 0, -1) < 0)
+    {
+        free(profile);
+        return NULL;
+    }
+    profile->start_instructions = cpu->instructions;
+    profile->start_tstates = cpu->tstates;
+    return profile;
+}
+
+void profile_destroy(struct profile *profile)
+{
+    if (profile == NULL)
+    {
+        return;
+    }
+    free(profile->nodes);
+    free(profile);
+}
+
+// Close the frames whose return address lies below sp: returned from, or
+// abandoned by the program
+static void unwind(struct profile *profile, unsigned short sp)
+{
+    while (profile->depth > 0 && profile->stack[profile->depth - 1].sp <= sp)
+    {
+        profile->node = profile->stack[--profile->depth].caller;
+    }
+}
+
+void profile_call(struct profile *profile, unsigned short entry, unsigned short sp, int interrupt)
+{
+    unwind(profile, sp);
+    if (interrupt)
+    {
+        profile->interrupts++;
+    }
+    if (profile->depth == PROFILE_MAX_DEPTH)
+    {
+        return;
+    }
+
+    int n = profile->nodes[profile->node].child;
+    while (n >= 0 && (profile->nodes[n].entry != entry || profile->nodes[n].interrupt != interrupt))
+    {
+        n = profile->nodes[n].sibling;
+    }
+    if (n < 0 && (n = add_node(profile, entry, interrupt, profile->node)) < 0)
+    {
+        return;
+    }
+    profile->stack[profile->depth++] = (struct profile_frame){ profile->node, sp };
+    profile->node = n;
+    profile->nodes[n].calls++;
+}
+
+void profile_return(struct profile *profile, unsigned short sp)
+{
+    unwind(profile, sp);
+}
+
+// ---- Reports ----
+
+// The opcode's mnemonic without its data operand, e.g. "MVI A" or "JNZ"
+static void opcode_name(unsigned char opcode, char *buf, size_t size)
+{
+    unsigned char bytes[3] = { opcode, 0, 0 };
+
+    if (disassemble_bytes(bytes, buf, size) > 1)
+    {
+        char *space = strrchr(buf, ' ');
+        if (space != NULL)
+        {
+            *space = '\0';
+        }
+        size_t n = strlen(buf);
+        if (n > 0 && buf[n - 1] == ',')
+        {
+            buf[n - 1] = '\0';
+        }
+    }
+}
+
+// Sort keys by tstates, largest first, then by key
+struct ranked
+{
+    unsigned int key;
+    unsigned long long tstates;
+};
+
+static int compare_ranked(const void *a, const void *b)
+{
+    const struct ranked *x = a;
+    const struct ranked *y = b;
+    if (x->tstates != y->tstates)
+    {
+        return x->tstates < y->tstates ? 1 : -1;
+    }
+    return x->key < y->key ? -1 : x->key > y->key;
+}
+
+static double percent(unsigned long long part, unsigned long long whole)
+{
+    return whole ? 100.0 * part / whole : 0;
+}
+
+static void report_addresses(const struct profile *profile, const cpu8085 *cpu, struct ranked *ranked,
+                             int top, unsigned long long total, FILE *out)
+{
+    int n = 0;
+    for (unsigned int addr = 0; addr < CPU8085_MEMORY_SIZE; addr++)
+    {
+        if (profile->hits[addr])
+        {
+            ranked[n++] = (struct ranked){ addr, profile->tstates[addr] };
+        }
+    }
+    qsort(ranked, n, sizeof(*ranked), compare_ranked);
+
+    fprintf(out, "\nHot spots:\n");
+    fprintf(out, "  ADDR  INSTRUCTIONS        TSTATES       %%  CODE\n");
+    for (int i = 0; i < n && i < top; i++)
+    {
+        char text[32];
+        disassemble(cpu, ranked[i].key, text, sizeof(text));
+        fprintf(out, "  %04X  %12llu  %13llu  %6.2f  %s\n", ranked[i].key, profile->hits[ranked[i].key],
+                ranked[i].tstates, percent(ranked[i].tstates, total), text);
+    }
+}
+
+static void report_opcodes(const struct profile *profile, struct ranked *ranked, unsigned long long total,
+                           FILE *out)
+{
+    int n = 0;
+    for (int opcode = 0; opcode < 256; opcode++)
+    {
+        if (profile->opcode_hits[opcode])
+        {
+            ranked[n++] = (struct ranked){ opcode, profile->opcode_tstates[opcode] };
+        }
+    }
+    qsort(ranked, n, sizeof(*ranked), compare_ranked);
+
+    fprintf(out, "\nOpcodes:\n");
+    fprintf(out, "  OP  NAME          COUNT        TSTATES       %%\n");
+    for (int i = 0; i < n; i++)
+    {
+        char name[32];
+        opcode_name(ranked[i].key, name, sizeof(name));
+        fprintf(out, "  %02X  %-8s %10llu  %13llu  %6.2f\n", ranked[i].key, name,
+                profile->opcode_hits[ranked[i].key], ranked[i].tstates, percent(ranked[i].tstates, total));
+    }
+}
+
+// A loop is the code from the target of a backward jump to the jump itself
+static void report_loops(const struct profile *profile, const cpu8085 *cpu, struct ranked *ranked,
+                         int top, unsigned long long total, FILE *out)
+{
+    int n = 0;
+    for (unsigned int addr = 0; addr + 2 < CPU8085_MEMORY_SIZE; addr++)
+    {
+        if (profile->back_edges[addr])
+        {
+            unsigned int start = cpu->memory[addr + 1] | cpu->memory[addr + 2] << 8;
+            unsigned long long tstates = 0;
+            for (unsigned int a = start; a <= addr; a++)
+            {
+                tstates += profile->tstates[a];
+            }
+            ranked[n++] = (struct ranked){ addr, tstates };
+        }
+    }
+    qsort(ranked, n, sizeof(*ranked), compare_ranked);
+
+    fprintf(out, "\nLoops:\n");
+    fprintf(out, "  FROM  TO      ITERATIONS  INSTRUCTIONS        TSTATES       %%\n");
+    for (int i = 0; i < n && i < top; i++)
+    {
+        unsigned int addr = ranked[i].key;
+        unsigned int start = cpu->memory[addr + 1] | cpu->memory[addr + 2] << 8;
+        unsigned long long instructions = 0;
+        for (unsigned int a = start; a <= addr; a++)
+        {
+            instructions += profile->hits[a];
+        }
+        fprintf(out, "  %04X  %04X  %12llu  %12llu  %13llu  %6.2f\n", start, addr, profile->back_edges[addr],
+                instructions, ranked[i].tstates, percent(ranked[i].tstates, total));
+    }
+}
+
+// Routines by entry address, over all their call paths. A routine's total
+// counts its callees too, but a recursive call only once.
+static void report_routines(const struct profile *profile, struct ranked *ranked, int top, FILE *out)
+{
+    unsigned long long *inclusive = calloc(profile->node_count, sizeof(unsigned long long));
+    unsigned long long *self = calloc(CPU8085_MEMORY_SIZE * 3, sizeof(unsigned long long));
+    if (inclusive == NULL || self == NULL)
+    {
+        free(inclusive);
+        free(self);
+        fprintf(out, "\nRoutines: out of memory\n");
+        return;
+    }
+    unsigned long long *whole = self + CPU8085_MEMORY_SIZE;
+    unsigned long long *calls = whole + CPU8085_MEMORY_SIZE;
+
+    // Callees are always added after their caller, so this sums bottom-up
+    for (int i = profile->node_count - 1; i >= 0; i--)
+    {
+        const struct profile_node *node = &profile->nodes[i];
+        inclusive[i] += node->tstates;
+        if (node->parent >= 0)
+        {
+            inclusive[node->parent] += inclusive[i];
+        }
+    }
+    for (int i = 0; i < profile->node_count; i++)
+    {
+        const struct profile_node *node = &profile->nodes[i];
+        int outermost = 1;
+        for (int p = node->parent; p >= 0 && outermost; p = profile->nodes[p].parent)
+        {
+            outermost = profile->nodes[p].entry != node->entry;
+        }
+        self[node->entry] += node->tstates;
+        calls[node->entry] += node->calls;
+        if (outermost)
+        {
+            whole[node->entry] += inclusive[i];
+        }
+    }
+
+    // Interrupt acknowledges count here too, so the whole is the root's total
+    unsigned long long total = inclusive[0];
+    int n = 0;
+    for (unsigned int entry = 0; entry < CPU8085_MEMORY_SIZE; entry++)
+    {
+        if (whole[entry])
+        {
+            ranked[n++] = (struct ranked){ entry, whole[entry] };
+        }
+    }
+    qsort(ranked, n, sizeof(*ranked), compare_ranked);
+
+    fprintf(out, "\nRoutines:\n");
+    fprintf(out, "  ENTRY         CALLS   SELF_TSTATES  TOTAL_TSTATES       %%\n");
+    for (int i = 0; i < n && i < top; i++)
+    {
+        unsigned int entry = ranked[i].key;
+        fprintf(out, "  %04X   %12llu  %13llu  %13llu  %6.2f\n", entry, calls[entry], self[entry],
+                whole[entry], percent(whole[entry], total));
+    }
+
+    free(inclusive);
+    free(self);
+}
+
+int profile_report(const struct profile *profile, const cpu8085 *cpu, int top, FILE *out)
+{
+    struct ranked *ranked = malloc(CPU8085_MEMORY_SIZE * sizeof(struct ranked));
+    if (ranked == NULL)
+    {
+        fprintf(out, "Profile: out of memory\n");
+        return -1;
+    }
+
+    unsigned long long instructions = 0, tstates = 0;
+    for (unsigned int addr = 0; addr < CPU8085_MEMORY_SIZE; addr++)
+    {
+        instructions += profile->hits[addr];
+        tstates += profile->tstates[addr];
+    }
+    fprintf(out, "Profile: %llu instructions, %llu T-states in them (%llu in all), %llu interrupts\n",
+            instructions, tstates, cpu->tstates - profile->start_tstates, profile->interrupts);
+
+    report_addresses(profile, cpu, ranked, top, tstates, out);
+    report_opcodes(profile, ranked, tstates, out);
+    report_loops(profile, cpu, ranked, top, tstates, out);
+    report_routines(profile, ranked, top, out);
+
+    free(ranked);
+    return ferror(out) ? -1 : 0;
+}
+
+static void write_path(const struct profile *profile, int n, FILE *out)
+{
+    const struct profile_node *node = &profile->nodes[n];
+    if (node->parent >= 0)
+    {
+        write_path(profile, node->parent, out);
+        fputc(';', out);
+    }
+    fprintf(out, node->interrupt ? "int_%04X" : "%04X", node->entry);
+}
+
+int profile_write_folded(const struct profile *profile, FILE *out)
+{
+    for (int i = 0; i < profile->node_count; i++)
+    {
+        if (profile->nodes[i].tstates)
+        {
+            write_path(profile, i, out);
+            fprintf(out, " %llu\n", profile->nodes[i].tstates);
+        }
+    }
+    return ferror(out) ? -1 : 0;
+}
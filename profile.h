@@ -0,0 +1,146 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdio.h>
+
+#include "cpu8085.h"
+
+// Execution profile of a CPU: how often each address and each opcode ran
+// and for how many T-states, which loops and which call paths the time went
+// to. The profile only watches, so the program's timing is unchanged.
+//
+// Set cpu->profile to a profile from profile_create() before running. The
+// block cache counts whole blocks and hands its counts over lazily, so call
+// cpu8085_sync_profile() before reading the profile.
+//
+// Calls and returns are matched by SP: a CALL, a taken Ccc, an RST or an
+// interrupt opens a frame that ends when SP comes back above the return
+// address, so code that drops return addresses or jumps out of a routine
+// does not confuse the call paths for long. A taken JMP or Jcc to its own
+// address or below counts as the back edge of a loop.
+
+// Deepest call path followed; deeper calls count towards their caller
+#define PROFILE_MAX_DEPTH 256
+// Distinct call paths; calls along new ones beyond this count towards
+// their caller
+#define PROFILE_MAX_NODES 65536
+
+// A call path: the routine at entry, reached from parent's routine
+struct profile_node
+{
+    unsigned short entry;
+    int interrupt;                 // entered by an interrupt rather than a call
+    int parent;                    // -1 for the root, where the run started
+    int child;                     // first callee, -1 for none
+    int sibling;                   // next callee of parent, -1 for none
+    unsigned long long calls;
+    unsigned long long instructions; // run in the routine itself, not its callees
+    unsigned long long tstates;
+};
+
+// An open call: the caller's node, and SP before the return address was pushed
+struct profile_frame
+{
+    int caller;
+    unsigned short sp;
+};
+
+struct profile
+{
+    unsigned long long hits[CPU8085_MEMORY_SIZE];       // instructions run at each address
+    unsigned long long tstates[CPU8085_MEMORY_SIZE];    // their T-states
+    unsigned long long back_edges[CPU8085_MEMORY_SIZE]; // times the jump at each address went backwards
+    unsigned long long opcode_hits[256];
+    unsigned long long opcode_tstates[256];
+    unsigned long long interrupts;
+    unsigned long long start_instructions; // the CPU's counters when profiling started
+    unsigned long long start_tstates;
+
+    struct profile_node *nodes;  // nodes[0] is the root
+    int node_count;
+    int node_capacity;
+    int node;                    // call path being run
+    struct profile_frame stack[PROFILE_MAX_DEPTH];
+    int depth;
+};
+
+// Profile cpu from its current PC and counters; NULL if out of memory
+struct profile *profile_create(const cpu8085 *cpu);
+void profile_destroy(struct profile *profile);
+
+// Print the hot spots (the top addresses, opcodes, loops and routines by
+// T-states) of a synced profile of cpu. Returns 0, or -1 on a write error.
+int profile_report(const struct profile *profile, const cpu8085 *cpu, int top, FILE *out);
+
+// Write the call paths in the folded-stack format of flamegraph.pl, one
+// "0000;0040;0123 tstates" line per path, routines named by their entry
+// address (int_0024 for an interrupt handler). Returns 0, or -1 on a write
+// error.
+int profile_write_folded(const struct profile *profile, FILE *out);
+
+// ---- Recording, called by the core ----
+
+// Branch class of each opcode, for profile_branch()
+#define PROFILE_JUMP 1   // JMP, Jcc, JNK, JK
+#define PROFILE_CALL 2   // CALL, RST
+#define PROFILE_CCALL 3  // Ccc, RSTV
+#define PROFILE_RETURN 4 // RET
+#define PROFILE_CRETURN 5 // Rcc
+extern const unsigned char profile_branch_kind[256];
+
+void profile_call(struct profile *profile, unsigned short entry, unsigned short sp, int interrupt);
+void profile_return(struct profile *profile, unsigned short sp);
+
+// Count runs of the instruction at pc, which took tstates T-states in all
+static inline void profile_count(struct profile *profile, unsigned short pc, unsigned char opcode,
+                                 unsigned long long count, unsigned long long tstates)
+{
+    profile->hits[pc] += count;
+    profile->tstates[pc] += tstates;
+    profile->opcode_hits[opcode] += count;
+    profile->opcode_tstates[opcode] += tstates;
+}
+
+// Instructions run on the current call path
+static inline void profile_attribute(struct profile *profile, unsigned long long instructions,
+                                     unsigned long long tstates)
+{
+    profile->nodes[profile->node].instructions += instructions;
+    profile->nodes[profile->node].tstates += tstates;
+}
+
+// After the instruction at pc (the next one at next_pc) left PC and SP as
+// they are now: follow calls, returns and loop back edges
+static inline void profile_branch(struct profile *profile, unsigned char opcode, unsigned short pc,
+                                  unsigned short next_pc, unsigned short new_pc, unsigned short new_sp)
+{
+    switch (profile_branch_kind[opcode])
+    {
+    case PROFILE_JUMP:
+        if (new_pc <= pc)
+        {
+            profile->back_edges[pc]++;
+        }
+        break;
+    case PROFILE_CCALL:
+        if (new_pc == next_pc)
+        {
+            break;
+        }
+        /* fall through */
+    case PROFILE_CALL:
+        profile_call(profile, new_pc, new_sp + 2, 0);
+        break;
+    case PROFILE_CRETURN:
+        if (new_pc == next_pc)
+        {
+            break;
+        }
+        /* fall through */
+    case PROFILE_RETURN:
+        profile_return(profile, new_sp);
+        break;
+    }
+}
+
+#endif
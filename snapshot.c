@@ -0,0 +1,189 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "snapshot.h"
+
+#define SNAPSHOT_MAGIC "85SNAP"
+#define SNAPSHOT_VERSION 3
+
+// File layout: this header, then `pages` records of a one-byte page number
+// followed by the SNAPSHOT_PAGE_SIZE bytes of that page, in ascending order,
+// then the CPU8085_DIRTY_WORDS words of the dirty bitmap. Fields are in host
+// byte order.
+struct snapshot_header
+{
+    char magic[6];                // SNAPSHOT_MAGIC, not NUL-terminated
+    unsigned short version;       // SNAPSHOT_VERSION
+    unsigned long long base_hash; // cpu8085_image_hash() of the base (delta only)
+    unsigned long long tstates;
+    unsigned long long instructions;
+    unsigned char reg[8];         // B C D E H L F A
+    unsigned short PC, SP;
+    unsigned char halted;
+    unsigned char fault;
+    unsigned char delta;          // 1: pages differ from a base, 0: from zero memory
+    unsigned char reserved;
+    unsigned short pages;
+    unsigned char int_enable;     // interrupt controller, as in cpu8085
+    unsigned char int_enable_delay;
+    unsigned char int_mask;
+    unsigned char int_lines;
+    unsigned char intr_opcode;
+    unsigned char sod, sid;
+    unsigned char waiting;
+};
+
+static const unsigned char zero_page[SNAPSHOT_PAGE_SIZE];
+
+int snapshot_save(const cpu8085 *cpu, const char *path, const unsigned char *base)
+{
+    unsigned char changed[SNAPSHOT_PAGES];
+    int pages = 0;
+
+    for (int page = 0; page < SNAPSHOT_PAGES; page++)
+    {
+        const unsigned char *old = base ? base + page * SNAPSHOT_PAGE_SIZE : zero_page;
+        if (memcmp(cpu->memory + page * SNAPSHOT_PAGE_SIZE, old, SNAPSHOT_PAGE_SIZE) != 0)
+        {
+            changed[pages++] = page;
+        }
+    }
+
+    struct snapshot_header header = {
+        .version = SNAPSHOT_VERSION,
+        .base_hash = base ? cpu8085_image_hash(base) : 0,
+        .tstates = cpu->tstates,
+        .instructions = cpu->instructions,
+        .PC = cpu->PC,
+        .SP = cpu->SP,
+        .halted = cpu->halted,
+        .fault = cpu->fault,
+        .delta = base != NULL,
+        .pages = pages,
+        .int_enable = cpu->int_enable,
+        .int_enable_delay = cpu->int_enable_delay,
+        .int_mask = cpu->int_mask,
+        .int_lines = cpu->int_lines,
+        .intr_opcode = cpu->intr_opcode,
+        .sod = cpu->sod,
+        .sid = cpu->sid,
+        .waiting = cpu->waiting,
+    };
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    memcpy(header.reg, cpu->reg, sizeof(header.reg));
+
+    FILE *file = fopen(path, "wb");
+    if (file == NULL)
+    {
+        perror(path);
+        return -1;
+    }
+    fwrite(&header, sizeof(header), 1, file);
+    for (int i = 0; i < pages; i++)
+    {
+        fputc(changed[i], file);
+        fwrite(cpu->memory + changed[i] * SNAPSHOT_PAGE_SIZE, SNAPSHOT_PAGE_SIZE, 1, file);
+    }
+    fwrite(cpu->dirty, sizeof(cpu->dirty), 1, file);
+    if (ferror(file) | fclose(file))
+    {
+        fprintf(stderr, "%s: could not write the snapshot\n", path);
+        return -1;
+    }
+    return pages;
+}
+
+int snapshot_load(cpu8085 *cpu, const char *path, const unsigned char *base)
+{
+    struct snapshot_header header;
+    FILE *file = fopen(path, "rb");
+
+    if (file == NULL)
+    {
+        perror(path);
+        return -1;
+    }
+    if (fread(&header, sizeof(header), 1, file) != 1 ||
+        memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0)
+    {
+        fprintf(stderr, "%s: not a snapshot file\n", path);
+        fclose(file);
+        return -1;
+    }
+    if (header.version != SNAPSHOT_VERSION)
+    {
+        fprintf(stderr, "%s: snapshot version %u, expected %u\n", path, header.version, SNAPSHOT_VERSION);
+        fclose(file);
+        return -1;
+    }
+    if (header.delta && (base == NULL || cpu8085_image_hash(base) != header.base_hash))
+    {
+        fprintf(stderr, "%s: delta snapshot needs the base image it was taken against\n", path);
+        fclose(file);
+        return -1;
+    }
+
+    // Rebuild memory aside, so a truncated file leaves cpu as it was
+    unsigned char *memory = malloc(CPU8085_MEMORY_SIZE);
+    if (memory == NULL)
+    {
+        fprintf(stderr, "%s: out of memory\n", path);
+        fclose(file);
+        return -1;
+    }
+    if (header.delta)
+    {
+        memcpy(memory, base, CPU8085_MEMORY_SIZE);
+    }
+    else
+    {
+        memset(memory, 0, CPU8085_MEMORY_SIZE);
+    }
+
+    for (int i = 0; i < header.pages; i++)
+    {
+        int page = fgetc(file);
+        if (page == EOF || fread(memory + page * SNAPSHOT_PAGE_SIZE, SNAPSHOT_PAGE_SIZE, 1, file) != 1)
+        {
+            fprintf(stderr, "%s: truncated snapshot\n", path);
+            free(memory);
+            fclose(file);
+            return -1;
+        }
+    }
+    unsigned long long dirty[CPU8085_DIRTY_WORDS];
+    if (fread(dirty, sizeof(dirty), 1, file) != 1)
+    {
+        fprintf(stderr, "%s: truncated snapshot\n", path);
+        free(memory);
+        fclose(file);
+        return -1;
+    }
+    fclose(file);
+
+    memcpy(cpu->memory, memory, CPU8085_MEMORY_SIZE);
+    free(memory);
+    memcpy(cpu->dirty, dirty, sizeof(cpu->dirty));
+    memcpy(cpu->reg, header.reg, sizeof(cpu->reg));
+    cpu->PC = header.PC;
+    cpu->SP = header.SP;
+    cpu->halted = header.halted;
+    cpu->fault = header.fault;
+    cpu->tstates = header.tstates;
+    cpu->instructions = header.instructions;
+    cpu->int_enable = header.int_enable;
+    cpu->int_enable_delay = header.int_enable_delay;
+    cpu->int_mask = header.int_mask;
+    cpu->int_lines = header.int_lines;
+    cpu->intr_opcode = header.intr_opcode;
+    cpu->sod = header.sod;
+    cpu->sid = header.sid;
+    cpu->waiting = header.waiting;
+    cpu->next_event = 0; // look at interrupts and events before the next instruction
+
+    // Memory no longer matches a fork image or decoded blocks the CPU may hold
+    cpu->image_instructions = ~0ULL;
+    cpu8085_flush_blocks(cpu);
+    return 0;
+}
@@ -0,0 +1,31 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "cpu8085.h"
+
+// Snapshots of the complete machine state: registers, flags, PC, SP, the
+// halt/fault state, the interrupt state, the cycle and instruction counters,
+// all 64 KiB of memory and the dirty bitmap of what has been written.
+// Scheduled events belong to the host's devices and are not saved; a
+// restore keeps the events the CPU already has.
+//
+// Memory is stored as 256-byte pages, and only the pages that differ from a
+// base image are written: a full snapshot is taken against all-zero memory,
+// a delta snapshot against a base the caller keeps (usually the memory of
+// an earlier full snapshot). A delta records the hash of its base and can
+// only be restored on top of that same image.
+
+#define SNAPSHOT_PAGE_SIZE 256
+#define SNAPSHOT_PAGES (CPU8085_MEMORY_SIZE / SNAPSHOT_PAGE_SIZE)
+
+// Write the state of cpu to path; base is a 64 KiB image, or NULL for a
+// full snapshot. Returns the number of memory pages stored, or -1 after
+// printing an error.
+int snapshot_save(const cpu8085 *cpu, const char *path, const unsigned char *base);
+
+// Restore the snapshot at path into cpu. A delta snapshot needs the base it
+// was taken against; a full one ignores base. Returns 0, or -1 after
+// printing an error (cpu is then left unchanged).
+int snapshot_load(cpu8085 *cpu, const char *path, const unsigned char *base);
+
+#endif
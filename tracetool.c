@@ -0,0 +1,326 @@
+// Offline tool for the binary traces written by 'emulator --trace-file'.
+//
+//   tracetool dump FILE [filters]     decode the records as text
+//   tracetool diff FILE1 FILE2        report the first record that differs
+//
+// Exit status: 0 (for diff: the traces are identical), 1 traces differ,
+// 2 usage or file error.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "cpu8085.h"
+#include "bintrace.h"
+
+struct trace_file
+{
+    const struct trace_record *records;
+    unsigned long long count;
+    void *map;
+    size_t size;
+};
+
+// Record selection for dump; ranges are inclusive, hi < lo means no filter
+struct filter
+{
+    unsigned long long from, to;    // record numbers
+    unsigned int pc_lo, pc_hi;
+    int opcode;                     // -1 = any
+    unsigned int write_lo, write_hi;
+};
+
+static int open_trace(const char *path, struct trace_file *trace)
+{
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+
+    if (fd < 0 || fstat(fd, &st) < 0)
+    {
+        perror(path);
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        return -1;
+    }
+    if ((size_t)st.st_size < sizeof(struct bintrace_header))
+    {
+        fprintf(stderr, "%s: not a trace file\n", path);
+        close(fd);
+        return -1;
+    }
+
+    trace->size = st.st_size;
+    trace->map = mmap(NULL, trace->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (trace->map == MAP_FAILED)
+    {
+        perror(path);
+        return -1;
+    }
+
+    const struct bintrace_header *header = trace->map;
+    if (memcmp(header->magic, BINTRACE_MAGIC, sizeof(header->magic)) != 0 ||
+        header->record_size != sizeof(struct trace_record))
+    {
+        fprintf(stderr, "%s: not a trace file, or from an incompatible version\n", path);
+        munmap(trace->map, trace->size);
+        return -1;
+    }
+
+    trace->records = (const struct trace_record *)(header + 1);
+    trace->count = (trace->size - sizeof(*header)) / sizeof(struct trace_record);
+    madvise(trace->map, trace->size, MADV_SEQUENTIAL);
+    return 0;
+}
+
+static void close_trace(struct trace_file *trace)
+{
+    munmap(trace->map, trace->size);
+}
+
+static void print_record(const char *prefix, unsigned long long n, const struct trace_record *r)
+{
+    char text[32];
+    if (r->write_count & TRACE_INTERRUPT)
+    {
+        snprintf(text, sizeof(text), "INT %04X", r->bytes[1] | r->bytes[2] << 8);
+    }
+    else
+    {
+        disassemble_bytes(r->bytes, text, sizeof(text));
+    }
+
+    printf("%s%10llu  %04X  %-12s A=%02X B=%02X C=%02X D=%02X E=%02X H=%02X L=%02X F=%02X SP=%04X",
+           prefix, n, r->pc, text, r->reg[7], r->reg[0], r->reg[1], r->reg[2], r->reg[3],
+           r->reg[4], r->reg[5], r->reg[6], r->sp);
+    if (TRACE_WRITE_COUNT(r) == 1)
+    {
+        printf("  [%04X]=%02X", r->write_addr, r->write[0]);
+    }
+    else if (TRACE_WRITE_COUNT(r) == 2)
+    {
+        printf("  [%04X]=%02X %02X", r->write_addr, r->write[0], r->write[1]);
+    }
+    printf("\n");
+}
+
+static int matches(const struct filter *f, const struct trace_record *r)
+{
+    if (f->pc_hi >= f->pc_lo && (r->pc < f->pc_lo || r->pc > f->pc_hi))
+    {
+        return 0;
+    }
+    if (f->opcode >= 0 && ((r->write_count & TRACE_INTERRUPT) || r->bytes[0] != f->opcode))
+    {
+        return 0;
+    }
+    if (f->write_hi >= f->write_lo)
+    {
+        // Either written byte inside the range
+        unsigned int first = r->write_addr;
+        unsigned int last = r->write_addr + TRACE_WRITE_COUNT(r) - 1;
+        return TRACE_WRITE_COUNT(r) > 0 && first <= f->write_hi && last >= f->write_lo;
+    }
+    return 1;
+}
+
+// Parse "ADDR" or "LO-HI" (hex)
+static int parse_range(const char *text, unsigned int *lo, unsigned int *hi)
+{
+    char *end;
+    *lo = strtoul(text, &end, 16);
+    *hi = *end == '-' ? strtoul(end + 1, &end, 16) : *lo;
+    return *end == '\0' && *lo <= 0xFFFF && *hi <= 0xFFFF ? 0 : -1;
+}
+
+static int dump(const char *path, const struct filter *f)
+{
+    struct trace_file trace;
+    if (open_trace(path, &trace) < 0)
+    {
+        return 2;
+    }
+
+    unsigned long long to = f->to < trace.count ? f->to + 1 : trace.count;
+    for (unsigned long long n = f->from; n < to; n++)
+    {
+        if (matches(f, &trace.records[n]))
+        {
+            print_record("", n, &trace.records[n]);
+        }
+    }
+    close_trace(&trace);
+    return 0;
+}
+
+static void print_differences(const struct trace_record *a, const struct trace_record *b)
+{
+    static const char *const names[8] = { "B", "C", "D", "E", "H", "L", "F", "A" };
+
+    printf("differs in:");
+    if (a->pc != b->pc)
+    {
+        printf(" PC");
+    }
+    if (memcmp(a->bytes, b->bytes, sizeof(a->bytes)) != 0 ||
+        (a->write_count & TRACE_INTERRUPT) != (b->write_count & TRACE_INTERRUPT))
+    {
+        printf(" instruction");
+    }
+    for (int i = 0; i < 8; i++)
+    {
+        if (a->reg[i] != b->reg[i])
+        {
+            printf(" %s", names[i]);
+        }
+    }
+    if (a->sp != b->sp)
+    {
+        printf(" SP");
+    }
+    if (TRACE_WRITE_COUNT(a) != TRACE_WRITE_COUNT(b) || a->write_addr != b->write_addr ||
+        memcmp(a->write, b->write, sizeof(a->write)) != 0)
+    {
+        printf(" memory-write");
+    }
+    printf("\n");
+}
+
+static int diff(const char *path_a, const char *path_b, unsigned long long context)
+{
+    struct trace_file a, b;
+    if (open_trace(path_a, &a) < 0)
+    {
+        return 2;
+    }
+    if (open_trace(path_b, &b) < 0)
+    {
+        close_trace(&a);
+        return 2;
+    }
+
+    unsigned long long common = a.count < b.count ? a.count : b.count;
+    unsigned long long n = 0;
+    while (n < common && memcmp(&a.records[n], &b.records[n], sizeof(struct trace_record)) == 0)
+    {
+        n++;
+    }
+
+    int status = 0;
+    if (n < common)
+    {
+        printf("First difference at record %llu:\n", n);
+        for (unsigned long long i = n > context ? n - context : 0; i < n; i++)
+        {
+            print_record("  ", i, &a.records[i]);
+        }
+        print_record("< ", n, &a.records[n]);
+        print_record("> ", n, &b.records[n]);
+        print_differences(&a.records[n], &b.records[n]);
+        status = 1;
+    }
+    else if (a.count != b.count)
+    {
+        printf("Identical for %llu records, then %s has %llu more\n", common,
+               a.count > b.count ? path_a : path_b,
+               (a.count > b.count ? a.count : b.count) - common);
+        status = 1;
+    }
+    else
+    {
+        printf("Identical: %llu records\n", common);
+    }
+
+    close_trace(&a);
+    close_trace(&b);
+    return status;
+}
+
+static void print_help(void)
+{
+    printf("Usage: tracetool dump FILE [filters]\n");
+    printf("       tracetool diff FILE1 FILE2 [--context N]\n\n");
+    printf("Filters for dump (addresses and opcodes in hex):\n");
+    printf("  --from N        First record number to show\n");
+    printf("  --to N          Last record number to show\n");
+    printf("  --pc A[-B]      Only instructions at these addresses\n");
+    printf("  --opcode XX     Only this opcode\n");
+    printf("  --writes A[-B]  Only instructions writing memory in this range\n");
+    printf("\n--context N shows the N records before the first difference (default 5).\n");
+}
+
+int main(int argc, char *argv[])
+{
+    static struct option long_options[] = {
+        {"help", no_argument, NULL, 'h'},
+        {"from", required_argument, NULL, 'f'},
+        {"to", required_argument, NULL, 't'},
+        {"pc", required_argument, NULL, 'p'},
+        {"opcode", required_argument, NULL, 'o'},
+        {"writes", required_argument, NULL, 'w'},
+        {"context", required_argument, NULL, 'c'},
+        {NULL, 0, NULL, 0}
+    };
+
+    struct filter filter = { .from = 0, .to = ~0ULL, .pc_lo = 1, .pc_hi = 0, .opcode = -1,
+                             .write_lo = 1, .write_hi = 0 };
+    unsigned long long context = 5;
+    int opt;
+
+    while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1)
+    {
+        switch (opt)
+        {
+        case 'h':
+            print_help();
+            return 0;
+        case 'f':
+            filter.from = strtoull(optarg, NULL, 0);
+            break;
+        case 't':
+            filter.to = strtoull(optarg, NULL, 0);
+            break;
+        case 'p':
+            if (parse_range(optarg, &filter.pc_lo, &filter.pc_hi) < 0)
+            {
+                fprintf(stderr, "Invalid address range: %s\n", optarg);
+                return 2;
+            }
+            break;
+        case 'o':
+            filter.opcode = (int)strtol(optarg, NULL, 16) & 0xFF;
+            break;
+        case 'w':
+            if (parse_range(optarg, &filter.write_lo, &filter.write_hi) < 0)
+            {
+                fprintf(stderr, "Invalid address range: %s\n", optarg);
+                return 2;
+            }
+            break;
+        case 'c':
+            context = strtoull(optarg, NULL, 0);
+            break;
+        default:
+            fprintf(stderr, "Run with '--help' for the valid flags.\n");
+            return 2;
+        }
+    }
+
+    int args = argc - optind;
+    if (args == 2 && strcmp(argv[optind], "dump") == 0)
+    {
+        return dump(argv[optind + 1], &filter);
+    }
+    if (args == 3 && strcmp(argv[optind], "diff") == 0)
+    {
+        return diff(argv[optind + 1], argv[optind + 2], context);
+    }
+    print_help();
+    return 2;
+}